@@ -13,6 +13,8 @@
 
 #include "QSenseHat.h"
 
+#include <QDebug>
+
 
 //*** initialize the singleton instance ***
 QSenseHat* QSenseHat::senseHatInstance_ = NULL;
@@ -32,6 +34,42 @@ QSenseHat::QSenseHat( QObject *parent ) :
     connect( &ledMatrix_, SIGNAL(error(QString)), SIGNAL(error(QString)) );
     connect( &joystick_,  SIGNAL(error(QString)), SIGNAL(error(QString)) );
     connect( &sensors_,   SIGNAL(error(QString)), SIGNAL(error(QString)) );
+
+    simulator_ = 0;
+
+    //*** simulator selected from the environment ***
+    QByteArray simSpec = qgetenv( SimulatorEnvVar );
+    if ( !simSpec.isEmpty() )
+    {
+        SimSensorOptions options;
+
+        if ( !SHSimulator::parseOptions( QString::fromLocal8Bit( simSpec ), options ) )
+        {
+            qDebug() << "Ignoring unknown settings in" << SimulatorEnvVar << simSpec;
+        }
+
+        startSimulator( options );
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief QSenseHat::startSimulator - run on the simulator instead of the hardware
+ * @param options - sensor simulation and speed
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool QSenseHat::startSimulator( const SimSensorOptions &options )
+{
+    if ( !simulator_ )
+    {
+        simulator_ = new SHSimulator( this );
+        connect( simulator_, SIGNAL(error(QString)), SIGNAL(error(QString)) );
+    }
+
+    return simulator_->attach( &ledMatrix_, &joystick_, &sensors_, options );
 }
 
 
@@ -21,6 +21,7 @@
 #include "SHLedMatrix.h"
 #include "SHJoystick.h"
 #include "SHSensors.h"
+#include "SHSimulator.h"
 
 
 //******************************************************************************
@@ -76,6 +77,27 @@ public:
     SHSensors &sensors() { return sensors_; }
     const SHSensors *sensorsP() const { return &sensors_; }
 
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief startSimulator - run the display, joystick and sensors on the
+     *              headless simulator in place of the hardware. Also started
+     *              by getInstance() when QSENSEHAT_SIMULATOR is set
+     * @param options - sensor simulation and speed
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool startSimulator( const SimSensorOptions &options = SimSensorOptions() );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief simulator - the simulator, for joystick input and the framebuffer
+     * @return - simulator, or 0 when running on the hardware
+     */
+    //******************************************************************************
+    SHSimulator *simulator() { return simulator_; }
+
 
 signals:
 
@@ -93,6 +115,9 @@ protected:
     //*** sensors ***
     SHSensors sensors_;
 
+    //*** simulator in place of the hardware, or 0 ***
+    SHSimulator *simulator_;
+
 private:
 
     //*** singleton ***
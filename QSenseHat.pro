@@ -10,18 +10,56 @@ TEMPLATE = lib
 
 DEFINES += QSENSEHAT_LIBRARY
 
+CONFIG += c++11
+
+# qmake CONFIG+=sh_no_instrumentation compiles out the acquisition instrumentation
+sh_no_instrumentation {
+    DEFINES += SH_NO_INSTRUMENTATION
+}
+
 SOURCES += QSenseHat.cpp \
            SHJoystick.cpp \
            SHLedMatrix.cpp \
-           SHSensors.cpp
+           SHSensors.cpp \
+           SHSensorLog.cpp \
+           SHReplay.cpp \
+           SHSensorStats.cpp \
+           SHSpectrum.cpp \
+           SHFusion.cpp \
+           SHInstrument.cpp \
+           SHSharedRing.cpp \
+           SHMotionEvents.cpp \
+           SHAlign.cpp \
+           SHProcessing.cpp \
+           SHTimeSeries.cpp \
+           SHDisplayBinding.cpp \
+           SHSimSensors.cpp \
+           SHSimulator.cpp
 
 HEADERS += QSenseHat.h\
            qsensehat_global.h \
            SHJoystick.h \
            SHLedMatrix.h \
-           SHSensors.h
+           SHSensors.h \
+           SHSeqLock.h \
+           SHSensorLog.h \
+           SHReplay.h \
+           SHSensorStats.h \
+           SHSpectrum.h \
+           SHFusion.h \
+           SHInstrument.h \
+           SHSharedRing.h \
+           SHMotionEvents.h \
+           SHAlign.h \
+           SHProcessing.h \
+           SHTimeSeries.h \
+           SHDisplayBinding.h \
+           SHSimSensors.h \
+           SHSimulator.h
 
 unix {
+    LIBS += -lrt
+
     target.path = /usr/lib
     INSTALLS += target
 
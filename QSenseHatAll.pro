@@ -0,0 +1,15 @@
+#-------------------------------------------------
+#
+# QSenseHat library and its benchmarks. The benchmarks link against the
+#   library built here; QSenseHat.pro alone builds just the library
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += library \
+           benchmarks
+
+library.file = QSenseHat.pro
+
+benchmarks.depends = library
@@ -0,0 +1,300 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat channel alignment
+//
+// Resamples channels that arrive at different rates and times onto one
+//      output clock, by linear interpolation or zero-order hold
+//
+//******************************************************************************
+//******************************************************************************
+#include "SHAlign.h"
+
+#include <string.h>
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief wrapAngle - bring an angle into -180 to 180 degrees
+ * @param degrees - angle
+ * @return - wrapped angle
+ */
+//******************************************************************************
+static float wrapAngle( float degrees )
+{
+    while ( degrees > 180.0f ) degrees -= 360.0f;
+    while ( degrees < -180.0f ) degrees += 360.0f;
+
+    return degrees;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHChannelAligner::SHChannelAligner
+ */
+//******************************************************************************
+SHChannelAligner::SHChannelAligner()
+{
+    channels_ = 0;
+    periodNs_ = 1;
+    interpolation_ = ALIGN_LINEAR;
+    maxDelayNs_ = 0;
+    angleChannels_ = 0;
+    reset();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHChannelAligner::configure - set up the output clock and start over
+ * @param channels      - bit n selects channel n
+ * @param periodNs      - output clock period
+ * @param interpolation - linear or zero-order hold
+ * @param maxDelayNs    - longest a linear tick waits for slow channels
+ * @param angleChannels - channels in degrees that wrap at +/-180
+ */
+//******************************************************************************
+void SHChannelAligner::configure( quint32 channels, qint64 periodNs,
+                                  AlignInterpolation interpolation,
+                                  qint64 maxDelayNs, quint32 angleChannels )
+{
+    channels_ = channels & ( ( 1u << AlignMaxChannels ) - 1 );
+    periodNs_ = qMax( periodNs, (qint64)1 );
+    interpolation_ = interpolation;
+    maxDelayNs_ = qMax( maxDelayNs, (qint64)0 );
+    angleChannels_ = angleChannels;
+    reset();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHChannelAligner::reset - forget all readings
+ */
+//******************************************************************************
+void SHChannelAligner::reset()
+{
+    memset( head_, 0, sizeof(head_) );
+    memset( count_, 0, sizeof(count_) );
+    memset( components_, 0, sizeof(components_) );
+    memset( &stats_, 0, sizeof(stats_) );
+    nextTickNs_ = 0;
+    nowNs_ = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHChannelAligner::add - add a reading and release the frames it
+ *              completes
+ * @param channel     - channel number
+ * @param timestampNs - acquisition time of the reading
+ * @param values      - the reading
+ * @param components  - number of values
+ * @param frames      - receives up to AlignMaxFrames frames
+ * @return - number of frames
+ */
+//******************************************************************************
+int SHChannelAligner::add( int channel, qint64 timestampNs, const float *values, int components,
+                           AlignedFrame *frames )
+{
+Reading *entry;
+qint64 lagNs;
+qint64 skip;
+int frameCount = 0;
+
+    if ( channel < 0 || channel >= AlignMaxChannels || !( channels_ & ( 1u << channel ) ) )
+    {
+        return 0;
+    }
+
+    //*** readings of a channel must come in time order ***
+    if ( count_[channel] > 0 && timestampNs < reading( channel, 0 ).timestampNs )
+    {
+        stats_.lateReadings++;
+        return 0;
+    }
+
+    //*** keep the reading ***
+    components = qBound( 1, components, AlignMaxComponents );
+    entry = &history_[channel][ head_[channel] ];
+    entry->timestampNs = timestampNs;
+    memset( entry->values, 0, sizeof(entry->values) );
+    memcpy( entry->values, values, components * sizeof(float) );
+
+    head_[channel] = ( head_[channel] + 1 ) % AlignHistory;
+    if ( count_[channel] < AlignHistory ) count_[channel]++;
+    components_[channel] = components;
+
+    if ( timestampNs > nowNs_ ) nowNs_ = timestampNs;
+
+    //*** the clock starts at the first tick at or after the first reading ***
+    if ( nextTickNs_ == 0 )
+    {
+        nextTickNs_ = ( ( timestampNs + periodNs_ - 1 ) / periodNs_ ) * periodNs_;
+    }
+
+    //*** after a gap in the input, skip the ticks nobody could use ***
+    lagNs = nowNs_ - nextTickNs_ - maxDelayNs_;
+    if ( lagNs > AlignMaxFrames * periodNs_ )
+    {
+        skip = lagNs / periodNs_;
+        nextTickNs_ += skip * periodNs_;
+        stats_.skippedTicks += skip;
+    }
+
+    //*** every tick that can be resampled now ***
+    while ( frameCount < AlignMaxFrames && tickReady( nextTickNs_ ) )
+    {
+        resample( nextTickNs_, frames[frameCount] );
+        nextTickNs_ += periodNs_;
+        frameCount++;
+    }
+
+    stats_.frames += frameCount;
+
+    return frameCount;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHChannelAligner::tickReady - the readings needed at a tick have
+ *              arrived, or the tick has waited long enough
+ * @param tickNs - tick time
+ * @return - TRUE if the tick can be resampled
+ */
+//******************************************************************************
+bool SHChannelAligner::tickReady( qint64 tickNs )
+{
+    //*** acquisition has not reached the tick yet ***
+    if ( nowNs_ < tickNs ) return false;
+
+    //*** zero-order hold only needs the readings taken at the tick itself ***
+    if ( interpolation_ == ALIGN_HOLD ) return nowNs_ > tickNs;
+
+    //*** waited long enough - slow channels are held ***
+    if ( nowNs_ - tickNs >= maxDelayNs_ ) return true;
+
+    //*** linear needs a reading past the tick on every channel ***
+    for ( int i=0; i<AlignMaxChannels; i++ )
+    {
+        if ( !( channels_ & ( 1u << i ) ) ) continue;
+
+        if ( count_[i] == 0 || reading( i, 0 ).timestampNs < tickNs ) return false;
+    }
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHChannelAligner::resample - every channel at a tick
+ * @param tickNs - tick time
+ * @param frame  - receives the values
+ */
+//******************************************************************************
+void SHChannelAligner::resample( qint64 tickNs, AlignedFrame &frame )
+{
+    memset( &frame, 0, sizeof(frame) );
+    frame.timestampNs = tickNs;
+
+    for ( int i=0; i<AlignMaxChannels; i++ )
+    {
+        if ( channels_ & ( 1u << i ) )
+        {
+            resampleChannel( i, tickNs, frame );
+        }
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHChannelAligner::resampleChannel - one channel at a tick. A
+ *              channel whose readings all come after the tick, or whose
+ *              reading before it has already been overwritten, is left out
+ * @param channel - channel number
+ * @param tickNs  - tick time
+ * @param frame   - receives the values
+ */
+//******************************************************************************
+void SHChannelAligner::resampleChannel( int channel, qint64 tickNs, AlignedFrame &frame )
+{
+const Reading *before = 0;
+const Reading *after = 0;
+float *out = frame.values[channel];
+float frac;
+float diff;
+
+    //*** newest reading at or before the tick, and the one after it ***
+    for ( int age=0; age<count_[channel]; age++ )
+    {
+        if ( reading( channel, age ).timestampNs <= tickNs )
+        {
+            before = &reading( channel, age );
+            break;
+        }
+
+        after = &reading( channel, age );
+    }
+
+    if ( !before ) return;
+
+    frame.valid |= 1u << channel;
+
+    //*** zero-order hold, or linear without a newer reading in time ***
+    if ( interpolation_ == ALIGN_HOLD || !after )
+    {
+        memcpy( out, before->values, sizeof(before->values) );
+
+        if ( interpolation_ == ALIGN_LINEAR && before->timestampNs < tickNs )
+        {
+            frame.held |= 1u << channel;
+            stats_.heldChannels++;
+        }
+        return;
+    }
+
+    //*** linear between the readings either side ***
+    frac = (float)( tickNs - before->timestampNs ) / ( after->timestampNs - before->timestampNs );
+
+    for ( int c=0; c<components_[channel]; c++ )
+    {
+        diff = after->values[c] - before->values[c];
+
+        if ( angleChannels_ & ( 1u << channel ) )
+        {
+            out[c] = wrapAngle( before->values[c] + frac * wrapAngle( diff ) );
+        }
+        else
+        {
+            out[c] = before->values[c] + frac * diff;
+        }
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHChannelAligner::reading - a reading from a channel's history
+ * @param channel - channel number
+ * @param age     - 0 for the newest, up to count - 1
+ * @return - reading
+ */
+//******************************************************************************
+const SHChannelAligner::Reading &SHChannelAligner::reading( int channel, int age ) const
+{
+    return history_[channel][ ( head_[channel] - 1 - age + AlignHistory ) % AlignHistory ];
+}
@@ -0,0 +1,146 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat channel alignment
+//
+// Resamples channels that arrive at different rates and times onto one
+//      output clock. Every reading carries the time it was acquired; the
+//      aligner keeps a short history per channel and, for each tick of the
+//      output clock, interpolates each channel between the readings either
+//      side of the tick (linear) or takes the last reading at or before it
+//      (zero-order hold). A linear tick waits until every channel has a
+//      reading past it, or until the maximum delay has passed, after which
+//      channels without a newer reading are held and flagged.
+//
+//  Time only advances with the readings, so the output is the same whether
+//      the data is live or replayed. Nothing is allocated after construction
+//
+//******************************************************************************
+//******************************************************************************
+#ifndef SHALIGN_H
+#define SHALIGN_H
+
+#include <QtGlobal>
+
+//*** channels, components per channel and readings kept per channel ***
+const int AlignMaxChannels = 8;
+const int AlignMaxComponents = 3;
+const int AlignHistory = 128;
+
+//*** most frames one reading can release ***
+const int AlignMaxFrames = 16;
+
+//*** how values between readings are found ***
+enum AlignInterpolation
+{
+    ALIGN_LINEAR,               // straight line between the readings either side
+    ALIGN_HOLD                  // last reading at or before the tick
+};
+
+//*** all channels at one tick of the output clock ***
+struct AlignedFrame
+{
+    qint64 timestampNs;         // tick time, a multiple of the output period
+    quint32 valid;              // bit n - channel n has a value
+    quint32 held;               // bit n - channel n had no reading after the tick in time and was held
+    float values[AlignMaxChannels][AlignMaxComponents];
+};
+
+//*** aligner statistics ***
+struct AlignStats
+{
+    quint64 frames;             // frames produced
+    quint64 heldChannels;       // channel values held for want of a newer reading
+    quint64 skippedTicks;       // ticks dropped after a gap in the input
+    quint64 lateReadings;       // readings older than the channel's last, ignored
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHChannelAligner class - resamples channels onto a common
+ *              output clock
+ */
+//******************************************************************************
+class SHChannelAligner
+{
+public:
+
+    SHChannelAligner();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief configure - set up the output clock and start over
+     * @param channels      - bit n selects channel n
+     * @param periodNs      - output clock period
+     * @param interpolation - linear or zero-order hold
+     * @param maxDelayNs    - longest a linear tick waits for slow channels
+     * @param angleChannels - channels in degrees that wrap at +/-180, which
+     *                        are interpolated along the shorter arc
+     */
+    //******************************************************************************
+    void configure( quint32 channels, qint64 periodNs, AlignInterpolation interpolation,
+                    qint64 maxDelayNs, quint32 angleChannels = 0 );
+
+    //*** forget all readings, the clock restarts at the next reading ***
+    void reset();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief add - add a reading and release the frames it completes
+     * @param channel     - channel number
+     * @param timestampNs - acquisition time of the reading
+     * @param values      - the reading
+     * @param components  - number of values, up to AlignMaxComponents
+     * @param frames      - receives up to AlignMaxFrames frames
+     * @return - number of frames
+     */
+    //******************************************************************************
+    int add( int channel, qint64 timestampNs, const float *values, int components,
+             AlignedFrame *frames );
+
+    AlignStats stats() const { return stats_; }
+
+private:
+
+    //*** one timestamped reading ***
+    struct Reading
+    {
+        qint64 timestampNs;
+        float values[AlignMaxComponents];
+    };
+
+    //*** the tick can be resampled ***
+    bool tickReady( qint64 tickNs );
+
+    //*** resample every channel at a tick ***
+    void resample( qint64 tickNs, AlignedFrame &frame );
+    void resampleChannel( int channel, qint64 tickNs, AlignedFrame &frame );
+
+    //*** the reading age places back from the newest ***
+    const Reading &reading( int channel, int age ) const;
+
+    //*** configuration ***
+    quint32 channels_;
+    qint64 periodNs_;
+    AlignInterpolation interpolation_;
+    qint64 maxDelayNs_;
+    quint32 angleChannels_;
+
+    //*** per channel history - a ring, head_ is the next entry written ***
+    Reading history_[AlignMaxChannels][AlignHistory];
+    int head_[AlignMaxChannels];
+    int count_[AlignMaxChannels];
+    int components_[AlignMaxChannels];
+
+    //*** output clock - nowNs_ is the newest reading of any channel ***
+    qint64 nextTickNs_;
+    qint64 nowNs_;
+
+    AlignStats stats_;
+};
+
+#endif // SHALIGN_H
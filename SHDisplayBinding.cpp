@@ -0,0 +1,603 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat display bindings
+//
+// Bar graph, spirit level, heatmap and sparkline renderers, drawn from the
+//      acquisition thread into the LED matrix
+//
+//******************************************************************************
+//******************************************************************************
+#include "SHDisplayBinding.h"
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+//*** bubble size on regions that have room for it ***
+const int BubbleSize = 2;
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief monotonicNs - current CLOCK_MONOTONIC time, the sample clock
+ * @return - time in nanoseconds
+ */
+//******************************************************************************
+static qint64 monotonicNs()
+{
+struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief channelValue - one value of a channel in a sample
+ * @param sample    - sample
+ * @param channel   - ImuSensors channel
+ * @param component - 0 to 2 for vectors, -1 for the magnitude
+ * @return - value
+ */
+//******************************************************************************
+static float channelValue( const SensorSample &sample, ImuSensors channel, int component )
+{
+const float *v;
+
+    switch ( channel )
+    {
+        case IMU_PRESSURE: return sample.pressure;
+        case IMU_TEMP:     return sample.temperature;
+        case IMU_HUMIDITY: return sample.humidity;
+        case IMU_GYRO:     v = sample.gyro;       break;
+        case IMU_ACCEL:    v = sample.accel;      break;
+        case IMU_COMPASS:  v = sample.compass;    break;
+        default:           v = sample.fusionPose; break;
+    }
+
+    if ( component < 0 ) return sqrtf( v[0] * v[0] + v[1] * v[1] + v[2] * v[2] );
+
+    return v[ qMin( component, 2 ) ];
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief scale - position of a value in a range
+ * @param value    - value
+ * @param minValue - value at 0
+ * @param maxValue - value at 1
+ * @return - 0 to 1
+ */
+//******************************************************************************
+static float scale( float value, float minValue, float maxValue )
+{
+    if ( maxValue == minValue ) return 0.0f;
+
+    return qBound( 0.0f, ( value - minValue ) / ( maxValue - minValue ), 1.0f );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief heatColor - blue through green to red
+ * @param frac - 0 to 1
+ * @return - 16 bit color
+ */
+//******************************************************************************
+static quint16 heatColor( float frac )
+{
+float t;
+
+    if ( frac < 0.5f )
+    {
+        t = frac * 2.0f;
+        return Color16b::getColorValue( 0, (quint8)( t * MaxGreen ), (quint8)( ( 1.0f - t ) * MaxBlue ) );
+    }
+
+    t = ( frac - 0.5f ) * 2.0f;
+    return Color16b::getColorValue( (quint8)( t * MaxRed ), (quint8)( ( 1.0f - t ) * MaxGreen ), 0 );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief DisplayBinding::DisplayBinding - magnitude of vectors, white, a
+ *              value per sample
+ */
+//******************************************************************************
+DisplayBinding::DisplayBinding( DisplayStyle style, ImuSensors channel, float minValue, float maxValue,
+                                int x, int y, int width, int height )
+{
+    this->style = style;
+    this->channel = channel;
+    component = -1;
+    this->minValue = minValue;
+    this->maxValue = maxValue;
+    color = Color16b::white();
+    this->x = x;
+    this->y = y;
+    this->width = width;
+    this->height = height;
+    stepMs = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHDisplayBinder::SHDisplayBinder
+ * @param matrix - display to draw on
+ * @param maxFps - frame rate limit, 0 to only draw from present()
+ */
+//******************************************************************************
+SHDisplayBinder::SHDisplayBinder( SHLedMatrix *matrix, double maxFps )
+{
+    matrix_ = matrix;
+    mask_ = 0;
+    memset( frame_, 0, sizeof(frame_) );
+    memset( shown_, 0, sizeof(shown_) );
+    shownValid_ = false;
+    lastFrameNs_ = 0;
+    pendingNs_ = 0;
+    memset( &stats_, 0, sizeof(stats_) );
+    setMaxFps( maxFps );
+
+    for ( int i=0; i<DisplayMaxBindings; i++ )
+    {
+        slots_[i].used = false;
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHDisplayBinder::addBinding - attach a visualization to a channel
+ * @param binding - binding
+ * @return - binding id, or -1 if invalid or all are in use
+ */
+//******************************************************************************
+int SHDisplayBinder::addBinding( const DisplayBinding &binding )
+{
+QMutexLocker bLock( &mutex_ );
+DisplayBinding b = binding;
+int id = -1;
+
+    //*** one channel, with a level needing two components ***
+    if ( b.channel == 0 || ( b.channel & ( b.channel - 1 ) ) ) return -1;
+    if ( b.style == BIND_LEVEL && ( b.channel & ( IMU_PRESSURE | IMU_TEMP | IMU_HUMIDITY ) ) ) return -1;
+
+    //*** clip the region ***
+    b.width = qMin( b.x + b.width, DisplayXSize ) - qMax( b.x, 0 );
+    b.height = qMin( b.y + b.height, DisplayYSize ) - qMax( b.y, 0 );
+    b.x = qMax( b.x, 0 );
+    b.y = qMax( b.y, 0 );
+    if ( b.width <= 0 || b.height <= 0 ) return -1;
+
+    for ( int i=0; i<DisplayMaxBindings; i++ )
+    {
+        if ( !slots_[i].used )
+        {
+            id = i;
+            break;
+        }
+    }
+    if ( id < 0 ) return -1;
+
+    slots_[id].used = true;
+    slots_[id].binding = b;
+    slots_[id].mask = 0;
+    slots_[id].hasValue = false;
+    slots_[id].head = 0;
+    slots_[id].count = 0;
+    slots_[id].stepSum = 0.0;
+    slots_[id].stepCount = 0;
+    slots_[id].stepStartNs = 0;
+
+    for ( int row=b.y; row<b.y + b.height; row++ )
+    {
+        for ( int col=b.x; col<b.x + b.width; col++ )
+        {
+            slots_[id].mask |= 1ULL << ( row * DisplayXSize + col );
+        }
+    }
+
+    mask_ |= slots_[id].mask;
+
+    return id;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHDisplayBinder::removeBinding - detach a binding
+ * @param id - binding id from addBinding()
+ */
+//******************************************************************************
+void SHDisplayBinder::removeBinding( int id )
+{
+QMutexLocker bLock( &mutex_ );
+
+    if ( id < 0 || id >= DisplayMaxBindings ) return;
+
+    slots_[id].used = false;
+
+    mask_ = 0;
+    for ( int i=0; i<DisplayMaxBindings; i++ )
+    {
+        if ( slots_[i].used ) mask_ |= slots_[i].mask;
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHDisplayBinder::clearBindings - detach every binding
+ */
+//******************************************************************************
+void SHDisplayBinder::clearBindings()
+{
+QMutexLocker bLock( &mutex_ );
+
+    for ( int i=0; i<DisplayMaxBindings; i++ )
+    {
+        slots_[i].used = false;
+    }
+
+    mask_ = 0;
+    pendingNs_ = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHDisplayBinder::setMaxFps - set the frame rate limit
+ * @param maxFps - frames per second, 0 to only draw from present()
+ */
+//******************************************************************************
+void SHDisplayBinder::setMaxFps( double maxFps )
+{
+QMutexLocker bLock( &mutex_ );
+
+    minFrameNs_ = ( maxFps > 0.0 ) ? (qint64)( 1e9 / maxFps ) : 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHDisplayBinder::process - update the bindings from a sample and
+ *              draw if a frame is due. A frame held back by the rate limit
+ *              or a busy display goes out with a later sample
+ * @param sample - sample
+ */
+//******************************************************************************
+void SHDisplayBinder::process( const SensorSample &sample )
+{
+QMutexLocker bLock( &mutex_ );
+bool changed = false;
+qint64 nowNs;
+
+    for ( int i=0; i<DisplayMaxBindings; i++ )
+    {
+        if ( slots_[i].used && update( slots_[i], sample ) ) changed = true;
+    }
+
+    if ( changed )
+    {
+        stats_.samples++;
+        if ( pendingNs_ == 0 ) pendingNs_ = sample.timestampNs;
+    }
+
+    //*** nothing new, or drawing is left to present() ***
+    if ( pendingNs_ == 0 || minFrameNs_ == 0 ) return;
+
+    nowNs = monotonicNs();
+    if ( nowNs - lastFrameNs_ < minFrameNs_ ) return;
+
+    presentFrame( nowNs );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHDisplayBinder::present - draw the changes now
+ * @return - FALSE if another thread was drawing
+ */
+//******************************************************************************
+bool SHDisplayBinder::present()
+{
+QMutexLocker bLock( &mutex_ );
+
+    if ( pendingNs_ == 0 ) return true;
+
+    return presentFrame( monotonicNs() );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHDisplayBinder::stats - binder statistics
+ * @return - statistics since construction or resetStats()
+ */
+//******************************************************************************
+DisplayBindingStats SHDisplayBinder::stats()
+{
+QMutexLocker bLock( &mutex_ );
+DisplayBindingStats stats = stats_;
+
+    latency_.snapshot( stats.latency );
+
+    return stats;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHDisplayBinder::resetStats - clear the statistics
+ */
+//******************************************************************************
+void SHDisplayBinder::resetStats()
+{
+QMutexLocker bLock( &mutex_ );
+
+    memset( &stats_, 0, sizeof(stats_) );
+    latency_.reset();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHDisplayBinder::update - take a sample into a binding
+ * @param slot   - binding
+ * @param sample - sample
+ * @return - TRUE if the binding has something new to draw
+ */
+//******************************************************************************
+bool SHDisplayBinder::update( Slot &slot, const SensorSample &sample )
+{
+const DisplayBinding &b = slot.binding;
+float value;
+
+    if ( !( sample.valid & b.channel ) ) return false;
+
+    //*** bar and level show the newest value ***
+    if ( b.style == BIND_LEVEL )
+    {
+        slot.value[0] = channelValue( sample, b.channel, 0 );
+        slot.value[1] = channelValue( sample, b.channel, 1 );
+        slot.hasValue = true;
+        return true;
+    }
+
+    value = channelValue( sample, b.channel, b.component );
+
+    if ( b.style == BIND_BAR )
+    {
+        slot.value[0] = value;
+        slot.hasValue = true;
+        return true;
+    }
+
+    //*** heatmap and sparkline add a value per step ***
+    slot.stepSum += value;
+    slot.stepCount++;
+
+    if ( slot.stepCount == 1 ) slot.stepStartNs = sample.timestampNs;
+
+    if ( b.stepMs > 0 && sample.timestampNs - slot.stepStartNs < (qint64)b.stepMs * 1000000 )
+    {
+        return false;
+    }
+
+    slot.history[ slot.head ] = slot.stepSum / slot.stepCount;
+    slot.head = ( slot.head + 1 ) % BindingHistory;
+    if ( slot.count < BindingHistory ) slot.count++;
+
+    slot.stepSum = 0.0;
+    slot.stepCount = 0;
+    slot.hasValue = true;
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHDisplayBinder::presentFrame - render every binding and write the
+ *              regions to the display. Called with mutex_ held
+ * @param nowNs - current time
+ * @return - FALSE if another thread was drawing
+ */
+//******************************************************************************
+bool SHDisplayBinder::presentFrame( qint64 nowNs )
+{
+bool same = shownValid_;
+
+    for ( int i=0; i<DisplayMaxBindings; i++ )
+    {
+        if ( !slots_[i].used || !slots_[i].hasValue ) continue;
+
+        switch ( slots_[i].binding.style )
+        {
+            case BIND_BAR:       drawBar( slots_[i] );       break;
+            case BIND_LEVEL:     drawLevel( slots_[i] );     break;
+            case BIND_HEATMAP:   drawHeatmap( slots_[i] );   break;
+            case BIND_SPARKLINE: drawSparkline( slots_[i] ); break;
+        }
+    }
+
+    //*** only the bound pixels are compared and written ***
+    for ( int i=0; i<DisplayXSize * DisplayYSize && same; i++ )
+    {
+        if ( ( mask_ & ( 1ULL << i ) ) && frame_[i] != shown_[i] ) same = false;
+    }
+
+    if ( same )
+    {
+        stats_.unchanged++;
+        pendingNs_ = 0;
+        return true;
+    }
+
+    if ( !matrix_->trySetMatrix( frame_, mask_ ) )
+    {
+        stats_.busySkips++;
+        return false;
+    }
+
+    latency_.add( monotonicNs() - pendingNs_ );
+    stats_.frames++;
+
+    memcpy( shown_, frame_, sizeof(shown_) );
+    shownValid_ = true;
+    lastFrameNs_ = nowNs;
+    pendingNs_ = 0;
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHDisplayBinder::drawBar - bar from the bottom, or from the left of
+ *              a region wider than tall
+ * @param slot - binding
+ */
+//******************************************************************************
+void SHDisplayBinder::drawBar( const Slot &slot )
+{
+const DisplayBinding &b = slot.binding;
+bool vertical = b.height >= b.width;
+int length = vertical ? b.height : b.width;
+int lit = (int)( scale( slot.value[0], b.minValue, b.maxValue ) * length + 0.5f );
+int pos;
+
+    for ( int row=0; row<b.height; row++ )
+    {
+        for ( int col=0; col<b.width; col++ )
+        {
+            pos = vertical ? b.height - 1 - row : col;
+            frame_[ ( b.y + row ) * DisplayXSize + b.x + col ] = ( pos < lit ) ? b.color : Color16b::black();
+        }
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHDisplayBinder::drawLevel - a bubble that rises away from the
+ *              reading: left for a positive component 0, up for a positive
+ *              component 1. Green when centred
+ * @param slot - binding
+ */
+//******************************************************************************
+void SHDisplayBinder::drawLevel( const Slot &slot )
+{
+const DisplayBinding &b = slot.binding;
+int size = ( b.width > BubbleSize && b.height > BubbleSize ) ? BubbleSize : 1;
+int bx = (int)( ( 1.0f - scale( slot.value[0], b.minValue, b.maxValue ) ) * ( b.width - size ) + 0.5f );
+int by = (int)( ( 1.0f - scale( slot.value[1], b.minValue, b.maxValue ) ) * ( b.height - size ) + 0.5f );
+bool centred = ( bx == ( b.width - size ) / 2 ) && ( by == ( b.height - size ) / 2 );
+quint16 color = centred ? Color16b::lime() : b.color;
+
+    for ( int row=0; row<b.height; row++ )
+    {
+        for ( int col=0; col<b.width; col++ )
+        {
+            frame_[ ( b.y + row ) * DisplayXSize + b.x + col ] =
+                ( col >= bx && col < bx + size && row >= by && row < by + size ) ? color : Color16b::black();
+        }
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHDisplayBinder::drawHeatmap - recent values a pixel each, oldest
+ *              at the top left, newest at the bottom right
+ * @param slot - binding
+ */
+//******************************************************************************
+void SHDisplayBinder::drawHeatmap( const Slot &slot )
+{
+const DisplayBinding &b = slot.binding;
+int pixels = b.width * b.height;
+int age;
+
+    for ( int p=0; p<pixels; p++ )
+    {
+        age = pixels - 1 - p;
+
+        frame_[ ( b.y + p / b.width ) * DisplayXSize + b.x + p % b.width ] =
+            ( age < slot.count ) ? heatColor( scale( historyValue( slot, age ), b.minValue, b.maxValue ) )
+                                 : Color16b::black();
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHDisplayBinder::drawSparkline - recent values a column each,
+ *              newest on the right
+ * @param slot - binding
+ */
+//******************************************************************************
+void SHDisplayBinder::drawSparkline( const Slot &slot )
+{
+const DisplayBinding &b = slot.binding;
+int age;
+int level;
+
+    for ( int col=0; col<b.width; col++ )
+    {
+        age = b.width - 1 - col;
+        level = -1;
+
+        if ( age < slot.count )
+        {
+            level = (int)( scale( historyValue( slot, age ), b.minValue, b.maxValue ) * ( b.height - 1 ) + 0.5f );
+        }
+
+        for ( int row=0; row<b.height; row++ )
+        {
+            frame_[ ( b.y + row ) * DisplayXSize + b.x + col ] =
+                ( b.height - 1 - row == level ) ? b.color : Color16b::black();
+        }
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHDisplayBinder::historyValue - a recent value of a binding
+ * @param slot - binding
+ * @param age  - 0 for the newest, up to count - 1
+ * @return - value
+ */
+//******************************************************************************
+float SHDisplayBinder::historyValue( const Slot &slot, int age )
+{
+    return slot.history[ ( slot.head - 1 - age + BindingHistory ) % BindingHistory ];
+}
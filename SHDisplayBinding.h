@@ -0,0 +1,226 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat display bindings
+//
+// Draws sensor channels on the LED matrix straight from the acquisition
+//      thread. A binding ties a channel to a visualization - bar graph,
+//      spirit level, heatmap or sparkline - in a region of the display.
+//      SHDisplayBinder updates its bindings from every sample, renders them
+//      into its own frame and copies the regions to the framebuffer in one
+//      write, with no signal, slot or event loop in between.
+//
+//  The display is never waited for: if another thread is drawing, the frame
+//      goes out with the next sample instead. Frames are limited to a set
+//      rate and unchanged frames are not written, so sensor-to-display
+//      latency is bounded by one frame interval plus one sample period. It
+//      is measured from the sample timestamp to the framebuffer write
+//
+//  Example:
+//      SHDisplayBinder *binder = new SHDisplayBinder( &hat.display() );
+//      binder->addBinding( DisplayBinding( BIND_BAR, IMU_TEMP, 15.0, 35.0, 0, 0, 1, 8 ) );
+//      binder->addBinding( DisplayBinding( BIND_LEVEL, IMU_ACCEL, -0.5, 0.5, 2, 1, 6, 6 ) );
+//      hat.sensors().setProcessor( binder );
+//
+//  or, next to other stages, as SHDisplayStage( binder ) in an SHPipeline
+//
+//******************************************************************************
+//******************************************************************************
+#ifndef SHDISPLAYBINDING_H
+#define SHDISPLAYBINDING_H
+
+#include <QMutex>
+
+#include "SHSensors.h"
+#include "SHLedMatrix.h"
+#include "SHInstrument.h"
+
+//*** bindings per binder ***
+const int DisplayMaxBindings = 8;
+
+//*** values kept for heatmaps and sparklines - one per pixel at most ***
+const int BindingHistory = DisplayXSize * DisplayYSize;
+
+//*** visualizations ***
+enum DisplayStyle
+{
+    BIND_BAR,                   // filled bar, vertical if the region is taller than wide
+    BIND_LEVEL,                 // spirit level bubble from components 0 and 1
+    BIND_HEATMAP,               // recent values, one pixel each, blue (min) to red (max)
+    BIND_SPARKLINE              // recent values, one column each, newest on the right
+};
+
+//*** one binding - the constructor sets defaults ***
+struct DisplayBinding
+{
+    DisplayBinding( DisplayStyle style = BIND_BAR, ImuSensors channel = IMU_TEMP,
+                    float minValue = 0.0f, float maxValue = 1.0f,
+                    int x = 0, int y = 0, int width = DisplayXSize, int height = DisplayYSize );
+
+    DisplayStyle style;
+    ImuSensors channel;
+    int component;              // 0 to 2 for vectors, -1 for the magnitude
+    float minValue;             // value at the bottom or left of the scale
+    float maxValue;             // value at the top or right. BIND_LEVEL: tilt at the edge
+    quint16 color;              // bar, bubble and line color
+    int x;                      // region of the display
+    int y;
+    int width;
+    int height;
+    int stepMs;                 // heatmap and sparkline: averaging time per value, 0 for every sample
+};
+
+//*** binder statistics ***
+struct DisplayBindingStats
+{
+    quint64 samples;            // samples that changed a binding
+    quint64 frames;             // frames written to the display
+    quint64 unchanged;          // frames not written because the pixels were the same
+    quint64 busySkips;          // writes deferred because another thread was drawing
+    HistogramSnapshot latency;  // sample timestamp to framebuffer write, nanoseconds
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHDisplayBinder class - renders its bindings on the display from
+ *              every sample. Install it with SHSensors::setProcessor(), or
+ *              call process() from any thread that has the samples
+ */
+//******************************************************************************
+class SHDisplayBinder : public SensorProcessor
+{
+public:
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief SHDisplayBinder
+     * @param matrix - display to draw on
+     * @param maxFps - frame rate limit, 0 to only draw from present()
+     */
+    //******************************************************************************
+    SHDisplayBinder( SHLedMatrix *matrix, double maxFps = 60.0 );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief addBinding - attach a visualization to a channel. The region is
+     *              clipped to the display. BIND_LEVEL needs a vector channel
+     *              or IMU_FUSION
+     * @param binding - binding
+     * @return - binding id, or -1 if invalid or all are in use
+     */
+    //******************************************************************************
+    int addBinding( const DisplayBinding &binding );
+
+    //*** detach bindings - their regions keep the last pixels drawn ***
+    void removeBinding( int id );
+    void clearBindings();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setMaxFps - set the frame rate limit
+     * @param maxFps - frames per second, 0 to only draw from present()
+     */
+    //******************************************************************************
+    void setMaxFps( double maxFps );
+
+    //*** SensorProcessor - update the bindings and draw if a frame is due ***
+    void process( const SensorSample &sample );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief present - draw the changes now, for a render thread or timer
+     *              driving the display at its own rate
+     * @return - FALSE if another thread was drawing
+     */
+    //******************************************************************************
+    bool present();
+
+    DisplayBindingStats stats();
+    void resetStats();
+
+private:
+
+    //*** a binding and its recent values ***
+    struct Slot
+    {
+        bool used;
+        DisplayBinding binding;
+        quint64 mask;                   // region pixels
+        float value[2];                 // newest value, two for BIND_LEVEL
+        bool hasValue;
+        float history[BindingHistory];  // ring of recent values
+        int head;
+        int count;
+        double stepSum;                 // value being averaged
+        int stepCount;
+        qint64 stepStartNs;
+    };
+
+    //*** take a sample into a binding - FALSE if it did not change ***
+    bool update( Slot &slot, const SensorSample &sample );
+
+    //*** render every binding and write the frame ***
+    bool presentFrame( qint64 nowNs );
+
+    //*** visualizations ***
+    void drawBar( const Slot &slot );
+    void drawLevel( const Slot &slot );
+    void drawHeatmap( const Slot &slot );
+    void drawSparkline( const Slot &slot );
+
+    //*** history value by age, 0 for the newest ***
+    float historyValue( const Slot &slot, int age );
+
+    SHLedMatrix *matrix_;
+    Slot slots_[DisplayMaxBindings];
+    quint64 mask_;                          // pixels of all bindings
+
+    //*** frame being rendered and the last written ***
+    quint16 frame_[DisplayXSize * DisplayYSize];
+    quint16 shown_[DisplayXSize * DisplayYSize];
+    bool shownValid_;
+
+    //*** frame timing ***
+    qint64 minFrameNs_;                     // 0 when drawing only from present()
+    qint64 lastFrameNs_;
+    qint64 pendingNs_;                      // oldest sample not yet on the display, 0 for none
+
+    //*** statistics ***
+    DisplayBindingStats stats_;
+    SHHistogram latency_;
+
+    //*** guards everything ***
+    QMutex mutex_;
+
+    Q_DISABLE_COPY( SHDisplayBinder )
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHDisplayStage class - an SHPipeline stage that passes every
+ *              sample to a binder and always continues the chain
+ */
+//******************************************************************************
+class SHDisplayStage
+{
+public:
+
+    SHDisplayStage( SHDisplayBinder *binder ) : binder_( binder ) {}
+
+    bool process( SensorSample &sample ) { binder_->process( sample ); return true; }
+    const char *name() const { return "display"; }
+
+private:
+
+    SHDisplayBinder *binder_;
+};
+
+#endif // SHDISPLAYBINDING_H
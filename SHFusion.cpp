@@ -0,0 +1,491 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat sensor fusion
+//
+// Lightweight orientation filters that run on the raw gyro, accelerometer
+//      and compass of RTIMU_DATA in place of RTIMU's own fusion. Output
+//      follows RTIMULib's conventions, so fusionPose and fusionQPose can be
+//      used unchanged
+//
+//******************************************************************************
+//******************************************************************************
+#include "SHFusion.h"
+
+#include <math.h>
+
+//*** longest gap integrated - after this the filter restarts from accel/compass ***
+const float MaxFusionGapSec = 0.5f;
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief invSqrt - 1 / sqrt(x)
+ * @param x - value
+ * @return - reciprocal square root, or 0 for 0
+ */
+//******************************************************************************
+static inline float invSqrt( float x )
+{
+    return ( x > 0.0f ) ? 1.0f / sqrtf( x ) : 0.0f;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHFusion::SHFusion
+ */
+//******************************************************************************
+SHFusion::SHFusion()
+{
+    SHFusion::reset();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHFusion::reset - start again from the next sample
+ */
+//******************************************************************************
+void SHFusion::reset()
+{
+    q_[0] = 1.0f;
+    q_[1] = q_[2] = q_[3] = 0.0f;
+    initialized_ = false;
+    lastTimestamp_ = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHFusion::getState - save the filter state
+ * @param state - receives the state
+ * @return - FALSE if the filter has not started yet
+ */
+//******************************************************************************
+bool SHFusion::getState( FusionState &state )
+{
+    for ( int i=0; i<4; i++ ) state.q[i] = q_[i];
+    state.bias[0] = state.bias[1] = state.bias[2] = 0.0f;
+
+    return initialized_;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHFusion::setState - restore the filter state. The next sample
+ *              only starts the clock
+ * @param state - saved state
+ */
+//******************************************************************************
+void SHFusion::setState( const FusionState &state )
+{
+    for ( int i=0; i<4; i++ ) q_[i] = state.q[i];
+
+    initialized_ = true;
+    lastTimestamp_ = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHFusion::initialPose - set the orientation from one accelerometer
+ *              and compass reading, as RTIMULib's measured pose
+ * @param data - RTIMU data
+ */
+//******************************************************************************
+void SHFusion::initialPose( const RTIMU_DATA &data )
+{
+float ax = data.accel.x(), ay = data.accel.y(), az = data.accel.z();
+float roll = atan2f( ay, az );
+float pitch = -atan2f( ax, sqrtf( ay * ay + az * az ) );
+float yaw = 0.0f;
+float mx, my;
+float cr, sr, cp, sp, cy, sy;
+
+    //*** tilt compensated heading ***
+    if ( data.compassValid )
+    {
+        mx = data.compass.x() * cosf( pitch ) +
+             sinf( pitch ) * ( data.compass.y() * sinf( roll ) + data.compass.z() * cosf( roll ) );
+        my = data.compass.y() * cosf( roll ) - data.compass.z() * sinf( roll );
+        yaw = -atan2f( my, mx );
+    }
+
+    cr = cosf( roll * 0.5f );  sr = sinf( roll * 0.5f );
+    cp = cosf( pitch * 0.5f ); sp = sinf( pitch * 0.5f );
+    cy = cosf( yaw * 0.5f );   sy = sinf( yaw * 0.5f );
+
+    q_[0] = cr * cp * cy + sr * sp * sy;
+    q_[1] = sr * cp * cy - cr * sp * sy;
+    q_[2] = cr * sp * cy + sr * cp * sy;
+    q_[3] = cr * cp * sy - sr * sp * cy;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHFusion::newIMUData - update the filter and fill in the pose
+ * @param data - RTIMU data with raw gyro, accel and optional compass
+ */
+//******************************************************************************
+void SHFusion::newIMUData( RTIMU_DATA &data )
+{
+float dt = ( data.timestamp - lastTimestamp_ ) / 1000000.0f;
+
+    //*** first sample, or too long a gap to integrate ***
+    if ( !initialized_ ||
+         ( lastTimestamp_ != 0 && ( data.timestamp <= lastTimestamp_ || dt > MaxFusionGapSec ) ) )
+    {
+        if ( data.accelValid )
+        {
+            initialPose( data );
+            initialized_ = true;
+        }
+    }
+
+    //*** a restored state has no previous sample - this one starts the clock ***
+    else if ( lastTimestamp_ != 0 )
+    {
+        update( data.gyro.x(), data.gyro.y(), data.gyro.z(),
+                data.accelValid ? data.accel.x() : 0.0f,
+                data.accelValid ? data.accel.y() : 0.0f,
+                data.accelValid ? data.accel.z() : 0.0f,
+                data.compass.x(), data.compass.y(), data.compass.z(),
+                data.compassValid, dt );
+    }
+
+    lastTimestamp_ = data.timestamp;
+
+    //*** RTIMULib pose outputs ***
+    data.fusionQPose.setScalar( q_[0] );
+    data.fusionQPose.setX( q_[1] );
+    data.fusionQPose.setY( q_[2] );
+    data.fusionQPose.setZ( q_[3] );
+    data.fusionQPose.toEuler( data.fusionPose );
+    data.fusionQPoseValid = initialized_;
+    data.fusionPoseValid = initialized_;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+//
+// Madgwick
+//
+//******************************************************************************
+//******************************************************************************
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHMadgwickFusion::SHMadgwickFusion
+ */
+//******************************************************************************
+SHMadgwickFusion::SHMadgwickFusion()
+{
+    beta_ = MadgwickDefaultBeta;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHMadgwickFusion::update - one gradient descent step
+ * @param gx, gy, gz - gyro in rad/s
+ * @param ax, ay, az - accelerometer, all zero if not valid
+ * @param mx, my, mz - compass
+ * @param useCompass - compass is valid
+ * @param dt         - seconds since the last update
+ */
+//******************************************************************************
+void SHMadgwickFusion::update( float gx, float gy, float gz,
+                               float ax, float ay, float az,
+                               float mx, float my, float mz,
+                               bool useCompass, float dt )
+{
+float q0 = q_[0], q1 = q_[1], q2 = q_[2], q3 = q_[3];
+float qDot0, qDot1, qDot2, qDot3;
+float s0, s1, s2, s3;
+float recipNorm;
+
+    //*** rate of change from the gyro ***
+    qDot0 = 0.5f * ( -q1 * gx - q2 * gy - q3 * gz );
+    qDot1 = 0.5f * (  q0 * gx + q2 * gz - q3 * gy );
+    qDot2 = 0.5f * (  q0 * gy - q1 * gz + q3 * gx );
+    qDot3 = 0.5f * (  q0 * gz + q1 * gy - q2 * gx );
+
+    recipNorm = invSqrt( ax * ax + ay * ay + az * az );
+    if ( recipNorm > 0.0f )
+    {
+        ax *= recipNorm;
+        ay *= recipNorm;
+        az *= recipNorm;
+
+        recipNorm = useCompass ? invSqrt( mx * mx + my * my + mz * mz ) : 0.0f;
+
+        if ( recipNorm > 0.0f )
+        {
+            //*** gravity and magnetic field objective ***
+            mx *= recipNorm;
+            my *= recipNorm;
+            mz *= recipNorm;
+
+            float _2q0mx = 2.0f * q0 * mx;
+            float _2q0my = 2.0f * q0 * my;
+            float _2q0mz = 2.0f * q0 * mz;
+            float _2q1mx = 2.0f * q1 * mx;
+            float _2q0 = 2.0f * q0, _2q1 = 2.0f * q1, _2q2 = 2.0f * q2, _2q3 = 2.0f * q3;
+            float _2q0q2 = 2.0f * q0 * q2;
+            float _2q2q3 = 2.0f * q2 * q3;
+            float q0q0 = q0 * q0, q0q1 = q0 * q1, q0q2 = q0 * q2, q0q3 = q0 * q3;
+            float q1q1 = q1 * q1, q1q2 = q1 * q2, q1q3 = q1 * q3;
+            float q2q2 = q2 * q2, q2q3 = q2 * q3, q3q3 = q3 * q3;
+
+            //*** earth's field direction ***
+            float hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1 + _2q1 * my * q2 +
+                       _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
+            float hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2 - my * q1q1 +
+                       my * q2q2 + _2q2 * mz * q3 - my * q3q3;
+            float _2bx = sqrtf( hx * hx + hy * hy );
+            float _2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3 - mz * q1q1 +
+                         _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
+            float _4bx = 2.0f * _2bx;
+            float _4bz = 2.0f * _2bz;
+
+            //*** objective function errors ***
+            float fgx = 2.0f * q1q3 - _2q0q2 - ax;
+            float fgy = 2.0f * q0q1 + _2q2q3 - ay;
+            float fgz = 1.0f - 2.0f * q1q1 - 2.0f * q2q2 - az;
+            float fmx = _2bx * ( 0.5f - q2q2 - q3q3 ) + _2bz * ( q1q3 - q0q2 ) - mx;
+            float fmy = _2bx * ( q1q2 - q0q3 ) + _2bz * ( q0q1 + q2q3 ) - my;
+            float fmz = _2bx * ( q0q2 + q1q3 ) + _2bz * ( 0.5f - q1q1 - q2q2 ) - mz;
+
+            //*** gradient ***
+            s0 = -_2q2 * fgx + _2q1 * fgy - _2bz * q2 * fmx +
+                 ( -_2bx * q3 + _2bz * q1 ) * fmy + _2bx * q2 * fmz;
+            s1 = _2q3 * fgx + _2q0 * fgy - 4.0f * q1 * fgz + _2bz * q3 * fmx +
+                 ( _2bx * q2 + _2bz * q0 ) * fmy + ( _2bx * q3 - _4bz * q1 ) * fmz;
+            s2 = -_2q0 * fgx + _2q3 * fgy - 4.0f * q2 * fgz + ( -_4bx * q2 - _2bz * q0 ) * fmx +
+                 ( _2bx * q1 + _2bz * q3 ) * fmy + ( _2bx * q0 - _4bz * q2 ) * fmz;
+            s3 = _2q1 * fgx + _2q2 * fgy + ( -_4bx * q3 + _2bz * q1 ) * fmx +
+                 ( -_2bx * q0 + _2bz * q2 ) * fmy + _2bx * q1 * fmz;
+        }
+        else
+        {
+            //*** gravity only objective ***
+            float _2q0 = 2.0f * q0, _2q1 = 2.0f * q1, _2q2 = 2.0f * q2, _2q3 = 2.0f * q3;
+            float _4q0 = 4.0f * q0, _4q1 = 4.0f * q1, _4q2 = 4.0f * q2;
+            float _8q1 = 8.0f * q1, _8q2 = 8.0f * q2;
+            float q0q0 = q0 * q0, q1q1 = q1 * q1, q2q2 = q2 * q2, q3q3 = q3 * q3;
+
+            s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
+            s1 = _4q1 * q3q3 - _2q3 * ax + 4.0f * q0q0 * q1 - _2q0 * ay - _4q1 +
+                 _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+            s2 = 4.0f * q0q0 * q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2 +
+                 _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+            s3 = 4.0f * q1q1 * q3 - _2q1 * ax + 4.0f * q2q2 * q3 - _2q2 * ay;
+        }
+
+        //*** step along the normalized gradient ***
+        recipNorm = invSqrt( s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3 );
+        qDot0 -= beta_ * s0 * recipNorm;
+        qDot1 -= beta_ * s1 * recipNorm;
+        qDot2 -= beta_ * s2 * recipNorm;
+        qDot3 -= beta_ * s3 * recipNorm;
+    }
+
+    q0 += qDot0 * dt;
+    q1 += qDot1 * dt;
+    q2 += qDot2 * dt;
+    q3 += qDot3 * dt;
+
+    recipNorm = invSqrt( q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3 );
+    q_[0] = q0 * recipNorm;
+    q_[1] = q1 * recipNorm;
+    q_[2] = q2 * recipNorm;
+    q_[3] = q3 * recipNorm;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+//
+// Mahony
+//
+//******************************************************************************
+//******************************************************************************
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHMahonyFusion::SHMahonyFusion
+ */
+//******************************************************************************
+SHMahonyFusion::SHMahonyFusion()
+{
+    kp_ = MahonyDefaultKp;
+    ki_ = MahonyDefaultKi;
+    integral_[0] = integral_[1] = integral_[2] = 0.0f;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHMahonyFusion::reset - start again, forgetting the learned bias
+ */
+//******************************************************************************
+void SHMahonyFusion::reset()
+{
+    SHFusion::reset();
+    integral_[0] = integral_[1] = integral_[2] = 0.0f;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHMahonyFusion::getState - save the filter state
+ * @param state - receives the state
+ * @return - FALSE if the filter has not started yet
+ */
+//******************************************************************************
+bool SHMahonyFusion::getState( FusionState &state )
+{
+bool valid = SHFusion::getState( state );
+
+    for ( int i=0; i<3; i++ ) state.bias[i] = integral_[i];
+
+    return valid;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHMahonyFusion::setState - restore the filter state
+ * @param state - saved state
+ */
+//******************************************************************************
+void SHMahonyFusion::setState( const FusionState &state )
+{
+    SHFusion::setState( state );
+
+    for ( int i=0; i<3; i++ ) integral_[i] = state.bias[i];
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHMahonyFusion::update - one complementary filter step
+ * @param gx, gy, gz - gyro in rad/s
+ * @param ax, ay, az - accelerometer, all zero if not valid
+ * @param mx, my, mz - compass
+ * @param useCompass - compass is valid
+ * @param dt         - seconds since the last update
+ */
+//******************************************************************************
+void SHMahonyFusion::update( float gx, float gy, float gz,
+                             float ax, float ay, float az,
+                             float mx, float my, float mz,
+                             bool useCompass, float dt )
+{
+float q0 = q_[0], q1 = q_[1], q2 = q_[2], q3 = q_[3];
+float ex = 0.0f, ey = 0.0f, ez = 0.0f;
+float recipNorm;
+float qa, qb, qc;
+
+    recipNorm = invSqrt( ax * ax + ay * ay + az * az );
+    if ( recipNorm > 0.0f )
+    {
+        ax *= recipNorm;
+        ay *= recipNorm;
+        az *= recipNorm;
+
+        float q0q0 = q0 * q0, q0q1 = q0 * q1, q0q2 = q0 * q2, q0q3 = q0 * q3;
+        float q1q1 = q1 * q1, q1q2 = q1 * q2, q1q3 = q1 * q3;
+        float q2q2 = q2 * q2, q2q3 = q2 * q3, q3q3 = q3 * q3;
+
+        //*** estimated gravity direction, halved ***
+        float vx = q1q3 - q0q2;
+        float vy = q0q1 + q2q3;
+        float vz = q0q0 - 0.5f + q3q3;
+
+        //*** error is the cross product of measured and estimated ***
+        ex = ay * vz - az * vy;
+        ey = az * vx - ax * vz;
+        ez = ax * vy - ay * vx;
+
+        recipNorm = useCompass ? invSqrt( mx * mx + my * my + mz * mz ) : 0.0f;
+        if ( recipNorm > 0.0f )
+        {
+            mx *= recipNorm;
+            my *= recipNorm;
+            mz *= recipNorm;
+
+            //*** earth's field direction ***
+            float hx = 2.0f * ( mx * ( 0.5f - q2q2 - q3q3 ) + my * ( q1q2 - q0q3 ) + mz * ( q1q3 + q0q2 ) );
+            float hy = 2.0f * ( mx * ( q1q2 + q0q3 ) + my * ( 0.5f - q1q1 - q3q3 ) + mz * ( q2q3 - q0q1 ) );
+            float bx = sqrtf( hx * hx + hy * hy );
+            float bz = 2.0f * ( mx * ( q1q3 - q0q2 ) + my * ( q2q3 + q0q1 ) + mz * ( 0.5f - q1q1 - q2q2 ) );
+
+            //*** estimated field direction, halved ***
+            float wx = bx * ( 0.5f - q2q2 - q3q3 ) + bz * ( q1q3 - q0q2 );
+            float wy = bx * ( q1q2 - q0q3 ) + bz * ( q0q1 + q2q3 );
+            float wz = bx * ( q0q2 + q1q3 ) + bz * ( 0.5f - q1q1 - q2q2 );
+
+            ex += my * wz - mz * wy;
+            ey += mz * wx - mx * wz;
+            ez += mx * wy - my * wx;
+        }
+
+        //*** integral feedback learns the gyro bias ***
+        if ( ki_ > 0.0f )
+        {
+            integral_[0] += 2.0f * ki_ * ex * dt;
+            integral_[1] += 2.0f * ki_ * ey * dt;
+            integral_[2] += 2.0f * ki_ * ez * dt;
+            gx += integral_[0];
+            gy += integral_[1];
+            gz += integral_[2];
+        }
+        else
+        {
+            integral_[0] = integral_[1] = integral_[2] = 0.0f;
+        }
+
+        //*** proportional feedback ***
+        gx += 2.0f * kp_ * ex;
+        gy += 2.0f * kp_ * ey;
+        gz += 2.0f * kp_ * ez;
+    }
+
+    //*** integrate ***
+    gx *= 0.5f * dt;
+    gy *= 0.5f * dt;
+    gz *= 0.5f * dt;
+
+    qa = q0;
+    qb = q1;
+    qc = q2;
+    q0 += -qb * gx - qc * gy - q3 * gz;
+    q1 +=  qa * gx + qc * gz - q3 * gy;
+    q2 +=  qa * gy - qb * gz + q3 * gx;
+    q3 +=  qa * gz + qb * gy - qc * gx;
+
+    recipNorm = invSqrt( q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3 );
+    q_[0] = q0 * recipNorm;
+    q_[1] = q1 * recipNorm;
+    q_[2] = q2 * recipNorm;
+    q_[3] = q3 * recipNorm;
+}
@@ -0,0 +1,165 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat sensor fusion
+//
+// Lightweight orientation filters that run on the raw gyro, accelerometer
+//      and compass of RTIMU_DATA in place of RTIMU's own fusion. Output
+//      follows RTIMULib's conventions, so fusionPose and fusionQPose can be
+//      used unchanged
+//
+//******************************************************************************
+//******************************************************************************
+#ifndef SHFUSION_H
+#define SHFUSION_H
+
+#include "RTIMULib.h"
+
+//*** default filter gains ***
+const float MadgwickDefaultBeta = 0.1f;
+const float MahonyDefaultKp = 0.5f;
+const float MahonyDefaultKi = 0.0f;
+
+//*** filter state that can be saved and restored ***
+struct FusionState
+{
+    float q[4];                 // orientation - scalar, x, y, z
+    float bias[3];              // learned gyro bias correction (rad/s), if any
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHFusion class - base of the orientation filters. Handles
+ *              timing, initial attitude and output; subclasses implement the
+ *              quaternion update
+ */
+//******************************************************************************
+class SHFusion
+{
+public:
+
+    SHFusion();
+    virtual ~SHFusion() {}
+
+    virtual const char *name() = 0;
+
+    //*** start again from the next sample ***
+    virtual void reset();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief getState/setState - save and restore the filter. A restored
+     *              filter continues from the saved orientation instead of
+     *              starting over from the accelerometer and compass
+     * @param state - filter state
+     * @return - getState: FALSE if the filter has not started yet
+     */
+    //******************************************************************************
+    virtual bool getState( FusionState &state );
+    virtual void setState( const FusionState &state );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief newIMUData - update the filter with a sample and fill in its
+     *              fusionPose and fusionQPose
+     * @param data - RTIMU data with raw gyro, accel and optional compass
+     */
+    //******************************************************************************
+    void newIMUData( RTIMU_DATA &data );
+
+protected:
+
+    //*** quaternion update - gyro rad/s, accel and compass in any units ***
+    virtual void update( float gx, float gy, float gz,
+                         float ax, float ay, float az,
+                         float mx, float my, float mz,
+                         bool useCompass, float dt ) = 0;
+
+    //*** orientation quaternion - scalar, x, y, z ***
+    float q_[4];
+
+private:
+
+    //*** attitude from a single accel/compass reading ***
+    void initialPose( const RTIMU_DATA &data );
+
+    bool initialized_;
+    uint64_t lastTimestamp_;
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHMadgwickFusion class - Madgwick gradient descent filter
+ */
+//******************************************************************************
+class SHMadgwickFusion : public SHFusion
+{
+public:
+
+    SHMadgwickFusion();
+
+    virtual const char *name() { return "Madgwick"; }
+
+    //*** gradient step gain - larger trusts accel/compass more ***
+    void setBeta( float beta ) { beta_ = beta; }
+
+protected:
+
+    virtual void update( float gx, float gy, float gz,
+                         float ax, float ay, float az,
+                         float mx, float my, float mz,
+                         bool useCompass, float dt );
+
+private:
+
+    float beta_;
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHMahonyFusion class - Mahony complementary filter with
+ *              proportional and integral feedback
+ */
+//******************************************************************************
+class SHMahonyFusion : public SHFusion
+{
+public:
+
+    SHMahonyFusion();
+
+    virtual const char *name() { return "Mahony"; }
+
+    virtual void reset();
+
+    //*** the integral term is the learned gyro bias ***
+    virtual bool getState( FusionState &state );
+    virtual void setState( const FusionState &state );
+
+    //*** feedback gains - ki > 0 learns gyro bias ***
+    void setGains( float kp, float ki ) { kp_ = kp; ki_ = ki; }
+
+protected:
+
+    virtual void update( float gx, float gy, float gz,
+                         float ax, float ay, float az,
+                         float mx, float my, float mz,
+                         bool useCompass, float dt );
+
+private:
+
+    float kp_;
+    float ki_;
+
+    //*** integral feedback ***
+    float integral_[3];
+};
+
+#endif // SHFUSION_H
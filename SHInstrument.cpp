@@ -0,0 +1,292 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat acquisition instrumentation
+//
+// Event counters and log2 bucketed histograms for the stages of the
+//      acquisition path. Recording is a few relaxed atomic adds, skipped
+//      entirely while disabled. Building with SH_NO_INSTRUMENTATION
+//      (qmake CONFIG+=sh_no_instrumentation) compiles the recording out
+//
+//******************************************************************************
+//******************************************************************************
+#include "SHInstrument.h"
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHHistogram::reset - remove every value
+ */
+//******************************************************************************
+void SHHistogram::reset()
+{
+    for ( int i=0; i<HistogramBuckets; i++ )
+    {
+        buckets_[i].store( 0 );
+    }
+
+    count_.store( 0 );
+    sum_.store( 0 );
+    max_.store( 0 );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHHistogram::snapshot - copy the histogram
+ * @param snap - receives the copy
+ */
+//******************************************************************************
+void SHHistogram::snapshot( HistogramSnapshot &snap ) const
+{
+    for ( int i=0; i<HistogramBuckets; i++ )
+    {
+        snap.buckets[i] = buckets_[i].load();
+    }
+
+    snap.count = count_.load();
+    snap.sum = sum_.load();
+    snap.max = max_.load();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHHistogram::bucketLow - smallest value of a bucket
+ * @param bucket - bucket index
+ * @return - lower bound
+ */
+//******************************************************************************
+quint64 SHHistogram::bucketLow( int bucket )
+{
+    return ( bucket == 0 ) ? 0 : ( 1ULL << ( bucket - 1 ) );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHHistogram::percentile - upper bound of the bucket holding a
+ *              percentile
+ * @param snap     - histogram
+ * @param fraction - 0.0 to 1.0
+ * @return - value, limited to the largest value seen
+ */
+//******************************************************************************
+quint64 SHHistogram::percentile( const HistogramSnapshot &snap, double fraction )
+{
+quint64 total = 0;
+quint64 target;
+quint64 upper;
+
+    for ( int i=0; i<HistogramBuckets; i++ )
+    {
+        total += snap.buckets[i];
+    }
+
+    if ( total == 0 ) return 0;
+
+    target = (quint64)( fraction * total );
+    if ( target >= total ) target = total - 1;
+
+    for ( int i=0; i<HistogramBuckets; i++ )
+    {
+        if ( snap.buckets[i] > target )
+        {
+            upper = ( i == HistogramBuckets - 1 ) ? snap.max : ( 1ULL << i ) - 1;
+            return qMin( upper, snap.max );
+        }
+
+        target -= snap.buckets[i];
+    }
+
+    return snap.max;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHInstrumentation::SHInstrumentation
+ */
+//******************************************************************************
+SHInstrumentation::SHInstrumentation()
+{
+    enabled_.store( 0 );
+    reset();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHInstrumentation::setEnabled - start or stop recording. Has no
+ *              effect when built with SH_NO_INSTRUMENTATION
+ * @param enable - TRUE to record
+ */
+//******************************************************************************
+void SHInstrumentation::setEnabled( bool enable )
+{
+    enabled_.store( enable ? 1 : 0 );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHInstrumentation::reset - zero every counter and histogram
+ */
+//******************************************************************************
+void SHInstrumentation::reset()
+{
+    for ( int i=0; i<COUNT_COUNT; i++ )
+    {
+        counters_[i].store( 0 );
+    }
+
+    for ( int i=0; i<HIST_COUNT; i++ )
+    {
+        histograms_[i].reset();
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHInstrumentation::counter - value of a counter
+ * @param counter - counter
+ * @return - events counted since the last reset
+ */
+//******************************************************************************
+quint64 SHInstrumentation::counter( InstrCounter counter ) const
+{
+    return counters_[counter].load();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHInstrumentation::histogram - copy a histogram
+ * @param hist - histogram
+ * @param snap - receives the copy
+ */
+//******************************************************************************
+void SHInstrumentation::histogram( InstrHistogram hist, HistogramSnapshot &snap ) const
+{
+    histograms_[hist].snapshot( snap );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHInstrumentation::dump - text report. Lines are
+ *              counter <name> <value>
+ *              histogram <name> count <n> mean <v> p50 <v> p99 <v> max <v>
+ *                bucket <low> <high> <n>
+ * @return - report
+ */
+//******************************************************************************
+QString SHInstrumentation::dump() const
+{
+QString report;
+HistogramSnapshot snap;
+quint64 high;
+
+#ifdef SH_NO_INSTRUMENTATION
+    report += "# instrumentation compiled out\n";
+#else
+    if ( !isEnabled() ) report += "# instrumentation disabled\n";
+#endif
+
+    for ( int i=0; i<COUNT_COUNT; i++ )
+    {
+        report += QString( "counter %1 %2\n" )
+                    .arg( counterName( (InstrCounter)i ) )
+                    .arg( counter( (InstrCounter)i ) );
+    }
+
+    for ( int i=0; i<HIST_COUNT; i++ )
+    {
+        histogram( (InstrHistogram)i, snap );
+
+        report += QString( "histogram %1 count %2 mean %3 p50 %4 p99 %5 max %6\n" )
+                    .arg( histogramName( (InstrHistogram)i ) )
+                    .arg( snap.count )
+                    .arg( snap.count ? (double)snap.sum / snap.count : 0.0, 0, 'f', 1 )
+                    .arg( SHHistogram::percentile( snap, 0.5 ) )
+                    .arg( SHHistogram::percentile( snap, 0.99 ) )
+                    .arg( snap.max );
+
+        for ( int b=0; b<HistogramBuckets; b++ )
+        {
+            if ( snap.buckets[b] == 0 ) continue;
+
+            high = ( b == HistogramBuckets - 1 ) ? snap.max : ( 1ULL << b ) - 1;
+            report += QString( "  bucket %1 %2 %3\n" )
+                        .arg( SHHistogram::bucketLow( b ) )
+                        .arg( high )
+                        .arg( snap.buckets[b] );
+        }
+    }
+
+    return report;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHInstrumentation::counterName - name of a counter in the report
+ * @param counter - counter
+ * @return - name
+ */
+//******************************************************************************
+const char *SHInstrumentation::counterName( InstrCounter counter )
+{
+    switch ( counter )
+    {
+        case COUNT_UPDATES:             return "updates";
+        case COUNT_IDLE_UPDATES:        return "idle_updates";
+        case COUNT_IMU_READS:           return "imu_reads";
+        case COUNT_IMU_EMPTY_READS:     return "imu_empty_reads";
+        case COUNT_SAMPLES:             return "samples";
+        case COUNT_SAMPLES_SUPPRESSED:  return "samples_suppressed";
+        case COUNT_PRESSURE_READS:      return "pressure_reads";
+        case COUNT_PRESSURE_FAILURES:   return "pressure_failures";
+        case COUNT_HUMIDITY_READS:      return "humidity_reads";
+        case COUNT_HUMIDITY_FAILURES:   return "humidity_failures";
+        case COUNT_BURST_SKIPPED:       return "burst_skipped_updates";
+        default:                        return "unknown";
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHInstrumentation::histogramName - name of a histogram in the report
+ * @param hist - histogram
+ * @return - name, with its unit
+ */
+//******************************************************************************
+const char *SHInstrumentation::histogramName( InstrHistogram hist )
+{
+    switch ( hist )
+    {
+        case HIST_TIMER_LATENESS:   return "timer_lateness_ns";
+        case HIST_UPDATE:           return "update_ns";
+        case HIST_IMU_READ:         return "imu_read_ns";
+        case HIST_PRESSURE_READ:    return "pressure_read_ns";
+        case HIST_HUMIDITY_READ:    return "humidity_read_ns";
+        case HIST_CONVERT:          return "convert_ns";
+        case HIST_EMIT:             return "emit_ns";
+        case HIST_DRAINED:          return "samples_per_update";
+        default:                    return "unknown";
+    }
+}
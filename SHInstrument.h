@@ -0,0 +1,252 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat acquisition instrumentation
+//
+// Event counters and log2 bucketed histograms for the stages of the
+//      acquisition path. Recording is a few relaxed atomic adds, skipped
+//      entirely while disabled. Building with SH_NO_INSTRUMENTATION
+//      (qmake CONFIG+=sh_no_instrumentation) compiles the recording out
+//
+//******************************************************************************
+//******************************************************************************
+#ifndef SHINSTRUMENT_H
+#define SHINSTRUMENT_H
+
+#include <QString>
+#include <QAtomicInt>
+
+#include <time.h>
+
+//*** bucket 0 holds 0, bucket k holds [2^(k-1), 2^k), the last everything above ***
+const int HistogramBuckets = 40;
+
+//*** histograms - nanoseconds unless noted ***
+enum InstrHistogram
+{
+    HIST_TIMER_LATENESS,        // update start after its due time on the absolute schedule
+    HIST_UPDATE,                // one complete update
+    HIST_IMU_READ,              // IMURead() bus transaction
+    HIST_PRESSURE_READ,         // pressureRead() bus transaction
+    HIST_HUMIDITY_READ,         // humidityRead() bus transaction
+    HIST_CONVERT,               // fusion, conversion and processing of a sample
+    HIST_EMIT,                  // publishing, signals and batches of a sample
+    HIST_DRAINED,               // samples read by one update (count)
+    HIST_COUNT
+};
+
+//*** event counters ***
+enum InstrCounter
+{
+    COUNT_UPDATES,              // updates run
+    COUNT_IDLE_UPDATES,         // updates with the IMU idle
+    COUNT_IMU_READS,            // IMURead() calls
+    COUNT_IMU_EMPTY_READS,      // updates whose IMU reads found no new sample
+    COUNT_SAMPLES,              // IMU samples processed
+    COUNT_SAMPLES_SUPPRESSED,   // samples with every channel decimated or filtered
+    COUNT_PRESSURE_READS,
+    COUNT_PRESSURE_FAILURES,
+    COUNT_HUMIDITY_READS,
+    COUNT_HUMIDITY_FAILURES,
+    COUNT_BURST_SKIPPED,        // updates skipped while a burst capture held the IMU
+    COUNT_COUNT
+};
+
+//*** copy of a histogram ***
+struct HistogramSnapshot
+{
+    quint64 count;              // values added
+    quint64 sum;                // sum of the values
+    quint64 max;                // largest value
+    quint64 buckets[HistogramBuckets];
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHHistogram class - log2 bucketed histogram of non-negative
+ *              values. Safe to add to from any thread; a snapshot taken while
+ *              values are added may be off by the values in flight
+ */
+//******************************************************************************
+class SHHistogram
+{
+public:
+
+    SHHistogram() { reset(); }
+
+    void reset();
+
+    //*** add a value, negative values count as 0 ***
+    void add( qint64 value );
+
+    //*** copy the histogram ***
+    void snapshot( HistogramSnapshot &snap ) const;
+
+    //*** bucket of a value, and the lower bound of a bucket ***
+    static int bucket( quint64 value );
+    static quint64 bucketLow( int bucket );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief percentile - upper bound of the bucket holding a percentile
+     * @param snap     - histogram
+     * @param fraction - 0.0 to 1.0
+     * @return - value, limited to the largest value seen
+     */
+    //******************************************************************************
+    static quint64 percentile( const HistogramSnapshot &snap, double fraction );
+
+private:
+
+    QAtomicInteger<quint64> buckets_[HistogramBuckets];
+    QAtomicInteger<quint64> count_;
+    QAtomicInteger<quint64> sum_;
+    QAtomicInteger<quint64> max_;
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHInstrumentation class - counters and histograms of the
+ *              acquisition path. Stages are timed as
+ *                  qint64 t = instr.start();
+ *                  ...
+ *                  instr.stop( HIST_..., t );
+ *              start() returns 0 while disabled, which stop() ignores, so a
+ *              disabled stage costs one flag test
+ */
+//******************************************************************************
+class SHInstrumentation
+{
+public:
+
+    SHInstrumentation();
+
+    //*** start or stop recording - disabled by default ***
+    void setEnabled( bool enable );
+    bool isEnabled() const;
+
+    //*** zero every counter and histogram ***
+    void reset();
+
+    //*** start timing a stage - 0 while disabled ***
+    qint64 start() const;
+
+    //*** finish timing a stage - returns the time for a following stage ***
+    qint64 stop( InstrHistogram hist, qint64 startNs );
+
+    //*** add a value to a histogram ***
+    void add( InstrHistogram hist, qint64 value );
+
+    //*** bump a counter ***
+    void count( InstrCounter counter, quint64 n = 1 );
+
+    //*** read back ***
+    quint64 counter( InstrCounter counter ) const;
+    void histogram( InstrHistogram hist, HistogramSnapshot &snap ) const;
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief dump - text report, one line per counter and per histogram
+     *              followed by its non-empty buckets
+     * @return - report
+     */
+    //******************************************************************************
+    QString dump() const;
+
+    //*** names used in the report ***
+    static const char *counterName( InstrCounter counter );
+    static const char *histogramName( InstrHistogram hist );
+
+private:
+
+    //*** CLOCK_MONOTONIC in nanoseconds ***
+    static qint64 nowNs();
+
+    QAtomicInt enabled_;
+    QAtomicInteger<quint64> counters_[COUNT_COUNT];
+    SHHistogram histograms_[HIST_COUNT];
+};
+
+
+//******************************************************************************
+//******************************************************************************
+//*** recording is inline so it costs nothing when compiled out ***
+//******************************************************************************
+//******************************************************************************
+inline bool SHInstrumentation::isEnabled() const
+{
+#ifdef SH_NO_INSTRUMENTATION
+    return false;
+#else
+    return enabled_.load() != 0;
+#endif
+}
+
+inline int SHHistogram::bucket( quint64 value )
+{
+int b;
+
+    if ( value == 0 ) return 0;
+
+    b = 64 - __builtin_clzll( value );
+
+    return ( b < HistogramBuckets ) ? b : HistogramBuckets - 1;
+}
+
+inline void SHHistogram::add( qint64 value )
+{
+quint64 v = ( value > 0 ) ? value : 0;
+quint64 m = max_.load();
+
+    buckets_[ bucket( v ) ].fetchAndAddRelaxed( 1 );
+    count_.fetchAndAddRelaxed( 1 );
+    sum_.fetchAndAddRelaxed( v );
+
+    //*** rarely taken once the maximum has settled ***
+    while ( v > m && !max_.testAndSetRelaxed( m, v, m ) ) {}
+}
+
+inline qint64 SHInstrumentation::nowNs()
+{
+struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+inline qint64 SHInstrumentation::start() const
+{
+    if ( !isEnabled() ) return 0;
+
+    return nowNs();
+}
+
+inline qint64 SHInstrumentation::stop( InstrHistogram hist, qint64 startNs )
+{
+qint64 endNs;
+
+    if ( startNs == 0 ) return 0;
+
+    endNs = nowNs();
+    histograms_[hist].add( endNs - startNs );
+
+    return endNs;
+}
+
+inline void SHInstrumentation::add( InstrHistogram hist, qint64 value )
+{
+    if ( isEnabled() ) histograms_[hist].add( value );
+}
+
+inline void SHInstrumentation::count( InstrCounter counter, quint64 n )
+{
+    if ( isEnabled() ) counters_[counter].fetchAndAddRelaxed( n );
+}
+
+#endif // SHINSTRUMENT_H
@@ -21,6 +21,10 @@
 #include <linux/input.h>
 #include <linux/fb.h>
 #include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
 
 //*** constants ***
 const int INVALID_DEV = -1;
@@ -43,6 +47,7 @@ SHJoystick::SHJoystick( QObject *parent ) :
     //*** initialize vars ***
     ready_ = false;
     jsThread_ = 0;
+    replayThread_ = 0;
 
     //*** register the signal parameter metatype ***
     qRegisterMetaType<Joystick_Event>("Joystick_Event");
@@ -55,35 +60,253 @@ SHJoystick::SHJoystick( QObject *parent ) :
     {
         qDebug() << "Joystick Device found";
 
-        //*** create the joystick thread ***
-        jsThread_ = new JsThread( jsFd_, this );
+        //*** start reading the device ***
+        startInput();
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHJoystick::~SHJoystick - destructor
+ */
+//******************************************************************************
+SHJoystick::~SHJoystick()
+{
+    //*** stop feeding any replay pipe ***
+    stopReplayThread();
+
+    //*** stop the thread and close the input device ***
+    stopInput();
 
-        //*** connect thread signal to outside ***
-        connect( jsThread_, SIGNAL(joystickEvent(Joystick_Event)), SIGNAL(joystickEvent(Joystick_Event)) );
+    //*** close any recording ***
+    recFile_.close();
+}
 
-        //*** start joystick thread ***
-        jsThread_->start();
 
-        //*** we are ready ***
-        ready_ = true;
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief setInputDevice - use the given file descriptor in place of the
+ *              joystick device
+ * @param fd - file descriptor to read events from
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHJoystick::setInputDevice( int fd )
+{
+    if ( fd < 0 )
+    {
+        emit error( QString("Joystick: Invalid input device") );
+        return false;
     }
+
+    //*** a replay must not write into a pipe nobody reads ***
+    stopReplayThread();
+
+    //*** drop the current device ***
+    stopInput();
+
+    //*** read from the new one ***
+    jsFd_ = fd;
+    startInput();
+
+    return true;
 }
 
 
 //******************************************************************************
 //******************************************************************************
 /**
- * @brief SHJoystick::~SHJoystick - destructor
+ * @brief startRecording - record the raw input event stream to a file
+ * @param fileName - file to record into (overwritten)
+ * @return - TRUE if successful, else FALSE
  */
 //******************************************************************************
-SHJoystick::~SHJoystick()
+bool SHJoystick::startRecording( QString fileName )
 {
-    //*** close input device ***
+JsRecordHeader header;
+
+    //*** only one recording at a time ***
+    stopRecording();
+
+    recFile_.setFileName( fileName );
+    if ( !recFile_.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+    {
+        emit error( QString("Joystick: Could not open recording file %1").arg(fileName) );
+        return false;
+    }
+
+    //*** write the file header ***
+    memcpy( header.magic, JsRecordMagic, sizeof(header.magic) );
+    header.version = JsRecordVersion;
+    header.recordSize = sizeof(JsRecord);
+    recFile_.write( (const char *)&header, sizeof(header) );
+
+    //*** hand the file to the reading thread ***
+    if ( jsThread_ )
+    {
+        jsThread_->setRecordFile( &recFile_ );
+    }
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief stopRecording - stop recording and close the recording file
+ */
+//******************************************************************************
+void SHJoystick::stopRecording()
+{
+    if ( jsThread_ )
+    {
+        jsThread_->setRecordFile( 0 );
+    }
+
+    recFile_.close();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief startReplay - replay a recording in place of the joystick device
+ * @param fileName - recording to replay
+ * @param realTime - TRUE for original timing, FALSE for as fast as possible
+ * @return - TRUE if replay started, else FALSE
+ */
+//******************************************************************************
+bool SHJoystick::startReplay( QString fileName, bool realTime )
+{
+QFile recFile( fileName );
+JsRecordHeader header;
+int pipeFds[2];
+
+    //*** only one replay at a time ***
+    stopReplay();
+
+    //*** check the recording before giving up the device ***
+    if ( !recFile.open( QIODevice::ReadOnly ) ||
+         recFile.read( (char *)&header, sizeof(header) ) != sizeof(header) ||
+         memcmp( header.magic, JsRecordMagic, sizeof(header.magic) ) != 0 ||
+         header.recordSize != sizeof(JsRecord) )
+    {
+        emit error( QString("Joystick: Invalid recording file %1").arg(fileName) );
+        return false;
+    }
+
+    if ( header.version != JsRecordVersion )
+    {
+        emit error( QString("Joystick: Unsupported recording version %1 in %2")
+                    .arg(header.version).arg(fileName) );
+        return false;
+    }
+    recFile.close();
+
+    //*** the pipe takes the place of the input device ***
+    if ( pipe2( pipeFds, O_CLOEXEC ) < 0 )
+    {
+        emit error( QString("Joystick: Could not create replay pipe") );
+        return false;
+    }
+
+    setInputDevice( pipeFds[0] );
+
+    //*** feed the pipe ***
+    replayThread_ = new JsReplayThread( fileName, pipeFds[1], realTime, this );
+    replayThread_->start();
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief stopReplay - stop any replay and reattach the joystick device
+ */
+//******************************************************************************
+void SHJoystick::stopReplay()
+{
+    if ( !replayThread_ )
+    {
+        return;
+    }
+
+    //*** stop writing into the pipe ***
+    stopReplayThread();
+
+    //*** back to the real device ***
+    stopInput();
+    jsFd_ = findJsDevice();
     if ( jsFd_ != INVALID_DEV )
     {
-        ::close( jsFd_ );
+        startInput();
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief stopReplayThread - stop writing into the replay pipe
+ */
+//******************************************************************************
+void SHJoystick::stopReplayThread()
+{
+    if ( !replayThread_ )
+    {
+        return;
+    }
+
+    replayThread_->requestInterruption();
+    replayThread_->wait();
+    delete replayThread_;
+    replayThread_ = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief startInput - start the joystick thread on the current jsFd_
+ */
+//******************************************************************************
+void SHJoystick::startInput()
+{
+    //*** create the joystick thread ***
+    jsThread_ = new JsThread( jsFd_, this );
+
+    //*** connect thread signals to outside ***
+    connect( jsThread_, SIGNAL(joystickEvent(Joystick_Event)), SIGNAL(joystickEvent(Joystick_Event)) );
+    connect( jsThread_, SIGNAL(inputEnded()), SIGNAL(replayFinished()) );
+
+    //*** keep recording across device changes ***
+    if ( recFile_.isOpen() )
+    {
+        jsThread_->setRecordFile( &recFile_ );
     }
 
+    //*** start joystick thread ***
+    jsThread_->start();
+
+    //*** we are ready ***
+    ready_ = true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief stopInput - stop the joystick thread and close jsFd_
+ */
+//******************************************************************************
+void SHJoystick::stopInput()
+{
     //*** is the thread object valid? ***
     if ( jsThread_ )
     {
@@ -99,7 +322,17 @@ SHJoystick::~SHJoystick()
 
         //*** delete the thread ***
         delete jsThread_;
+        jsThread_ = 0;
     }
+
+    //*** close input device ***
+    if ( jsFd_ != INVALID_DEV )
+    {
+        ::close( jsFd_ );
+        jsFd_ = INVALID_DEV;
+    }
+
+    ready_ = false;
 }
 
 
@@ -180,6 +413,22 @@ JsThread::JsThread( int jsFd, QObject *parent )
     : QThread( parent )
 {
     jsFd_ = jsFd;
+    recFile_ = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief JsThread::setRecordFile - record raw events to the given file
+ * @param recFile - open recording file, or NULL to stop recording
+ */
+//******************************************************************************
+void JsThread::setRecordFile( QFile *recFile )
+{
+QMutexLocker rLock( &recMutex_ );
+
+    recFile_ = recFile;
 }
 
 
@@ -211,8 +460,12 @@ const int PollTimeoutMs = 1000; // poll timeout in msecs
         //*** was there an event??? ***
         if ( pollRes > 0 )
         {
-            //*** handle the event(s) ***
-            handleEvents();
+            //*** handle the event(s), stop at end of input ***
+            if ( !handleEvents() )
+            {
+                emit inputEnded();
+                break;
+            }
         }
     }
 }
@@ -222,9 +475,10 @@ const int PollTimeoutMs = 1000; // poll timeout in msecs
 //******************************************************************************
 /**
  * @brief JsThread::handleEvents
+ * @return - FALSE at end of input (replay pipe or file), else TRUE
  */
 //******************************************************************************
-void JsThread::handleEvents()
+bool JsThread::handleEvents()
 {
 const int MaxEvents = 64;                           // Max # events to read
 struct input_event ev[MaxEvents];                   // array of potential events
@@ -236,14 +490,24 @@ int numEvents = 0;                                  // # events read
     //*** read the input device ***
     bytesRead = read( jsFd_, ev, EventSize * MaxEvents );
 
+    //*** writer end closed or end of file ***
+    if ( bytesRead == 0 )
+    {
+        return false;
+    }
+
     //*** make sure we have at least one event ***
     if ( bytesRead < EventSize )
     {
-        return;
+        return true;
     }
 
-    //*** process all events received ***
     numEvents = bytesRead / EventSize;
+
+    //*** record the raw stream ***
+    recordEvents( ev, numEvents );
+
+    //*** process all events received ***
     for ( i=0; i<numEvents; i++ )
     {
         //*** only handle key events ***
@@ -262,4 +526,144 @@ int numEvents = 0;                                  // # events read
             default: break;
         }
     }
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief JsThread::recordEvents - append raw events to the recording file
+ * @param ev        - events read from the device
+ * @param numEvents - number of events
+ */
+//******************************************************************************
+void JsThread::recordEvents( const struct input_event *ev, int numEvents )
+{
+QMutexLocker rLock( &recMutex_ );
+const int MaxEvents = 64;
+JsRecord recs[MaxEvents];
+
+    if ( !recFile_ ) return;
+
+    numEvents = qMin( numEvents, MaxEvents );
+
+    //*** convert to the compact record layout ***
+    for ( int i=0; i<numEvents; i++ )
+    {
+        recs[i].timeUSec = (qint64)ev[i].time.tv_sec * 1000000 + ev[i].time.tv_usec;
+        recs[i].type     = ev[i].type;
+        recs[i].code     = ev[i].code;
+        recs[i].value    = ev[i].value;
+    }
+
+    //*** single write for the whole read ***
+    recFile_->write( (const char *)recs, numEvents * sizeof(JsRecord) );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+//
+// Joystick replay thread
+//
+//******************************************************************************
+//******************************************************************************
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief JsReplayThread::JsReplayThread
+ * @param fileName - recording to replay
+ * @param pipeFd   - write end of the replay pipe (closed when done)
+ * @param realTime - TRUE for original timing, FALSE for as fast as possible
+ * @param parent
+ */
+//******************************************************************************
+JsReplayThread::JsReplayThread( QString fileName, int pipeFd, bool realTime, QObject *parent )
+    : QThread( parent )
+{
+    fileName_ = fileName;
+    pipeFd_ = pipeFd;
+    realTime_ = realTime;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief JsReplayThread::run
+ */
+//******************************************************************************
+void JsReplayThread::run()
+{
+QFile recFile( fileName_ );
+JsRecord rec;
+struct input_event ev;
+struct timespec start;          // replay start time
+struct timespec now;
+qint64 firstUSec = 0;           // timestamp of first recorded event
+bool first = true;
+const qint64 MaxSleepNSec = 100000000;  // check for interruption every 100 msecs
+sigset_t pipeSig;
+
+    //*** a closed reader fails the write with EPIPE instead of killing the process ***
+    sigemptyset( &pipeSig );
+    sigaddset( &pipeSig, SIGPIPE );
+    pthread_sigmask( SIG_BLOCK, &pipeSig, 0 );
+
+    //*** skip the header (validated by SHJoystick) ***
+    if ( recFile.open( QIODevice::ReadOnly ) )
+    {
+        recFile.seek( sizeof(JsRecordHeader) );
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    while ( !isInterruptionRequested() &&
+            recFile.read( (char *)&rec, sizeof(rec) ) == sizeof(rec) )
+    {
+        if ( first )
+        {
+            firstUSec = rec.timeUSec;
+            first = false;
+        }
+
+        //*** wait until the event's original offset from the start ***
+        if ( realTime_ )
+        {
+            qint64 dueNSec = ( rec.timeUSec - firstUSec ) * 1000;
+
+            while ( !isInterruptionRequested() )
+            {
+                clock_gettime( CLOCK_MONOTONIC, &now );
+                qint64 elapsedNSec = ( now.tv_sec - start.tv_sec ) * 1000000000LL +
+                                     ( now.tv_nsec - start.tv_nsec );
+                qint64 waitNSec = dueNSec - elapsedNSec;
+                if ( waitNSec <= 0 ) break;
+
+                waitNSec = qMin( waitNSec, MaxSleepNSec );
+                struct timespec ts = { (time_t)(waitNSec / 1000000000), (long)(waitNSec % 1000000000) };
+                nanosleep( &ts, 0 );
+            }
+        }
+
+        //*** rebuild the device event ***
+        memset( &ev, 0, sizeof(ev) );
+        ev.time.tv_sec  = rec.timeUSec / 1000000;
+        ev.time.tv_usec = rec.timeUSec % 1000000;
+        ev.type  = rec.type;
+        ev.code  = rec.code;
+        ev.value = rec.value;
+
+        //*** less than PIPE_BUF, so written atomically. EPIPE: reader gone ***
+        if ( write( pipeFd_, &ev, sizeof(ev) ) < 0 && errno != EINTR )
+        {
+            break;
+        }
+    }
+
+    //*** closing the write end signals end of input to the reader ***
+    ::close( pipeFd_ );
 }
@@ -15,9 +15,30 @@
 
 #include <QObject>
 #include <QThread>
+#include <QMutex>
+#include <QFile>
 
 enum Joystick_Event { JS_ENTER, JS_LEFT, JS_RIGHT, JS_UP, JS_DOWN };
 
+//*** joystick recording file layout - a header followed by fixed size records ***
+const char JsRecordMagic[4] = { 'S', 'H', 'J', 'S' };
+const quint16 JsRecordVersion = 1;
+
+struct JsRecordHeader
+{
+    char magic[4];              // JsRecordMagic
+    quint16 version;            // JsRecordVersion
+    quint16 recordSize;         // sizeof(JsRecord)
+};
+
+struct JsRecord
+{
+    qint64 timeUSec;            // event timestamp in microseconds
+    quint16 type;               // input_event type
+    quint16 code;               // input_event code
+    qint32 value;               // input_event value
+};
+
 
 //******************************************************************************
 //******************************************************************************
@@ -33,21 +54,67 @@ public:
 
     JsThread( int jsFd, QObject *parent );
 
+    //*** record raw events to the given (open) file, or stop if NULL ***
+    void setRecordFile( QFile *recFile );
+
 signals:
 
     void joystickEvent( Joystick_Event jEv );
 
+    //*** input device reached end of file (replay done) ***
+    void inputEnded();
+
 private:
 
     //*** override this for the actual thread code ***
     void run();
 
-    //*** get and process events ***
-    void handleEvents();
+    //*** get and process events - returns FALSE at end of input ***
+    bool handleEvents();
+
+    //*** append raw events to the recording file ***
+    void recordEvents( const struct input_event *ev, int numEvents );
 
     //*** joystick device file descriptor ***
     int jsFd_;
 
+    //*** recording file and its guard ***
+    QFile *recFile_;
+    QMutex recMutex_;
+
+};
+
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The JsReplayThread class - writes recorded events into a pipe that
+ *              takes the place of the joystick input device
+ */
+//******************************************************************************
+class JsReplayThread : public QThread
+{
+    Q_OBJECT
+
+public:
+
+    JsReplayThread( QString fileName, int pipeFd, bool realTime, QObject *parent );
+
+private:
+
+    //*** override this for the actual thread code ***
+    void run();
+
+    //*** recording to replay ***
+    QString fileName_;
+
+    //*** write end of the replay pipe ***
+    int pipeFd_;
+
+    //*** replay at original timing, else as fast as possible ***
+    bool realTime_;
+
 };
 
 
@@ -91,6 +158,66 @@ public:
     //******************************************************************************
     bool ready() { return ready_; }
 
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setInputDevice - use the given file descriptor in place of the
+     *              joystick device. It must deliver struct input_event records
+     *              (an event device, a pipe, a socket or a file). Ownership is taken.
+     * @param fd - file descriptor to read events from
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool setInputDevice( int fd );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief startRecording - record the raw input event stream to a file
+     * @param fileName - file to record into (overwritten)
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool startRecording( QString fileName );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief stopRecording - stop recording and close the recording file
+     */
+    //******************************************************************************
+    void stopRecording();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief isRecording - indicates events are being recorded
+     * @return - TRUE if recording, else FALSE
+     */
+    //******************************************************************************
+    bool isRecording() { return recFile_.isOpen(); }
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief startReplay - replay a recording in place of the joystick device.
+     *              Events are fed through a pipe, so they are handled exactly as
+     *              device events. replayFinished() is emitted at the end.
+     * @param fileName - recording to replay
+     * @param realTime - TRUE for original timing, FALSE for as fast as possible
+     * @return - TRUE if replay started, else FALSE
+     */
+    //******************************************************************************
+    bool startReplay( QString fileName, bool realTime = true );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief stopReplay - stop any replay and reattach the joystick device
+     */
+    //******************************************************************************
+    void stopReplay();
+
 
 signals:
 
@@ -100,6 +227,9 @@ signals:
     //*** joystick events ***
     void joystickEvent( Joystick_Event jEv );
 
+    //*** replay has delivered all recorded events ***
+    void replayFinished();
+
 
 protected:
 
@@ -112,6 +242,31 @@ protected:
     //******************************************************************************
     int findJsDevice();
 
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief startInput - start the joystick thread on the current jsFd_
+     */
+    //******************************************************************************
+    void startInput();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief stopInput - stop the joystick thread and close jsFd_
+     */
+    //******************************************************************************
+    void stopInput();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief stopReplayThread - stop writing into the replay pipe, before its
+     *              read end is closed
+     */
+    //******************************************************************************
+    void stopReplayThread();
+
 
     //*** file descriptor for the joystick input device ***
     int jsFd_;
@@ -119,6 +274,12 @@ protected:
     //*** joystick thread ***
     JsThread *jsThread_;
 
+    //*** replay thread ***
+    JsReplayThread *replayThread_;
+
+    //*** recording file ***
+    QFile recFile_;
+
     //*** indicates that the device is ready for use ***
     bool ready_;
 
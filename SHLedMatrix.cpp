@@ -23,6 +23,7 @@
 #include <linux/fb.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 
 #include <QtGui>
 #include <QDebug>
@@ -101,6 +102,54 @@ SHLedMatrix::~SHLedMatrix()
 
 }
 
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHLedMatrix::setFramebufferDevice - draw into the given file
+ *              descriptor in place of the Sense HAT framebuffer
+ * @param fd - framebuffer device or memory file to map
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHLedMatrix::setFramebufferDevice( int fd )
+{
+QMutexLocker dLock( &accessMutex_ );
+struct stat st;
+quint16 *ptr;
+
+    //*** devices report no size - the map fails if they are too small ***
+    if ( fd < 0 || fstat( fd, &st ) < 0 ||
+         ( !S_ISCHR( st.st_mode ) && st.st_size < DisplayMemSizeBytes ) )
+    {
+        lastError_ = "Invalid framebuffer device";
+        emit error( QString("Display: Invalid framebuffer device") );
+        return false;
+    }
+
+    ptr = (quint16 *)mmap( 0, DisplayMemSizeBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+
+    if ( ptr == MAP_FAILED )
+    {
+        lastError_ = "Error getting framebuffer memory map";
+        emit error( QString("Display: Error getting framebuffer memory map") );
+        return false;
+    }
+
+    //*** drop the current device ***
+    if ( validFbPtr_ ) munmap( fbPtr_, DisplayMemSizeBytes );
+    if ( fbFd_ != INVALID_FB ) ::close( fbFd_ );
+
+    //*** draw into the new one, keeping what it shows ***
+    fbFd_ = fd;
+    fbPtr_ = ptr;
+    validFbPtr_ = true;
+    ready_ = true;
+
+    publishFrame();
+
+    return true;
+}
+
 //******************************************************************************
 //******************************************************************************
 /**
@@ -122,6 +171,9 @@ QMutexLocker dLock( &accessMutex_ );
     //*** clear all framebuffer memory ***
     memset( fbPtr_, 0, DisplayMemSizeBytes );
 
+    //*** make it visible to getFrame() ***
+    publishFrame();
+
     return true;
 }
 
@@ -171,6 +223,9 @@ long location = 0;
     //*** set the pixel ***
     *(fbPtr_ + location) = color;
 
+    //*** make it visible to getFrame() ***
+    publishFrame();
+
     return true;
 }
 
@@ -232,6 +287,9 @@ int lineLenPix = 0;
         *(fbPtr_ + location + i) = color;
     }
 
+    //*** make it visible to getFrame() ***
+    publishFrame();
+
     return true;
 }
 
@@ -293,6 +351,9 @@ int lineLenPix = 0;
         *(fbPtr_ + location + (i * DisplayXSize)) = color;
     }
 
+    //*** make it visible to getFrame() ***
+    publishFrame();
+
     return true;
 }
 
@@ -321,6 +382,9 @@ const int NumPixels = DisplayXSize*DisplayYSize;
     for ( int i=0; i<NumPixels; i++ )
         fbPtr_[i] = fillColor;
 
+    //*** make it visible to getFrame() ***
+    publishFrame();
+
     return true;
 }
 
@@ -347,6 +411,51 @@ QMutexLocker dLock( &accessMutex_ );
     //*** copy the data ***
     memcpy( fbPtr_, buffer, DisplayMemSizeBytes );
 
+    //*** make it visible to getFrame() ***
+    publishFrame();
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief trySetMatrix - sets the selected pixels without waiting
+ * @param buffer - pointer to an 8x8 quint16 array
+ * @param mask   - bit (y * DisplayXSize + x) set for each pixel to copy
+ * @return - true if written, false if busy or not ready
+ */
+//******************************************************************************
+bool SHLedMatrix::trySetMatrix( const quint16 *buffer, quint64 mask )
+{
+    //*** never wait for another writer ***
+    if ( !accessMutex_.tryLock() ) return false;
+
+    if ( !ready_ )
+    {
+        accessMutex_.unlock();
+        return false;
+    }
+
+    //*** copy the data ***
+    if ( mask == ~0ULL )
+    {
+        memcpy( fbPtr_, buffer, DisplayMemSizeBytes );
+    }
+    else
+    {
+        for ( int i=0; i<DisplayXSize * DisplayYSize; i++ )
+        {
+            if ( mask & ( 1ULL << i ) ) fbPtr_[i] = buffer[i];
+        }
+    }
+
+    //*** make it visible to getFrame() ***
+    publishFrame();
+
+    accessMutex_.unlock();
+
     return true;
 }
 
@@ -441,6 +550,9 @@ int endY = destY + ySize - 1;
         destBuf += DisplayYSize;
     }
 
+    //*** make it visible to getFrame() ***
+    publishFrame();
+
     return true;
 }
 
@@ -540,6 +652,9 @@ quint16 *imgPtr = 0;
         memcpy( dispPtr, imgPtr + xOffset, DisplayLineLenBytes );
     }
 
+    //*** make it visible to getFrame() ***
+    publishFrame();
+
     return true;
 }
 
@@ -762,6 +877,9 @@ bool expected = true;
         //*** we are ready to go ***
         ready_ = true;
 
+        //*** getFrame() shows what is on the display from the start ***
+        publishFrame();
+
         clear();
     }
     else
@@ -858,6 +976,36 @@ int idx1=0, idx2=0;
     }
 }
 
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief getFrame - copy of what is currently on the display
+ * @param buffer - pointer to an 8x8 quint16 array to receive the pixels
+ */
+//******************************************************************************
+void SHLedMatrix::getFrame( quint16 *buffer ) const
+{
+LedFrame frame = frameLock_.load();
+
+    memcpy( buffer, frame.pixels, DisplayMemSizeBytes );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief publishFrame - publish the framebuffer contents for getFrame()
+ */
+//******************************************************************************
+void SHLedMatrix::publishFrame()
+{
+LedFrame frame;
+
+    memcpy( frame.pixels, fbPtr_, DisplayMemSizeBytes );
+    frameLock_.store( frame );
+}
+
+
 //******************************************************************************
 //******************************************************************************
 /**
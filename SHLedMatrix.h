@@ -25,6 +25,8 @@
 #include <QPainter>
 #include <QTimer>
 
+#include "SHSeqLock.h"
+
 //*** set up known values for display - 8x8 matrix ***
 
 const int DisplayXSize = 8;
@@ -37,6 +39,12 @@ const int DisplayLineLenBytes = DisplayXSize * DisplayBytesPerPixel;
 
 const int DisplayMemSizeBytes = DisplayXSize * DisplayYSize * DisplayBytesPerPixel;
 
+//*** copy of the displayed pixels ***
+struct LedFrame
+{
+    quint16 pixels[DisplayXSize * DisplayYSize];
+};
+
 //*** Amount of rotation ***
 enum BufRotate { ROT_90, ROT_180, ROT_270 };
 
@@ -171,6 +179,20 @@ public:
     //******************************************************************************
     QString lastError() { return lastError_; }
 
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setFramebufferDevice - draw into the given file descriptor in place
+     *              of the Sense HAT framebuffer. It must be mappable and hold at
+     *              least DisplayMemSizeBytes: a framebuffer device, or a memory
+     *              file (memfd, tmpfs) for running and benchmarking without the
+     *              hardware. Ownership is taken if successful
+     * @param fd - file descriptor to map
+     * @return - true if successful, else false
+     */
+    //******************************************************************************
+    bool setFramebufferDevice( int fd );
+
     //******************************************************************************
     //******************************************************************************
     /**
@@ -239,6 +261,20 @@ public:
     //******************************************************************************
     bool setMatrix( quint16 *buffer );
 
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief trySetMatrix - sets the selected pixels of the memory mapped buffer
+     *              without waiting. For writers that must not block, such as
+     *              the sensor acquisition thread
+     * @param buffer - pointer to an 8x8 quint16 array
+     * @param mask   - bit (y * DisplayXSize + x) set for each pixel to copy
+     * @return - true if written, false if another thread is drawing or the
+     *              display is not ready
+     */
+    //******************************************************************************
+    bool trySetMatrix( const quint16 *buffer, quint64 mask = ~0ULL );
+
     //******************************************************************************
     //******************************************************************************
     /**
@@ -343,6 +379,16 @@ public:
     //******************************************************************************
     void setTextPointSize( int pSize ) { txtFont_.setPointSize( pSize ); }
 
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief getFrame - copy of what is currently on the display. Never blocks
+     *              the drawing methods
+     * @param buffer - pointer to an 8x8 quint16 array to receive the pixels
+     */
+    //******************************************************************************
+    void getFrame( quint16 *buffer ) const;
+
 signals:
 
     //*** error signal ***
@@ -417,6 +463,15 @@ protected:
     //******************************************************************************
     void dumpImage( QImage *image );
 
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief publishFrame - publish the framebuffer contents for getFrame().
+     *              Call with accessMutex_ held, after changing the display
+     */
+    //******************************************************************************
+    void publishFrame();
+
 
     //*** file descriptor of frame buffer device ***
     int fbFd_;
@@ -445,6 +500,9 @@ protected:
     quint16 *fbPtr_;            // pointer to memory mapped framebuffer
     bool validFbPtr_;           // indicates memory map pointer is valid
 
+    //*** latest frame for readers ***
+    SHSeqLock<LedFrame> frameLock_;
+
 };
 
 #endif // SHLEDMATRIX_H
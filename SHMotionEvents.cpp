@@ -0,0 +1,482 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat motion events
+//
+// Detectors for taps, shakes, drops, tilt and stillness that run on every
+//      accelerometer and gyro sample on the acquisition side and produce
+//      only discrete events
+//
+//******************************************************************************
+//******************************************************************************
+#include "SHMotionEvents.h"
+
+#include <math.h>
+#include <string.h>
+
+//*** still / moving states ***
+const int StillUnknown = 0;
+const int StillStill = 1;
+const int StillMoving = 2;
+
+//*** a tap has ended once the spike falls below this share of the threshold ***
+const float TapReleaseShare = 0.5f;
+
+//*** longest gap treated as continuous, larger gaps restart the gravity estimate ***
+const qint64 MaxMotionGapNs = 500 * 1000000LL;
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief MotionDetectorConfig::MotionDetectorConfig - default thresholds
+ */
+//******************************************************************************
+MotionDetectorConfig::MotionDetectorConfig()
+{
+    detectors = DETECT_ALL;
+
+    gravityTimeSec = 0.5f;
+
+    tapThreshold = 0.8f;
+    tapMaxNs = 80 * 1000000LL;
+    tapQuietNs = 100 * 1000000LL;
+    doubleTapNs = 400 * 1000000LL;
+
+    shakeThreshold = 0.6f;
+    shakeReversals = 4;
+    shakeWindowNs = 1000 * 1000000LL;
+
+    freeFallThreshold = 0.3f;
+    freeFallMinNs = 60 * 1000000LL;
+
+    tiltThresholdDeg = 30.0f;
+    tiltHysteresisDeg = 5.0f;
+    tiltReference[0] = 0.0f;
+    tiltReference[1] = 0.0f;
+    tiltReference[2] = 1.0f;
+
+    stillAccelThreshold = 0.04f;
+    stillGyroThreshold = 4.0f;
+    stillTimeNs = 2000 * 1000000LL;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHMotionDetector::SHMotionDetector
+ */
+//******************************************************************************
+SHMotionDetector::SHMotionDetector()
+{
+    reset();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHMotionDetector::configure - set the thresholds and start over
+ * @param config - thresholds
+ */
+//******************************************************************************
+void SHMotionDetector::configure( const MotionDetectorConfig &config )
+{
+float norm;
+
+    config_ = config;
+
+    //*** reference must be a unit vector ***
+    norm = sqrtf( config_.tiltReference[0] * config_.tiltReference[0] +
+                  config_.tiltReference[1] * config_.tiltReference[1] +
+                  config_.tiltReference[2] * config_.tiltReference[2] );
+
+    if ( norm > 0.0f )
+    {
+        for ( int i=0; i<3; i++ ) config_.tiltReference[i] /= norm;
+    }
+    else
+    {
+        config_.tiltReference[0] = 0.0f;
+        config_.tiltReference[1] = 0.0f;
+        config_.tiltReference[2] = 1.0f;
+    }
+
+    if ( config_.shakeReversals < 1 ) config_.shakeReversals = 1;
+
+    reset();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHMotionDetector::reset - start over from the next sample
+ */
+//******************************************************************************
+void SHMotionDetector::reset()
+{
+    nowNs_ = 0;
+    memset( dynamic_, 0, sizeof(dynamic_) );
+    events_ = 0;
+    eventCount_ = 0;
+
+    started_ = false;
+    lastNs_ = 0;
+    memset( gravity_, 0, sizeof(gravity_) );
+
+    tapActive_ = false;
+    tapStartNs_ = 0;
+    tapPeak_ = 0.0f;
+    memset( tapDirection_, 0, sizeof(tapDirection_) );
+    tapQuietUntilNs_ = 0;
+    tapPending_ = false;
+    lastTapNs_ = 0;
+
+    shakeAxis_ = 0;
+    shakeSign_ = 0;
+    shakeCount_ = 0;
+    shakeStartNs_ = 0;
+    shakePeak_ = 0.0f;
+    shakeHoldUntilNs_ = 0;
+
+    fallStartNs_ = 0;
+    fallMin_ = 0.0f;
+    fallReported_ = false;
+
+    tilted_ = false;
+
+    stillState_ = StillUnknown;
+    lastMoveNs_ = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHMotionDetector::add - run the detectors on a sample
+ * @param timestampNs - sample time
+ * @param accel       - acceleration in g
+ * @param gyro        - rotation rate in degrees/s, or NULL if not read
+ * @param events      - receives up to MotionMaxEvents events
+ * @return - number of events
+ */
+//******************************************************************************
+int SHMotionDetector::add( qint64 timestampNs, const float *accel, const float *gyro, MotionEvent *events )
+{
+float accelMag = sqrtf( accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2] );
+float dynMag;
+float alpha;
+qint64 dtNs = timestampNs - lastNs_;
+
+    nowNs_ = timestampNs;
+    events_ = events;
+    eventCount_ = 0;
+
+    //*** first sample, or after a gap - gravity is the reading itself ***
+    if ( !started_ || dtNs <= 0 || dtNs > MaxMotionGapNs )
+    {
+        memcpy( gravity_, accel, sizeof(gravity_) );
+        started_ = true;
+    }
+
+    //*** track gravity, except while falling ***
+    else if ( accelMag >= config_.freeFallThreshold )
+    {
+        alpha = dtNs / ( config_.gravityTimeSec * 1e9f + dtNs );
+        for ( int i=0; i<3; i++ )
+        {
+            gravity_[i] += alpha * ( accel[i] - gravity_[i] );
+        }
+    }
+
+    lastNs_ = timestampNs;
+
+    for ( int i=0; i<3; i++ )
+    {
+        dynamic_[i] = accel[i] - gravity_[i];
+    }
+    dynMag = sqrtf( dynamic_[0] * dynamic_[0] + dynamic_[1] * dynamic_[1] + dynamic_[2] * dynamic_[2] );
+
+    if ( config_.detectors & DETECT_FREE_FALL ) detectFreeFall( accelMag );
+    if ( config_.detectors & DETECT_TAP )       detectTap( dynMag );
+    if ( config_.detectors & DETECT_SHAKE )     detectShake();
+    if ( config_.detectors & DETECT_TILT )      detectTilt();
+    if ( config_.detectors & DETECT_STILL )     detectStill( dynMag, gyro );
+
+    return eventCount_;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHMotionDetector::raise - append an event
+ * @param type      - event type
+ * @param magnitude - event magnitude
+ * @param direction - event direction
+ */
+//******************************************************************************
+void SHMotionDetector::raise( MotionEventType type, float magnitude, const float *direction )
+{
+MotionEvent *event;
+
+    if ( eventCount_ >= MotionMaxEvents ) return;
+
+    event = &events_[ eventCount_++ ];
+    event->timestampNs = nowNs_;
+    event->type = type;
+    event->magnitude = magnitude;
+    memcpy( event->direction, direction, sizeof(event->direction) );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHMotionDetector::detectTap - a spike above the threshold that is
+ *              over within tapMaxNs and followed by tapQuietNs without
+ *              another, so the swings of a shake are not taps. A second tap
+ *              starting within doubleTapNs of the first also raises
+ *              DOUBLE_TAP. Events carry the time the spike started
+ * @param dynMag - dynamic acceleration magnitude
+ */
+//******************************************************************************
+void SHMotionDetector::detectTap( float dynMag )
+{
+    if ( !tapActive_ )
+    {
+        //*** another spike during the quiet time - not a tap ***
+        if ( dynMag > config_.tapThreshold && nowNs_ < tapQuietUntilNs_ )
+        {
+            tapPending_ = false;
+            lastTapNs_ = 0;
+            tapQuietUntilNs_ = nowNs_ + config_.tapQuietNs;
+            return;
+        }
+
+        //*** quiet time over - the tap stands ***
+        if ( tapPending_ && nowNs_ >= tapQuietUntilNs_ )
+        {
+            tapPending_ = false;
+            raiseTap();
+        }
+
+        if ( dynMag <= config_.tapThreshold ) return;
+
+        tapActive_ = true;
+        tapStartNs_ = nowNs_;
+        tapPeak_ = 0.0f;
+    }
+
+    if ( dynMag > tapPeak_ )
+    {
+        tapPeak_ = dynMag;
+        memcpy( tapDirection_, dynamic_, sizeof(tapDirection_) );
+    }
+
+    //*** still in the spike ***
+    if ( dynMag >= config_.tapThreshold * TapReleaseShare ) return;
+
+    tapActive_ = false;
+    tapQuietUntilNs_ = nowNs_ + config_.tapQuietNs;
+
+    //*** too long for a tap - a push or a swing ***
+    if ( nowNs_ - tapStartNs_ > config_.tapMaxNs )
+    {
+        lastTapNs_ = 0;
+        return;
+    }
+
+    tapPending_ = true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHMotionDetector::raiseTap - raise a confirmed tap, and a double
+ *              tap if it closely followed another
+ */
+//******************************************************************************
+void SHMotionDetector::raiseTap()
+{
+qint64 nowNs = nowNs_;
+
+    //*** stamped with the start of the spike ***
+    nowNs_ = tapStartNs_;
+
+    raise( MOTION_TAP, tapPeak_, tapDirection_ );
+
+    if ( lastTapNs_ != 0 && tapStartNs_ - lastTapNs_ <= config_.doubleTapNs )
+    {
+        raise( MOTION_DOUBLE_TAP, tapPeak_, tapDirection_ );
+        lastTapNs_ = 0;
+    }
+    else
+    {
+        lastTapNs_ = tapStartNs_;
+    }
+
+    nowNs_ = nowNs;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHMotionDetector::detectShake - shakeReversals changes of direction
+ *              of large swings along the strongest axis within shakeWindowNs
+ */
+//******************************************************************************
+void SHMotionDetector::detectShake()
+{
+float direction[3] = { 0.0f, 0.0f, 0.0f };
+int axis = 0;
+int sign;
+
+    if ( nowNs_ < shakeHoldUntilNs_ ) return;
+
+    for ( int i=1; i<3; i++ )
+    {
+        if ( fabsf( dynamic_[i] ) > fabsf( dynamic_[axis] ) ) axis = i;
+    }
+
+    if ( fabsf( dynamic_[axis] ) <= config_.shakeThreshold ) return;
+
+    sign = ( dynamic_[axis] > 0.0f ) ? 1 : -1;
+
+    //*** window expired or a different axis - start counting again ***
+    if ( shakeSign_ == 0 || axis != shakeAxis_ || nowNs_ - shakeStartNs_ > config_.shakeWindowNs )
+    {
+        shakeAxis_ = axis;
+        shakeSign_ = sign;
+        shakeCount_ = 0;
+        shakeStartNs_ = nowNs_;
+        shakePeak_ = 0.0f;
+    }
+
+    shakePeak_ = qMax( shakePeak_, fabsf( dynamic_[axis] ) );
+
+    if ( sign == shakeSign_ ) return;
+
+    shakeSign_ = sign;
+    if ( ++shakeCount_ < config_.shakeReversals ) return;
+
+    direction[axis] = 1.0f;
+    raise( MOTION_SHAKE, shakePeak_, direction );
+
+    //*** one event per shake ***
+    shakeSign_ = 0;
+    shakeHoldUntilNs_ = nowNs_ + config_.shakeWindowNs;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHMotionDetector::detectFreeFall - total acceleration below the
+ *              threshold for freeFallMinNs. Raised once per fall
+ * @param accelMag - total acceleration magnitude
+ */
+//******************************************************************************
+void SHMotionDetector::detectFreeFall( float accelMag )
+{
+    if ( accelMag >= config_.freeFallThreshold )
+    {
+        fallStartNs_ = 0;
+        fallReported_ = false;
+        return;
+    }
+
+    if ( fallStartNs_ == 0 )
+    {
+        fallStartNs_ = nowNs_;
+        fallMin_ = accelMag;
+    }
+
+    fallMin_ = qMin( fallMin_, accelMag );
+
+    if ( !fallReported_ && nowNs_ - fallStartNs_ >= config_.freeFallMinNs )
+    {
+        raise( MOTION_FREE_FALL, fallMin_, gravity_ );
+        fallReported_ = true;
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHMotionDetector::detectTilt - angle between the gravity estimate
+ *              and the reference, with hysteresis
+ */
+//******************************************************************************
+void SHMotionDetector::detectTilt()
+{
+float norm = sqrtf( gravity_[0] * gravity_[0] + gravity_[1] * gravity_[1] + gravity_[2] * gravity_[2] );
+float cosAngle, angle;
+
+    //*** no usable gravity while falling ***
+    if ( norm < config_.freeFallThreshold ) return;
+
+    cosAngle = ( gravity_[0] * config_.tiltReference[0] +
+                 gravity_[1] * config_.tiltReference[1] +
+                 gravity_[2] * config_.tiltReference[2] ) / norm;
+    angle = acosf( qBound( -1.0f, cosAngle, 1.0f ) ) * 180.0f / (float)M_PI;
+
+    if ( !tilted_ && angle > config_.tiltThresholdDeg )
+    {
+        tilted_ = true;
+        raise( MOTION_TILT, angle, gravity_ );
+    }
+    else if ( tilted_ && angle < config_.tiltThresholdDeg - config_.tiltHysteresisDeg )
+    {
+        tilted_ = false;
+        raise( MOTION_LEVEL, angle, gravity_ );
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHMotionDetector::detectStill - MOVING as soon as dynamic
+ *              acceleration or rotation passes its threshold, STILL after
+ *              stillTimeNs below both
+ * @param dynMag - dynamic acceleration magnitude
+ * @param gyro   - rotation rate, or NULL
+ */
+//******************************************************************************
+void SHMotionDetector::detectStill( float dynMag, const float *gyro )
+{
+bool moving = dynMag > config_.stillAccelThreshold;
+
+    if ( gyro )
+    {
+        moving = moving || ( gyro[0] * gyro[0] + gyro[1] * gyro[1] + gyro[2] * gyro[2] >
+                             config_.stillGyroThreshold * config_.stillGyroThreshold );
+    }
+
+    if ( moving )
+    {
+        lastMoveNs_ = nowNs_;
+
+        if ( stillState_ != StillMoving )
+        {
+            stillState_ = StillMoving;
+            raise( MOTION_MOVING, dynMag, dynamic_ );
+        }
+        return;
+    }
+
+    //*** the first sample starts the still timer ***
+    if ( lastMoveNs_ == 0 ) lastMoveNs_ = nowNs_;
+
+    if ( stillState_ != StillStill && nowNs_ - lastMoveNs_ >= config_.stillTimeNs )
+    {
+        stillState_ = StillStill;
+        raise( MOTION_STILL, dynMag, dynamic_ );
+    }
+}
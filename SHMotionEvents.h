@@ -0,0 +1,183 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat motion events
+//
+// Detectors for taps, shakes, drops, tilt and stillness that run on every
+//      accelerometer and gyro sample on the acquisition side and produce
+//      only discrete events. Gravity is tracked with a low pass filter; the
+//      remainder is the dynamic acceleration most detectors work on.
+//      Nothing is allocated after construction
+//
+//******************************************************************************
+//******************************************************************************
+#ifndef SHMOTIONEVENTS_H
+#define SHMOTIONEVENTS_H
+
+#include <QtGlobal>
+
+//*** most events one sample can produce ***
+const int MotionMaxEvents = 8;
+
+//*** event types - magnitude is in g unless noted ***
+enum MotionEventType
+{
+    MOTION_TAP,                 // short spike - peak dynamic acceleration
+    MOTION_DOUBLE_TAP,          // second tap soon after a first - peak of the second
+    MOTION_SHAKE,               // repeated reversals - peak dynamic acceleration
+    MOTION_FREE_FALL,           // acceleration near zero - lowest magnitude
+    MOTION_TILT,                // tilted past the threshold - angle in degrees
+    MOTION_LEVEL,               // back within the threshold - angle in degrees
+    MOTION_MOVING,              // started moving - dynamic acceleration
+    MOTION_STILL                // no movement for the still time - dynamic acceleration
+};
+
+//*** detectors, for MotionDetectorConfig::detectors ***
+enum MotionDetectors
+{
+    DETECT_TAP       = 0x01,
+    DETECT_SHAKE     = 0x02,
+    DETECT_FREE_FALL = 0x04,
+    DETECT_TILT      = 0x08,
+    DETECT_STILL     = 0x10,
+    DETECT_ALL       = 0x1F
+};
+
+//*** one event ***
+struct MotionEvent
+{
+    qint64 timestampNs;         // CLOCK_MONOTONIC time of the sample, the spike start for taps
+    MotionEventType type;
+    float magnitude;
+    float direction[3];         // dynamic acceleration, or gravity for tilt
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The MotionDetectorConfig struct - detector thresholds. The
+ *              constructor sets defaults suited to a hand held or desk
+ *              mounted Sense HAT
+ */
+//******************************************************************************
+struct MotionDetectorConfig
+{
+    MotionDetectorConfig();
+
+    quint32 detectors;          // 'OR' of MotionDetectors
+
+    float gravityTimeSec;       // low pass time constant of the gravity estimate
+
+    float tapThreshold;         // dynamic acceleration that starts a tap
+    qint64 tapMaxNs;            // longest spike still counted as a tap
+    qint64 tapQuietNs;          // time without a spike that confirms a tap
+    qint64 doubleTapNs;         // window for the second tap
+
+    float shakeThreshold;       // dynamic acceleration counted as a swing
+    int shakeReversals;         // direction changes that make a shake
+    qint64 shakeWindowNs;       // time the reversals must happen in
+
+    float freeFallThreshold;    // total acceleration below which the device falls
+    qint64 freeFallMinNs;       // fall time before the event
+
+    float tiltThresholdDeg;     // angle from tiltReference that raises TILT
+    float tiltHysteresisDeg;    // angle back below the threshold for LEVEL
+    float tiltReference[3];     // level gravity direction
+
+    float stillAccelThreshold;  // dynamic acceleration below which the device is still
+    float stillGyroThreshold;   // rotation rate (degrees/s) below which it is still
+    qint64 stillTimeNs;         // time without movement before STILL
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHMotionDetector class - runs the configured detectors on a
+ *              sample stream
+ */
+//******************************************************************************
+class SHMotionDetector
+{
+public:
+
+    SHMotionDetector();
+
+    //*** set the thresholds and start over ***
+    void configure( const MotionDetectorConfig &config );
+    const MotionDetectorConfig &config() { return config_; }
+
+    //*** start over from the next sample ***
+    void reset();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief add - run the detectors on a sample
+     * @param timestampNs - sample time
+     * @param accel       - acceleration in g
+     * @param gyro        - rotation rate in degrees/s, or NULL if not read
+     * @param events      - receives up to MotionMaxEvents events
+     * @return - number of events
+     */
+    //******************************************************************************
+    int add( qint64 timestampNs, const float *accel, const float *gyro, MotionEvent *events );
+
+private:
+
+    //*** append an event ***
+    void raise( MotionEventType type, float magnitude, const float *direction );
+
+    //*** detectors ***
+    void detectTap( float dynMag );
+    void raiseTap();
+    void detectShake();
+    void detectFreeFall( float accelMag );
+    void detectTilt();
+    void detectStill( float dynMag, const float *gyro );
+
+    MotionDetectorConfig config_;
+
+    //*** current sample ***
+    qint64 nowNs_;
+    float dynamic_[3];
+    MotionEvent *events_;
+    int eventCount_;
+
+    //*** gravity estimate ***
+    bool started_;
+    qint64 lastNs_;
+    float gravity_[3];
+
+    //*** tap ***
+    bool tapActive_;
+    qint64 tapStartNs_;
+    float tapPeak_;
+    float tapDirection_[3];
+    qint64 tapQuietUntilNs_;
+    bool tapPending_;                   // released, waiting out the quiet time
+    qint64 lastTapNs_;
+
+    //*** shake ***
+    int shakeAxis_;
+    int shakeSign_;
+    int shakeCount_;
+    qint64 shakeStartNs_;
+    float shakePeak_;
+    qint64 shakeHoldUntilNs_;
+
+    //*** free fall ***
+    qint64 fallStartNs_;
+    float fallMin_;
+    bool fallReported_;
+
+    //*** tilt ***
+    bool tilted_;
+
+    //*** still / moving - 0 unknown, 1 still, 2 moving ***
+    int stillState_;
+    qint64 lastMoveNs_;
+};
+
+#endif // SHMOTIONEVENTS_H
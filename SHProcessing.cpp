@@ -0,0 +1,315 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat processing graph
+//
+// Built-in calibrate, filter and transform stages, and the stage timing
+//      report shared by every SHPipeline
+//
+//******************************************************************************
+//******************************************************************************
+#include "SHProcessing.h"
+
+#include <math.h>
+#include <string.h>
+
+//*** identity matrix ***
+const float Identity3[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+
+//*** vector channels in calibration order ***
+const quint8 VectorChannels[3] = { IMU_GYRO, IMU_ACCEL, IMU_COMPASS };
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief vectorIndex - calibration slot of a vector channel
+ * @param channel - ImuSensors channel
+ * @return - 0 to 2, or -1 for other channels
+ */
+//******************************************************************************
+static int vectorIndex( quint8 channel )
+{
+    for ( int i=0; i<3; i++ )
+    {
+        if ( VectorChannels[i] == channel ) return i;
+    }
+
+    return -1;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief vectorValues - a vector channel's values in a sample
+ * @param sample - sample
+ * @param index  - 0 gyro, 1 accel, 2 compass
+ * @return - first component
+ */
+//******************************************************************************
+static float *vectorValues( SensorSample &sample, int index )
+{
+    switch ( index )
+    {
+        case 0:  return sample.gyro;
+        case 1:  return sample.accel;
+        default: return sample.compass;
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief multiply - v = m * v for a 3x3 row major matrix
+ * @param m - matrix
+ * @param v - vector, replaced by the product
+ */
+//******************************************************************************
+static void multiply( const float *m, float *v )
+{
+float x = v[0];
+float y = v[1];
+float z = v[2];
+
+    v[0] = m[0] * x + m[1] * y + m[2] * z;
+    v[1] = m[3] * x + m[4] * y + m[5] * z;
+    v[2] = m[6] * x + m[7] * y + m[8] * z;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHCalibrateStage::SHCalibrateStage
+ */
+//******************************************************************************
+SHCalibrateStage::SHCalibrateStage()
+{
+    channels_ = 0;
+    memset( bias_, 0, sizeof(bias_) );
+
+    for ( int i=0; i<3; i++ )
+    {
+        memcpy( matrix_[i], Identity3, sizeof(Identity3) );
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHCalibrateStage::setCalibration - set the correction of a channel
+ * @param channel - IMU_GYRO, IMU_ACCEL or IMU_COMPASS
+ * @param bias    - offset removed first
+ * @param matrix  - 3x3 row major matrix, NULL for identity
+ */
+//******************************************************************************
+void SHCalibrateStage::setCalibration( ImuSensors channel, const float *bias, const float *matrix )
+{
+int idx = vectorIndex( channel );
+
+    if ( idx < 0 ) return;
+
+    memcpy( bias_[idx], bias, sizeof(bias_[idx]) );
+    memcpy( matrix_[idx], matrix ? matrix : Identity3, sizeof(matrix_[idx]) );
+    channels_ |= channel;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHCalibrateStage::process - correct the calibrated channels
+ * @param sample - sample, corrected in place
+ * @return - TRUE, the chain always continues
+ */
+//******************************************************************************
+bool SHCalibrateStage::process( SensorSample &sample )
+{
+float *v;
+
+    for ( int i=0; i<3; i++ )
+    {
+        if ( !( channels_ & sample.valid & VectorChannels[i] ) ) continue;
+
+        v = vectorValues( sample, i );
+        v[0] -= bias_[i][0];
+        v[1] -= bias_[i][1];
+        v[2] -= bias_[i][2];
+        multiply( matrix_[i], v );
+    }
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHLowPassStage::SHLowPassStage
+ * @param channels - 'OR' of ImuSensors channels to filter
+ * @param cutoffHz - -3dB frequency
+ */
+//******************************************************************************
+SHLowPassStage::SHLowPassStage( quint8 channels, double cutoffHz )
+{
+    channels_ = channels & ~IMU_FUSION;
+    timeConstantSec_ = 1.0 / ( 2.0 * M_PI * qMax( cutoffHz, 0.001 ) );
+    reset();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHLowPassStage::reset - start again from the next sample
+ */
+//******************************************************************************
+void SHLowPassStage::reset()
+{
+    memset( lastNs_, 0, sizeof(lastNs_) );
+    memset( state_, 0, sizeof(state_) );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHLowPassStage::process - filter the selected channels
+ * @param sample - sample, filtered in place
+ * @return - TRUE, the chain always continues
+ */
+//******************************************************************************
+bool SHLowPassStage::process( SensorSample &sample )
+{
+float *v;
+float alpha;
+float dtSec;
+int components;
+
+    for ( int i=0; i<ImuChannelCount; i++ )
+    {
+        if ( !( channels_ & sample.valid & ( 1 << i ) ) ) continue;
+
+        switch ( 1 << i )
+        {
+            case IMU_PRESSURE: v = &sample.pressure;    components = 2; break;     // and altitude
+            case IMU_TEMP:     v = &sample.temperature; components = 1; break;
+            case IMU_HUMIDITY: v = &sample.humidity;    components = 1; break;
+            default:           v = vectorValues( sample, vectorIndex( 1 << i ) ); components = 3; break;
+        }
+
+        //*** the first sample seeds the filter ***
+        if ( lastNs_[i] == 0 || sample.timestampNs <= lastNs_[i] )
+        {
+            memcpy( state_[i], v, components * sizeof(float) );
+        }
+        else
+        {
+            dtSec = ( sample.timestampNs - lastNs_[i] ) / 1e9f;
+            alpha = dtSec / ( timeConstantSec_ + dtSec );
+
+            for ( int c=0; c<components; c++ )
+            {
+                state_[i][c] += alpha * ( v[c] - state_[i][c] );
+            }
+        }
+
+        lastNs_[i] = sample.timestampNs;
+        memcpy( v, state_[i], components * sizeof(float) );
+    }
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHRotateStage::SHRotateStage
+ */
+//******************************************************************************
+SHRotateStage::SHRotateStage()
+{
+    channels_ = 0;
+    memcpy( matrix_, Identity3, sizeof(matrix_) );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHRotateStage::setMatrix - set the rotation
+ * @param matrix   - 3x3 row major, device to target frame
+ * @param channels - 'OR' of IMU_GYRO, IMU_ACCEL and IMU_COMPASS
+ */
+//******************************************************************************
+void SHRotateStage::setMatrix( const float *matrix, quint8 channels )
+{
+    memcpy( matrix_, matrix, sizeof(matrix_) );
+    channels_ = channels & ( IMU_GYRO | IMU_ACCEL | IMU_COMPASS );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHRotateStage::process - rotate the selected channels
+ * @param sample - sample, rotated in place
+ * @return - TRUE, the chain always continues
+ */
+//******************************************************************************
+bool SHRotateStage::process( SensorSample &sample )
+{
+    for ( int i=0; i<3; i++ )
+    {
+        if ( channels_ & sample.valid & VectorChannels[i] )
+        {
+            multiply( matrix_, vectorValues( sample, i ) );
+        }
+    }
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief pipelineReport - text report of stage timings
+ * @param count  - number of stages
+ * @param names  - stage names
+ * @param hists  - stage histograms
+ * @param stops  - samples each stage stopped
+ * @return - report
+ */
+//******************************************************************************
+QString pipelineReport( int count, const char *const *names, const SHHistogram *hists,
+                        const QAtomicInteger<quint64> *stops )
+{
+QString report;
+HistogramSnapshot snap;
+
+#ifdef SH_NO_INSTRUMENTATION
+    report += "# stage timing compiled out\n";
+#endif
+
+    for ( int i=0; i<count; i++ )
+    {
+        hists[i].snapshot( snap );
+
+        report += QString( "stage %1 %2 count %3 stopped %4 mean %5 p50 %6 p99 %7 max %8\n" )
+                    .arg( i )
+                    .arg( names[i] )
+                    .arg( snap.count )
+                    .arg( stops[i].load() )
+                    .arg( snap.count ? (double)snap.sum / snap.count : 0.0, 0, 'f', 1 )
+                    .arg( SHHistogram::percentile( snap, 0.5 ) )
+                    .arg( SHHistogram::percentile( snap, 0.99 ) )
+                    .arg( snap.max );
+    }
+
+    return report;
+}
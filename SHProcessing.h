@@ -0,0 +1,338 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat processing graph
+//
+// A chain of stages - calibrate, filter, transform, detect, sink - that runs
+//      on every sample directly on the acquisition thread, in place of a
+//      chain of slots. The stages are template parameters of SHPipeline, so
+//      each call is resolved at compile time and can be inlined; the only
+//      virtual call is the one from SHSensors into the pipeline. The sample
+//      is copied once into the pipeline's own working sample, which the
+//      stages change in place. Nothing is allocated per sample.
+//
+//  A stage is any class with
+//          bool process( SensorSample &sample );
+//          const char *name() const;
+//      process() returns FALSE to stop the chain for that sample, so a
+//      detect stage can gate the sinks after it. Each stage is timed into
+//      its own log2 histogram; building with SH_NO_INSTRUMENTATION compiles
+//      the timing out
+//
+//  Example:
+//      auto *pipe = newPipeline( SHCalibrateStage(),
+//                                SHLowPassStage( IMU_ACCEL, 5.0 ),
+//                                functionStage( []( SensorSample &s ) {
+//                                    return s.accel[2] < 0.5f; }, "detect" ),
+//                                functionStage( []( SensorSample &s ) {
+//                                    ...; return true; }, "sink" ) );
+//      pipe->stage<0>().setCalibration( IMU_ACCEL, bias, matrix );
+//      sensors->setProcessor( pipe );
+//
+//******************************************************************************
+//******************************************************************************
+#ifndef SHPROCESSING_H
+#define SHPROCESSING_H
+
+#include <QString>
+#include <QAtomicInt>
+
+#include <tuple>
+#include <type_traits>
+#include <time.h>
+
+#include "SHSensors.h"
+#include "SHInstrument.h"
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHCalibrateStage class - corrects the vector channels as
+ *              M * ( raw - bias ). Identity until set
+ */
+//******************************************************************************
+class SHCalibrateStage
+{
+public:
+
+    SHCalibrateStage();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setCalibration - set the correction of a channel
+     * @param channel - IMU_GYRO, IMU_ACCEL or IMU_COMPASS
+     * @param bias    - offset removed first
+     * @param matrix  - 3x3 row major scale and cross-axis matrix, NULL for
+     *                  identity
+     */
+    //******************************************************************************
+    void setCalibration( ImuSensors channel, const float *bias, const float *matrix = 0 );
+
+    bool process( SensorSample &sample );
+    const char *name() const { return "calibrate"; }
+
+private:
+
+    quint8 channels_;           // channels with a calibration
+    float bias_[3][3];          // gyro, accel, compass
+    float matrix_[3][9];
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHLowPassStage class - first order low pass filter. The time
+ *              step comes from the sample timestamps, so the cutoff holds at
+ *              any update rate. Fusion angles are not filtered
+ */
+//******************************************************************************
+class SHLowPassStage
+{
+public:
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief SHLowPassStage
+     * @param channels - 'OR' of ImuSensors channels to filter
+     * @param cutoffHz - -3dB frequency
+     */
+    //******************************************************************************
+    SHLowPassStage( quint8 channels = IMU_ACCEL, double cutoffHz = 5.0 );
+
+    //*** start again from the next sample ***
+    void reset();
+
+    bool process( SensorSample &sample );
+    const char *name() const { return "lowpass"; }
+
+private:
+
+    quint8 channels_;
+    float timeConstantSec_;
+    qint64 lastNs_[ImuChannelCount];    // 0 until the channel's first sample
+    float state_[ImuChannelCount][3];
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHRotateStage class - rotates vector channels into another
+ *              frame, for a Sense HAT mounted at an angle. Identity until set
+ */
+//******************************************************************************
+class SHRotateStage
+{
+public:
+
+    SHRotateStage();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setMatrix - set the rotation
+     * @param matrix   - 3x3 row major, device to target frame
+     * @param channels - 'OR' of IMU_GYRO, IMU_ACCEL and IMU_COMPASS
+     */
+    //******************************************************************************
+    void setMatrix( const float *matrix, quint8 channels = IMU_GYRO | IMU_ACCEL | IMU_COMPASS );
+
+    bool process( SensorSample &sample );
+    const char *name() const { return "rotate"; }
+
+private:
+
+    quint8 channels_;
+    float matrix_[9];
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHFunctionStage class - a stage from any callable taking
+ *              SensorSample & and returning bool, for detect and sink stages.
+ *              A lambda is called directly, without a std::function
+ */
+//******************************************************************************
+template <typename F>
+class SHFunctionStage
+{
+public:
+
+    SHFunctionStage( F function, const char *name ) : function_( function ), name_( name ) {}
+
+    bool process( SensorSample &sample ) { return function_( sample ); }
+    const char *name() const { return name_; }
+
+private:
+
+    F function_;
+    const char *name_;
+};
+
+//*** function stage with the callable's type deduced ***
+template <typename F>
+SHFunctionStage<F> functionStage( F function, const char *name = "function" )
+{
+    return SHFunctionStage<F>( function, name );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief pipelineReport - text report of stage timings, one line per stage
+ *              stage <n> <name> count <n> stopped <n> mean <v> p50 <v> p99 <v> max <v>
+ * @param count  - number of stages
+ * @param names  - stage names
+ * @param hists  - stage histograms
+ * @param stops  - samples each stage stopped
+ * @return - report
+ */
+//******************************************************************************
+QString pipelineReport( int count, const char *const *names, const SHHistogram *hists,
+                        const QAtomicInteger<quint64> *stops );
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHPipeline class - runs its stages in order on every sample
+ *              and times each one
+ */
+//******************************************************************************
+template <typename... Stages>
+class SHPipeline : public SensorProcessor
+{
+    static_assert( sizeof...(Stages) > 0, "SHPipeline needs at least one stage" );
+
+public:
+
+    enum { StageCount = sizeof...(Stages) };
+
+    SHPipeline() { init(); }
+    explicit SHPipeline( const Stages &... stages ) : stages_( stages... ) { init(); }
+
+    //*** access a stage to configure it - only while the pipeline is not installed ***
+    template <int I>
+    typename std::tuple_element<I, std::tuple<Stages...> >::type &stage()
+    {
+        return std::get<I>( stages_ );
+    }
+
+    //*** SensorProcessor - called on the acquisition thread ***
+    void process( const SensorSample &sample )
+    {
+        work_ = sample;
+        run<0>( timingEnabled() ? nowNs() : 0 );
+    }
+
+    //*** stage timing, on by default ***
+    void setTiming( bool enable ) { timing_.store( enable ? 1 : 0 ); }
+    bool timingEnabled() const
+    {
+#ifdef SH_NO_INSTRUMENTATION
+        return false;
+#else
+        return timing_.load() != 0;
+#endif
+    }
+
+    //*** clear the stage timings ***
+    void resetTiming()
+    {
+        for ( int i=0; i<StageCount; i++ )
+        {
+            hists_[i].reset();
+            stops_[i].store( 0 );
+        }
+    }
+
+    //*** execution time of a stage in nanoseconds ***
+    void stageTiming( int stage, HistogramSnapshot &snap ) const { hists_[stage].snapshot( snap ); }
+
+    //*** samples a stage stopped ***
+    quint64 stageStops( int stage ) const { return stops_[stage].load(); }
+
+    const char *stageName( int stage ) const { return names_[stage]; }
+
+    //*** text report of the stage timings ***
+    QString dump() const { return pipelineReport( StageCount, names_, hists_, stops_ ); }
+
+private:
+
+    void init()
+    {
+        timing_.store( 1 );
+        collectNames<0>();
+        resetTiming();
+    }
+
+    //*** run stage I and the ones after it - startNs is 0 when not timing ***
+    template <int I>
+    typename std::enable_if<( I < StageCount )>::type run( qint64 startNs )
+    {
+    bool pass = std::get<I>( stages_ ).process( work_ );
+    qint64 endNs = 0;
+
+        if ( startNs != 0 )
+        {
+            endNs = nowNs();
+            hists_[I].add( endNs - startNs );
+        }
+
+        if ( !pass )
+        {
+            stops_[I].fetchAndAddRelaxed( 1 );
+            return;
+        }
+
+        run<I + 1>( endNs );
+    }
+
+    template <int I>
+    typename std::enable_if<( I == StageCount )>::type run( qint64 ) {}
+
+    //*** stage names for the report ***
+    template <int I>
+    typename std::enable_if<( I < StageCount )>::type collectNames()
+    {
+        names_[I] = std::get<I>( stages_ ).name();
+        collectNames<I + 1>();
+    }
+
+    template <int I>
+    typename std::enable_if<( I == StageCount )>::type collectNames() {}
+
+    //*** CLOCK_MONOTONIC in nanoseconds ***
+    static qint64 nowNs()
+    {
+    struct timespec ts;
+
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+    std::tuple<Stages...> stages_;
+    SensorSample work_;
+
+    //*** timing ***
+    QAtomicInt timing_;
+    const char *names_[StageCount];
+    SHHistogram hists_[StageCount];
+    QAtomicInteger<quint64> stops_[StageCount];
+};
+
+//*** pipeline with the stage types deduced ***
+template <typename... Stages>
+SHPipeline<Stages...> *newPipeline( const Stages &... stages )
+{
+    return new SHPipeline<Stages...>( stages... );
+}
+
+#endif // SHPROCESSING_H
@@ -0,0 +1,291 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat sensor replay backend
+//
+// RTIMU, RTPressure and RTHumidity implementations that play back a sensor
+//      log instead of reading the I2C bus, so SHSensors runs unchanged on a
+//      machine without the hardware
+//
+//******************************************************************************
+//******************************************************************************
+#include "SHReplay.h"
+
+#include <time.h>
+#include <string.h>
+
+//*** most records returned in a row by a fast replay before yielding ***
+const int MaxFastBurst = 256;
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief replayNowNs - current CLOCK_MONOTONIC time
+ * @return - time in nanoseconds
+ */
+//******************************************************************************
+static qint64 replayNowNs()
+{
+struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHReplaySource::SHReplaySource
+ */
+//******************************************************************************
+SHReplaySource::SHReplaySource()
+{
+    realTime_ = true;
+    atEnd_ = true;
+    haveNext_ = false;
+    firstLogUs_ = 0;
+    startNs_ = 0;
+    burstCount_ = 0;
+    memset( &next_, 0, sizeof(next_) );
+    imuDataFromLogRecord( next_, current_ );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHReplaySource::open - open a log for replay
+ * @param fileName - sensor log
+ * @param realTime - TRUE for original timing, FALSE for as fast as possible
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHReplaySource::open( QString fileName, bool realTime )
+{
+    if ( !reader_.open( fileName ) )
+    {
+        return false;
+    }
+
+    realTime_ = realTime;
+    haveNext_ = reader_.next( next_ );
+    atEnd_ = !haveNext_;
+    firstLogUs_ = next_.timestampUs;
+    startNs_ = 0;
+    burstCount_ = 0;
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHReplaySource::averageIntervalUs - average record interval
+ * @return - interval in usecs
+ */
+//******************************************************************************
+qint64 SHReplaySource::averageIntervalUs()
+{
+    if ( reader_.recordCount() < 2 ) return 10000;
+
+    return ( reader_.lastTimestampUs() - reader_.firstTimestampUs() ) /
+           ( reader_.recordCount() - 1 );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHReplaySource::nextDue - deliver the next record if it is due
+ * @param data - receives the record
+ * @return - TRUE if a record was delivered
+ */
+//******************************************************************************
+bool SHReplaySource::nextDue( RTIMU_DATA &data )
+{
+    if ( !haveNext_ )
+    {
+        atEnd_ = true;
+        return false;
+    }
+
+    //*** replay clock starts at the first read ***
+    if ( startNs_ == 0 )
+    {
+        startNs_ = replayNowNs();
+    }
+
+    if ( realTime_ )
+    {
+        //*** not due yet ***
+        qint64 dueNs = (qint64)( next_.timestampUs - firstLogUs_ ) * 1000;
+        if ( replayNowNs() - startNs_ < dueNs )
+        {
+            return false;
+        }
+    }
+    else if ( ++burstCount_ > MaxFastBurst )
+    {
+        //*** let the caller finish its update ***
+        burstCount_ = 0;
+        return false;
+    }
+
+    RTIMU_DATA previous = current_;
+    imuDataFromLogRecord( next_, current_ );
+
+    //*** environmental readings stay current until the log has newer ones ***
+    if ( !current_.pressureValid )
+    {
+        current_.pressureValid = previous.pressureValid;
+        current_.pressure = previous.pressure;
+    }
+
+    if ( !current_.temperatureValid )
+    {
+        current_.temperatureValid = previous.temperatureValid;
+        current_.temperature = previous.temperature;
+    }
+
+    if ( !current_.humidityValid )
+    {
+        current_.humidityValid = previous.humidityValid;
+        current_.humidity = previous.humidity;
+    }
+
+    data = current_;
+
+    haveNext_ = reader_.next( next_ );
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+//
+// Replay IMU
+//
+//******************************************************************************
+//******************************************************************************
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHReplayIMU::SHReplayIMU
+ * @param settings - RTIMU settings
+ * @param source   - shared replay position
+ */
+//******************************************************************************
+SHReplayIMU::SHReplayIMU( RTIMUSettings *settings, SHReplaySource *source )
+    : RTIMU( settings )
+{
+    source_ = source;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHReplayIMU::IMUGetPollInterval - poll at the recorded sample interval
+ * @return - interval in msecs
+ */
+//******************************************************************************
+int SHReplayIMU::IMUGetPollInterval()
+{
+    return qMax( (int)( source_->averageIntervalUs() / 1000 ), 1 );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHReplayIMU::IMURead - deliver the next due record, fusion included
+ * @return - TRUE if a record was delivered
+ */
+//******************************************************************************
+bool SHReplayIMU::IMURead()
+{
+    return source_->nextDue( m_imuData );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+//
+// Replay pressure and humidity
+//
+//******************************************************************************
+//******************************************************************************
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHReplayPressure::SHReplayPressure
+ * @param settings - RTIMU settings
+ * @param source   - shared replay position
+ */
+//******************************************************************************
+SHReplayPressure::SHReplayPressure( RTIMUSettings *settings, SHReplaySource *source )
+    : RTPressure( settings )
+{
+    source_ = source;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHReplayPressure::pressureRead - pressure of the current record
+ * @param data - receives pressure and temperature
+ * @return - TRUE if the record holds a reading
+ */
+//******************************************************************************
+bool SHReplayPressure::pressureRead( RTIMU_DATA &data )
+{
+const RTIMU_DATA &cur = source_->current();
+
+    data.pressureValid = cur.pressureValid;
+    data.pressure = cur.pressure;
+    data.temperatureValid = cur.temperatureValid;
+    data.temperature = cur.temperature;
+
+    return cur.pressureValid || cur.temperatureValid;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHReplayHumidity::SHReplayHumidity
+ * @param settings - RTIMU settings
+ * @param source   - shared replay position
+ */
+//******************************************************************************
+SHReplayHumidity::SHReplayHumidity( RTIMUSettings *settings, SHReplaySource *source )
+    : RTHumidity( settings )
+{
+    source_ = source;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHReplayHumidity::humidityRead - humidity of the current record
+ * @param data - receives humidity
+ * @return - TRUE if the record holds a reading
+ */
+//******************************************************************************
+bool SHReplayHumidity::humidityRead( RTIMU_DATA &data )
+{
+const RTIMU_DATA &cur = source_->current();
+
+    data.humidityValid = cur.humidityValid;
+    data.humidity = cur.humidity;
+
+    return cur.humidityValid;
+}
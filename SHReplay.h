@@ -0,0 +1,143 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat sensor replay backend
+//
+// RTIMU, RTPressure and RTHumidity implementations that play back a sensor
+//      log instead of reading the I2C bus, so SHSensors runs unchanged on a
+//      machine without the hardware
+//
+//******************************************************************************
+//******************************************************************************
+#ifndef SHREPLAY_H
+#define SHREPLAY_H
+
+#include "RTIMULib.h"
+#include "SHSensorLog.h"
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHReplaySource class - log position shared by the replay IMU,
+ *              pressure and humidity objects
+ */
+//******************************************************************************
+class SHReplaySource
+{
+public:
+
+    SHReplaySource();
+
+    //*** open a log, replaying at original timing or as fast as possible ***
+    bool open( QString fileName, bool realTime );
+
+    //*** format version of the log last opened, 0 if it is not a log ***
+    quint16 logVersion() { return reader_.version(); }
+
+    //*** the next record if it is due - FALSE if not yet or at end ***
+    bool nextDue( RTIMU_DATA &data );
+
+    //*** most recently delivered data ***
+    const RTIMU_DATA &current() { return current_; }
+
+    //*** all records delivered ***
+    bool atEnd() { return atEnd_; }
+
+    //*** average interval between records (usecs) ***
+    qint64 averageIntervalUs();
+
+private:
+
+    SHSensorLogReader reader_;
+    bool realTime_;
+    bool atEnd_;
+
+    //*** lookahead record ***
+    SensorLogRecord next_;
+    bool haveNext_;
+
+    //*** timing - log time of the first record against the replay start ***
+    quint64 firstLogUs_;
+    qint64 startNs_;
+
+    //*** records returned since the last FALSE - bounds fast replay bursts ***
+    int burstCount_;
+
+    //*** last record delivered ***
+    RTIMU_DATA current_;
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHReplayIMU class
+ */
+//******************************************************************************
+class SHReplayIMU : public RTIMU
+{
+public:
+
+    SHReplayIMU( RTIMUSettings *settings, SHReplaySource *source );
+
+    virtual const char *IMUName() { return "Sensor log replay"; }
+    virtual int IMUType() { return RTIMU_TYPE_AUTODISCOVER; }
+    virtual bool IMUInit() { return true; }
+    virtual int IMUGetPollInterval();
+    virtual bool IMURead();
+
+private:
+
+    SHReplaySource *source_;
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHReplayPressure class - pressure and temperature of the most
+ *              recently replayed record
+ */
+//******************************************************************************
+class SHReplayPressure : public RTPressure
+{
+public:
+
+    SHReplayPressure( RTIMUSettings *settings, SHReplaySource *source );
+
+    virtual const char *pressureName() { return "Sensor log replay"; }
+    virtual int pressureType() { return RTPRESSURE_TYPE_AUTODISCOVER; }
+    virtual bool pressureInit() { return true; }
+    virtual bool pressureRead( RTIMU_DATA &data );
+
+private:
+
+    SHReplaySource *source_;
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHReplayHumidity class - humidity of the most recently replayed
+ *              record
+ */
+//******************************************************************************
+class SHReplayHumidity : public RTHumidity
+{
+public:
+
+    SHReplayHumidity( RTIMUSettings *settings, SHReplaySource *source );
+
+    virtual const char *humidityName() { return "Sensor log replay"; }
+    virtual int humidityType() { return RTHUMIDITY_TYPE_AUTODISCOVER; }
+    virtual bool humidityInit() { return true; }
+    virtual bool humidityRead( RTIMU_DATA &data );
+
+private:
+
+    SHReplaySource *source_;
+};
+
+#endif // SHREPLAY_H
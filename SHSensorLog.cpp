@@ -0,0 +1,693 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat sensor log
+//
+// Append-only binary log of the RTIMU_DATA stream. The file is a sequence of
+//      fixed size blocks so it can be memory mapped and read from any block.
+//      Each block starts from a zero record and stores every following
+//      record as variable length deltas against the one before it
+//
+//******************************************************************************
+//******************************************************************************
+#include "SHSensorLog.h"
+#include "SHSensors.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//*** largest encoded record - timestamp, valid and floats as varints ***
+const int MaxRecordBytes = 10 + 5 + SensorLogFloats * 5;
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief putVarint - LEB128 encode a value
+ * @param p     - output position
+ * @param value - value to encode
+ * @return - position after the encoded value
+ */
+//******************************************************************************
+static quint8 *putVarint( quint8 *p, quint64 value )
+{
+    while ( value >= 0x80 )
+    {
+        *p++ = (quint8)( value | 0x80 );
+        value >>= 7;
+    }
+    *p++ = (quint8)value;
+
+    return p;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief getVarint - decode a LEB128 value
+ * @param p     - input position
+ * @param end   - end of input
+ * @param value - decoded value
+ * @return - position after the value, or NULL if truncated
+ */
+//******************************************************************************
+static const quint8 *getVarint( const quint8 *p, const quint8 *end, quint64 &value )
+{
+int shift = 0;
+
+    value = 0;
+    while ( p < end && shift < 64 )
+    {
+        quint8 byte = *p++;
+        value |= (quint64)( byte & 0x7F ) << shift;
+        if ( ( byte & 0x80 ) == 0 ) return p;
+        shift += 7;
+    }
+
+    return 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief floatBits - float fields of a record as raw bits
+ * @param rec  - record
+ * @param bits - receives SensorLogFloats words
+ */
+//******************************************************************************
+static void floatBits( const SensorLogRecord &rec, quint32 *bits )
+{
+    //*** the float fields are contiguous, starting with fusionPose ***
+    memcpy( bits, rec.fusionPose, SensorLogFloats * sizeof(float) );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief setFloatBits - set the float fields of a record from raw bits
+ * @param rec  - record
+ * @param bits - SensorLogFloats words
+ */
+//******************************************************************************
+static void setFloatBits( SensorLogRecord &rec, const quint32 *bits )
+{
+    memcpy( rec.fusionPose, bits, SensorLogFloats * sizeof(float) );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief logRecordFromImuData - fill a log record from RTIMU data
+ * @param data - RTIMU data
+ * @param rec  - record to fill
+ */
+//******************************************************************************
+void logRecordFromImuData( const RTIMU_DATA &data, SensorLogRecord &rec )
+{
+    memset( &rec, 0, sizeof(rec) );
+
+    rec.timestampUs = data.timestamp;
+
+    if ( data.fusionPoseValid )
+    {
+        rec.fusionPose[0] = data.fusionPose.x();
+        rec.fusionPose[1] = data.fusionPose.y();
+        rec.fusionPose[2] = data.fusionPose.z();
+        rec.valid |= IMU_FUSION;
+    }
+
+    if ( data.fusionQPoseValid )
+    {
+        rec.fusionQPose[0] = data.fusionQPose.scalar();
+        rec.fusionQPose[1] = data.fusionQPose.x();
+        rec.fusionQPose[2] = data.fusionQPose.y();
+        rec.fusionQPose[3] = data.fusionQPose.z();
+        rec.valid |= LogFusionQPoseValid;
+    }
+
+    if ( data.gyroValid )
+    {
+        rec.gyro[0] = data.gyro.x();
+        rec.gyro[1] = data.gyro.y();
+        rec.gyro[2] = data.gyro.z();
+        rec.valid |= IMU_GYRO;
+    }
+
+    if ( data.accelValid )
+    {
+        rec.accel[0] = data.accel.x();
+        rec.accel[1] = data.accel.y();
+        rec.accel[2] = data.accel.z();
+        rec.valid |= IMU_ACCEL;
+    }
+
+    if ( data.compassValid )
+    {
+        rec.compass[0] = data.compass.x();
+        rec.compass[1] = data.compass.y();
+        rec.compass[2] = data.compass.z();
+        rec.valid |= IMU_COMPASS;
+    }
+
+    if ( data.pressureValid )
+    {
+        rec.pressure = data.pressure;
+        rec.valid |= IMU_PRESSURE;
+    }
+
+    if ( data.temperatureValid )
+    {
+        rec.temperature = data.temperature;
+        rec.valid |= IMU_TEMP;
+    }
+
+    if ( data.humidityValid )
+    {
+        rec.humidity = data.humidity;
+        rec.valid |= IMU_HUMIDITY;
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief imuDataFromLogRecord - fill RTIMU data from a log record
+ * @param rec  - log record
+ * @param data - RTIMU data to fill
+ */
+//******************************************************************************
+void imuDataFromLogRecord( const SensorLogRecord &rec, RTIMU_DATA &data )
+{
+    data.timestamp = rec.timestampUs;
+
+    data.fusionPoseValid = ( rec.valid & IMU_FUSION ) != 0;
+    data.fusionPose = RTVector3( rec.fusionPose[0], rec.fusionPose[1], rec.fusionPose[2] );
+
+    data.fusionQPoseValid = ( rec.valid & LogFusionQPoseValid ) != 0;
+    data.fusionQPose.setScalar( rec.fusionQPose[0] );
+    data.fusionQPose.setX( rec.fusionQPose[1] );
+    data.fusionQPose.setY( rec.fusionQPose[2] );
+    data.fusionQPose.setZ( rec.fusionQPose[3] );
+
+    data.gyroValid = ( rec.valid & IMU_GYRO ) != 0;
+    data.gyro = RTVector3( rec.gyro[0], rec.gyro[1], rec.gyro[2] );
+
+    data.accelValid = ( rec.valid & IMU_ACCEL ) != 0;
+    data.accel = RTVector3( rec.accel[0], rec.accel[1], rec.accel[2] );
+
+    data.compassValid = ( rec.valid & IMU_COMPASS ) != 0;
+    data.compass = RTVector3( rec.compass[0], rec.compass[1], rec.compass[2] );
+
+    data.pressureValid = ( rec.valid & IMU_PRESSURE ) != 0;
+    data.pressure = rec.pressure;
+
+    data.temperatureValid = ( rec.valid & IMU_TEMP ) != 0;
+    data.temperature = rec.temperature;
+
+    data.humidityValid = ( rec.valid & IMU_HUMIDITY ) != 0;
+    data.humidity = rec.humidity;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+//
+// Log writer
+//
+//******************************************************************************
+//******************************************************************************
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensorLogWriter::SHSensorLogWriter
+ */
+//******************************************************************************
+SHSensorLogWriter::SHSensorLogWriter()
+{
+    header_ = (SensorLogBlockHeader *)block_;
+    writePtr_ = 0;
+    memset( &prev_, 0, sizeof(prev_) );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensorLogWriter::~SHSensorLogWriter
+ */
+//******************************************************************************
+SHSensorLogWriter::~SHSensorLogWriter()
+{
+    close();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensorLogWriter::open - open for append, creating the file if needed
+ * @param fileName - log file
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSensorLogWriter::open( QString fileName )
+{
+QMutexLocker wLock( &mutex_ );
+
+    file_.close();
+    file_.setFileName( fileName );
+
+    if ( !file_.open( QIODevice::ReadWrite ) )
+    {
+        return false;
+    }
+
+    //*** drop a partial block left by a crash, keeping blocks aligned ***
+    qint64 wholeBlocks = file_.size() / SensorLogBlockBytes;
+    file_.resize( wholeBlocks * SensorLogBlockBytes );
+    file_.seek( wholeBlocks * SensorLogBlockBytes );
+
+    //*** start an empty block ***
+    memset( block_, 0, sizeof(block_) );
+    writePtr_ = block_ + sizeof(SensorLogBlockHeader);
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensorLogWriter::close - write the partial block and close
+ */
+//******************************************************************************
+void SHSensorLogWriter::close()
+{
+QMutexLocker wLock( &mutex_ );
+
+    if ( !file_.isOpen() ) return;
+
+    if ( header_->count > 0 )
+    {
+        flushBlock();
+    }
+
+    file_.close();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensorLogWriter::append - add a record
+ * @param rec - record to add
+ */
+//******************************************************************************
+void SHSensorLogWriter::append( const SensorLogRecord &rec )
+{
+QMutexLocker wLock( &mutex_ );
+quint32 bits[SensorLogFloats];
+quint32 prevBits[SensorLogFloats];
+
+    if ( !file_.isOpen() ) return;
+
+    //*** block full - write it and start another ***
+    if ( block_ + SensorLogBlockBytes - writePtr_ < MaxRecordBytes )
+    {
+        flushBlock();
+    }
+
+    //*** first record of a block - deltas start from a zero record ***
+    if ( header_->count == 0 )
+    {
+        memcpy( header_->magic, SensorLogMagic, sizeof(header_->magic) );
+        header_->version = SensorLogVersion;
+        header_->firstTimestampUs = rec.timestampUs;
+
+        memset( &prev_, 0, sizeof(prev_) );
+        prev_.timestampUs = rec.timestampUs;
+    }
+
+    //*** timestamp and valid mask ***
+    writePtr_ = putVarint( writePtr_, rec.timestampUs - prev_.timestampUs );
+    writePtr_ = putVarint( writePtr_, rec.valid ^ prev_.valid );
+
+    //*** floats as zigzag deltas of their bit patterns ***
+    floatBits( rec, bits );
+    floatBits( prev_, prevBits );
+    for ( int i=0; i<SensorLogFloats; i++ )
+    {
+        qint32 delta = (qint32)( bits[i] - prevBits[i] );
+        writePtr_ = putVarint( writePtr_, ( (quint32)delta << 1 ) ^ (quint32)( delta >> 31 ) );
+    }
+
+    header_->count++;
+    header_->lastTimestampUs = rec.timestampUs;
+    header_->usedBytes = writePtr_ - block_ - sizeof(SensorLogBlockHeader);
+
+    prev_ = rec;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensorLogWriter::flushBlock - write the current block and start a
+ *              new one. Called with mutex_ held
+ */
+//******************************************************************************
+void SHSensorLogWriter::flushBlock()
+{
+    //*** always whole blocks, so the file stays mappable by block ***
+    file_.write( (const char *)block_, SensorLogBlockBytes );
+    file_.flush();
+
+    memset( block_, 0, sizeof(block_) );
+    writePtr_ = block_ + sizeof(SensorLogBlockHeader);
+}
+
+
+//******************************************************************************
+//******************************************************************************
+//
+// Log reader
+//
+//******************************************************************************
+//******************************************************************************
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensorLogReader::SHSensorLogReader
+ */
+//******************************************************************************
+SHSensorLogReader::SHSensorLogReader()
+{
+    map_ = 0;
+    mapSize_ = 0;
+    blockCount_ = 0;
+    recordCount_ = 0;
+    version_ = 0;
+    curBlock_ = 0;
+    curRecord_ = 0;
+    readPtr_ = 0;
+    memset( &prev_, 0, sizeof(prev_) );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensorLogReader::~SHSensorLogReader
+ */
+//******************************************************************************
+SHSensorLogReader::~SHSensorLogReader()
+{
+    close();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensorLogReader::open - map a log file
+ * @param fileName - log file
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSensorLogReader::open( QString fileName )
+{
+struct stat st;
+int fd = -1;
+void *map = 0;
+const SensorLogBlockHeader *first = 0;
+
+    close();
+    version_ = 0;
+
+    if ( ( fd = ::open( qPrintable(fileName), O_RDONLY | O_CLOEXEC ) ) < 0 )
+    {
+        return false;
+    }
+
+    //*** need at least one block ***
+    if ( fstat( fd, &st ) < 0 || st.st_size < SensorLogBlockBytes )
+    {
+        ::close( fd );
+        return false;
+    }
+
+    map = mmap( 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    ::close( fd );
+
+    if ( map == MAP_FAILED )
+    {
+        return false;
+    }
+
+    map_ = (const quint8 *)map;
+    mapSize_ = st.st_size;
+    blockCount_ = st.st_size / SensorLogBlockBytes;
+
+    //*** records of another format version would be misread ***
+    first = (const SensorLogBlockHeader *)map_;
+    if ( memcmp( first->magic, SensorLogMagic, sizeof(first->magic) ) != 0 )
+    {
+        close();
+        return false;
+    }
+
+    version_ = first->version;
+    if ( version_ != SensorLogVersion )
+    {
+        close();
+        return false;
+    }
+
+    //*** sequential reads ahead of the replay ***
+    madvise( map, mapSize_, MADV_SEQUENTIAL );
+
+    //*** total records from the block headers ***
+    recordCount_ = 0;
+    for ( int i=0; i<blockCount_; i++ )
+    {
+        const SensorLogBlockHeader *hdr = blockHeader( i );
+        if ( hdr ) recordCount_ += hdr->count;
+    }
+
+    rewind();
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensorLogReader::close - unmap the file
+ */
+//******************************************************************************
+void SHSensorLogReader::close()
+{
+    if ( map_ )
+    {
+        munmap( (void *)map_, mapSize_ );
+    }
+
+    map_ = 0;
+    mapSize_ = 0;
+    blockCount_ = 0;
+    recordCount_ = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensorLogReader::blockHeader - header of a block
+ * @param block - block index
+ * @return - header, or NULL if the block is not valid
+ */
+//******************************************************************************
+const SensorLogBlockHeader *SHSensorLogReader::blockHeader( int block )
+{
+const SensorLogBlockHeader *hdr = 0;
+
+    if ( !map_ || block < 0 || block >= blockCount_ ) return 0;
+
+    hdr = (const SensorLogBlockHeader *)( map_ + (qint64)block * SensorLogBlockBytes );
+
+    if ( memcmp( hdr->magic, SensorLogMagic, sizeof(hdr->magic) ) != 0 ||
+         hdr->version != SensorLogVersion ||
+         hdr->usedBytes > SensorLogBlockBytes - sizeof(SensorLogBlockHeader) )
+    {
+        return 0;
+    }
+
+    return hdr;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensorLogReader::firstTimestampUs - time of the first record
+ * @return - RTIMU timestamp, 0 if empty
+ */
+//******************************************************************************
+quint64 SHSensorLogReader::firstTimestampUs()
+{
+    for ( int i=0; i<blockCount_; i++ )
+    {
+        const SensorLogBlockHeader *hdr = blockHeader( i );
+        if ( hdr && hdr->count > 0 ) return hdr->firstTimestampUs;
+    }
+
+    return 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensorLogReader::lastTimestampUs - time of the last record
+ * @return - RTIMU timestamp, 0 if empty
+ */
+//******************************************************************************
+quint64 SHSensorLogReader::lastTimestampUs()
+{
+    for ( int i=blockCount_-1; i>=0; i-- )
+    {
+        const SensorLogBlockHeader *hdr = blockHeader( i );
+        if ( hdr && hdr->count > 0 ) return hdr->lastTimestampUs;
+    }
+
+    return 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensorLogReader::seekBlock - continue reading at a block
+ * @param block - block index
+ * @return - TRUE if the block exists, else FALSE
+ */
+//******************************************************************************
+bool SHSensorLogReader::seekBlock( int block )
+{
+const SensorLogBlockHeader *hdr = blockHeader( block );
+
+    curBlock_ = block;
+    curRecord_ = 0;
+    memset( &prev_, 0, sizeof(prev_) );
+
+    if ( !hdr )
+    {
+        readPtr_ = 0;
+        return block >= 0 && block < blockCount_;
+    }
+
+    readPtr_ = (const quint8 *)hdr + sizeof(SensorLogBlockHeader);
+    prev_.timestampUs = hdr->firstTimestampUs;
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensorLogReader::findBlock - block holding a time
+ * @param timestampUs - RTIMU timestamp
+ * @return - block index, or blockCount() if the time is after the log
+ */
+//******************************************************************************
+int SHSensorLogReader::findBlock( quint64 timestampUs )
+{
+int lo = 0;
+int hi = blockCount_;
+
+    //*** blocks are in time order - binary search on the last timestamp ***
+    while ( lo < hi )
+    {
+        int mid = ( lo + hi ) / 2;
+        const SensorLogBlockHeader *hdr = blockHeader( mid );
+
+        if ( hdr && hdr->count > 0 && hdr->lastTimestampUs < timestampUs )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensorLogReader::next - read the next record
+ * @param rec - receives the record
+ * @return - FALSE at end of file
+ */
+//******************************************************************************
+bool SHSensorLogReader::next( SensorLogRecord &rec )
+{
+quint32 bits[SensorLogFloats];
+quint32 prevBits[SensorLogFloats];
+quint64 value = 0;
+
+    while ( curBlock_ < blockCount_ )
+    {
+        const SensorLogBlockHeader *hdr = blockHeader( curBlock_ );
+
+        //*** block exhausted or damaged - move on ***
+        if ( !hdr || !readPtr_ || curRecord_ >= hdr->count )
+        {
+            seekBlock( curBlock_ + 1 );
+            continue;
+        }
+
+        const quint8 *p = readPtr_;
+        const quint8 *end = (const quint8 *)hdr + sizeof(SensorLogBlockHeader) + hdr->usedBytes;
+
+        rec = prev_;
+
+        //*** timestamp and valid mask ***
+        if ( !( p = getVarint( p, end, value ) ) ) { readPtr_ = 0; continue; }
+        rec.timestampUs = prev_.timestampUs + value;
+
+        if ( !( p = getVarint( p, end, value ) ) ) { readPtr_ = 0; continue; }
+        rec.valid = prev_.valid ^ (quint32)value;
+
+        //*** floats ***
+        floatBits( prev_, prevBits );
+        for ( int i=0; i<SensorLogFloats && p; i++ )
+        {
+            p = getVarint( p, end, value );
+            qint32 delta = (qint32)( ( (quint32)value >> 1 ) ^ -(qint32)( value & 1 ) );
+            bits[i] = prevBits[i] + (quint32)delta;
+        }
+        if ( !p ) { readPtr_ = 0; continue; }
+
+        setFloatBits( rec, bits );
+
+        readPtr_ = p;
+        curRecord_++;
+        prev_ = rec;
+
+        return true;
+    }
+
+    return false;
+}
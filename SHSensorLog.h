@@ -0,0 +1,193 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat sensor log
+//
+// Append-only binary log of the RTIMU_DATA stream. The file is a sequence of
+//      fixed size blocks so it can be memory mapped and read from any block.
+//      Each block starts from a zero record and stores every following
+//      record as variable length deltas against the one before it
+//
+//******************************************************************************
+//******************************************************************************
+#ifndef SHSENSORLOG_H
+#define SHSENSORLOG_H
+
+#include <QString>
+#include <QMutex>
+#include <QFile>
+
+#include "RTIMULib.h"
+
+//*** block layout ***
+const int SensorLogBlockBytes = 4096;
+const char SensorLogMagic[4] = { 'S', 'H', 'S', 'B' };
+const quint16 SensorLogVersion = 1;
+
+//*** valid bits beyond the ImuSensors channels ***
+const quint32 LogFusionQPoseValid = 0x100;
+
+//*** number of float fields in a record ***
+const int SensorLogFloats = 19;
+
+//*** one decoded log record - RTIMU units ***
+struct SensorLogRecord
+{
+    quint64 timestampUs;        // RTIMU timestamp
+    quint32 valid;              // 'OR' of ImuSensors bits and LogFusionQPoseValid
+    float fusionPose[3];        // radians
+    float fusionQPose[4];       // scalar, x, y, z
+    float gyro[3];              // radians per second
+    float accel[3];             // g
+    float compass[3];           // uT
+    float pressure;             // hPa
+    float temperature;          // celsius
+    float humidity;             // % relative humidity
+};
+
+//*** header at the start of every block ***
+struct SensorLogBlockHeader
+{
+    char magic[4];              // SensorLogMagic
+    quint16 version;            // SensorLogVersion
+    quint16 count;              // records in the block
+    quint32 usedBytes;          // encoded payload bytes after the header
+    quint32 reserved;
+    quint64 firstTimestampUs;   // timestamp of the first record
+    quint64 lastTimestampUs;    // timestamp of the last record
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief logRecordFromImuData - fill a log record from RTIMU data
+ * @param data - RTIMU data
+ * @param rec  - record to fill
+ */
+//******************************************************************************
+void logRecordFromImuData( const RTIMU_DATA &data, SensorLogRecord &rec );
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief imuDataFromLogRecord - fill RTIMU data from a log record
+ * @param rec  - log record
+ * @param data - RTIMU data to fill
+ */
+//******************************************************************************
+void imuDataFromLogRecord( const SensorLogRecord &rec, RTIMU_DATA &data );
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHSensorLogWriter class - appends records to a log file.
+ *              append() may be called from a different thread than open/close
+ */
+//******************************************************************************
+class SHSensorLogWriter
+{
+public:
+
+    SHSensorLogWriter();
+    ~SHSensorLogWriter();
+
+    //*** open for append, creating the file if needed ***
+    bool open( QString fileName );
+
+    //*** write the partial block and close ***
+    void close();
+
+    bool isOpen() { return file_.isOpen(); }
+
+    //*** add a record, writing the block when it fills ***
+    void append( const SensorLogRecord &rec );
+
+private:
+
+    //*** write the current block and start a new one ***
+    void flushBlock();
+
+    //*** log file ***
+    QFile file_;
+
+    //*** block being filled ***
+    quint8 block_[SensorLogBlockBytes];
+    SensorLogBlockHeader *header_;
+    quint8 *writePtr_;
+
+    //*** previous record in the block ***
+    SensorLogRecord prev_;
+
+    //*** guards file and block ***
+    QMutex mutex_;
+
+    Q_DISABLE_COPY( SHSensorLogWriter )
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHSensorLogReader class - reads a memory mapped log file
+ */
+//******************************************************************************
+class SHSensorLogReader
+{
+public:
+
+    SHSensorLogReader();
+    ~SHSensorLogReader();
+
+    //*** map a log file - FALSE if missing, short or of another version ***
+    bool open( QString fileName );
+    void close();
+
+    //*** format version of the last file opened, 0 if it is not a log ***
+    quint16 version() { return version_; }
+
+    bool isOpen() { return map_ != 0; }
+
+    //*** number of blocks and records in the file ***
+    int blockCount() { return blockCount_; }
+    quint64 recordCount() { return recordCount_; }
+
+    //*** time span of the file (RTIMU usecs) ***
+    quint64 firstTimestampUs();
+    quint64 lastTimestampUs();
+
+    //*** read the next record - FALSE at end of file ***
+    bool next( SensorLogRecord &rec );
+
+    //*** continue reading at the start of a block ***
+    bool seekBlock( int block );
+
+    //*** block containing the given time, or the first one after it ***
+    int findBlock( quint64 timestampUs );
+
+    //*** back to the start of the file ***
+    void rewind() { seekBlock( 0 ); }
+
+private:
+
+    //*** header of a block ***
+    const SensorLogBlockHeader *blockHeader( int block );
+
+    //*** mapped file ***
+    const quint8 *map_;
+    qint64 mapSize_;
+    int blockCount_;
+    quint64 recordCount_;
+    quint16 version_;
+
+    //*** read position ***
+    int curBlock_;
+    int curRecord_;
+    const quint8 *readPtr_;
+    SensorLogRecord prev_;
+
+    Q_DISABLE_COPY( SHSensorLogReader )
+};
+
+#endif // SHSENSORLOG_H
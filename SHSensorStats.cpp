@@ -0,0 +1,392 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat sensor statistics
+//
+// Incremental window statistics and anti-aliased decimation, updated once per
+//      sample on the acquisition side. All storage is allocated when a window
+//      is configured, so updates never allocate
+//
+//******************************************************************************
+//******************************************************************************
+#include "SHSensorStats.h"
+
+#include <math.h>
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHRollingStats::SHRollingStats
+ */
+//******************************************************************************
+SHRollingStats::SHRollingStats()
+{
+    capacity_ = 0;
+    windowNs_ = 0;
+    values_ = 0;
+    times_ = 0;
+    minQueue_ = 0;
+    maxQueue_ = 0;
+    reset();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHRollingStats::~SHRollingStats
+ */
+//******************************************************************************
+SHRollingStats::~SHRollingStats()
+{
+    delete [] values_;
+    delete [] times_;
+    delete [] minQueue_;
+    delete [] maxQueue_;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHRollingStats::configure - set the window and allocate its storage
+ * @param samples  - window length in samples or, for a time window, the most
+ *                   samples the window can hold
+ * @param windowNs - window length in nanoseconds, or 0 for a count window
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHRollingStats::configure( int samples, qint64 windowNs )
+{
+    if ( samples < 1 || windowNs < 0 ) return false;
+
+    delete [] values_;
+    delete [] times_;
+    delete [] minQueue_;
+    delete [] maxQueue_;
+
+    capacity_ = samples;
+    windowNs_ = windowNs;
+    values_ = new float[ capacity_ ];
+    times_ = new qint64[ capacity_ ];
+    minQueue_ = new quint64[ capacity_ ];
+    maxQueue_ = new quint64[ capacity_ ];
+
+    reset();
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHRollingStats::reset - empty the window
+ */
+//******************************************************************************
+void SHRollingStats::reset()
+{
+    first_ = 0;
+    next_ = 0;
+    offset_ = 0.0;
+    sum_ = 0.0;
+    sumSq_ = 0.0;
+    minFront_ = minBack_ = 0;
+    maxFront_ = maxBack_ = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHRollingStats::add - add a sample, dropping those that leave the
+ *              window
+ * @param timestampNs - time of the sample
+ * @param value       - sample value
+ */
+//******************************************************************************
+void SHRollingStats::add( qint64 timestampNs, float value )
+{
+int idx;
+double d;
+
+    if ( capacity_ == 0 ) return;
+
+    //*** samples older than a time window ***
+    if ( windowNs_ > 0 )
+    {
+        while ( next_ > first_ && times_[ first_ % capacity_ ] <= timestampNs - windowNs_ )
+        {
+            evict();
+        }
+    }
+
+    //*** make room - a count window, or a time window at its limit ***
+    if ( next_ - first_ == (quint64)capacity_ )
+    {
+        evict();
+    }
+
+    //*** an empty window restarts the sums, shedding rounding drift ***
+    if ( next_ == first_ )
+    {
+        offset_ = value;
+        sum_ = 0.0;
+        sumSq_ = 0.0;
+    }
+
+    idx = next_ % capacity_;
+    values_[idx] = value;
+    times_[idx] = timestampNs;
+
+    d = value - offset_;
+    sum_ += d;
+    sumSq_ += d * d;
+
+    //*** drop queued samples the new one supersedes ***
+    while ( minBack_ > minFront_ && values_[ minQueue_[ ( minBack_ - 1 ) % capacity_ ] % capacity_ ] >= value )
+    {
+        minBack_--;
+    }
+    minQueue_[ minBack_++ % capacity_ ] = next_;
+
+    while ( maxBack_ > maxFront_ && values_[ maxQueue_[ ( maxBack_ - 1 ) % capacity_ ] % capacity_ ] <= value )
+    {
+        maxBack_--;
+    }
+    maxQueue_[ maxBack_++ % capacity_ ] = next_;
+
+    next_++;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHRollingStats::evict - drop the oldest sample from the window
+ */
+//******************************************************************************
+void SHRollingStats::evict()
+{
+double d = values_[ first_ % capacity_ ] - offset_;
+
+    sum_ -= d;
+    sumSq_ -= d * d;
+
+    if ( minBack_ > minFront_ && minQueue_[ minFront_ % capacity_ ] == first_ ) minFront_++;
+    if ( maxBack_ > maxFront_ && maxQueue_[ maxFront_ % capacity_ ] == first_ ) maxFront_++;
+
+    first_++;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHRollingStats::mean - mean of the window
+ * @return - mean, or 0 if empty
+ */
+//******************************************************************************
+float SHRollingStats::mean()
+{
+int n = count();
+
+    if ( n == 0 ) return 0.0;
+
+    return offset_ + sum_ / n;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHRollingStats::variance - population variance of the window
+ * @return - variance, or 0 if empty
+ */
+//******************************************************************************
+float SHRollingStats::variance()
+{
+int n = count();
+double var;
+
+    if ( n == 0 ) return 0.0;
+
+    var = ( sumSq_ - sum_ * sum_ / n ) / n;
+
+    return ( var > 0.0 ) ? var : 0.0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHRollingStats::min - smallest value in the window
+ * @return - minimum, or 0 if empty
+ */
+//******************************************************************************
+float SHRollingStats::min()
+{
+    if ( minBack_ == minFront_ ) return 0.0;
+
+    return values_[ minQueue_[ minFront_ % capacity_ ] % capacity_ ];
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHRollingStats::max - largest value in the window
+ * @return - maximum, or 0 if empty
+ */
+//******************************************************************************
+float SHRollingStats::max()
+{
+    if ( maxBack_ == maxFront_ ) return 0.0;
+
+    return values_[ maxQueue_[ maxFront_ % capacity_ ] % capacity_ ];
+}
+
+
+//******************************************************************************
+//******************************************************************************
+//
+// CIC decimator
+//
+//******************************************************************************
+//******************************************************************************
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHCicDecimator::SHCicDecimator
+ */
+//******************************************************************************
+SHCicDecimator::SHCicDecimator()
+{
+    factor_ = 1;
+    order_ = 1;
+    quantum_ = 1.0;
+    scale_ = 1.0;
+    reset();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHCicDecimator::configure - set the decimation factor and order
+ * @param factor  - input samples per output sample
+ * @param order   - 1 to CicMaxOrder
+ * @param quantum - fixed point resolution of the input
+ * @return - TRUE if successful, FALSE if the gain is too large
+ */
+//******************************************************************************
+bool SHCicDecimator::configure( int factor, int order, double quantum )
+{
+    if ( factor < 1 || order < 1 || order > CicMaxOrder || quantum <= 0.0 ) return false;
+
+    //*** filter gain factor^order must leave room for the input in 64 bits ***
+    if ( order * log2( (double)factor ) > CicMaxGainBits ) return false;
+
+    factor_ = factor;
+    order_ = order;
+    quantum_ = quantum;
+    scale_ = quantum / pow( (double)factor, order );
+
+    //*** a constant must come out unchanged ***
+    if ( (qint64)factor * order <= CicCheckMaxSamples && !checkConstant() ) return false;
+
+    reset();
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHCicDecimator::checkConstant - run a constant through the filter
+ *              until the first full output and compare. Checks the gain and
+ *              scale together; leaves the state to be reset
+ * @return - TRUE if the constant came out unchanged
+ */
+//******************************************************************************
+bool SHCicDecimator::checkConstant()
+{
+float value = (float)( CicCheckQuanta * quantum_ );
+bool ready = false;
+
+    reset();
+
+    for ( int i=0; i<factor_ * order_; i++ )
+    {
+        ready = add( value );
+    }
+
+    return ready && fabs( output_ - value ) <= qMax( quantum_ / 2, fabs( value ) * 1e-6 );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHCicDecimator::reset - clear the filter state
+ */
+//******************************************************************************
+void SHCicDecimator::reset()
+{
+    for ( int i=0; i<CicMaxOrder; i++ )
+    {
+        integ_[i] = 0;
+        comb_[i] = 0;
+    }
+
+    phase_ = 0;
+    filled_ = 0;
+    output_ = 0.0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHCicDecimator::add - add a sample
+ * @param value - input sample
+ * @return - TRUE when a new output sample is ready
+ */
+//******************************************************************************
+bool SHCicDecimator::add( float value )
+{
+quint64 x;
+
+    //*** integrators at the input rate ***
+    x = (quint64)(qint64)llround( value / quantum_ );
+    for ( int i=0; i<order_; i++ )
+    {
+        integ_[i] += x;
+        x = integ_[i];
+    }
+
+    if ( ++phase_ < factor_ ) return false;
+    phase_ = 0;
+
+    //*** combs at the output rate ***
+    for ( int i=0; i<order_; i++ )
+    {
+        quint64 y = x - comb_[i];
+        comb_[i] = x;
+        x = y;
+    }
+
+    //*** impulse response spans order outputs - the first ones are partial ***
+    if ( filled_ < order_ - 1 )
+    {
+        filled_++;
+        return false;
+    }
+
+    output_ = (qint64)x * scale_;
+
+    return true;
+}
@@ -0,0 +1,158 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat sensor statistics
+//
+// Incremental window statistics and anti-aliased decimation, updated once per
+//      sample on the acquisition side. All storage is allocated when a window
+//      is configured, so updates never allocate
+//
+//******************************************************************************
+//******************************************************************************
+#ifndef SHSENSORSTATS_H
+#define SHSENSORSTATS_H
+
+#include <QtGlobal>
+
+//*** largest CIC decimator: order * log2(factor) bits of gain ***
+const int CicMaxOrder = 4;
+const int CicMaxGainBits = 32;
+
+//*** configure() checks that a constant passes unchanged, when that takes no more samples than this ***
+const int CicCheckQuanta = 1000;
+const int CicCheckMaxSamples = 65536;
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHRollingStats class - mean, variance, minimum and maximum over
+ *              the last N samples or the last T nanoseconds. Every update is
+ *              O(1) amortized: running sums for mean and variance, monotonic
+ *              queues for minimum and maximum
+ */
+//******************************************************************************
+class SHRollingStats
+{
+public:
+
+    SHRollingStats();
+    ~SHRollingStats();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief configure - set the window and allocate its storage
+     * @param samples  - window length in samples or, for a time window, the
+     *                   most samples the window can hold
+     * @param windowNs - window length in nanoseconds, or 0 for a count window
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool configure( int samples, qint64 windowNs );
+
+    //*** empty the window ***
+    void reset();
+
+    //*** add a sample, dropping those that leave the window ***
+    void add( qint64 timestampNs, float value );
+
+    //*** window contents ***
+    int count() { return (int)( next_ - first_ ); }
+    float mean();
+    float variance();
+    float min();
+    float max();
+
+private:
+
+    //*** drop the oldest sample ***
+    void evict();
+
+    //*** window ***
+    int capacity_;
+    qint64 windowNs_;
+
+    //*** samples, indexed by sequence number modulo capacity ***
+    float *values_;
+    qint64 *times_;
+    quint64 first_;             // sequence of the oldest sample in the window
+    quint64 next_;              // sequence of the next sample
+
+    //*** running sums, relative to offset_ to limit cancellation ***
+    double offset_;
+    double sum_;
+    double sumSq_;
+
+    //*** monotonic queues of sequence numbers ***
+    quint64 *minQueue_;
+    quint64 minFront_;
+    quint64 minBack_;
+    quint64 *maxQueue_;
+    quint64 maxFront_;
+    quint64 maxBack_;
+
+    Q_DISABLE_COPY( SHRollingStats )
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHCicDecimator class - cascaded integrator-comb decimator.
+ *              Order 1 is a plain moving average over the decimation factor,
+ *              each further order adds another stage of alias rejection.
+ *              Samples are quantized to fixed point so the integrators can
+ *              wrap without losing precision
+ */
+//******************************************************************************
+class SHCicDecimator
+{
+public:
+
+    SHCicDecimator();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief configure - set the decimation factor and filter order
+     * @param factor  - input samples per output sample
+     * @param order   - 1 to CicMaxOrder
+     * @param quantum - fixed point resolution of the input
+     * @return - TRUE if successful, FALSE if the gain is too large or a
+     *              constant input does not come out unchanged
+     */
+    //******************************************************************************
+    bool configure( int factor, int order, double quantum );
+
+    //*** clear the filter state ***
+    void reset();
+
+    //*** add a sample - TRUE when an output sample is ready ***
+    bool add( float value );
+
+    //*** most recent output sample ***
+    float output() { return output_; }
+
+private:
+
+    //*** TRUE if a constant input comes out unchanged ***
+    bool checkConstant();
+
+    int factor_;
+    int order_;
+    double quantum_;
+    double scale_;              // quantum / factor^order
+
+    //*** integrator and comb state, wrapping arithmetic ***
+    quint64 integ_[CicMaxOrder];
+    quint64 comb_[CicMaxOrder];
+    int phase_;
+
+    //*** samples through the filter since reset - the first outputs are partial ***
+    int filled_;
+
+    float output_;
+};
+
+#endif // SHSENSORSTATS_H
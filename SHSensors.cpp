@@ -10,7 +10,153 @@
 //******************************************************************************
 //******************************************************************************
 #include "SHSensors.h"
+#include "SHReplay.h"
+#include "SHSharedRing.h"
 #include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+//*** nanoseconds per second ***
+const qint64 NSecPerSec = 1000000000LL;
+
+//*** default output rates of the Sense HAT environmental sensors ***
+const double DefaultPressureHz = 25.0;      // LPS25H
+const double DefaultHumidityHz = 12.5;      // HTS221
+
+//*** adaptive rate - idle below this share of the thresholds, gravity time constant ***
+const float AdaptExitShare = 0.5f;
+const float AdaptGravityTimeSec = 1.0f;
+
+//*** samples between checks of the shared memory ring readers ***
+const quint32 RingCheckInterval = 256;
+
+//*** state cache file ***
+const char StateCacheMagic[4] = { 'S', 'H', 'I', 'C' };
+const quint16 StateCacheVersion = 3;
+
+//*** how often the acquisition path snapshots the state for the cache ***
+const qint64 StateSnapshotNs = 1000000000LL;
+
+struct ImuStateCache
+{
+    char magic[4];              // StateCacheMagic
+    quint16 version;            // StateCacheVersion
+    quint16 reserved;
+    quint32 settingsHash;       // IMU settings the state was learned with
+    qint32 fusionAlgorithm;     // engine the fusion state belongs to
+    qint64 savedAtSec;          // wall clock time of the save
+    float temperature;          // celsius
+    quint8 temperatureValid;
+    quint8 fusionValid;
+    quint8 gyroBiasValid;
+    quint8 pad;
+    float gyroBias[3];          // RTIMU's gyro bias (rad/s), from its settings
+    FusionState fusion;         // library fusion state
+};
+
+//*** fixed point resolution of the aggregation decimators ***
+const double AggregateQuantum = 1e-5;
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief channelIndex - bit position of an ImuSensors channel
+ * @param channel - single ImuSensors bit
+ * @return - index 0..ImuChannelCount-1
+ */
+//******************************************************************************
+static int channelIndex( quint8 channel )
+{
+int idx = 0;
+
+    while ( channel > 1 )
+    {
+        channel >>= 1;
+        idx++;
+    }
+
+    return idx;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief channelValues - a channel's values in a sample
+ * @param sample - sample
+ * @param chIdx  - channel index
+ * @return - first component
+ */
+//******************************************************************************
+static const float *channelValues( const SensorSample &sample, int chIdx )
+{
+    switch ( 1 << chIdx )
+    {
+        case IMU_PRESSURE: return &sample.pressure;
+        case IMU_TEMP:     return &sample.temperature;
+        case IMU_HUMIDITY: return &sample.humidity;
+        case IMU_GYRO:     return sample.gyro;
+        case IMU_ACCEL:    return sample.accel;
+        case IMU_COMPASS:  return sample.compass;
+        default:           return sample.fusionPose;
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief settingsHash - fingerprint of the settings a gyro bias depends on
+ * @param imu      - IMU object
+ * @param settings - RTIMU settings
+ * @return - FNV-1a hash
+ */
+//******************************************************************************
+static quint32 settingsHash( RTIMU *imu, RTIMUSettings *settings )
+{
+const int values[] =
+{
+    imu->IMUType(),
+    settings->m_axisRotation,
+    settings->m_LSM9DS1GyroSampleRate,
+    settings->m_LSM9DS1GyroBW,
+    settings->m_LSM9DS1GyroHpf,
+    settings->m_LSM9DS1GyroFsr
+};
+const quint8 *bytes = (const quint8 *)values;
+quint32 hash = 2166136261u;
+
+    for ( unsigned i=0; i<sizeof(values); i++ )
+    {
+        hash = ( hash ^ bytes[i] ) * 16777619u;
+    }
+
+    return hash;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief monotonicNs - current CLOCK_MONOTONIC time
+ * @return - time in nanoseconds
+ */
+//******************************************************************************
+static qint64 monotonicNs()
+{
+struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (qint64)ts.tv_sec * NSecPerSec + ts.tv_nsec;
+}
 
 
 //******************************************************************************
@@ -25,6 +171,11 @@ SHSensors::SHSensors(QObject *parent) :
 {
     //*** initialize vars ***
     enabled_ = 0;
+    active_ = IMU_FUSION;
+    demandDriven_ = false;
+    idleTimeoutNs_ = 5 * NSecPerSec;
+    imuIdle_ = false;
+    lastMotionDemandNs_ = 0;
     ready_ = false;
     validIMU_ = false;
     started_ = false;
@@ -32,10 +183,88 @@ SHSensors::SHSensors(QObject *parent) :
     pressure_ = 0;
     humidity_ = 0;
     imuTimer_ = 0;
-    updateIntervalMSec_ = 200;
+    sensorThread_ = 0;
+    burstThread_ = 0;
+    replaySource_ = 0;
+    simSource_ = 0;
+    updateIntervalNSec_ = 200 * 1000000LL;
+    savedIntervalNSec_ = 0;
+    rateStartNs_ = 0;
+    lastImuTimestamp_ = 0;
+    sampleClockUs_ = 0;
+    samplePeriodUs_.store( 0 );
+    batch_.count = 0;
+    batchSize_ = 1;
+    batchStartNs_ = 0;
+    batchMaxAgeNs_ = SensorBatchMaxAgeMs * 1000000LL;
+    batchHandler_ = 0;
+    processor_ = 0;
+    channelSignals_ = true;
+    memset( &pending_, 0, sizeof(pending_) );
+    memset( &latest_, 0, sizeof(latest_) );
+    memset( &logPending_, 0, sizeof(logPending_) );
+    memset( channelIntervalNs_, 0, sizeof(channelIntervalNs_) );
+    memset( channelNextDueNs_, 0, sizeof(channelNextDueNs_) );
+    memset( busStats_, 0, sizeof(busStats_) );
+    timerDueNs_ = 0;
+    timerPeriodNs_ = 0;
+    adaptive_ = false;
+    adaptActive_ = true;
+    idlePeriodNs_ = 0;
+    activePeriodNs_ = 0;
+    adaptAccelThreshold_ = 0.0;
+    adaptGyroThreshold_ = 0.0;
+    adaptHoldNs_ = 0;
+    adaptLastActivityNs_ = 0;
+    adaptLastSampleNs_ = 0;
+    adaptGravity_ = 0.0;
+    adaptSinceNs_ = 0;
+    memset( adaptTimeNs_, 0, sizeof(adaptTimeNs_) );
+    adaptSwitches_ = 0;
+    ring_ = new SHSharedRingWriter();
+    ringWrites_ = 0;
+    memset( reportPolicy_, 0, sizeof(reportPolicy_) );
+    memset( lastReported_, 0, sizeof(lastReported_) );
+    memset( lastReportNs_, 0, sizeof(lastReportNs_) );
+    onChangeChannels_ = 0;
+    reportedChannels_ = 0;
+    memset( aggregators_, 0, sizeof(aggregators_) );
+    aggChannels_ = 0;
+    fusion_ = 0;
+    fusionAlg_ = FUSION_RTIMU;
+    madgwickBeta_ = MadgwickDefaultBeta;
+    mahonyKp_ = MahonyDefaultKp;
+    mahonyKi_ = MahonyDefaultKi;
+    maxTempDeltaC_ = 5.0;
+    stateTimer_ = 0;
+    stateRestored_ = false;
+    stateSnapshots_ = false;
+    nextSnapshotNs_ = 0;
+    spectrum_ = 0;
+    motion_ = 0;
+    motionChannels_ = 0;
+    align_ = 0;
+    alignChannels_ = 0;
+    seriesChannels_ = 0;
+    spectrumAxis_ = SPECTRUM_MAGNITUDE;
+    spectrumEdgeCount_ = 0;
+
+    //*** slow sensors at their own output rates ***
+    slowRateSet_ = false;
+    scheduleChannels( IMU_PRESSURE | IMU_TEMP, DefaultPressureHz );
+    scheduleChannels( IMU_HUMIDITY, DefaultHumidityHz );
+
+    //*** register the signal parameter metatype ***
+    qRegisterMetaType<SensorBatch>("SensorBatch");
+    qRegisterMetaType<SensorAggregate>("SensorAggregate");
+    qRegisterMetaType<SpectrumResult>("SpectrumResult");
+    qRegisterMetaType<MotionEvent>("MotionEvent");
+    qRegisterMetaType<AlignedFrame>("AlignedFrame");
+    qRegisterMetaType<BurstStats>("BurstStats");
 
     //*** get the settings ***
     settings_ = new RTIMUSettings();
+    imuFusionType_ = settings_->m_fusionType;
 
     //*** create an IMU object ***
     imu_ = RTIMU::createIMU( settings_ );
@@ -72,6 +301,19 @@ SHSensors::SHSensors(QObject *parent) :
 //******************************************************************************
 SHSensors::~SHSensors()
 {
+    if ( burstThread_ )
+    {
+        burstThread_->wait();
+        delete burstThread_;
+    }
+
+    if ( sensorThread_ )
+    {
+        sensorThread_->requestInterruption();
+        sensorThread_->wait();
+        delete sensorThread_;
+    }
+
     if ( imuTimer_ )
     {
         if ( imuTimer_->isActive() )
@@ -82,10 +324,299 @@ SHSensors::~SHSensors()
         delete imuTimer_;
     }
 
+    //*** keep what the IMU has learned ***
+    if ( !stateFile_.isEmpty() )
+    {
+        saveState();
+    }
+
+    //*** finish any recording ***
+    logWriter_.close();
+    seriesWriter_.close();
+
+    //*** readers see the ring closed ***
+    delete ring_;
+
+    delete pressure_;
+    delete humidity_;
+    delete imu_;
+    delete replaySource_;
+    delete simSource_;
     delete settings_;
+
+    for ( int i=0; i<ImuChannelCount; i++ )
+    {
+        delete aggregators_[i];
+    }
+
+    delete spectrum_;
+    delete motion_;
+    delete align_;
+    delete fusion_;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief startRecording - record the sensor stream to a log file
+ * @param fileName - log file, appended to if it exists
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSensors::startRecording( QString fileName )
+{
+    if ( !logWriter_.open( fileName ) )
+    {
+        emit error( QString("Sensors: Could not open sensor log %1").arg(fileName) );
+        return false;
+    }
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief stopRecording - finish the log file
+ */
+//******************************************************************************
+void SHSensors::stopRecording()
+{
+    logWriter_.close();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief startTimeSeries - store channels in an on-disk time-series store
+ * @param directory - store directory, created if needed
+ * @param channels  - 'OR' of ImuSensors channels
+ * @param options   - segment size and retention
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSensors::startTimeSeries( QString directory, quint8 channels, const TimeSeriesOptions &options )
+{
+    if ( channels == 0 )
+    {
+        emit error( QString("Sensors: No channels to store") );
+        return false;
+    }
+
+    seriesChannels_ = 0;
+
+    if ( !seriesWriter_.open( directory, options ) )
+    {
+        emit error( QString("Sensors: Could not open time-series store %1").arg(directory) );
+        return false;
+    }
+
+    seriesChannels_ = channels;
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief stopTimeSeries - write what is buffered and close the store
+ */
+//******************************************************************************
+void SHSensors::stopTimeSeries()
+{
+    seriesChannels_ = 0;
+    seriesWriter_.close();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief timeSeriesStats - store statistics
+ * @return - statistics since startTimeSeries()
+ */
+//******************************************************************************
+TimeSeriesStats SHSensors::timeSeriesStats()
+{
+    return seriesWriter_.stats();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief timeSeriesId - series number of a channel component
+ * @param channel   - ImuSensors channel
+ * @param component - 0 for scalar channels, 0 to 2 for vectors
+ * @return - series number
+ */
+//******************************************************************************
+int SHSensors::timeSeriesId( ImuSensors channel, int component )
+{
+    return channelIndex( channel ) * 3 + qBound( 0, component, 2 );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief startPublishing - publish every delivered sample into a shared
+ *              memory ring
+ * @param name     - shared memory name, starting with '/'
+ * @param ringSize - ring size in samples
+ * @param mode     - permissions of the shared memory object
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSensors::startPublishing( QString name, int ringSize, int mode )
+{
+    if ( !ring_->open( name, ringSize, mode ) )
+    {
+        emit error( QString("Sensors: Could not create shared memory ring %1").arg(name) );
+        return false;
+    }
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief stopPublishing - close and remove the shared memory ring
+ */
+//******************************************************************************
+void SHSensors::stopPublishing()
+{
+    ring_->close();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief sharedReaders - readers registered with the shared memory ring
+ * @param status - receives up to max entries
+ * @param max    - size of status
+ * @return - number of readers
+ */
+//******************************************************************************
+int SHSensors::sharedReaders( SharedReaderStatus *status, int max )
+{
+    return ring_->checkReaders( status, max );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief openReplay - replace the sensors with a replay of a sensor log
+ * @param fileName - log file written by startRecording()
+ * @param realTime - TRUE for original timing, FALSE for as fast as possible
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSensors::openReplay( QString fileName, bool realTime )
+{
+SHReplaySource *source = new SHReplaySource();
+
+    if ( !source->open( fileName, realTime ) )
+    {
+        if ( source->logVersion() != 0 && source->logVersion() != SensorLogVersion )
+        {
+            emit error( QString("Sensors: Unsupported sensor log version %1 in %2")
+                        .arg(source->logVersion()).arg(fileName) );
+        }
+        else
+        {
+            emit error( QString("Sensors: Could not open sensor log %1").arg(fileName) );
+        }
+
+        delete source;
+        return false;
+    }
+
+    //*** nothing may read the old sensors while they are replaced ***
+    stopUpdates();
+
+    delete pressure_;
+    delete humidity_;
+    delete imu_;
+    delete replaySource_;
+    delete simSource_;
+    simSource_ = 0;
+
+    //*** replay objects take the place of the hardware ***
+    replaySource_ = source;
+    imu_ = new SHReplayIMU( settings_, source );
+    pressure_ = new SHReplayPressure( settings_, source );
+    humidity_ = new SHReplayHumidity( settings_, source );
+    validIMU_ = true;
+
+    imu_->IMUInit();
+
+    //*** no IMU was found at construction - create the timer now ***
+    if ( !imuTimer_ )
+    {
+        imuTimer_ = new QTimer( this );
+        connect( imuTimer_, SIGNAL(timeout()), SLOT(handleUpdate()) );
+    }
+
+    qDebug() << "Replaying sensor log" << fileName;
+
+    return true;
 }
 
 
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief openSimulator - replace the sensors with simulated ones
+ * @param options - motion, noise, rates and speed
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSensors::openSimulator( const SimSensorOptions &options )
+{
+SHSimSource *source = new SHSimSource( options );
+
+    //*** nothing may read the old sensors while they are replaced ***
+    stopUpdates();
+
+    delete pressure_;
+    delete humidity_;
+    delete imu_;
+    delete replaySource_;
+    delete simSource_;
+    replaySource_ = 0;
+
+    //*** simulated objects take the place of the hardware ***
+    simSource_ = source;
+    imu_ = new SHSimIMU( settings_, source );
+    pressure_ = new SHSimPressure( settings_, source );
+    humidity_ = new SHSimHumidity( settings_, source );
+    validIMU_ = true;
+
+    imu_->IMUInit();
+
+    //*** no IMU was found at construction - create the timer now ***
+    if ( !imuTimer_ )
+    {
+        imuTimer_ = new QTimer( this );
+        connect( imuTimer_, SIGNAL(timeout()), SLOT(handleUpdate()) );
+    }
+
+    qDebug() << "Simulating sensors at" << source->options().sampleRateHz << "Hz, speed"
+             << source->options().speed;
+
+    return true;
+}
+
 //******************************************************************************
 //******************************************************************************
 /**
@@ -106,7 +637,7 @@ bool SHSensors::enableSensors( quint8 sensorsEnabled )
     enabled_ = sensorsEnabled;
 
     //*** pressure ***
-    if ( enabled_ & IMU_PRESSURE || enabled_ & IMU_TEMP )
+    if ( ( enabled_ & IMU_PRESSURE || enabled_ & IMU_TEMP ) && !pressure_ )
     {
         pressure_ = RTPressure::createPressure( settings_ );
         if ( pressure_ != NULL )
@@ -116,7 +647,7 @@ bool SHSensors::enableSensors( quint8 sensorsEnabled )
     }
 
     //*** humidity ***
-    if ( enabled_ & IMU_HUMIDITY )
+    if ( ( enabled_ & IMU_HUMIDITY ) && !humidity_ )
     {
         humidity_ = RTHumidity::createHumidity( settings_ );
         if ( humidity_ != NULL )
@@ -143,6 +674,9 @@ bool SHSensors::enableSensors( quint8 sensorsEnabled )
         imu_->setCompassEnable( true );
     }
 
+    //*** all enabled channels start out active ***
+    active_ = enabled_ | IMU_FUSION;
+
     //*** set ready flag ***
     ready_ = true;
 
@@ -166,35 +700,1291 @@ void SHSensors::setUpdateRate( quint16 updatesPerSec )
         return;
     }
 
-    //*** save rate ***
-    updateIntervalMSec_ = 1000 / updatesPerSec;
-
-    //*** change if currently started ***
-    if ( imuTimer_->isActive() )
+    if ( updatesPerSec == 0 )
     {
-        imuTimer_->start( updateIntervalMSec_ );
+        emit error( "Sensors: Invalid update rate" );
+        return;
     }
+
+    //*** save rate ***
+    setUpdatePeriodNs( NSecPerSec / updatesPerSec );
 }
 
 
 //******************************************************************************
 //******************************************************************************
 /**
- * @brief startPeriodicUpdates - start sensors
- * @return - TRUE if started OK, else FALSE
+ * @brief setUpdatePeriodNs - set sensor data update period in nanoseconds
+ * @param periodNs - update period
  */
 //******************************************************************************
-bool SHSensors::startPeriodicUpdates()
+void SHSensors::setUpdatePeriodNs( qint64 periodNs )
 {
-    if ( !ready_ || started_ ) return false;
+    //*** must have valid IMU ***
+    if ( !validIMU_ )
+    {
+        emit error( "Sensors: No valid IMU found!!!" );
+        return;
+    }
 
-    //*** set started flag ***
-    started_ = true;
+    //*** save period - an explicit one outlasts high rate updates ***
+    updateIntervalNSec_ = qMax( periodNs, (qint64)1 );
+    savedIntervalNSec_ = 0;
 
-    //*** start the update timer ***
-    imuTimer_->start( updateIntervalMSec_ );
+    //*** change if currently started ***
+    if ( imuTimer_->isActive() )
+    {
+        imuTimer_->start( timerIntervalMSec() );
+    }
 
-    return true;
+    if ( sensorThread_ )
+    {
+        sensorThread_->setPeriodNs( currentPeriodNs() );
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief setAdaptiveRate - switch between an idle and an active update rate
+ *              on accelerometer and gyro activity
+ * @param idleHz         - update rate while still
+ * @param activeHz       - update rate while moving
+ * @param accelThreshold - dynamic acceleration in g
+ * @param gyroThreshold  - rotation rate in degrees/s
+ * @param holdMs         - quiet time before dropping to the idle rate
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSensors::setAdaptiveRate( double idleHz, double activeHz, float accelThreshold,
+                                 float gyroThreshold, int holdMs )
+{
+    if ( !validIMU_ )
+    {
+        emit error( "Sensors: No valid IMU found!!!" );
+        return false;
+    }
+
+    if ( idleHz <= 0.0 || activeHz < idleHz || accelThreshold <= 0.0 ||
+         gyroThreshold <= 0.0 || holdMs < 0 )
+    {
+        emit error( "Sensors: Invalid adaptive update rate" );
+        return false;
+    }
+
+    adaptMutex_.lock();
+    idlePeriodNs_ = (qint64)( NSecPerSec / idleHz );
+    activePeriodNs_ = (qint64)( NSecPerSec / activeHz );
+    adaptAccelThreshold_ = accelThreshold;
+    adaptGyroThreshold_ = gyroThreshold;
+    adaptHoldNs_ = (qint64)holdMs * 1000000;
+
+    //*** start active - it settles to idle after the hold time ***
+    adaptActive_ = true;
+    adaptLastActivityNs_ = monotonicNs();
+    adaptLastSampleNs_ = 0;
+    adaptSinceNs_ = adaptLastActivityNs_;
+    memset( adaptTimeNs_, 0, sizeof(adaptTimeNs_) );
+    adaptSwitches_ = 0;
+    adaptive_ = true;
+    adaptMutex_.unlock();
+
+    //*** apply now if running ***
+    setUpdatePeriodNs( updateIntervalNSec_ );
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief clearAdaptiveRate - return to the fixed update rate
+ */
+//******************************************************************************
+void SHSensors::clearAdaptiveRate()
+{
+    if ( !adaptive_ ) return;
+
+    adaptMutex_.lock();
+    adaptive_ = false;
+    adaptMutex_.unlock();
+
+    samplePeriodUs_.store( (qint64)( 1000000.0 / imuSampleRate() ) );
+    setUpdatePeriodNs( updateIntervalNSec_ );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief adaptiveRateStats - time spent at each rate
+ * @return - statistics
+ */
+//******************************************************************************
+AdaptiveRateStats SHSensors::adaptiveRateStats()
+{
+QMutexLocker aLock( &adaptMutex_ );
+AdaptiveRateStats stats;
+qint64 timeNs[2];
+
+    //*** include the rate in progress ***
+    timeNs[0] = adaptTimeNs_[0];
+    timeNs[1] = adaptTimeNs_[1];
+    if ( adaptive_ ) timeNs[ adaptActive_ ? 1 : 0 ] += monotonicNs() - adaptSinceNs_;
+
+    stats.enabled = adaptive_;
+    stats.active = adaptActive_;
+    stats.idleHz = idlePeriodNs_ ? (double)NSecPerSec / idlePeriodNs_ : 0.0;
+    stats.activeHz = activePeriodNs_ ? (double)NSecPerSec / activePeriodNs_ : 0.0;
+    stats.idleSec = timeNs[0] / (double)NSecPerSec;
+    stats.activeSec = timeNs[1] / (double)NSecPerSec;
+    stats.switches = adaptSwitches_;
+
+    return stats;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief currentPeriodNs - update period in effect
+ * @return - period in nanoseconds
+ */
+//******************************************************************************
+qint64 SHSensors::currentPeriodNs()
+{
+    if ( !adaptive_ ) return updateIntervalNSec_;
+
+    return adaptActive_ ? activePeriodNs_ : idlePeriodNs_;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::adaptSample - track activity and switch the update rate
+ * @param sample - sample with accelerometer and, if read, gyro data
+ */
+//******************************************************************************
+void SHSensors::adaptSample( const SensorSample &sample )
+{
+float accelMag = sqrtf( sample.accel[0] * sample.accel[0] +
+                        sample.accel[1] * sample.accel[1] +
+                        sample.accel[2] * sample.accel[2] );
+float gyroMag = 0.0;
+float dynamic, share, alpha;
+qint64 dtNs = sample.timestampNs - adaptLastSampleNs_;
+
+    if ( sample.valid & IMU_GYRO )
+    {
+        gyroMag = sqrtf( sample.gyro[0] * sample.gyro[0] +
+                         sample.gyro[1] * sample.gyro[1] +
+                         sample.gyro[2] * sample.gyro[2] );
+    }
+
+    //*** slow estimate of the gravity magnitude ***
+    if ( adaptLastSampleNs_ == 0 || dtNs <= 0 )
+    {
+        adaptGravity_ = accelMag;
+    }
+    else
+    {
+        alpha = dtNs / ( AdaptGravityTimeSec * NSecPerSec + dtNs );
+        adaptGravity_ += alpha * ( accelMag - adaptGravity_ );
+    }
+    adaptLastSampleNs_ = sample.timestampNs;
+
+    dynamic = fabsf( accelMag - adaptGravity_ );
+
+    //*** active stays active above the lower threshold ***
+    share = adaptActive_ ? AdaptExitShare : 1.0f;
+    if ( dynamic > adaptAccelThreshold_ * share || gyroMag > adaptGyroThreshold_ * share )
+    {
+        adaptLastActivityNs_ = sample.timestampNs;
+        if ( !adaptActive_ ) switchRate( true, sample.timestampNs );
+    }
+    else if ( adaptActive_ && sample.timestampNs - adaptLastActivityNs_ >= adaptHoldNs_ )
+    {
+        switchRate( false, sample.timestampNs );
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::switchRate - change between the idle and active rate.
+ *              Called on the acquisition side; the new period applies from
+ *              the next update
+ * @param active - TRUE for the active rate
+ * @param nowNs  - time of the switch
+ */
+//******************************************************************************
+void SHSensors::switchRate( bool active, qint64 nowNs )
+{
+qint64 periodNs;
+
+    adaptMutex_.lock();
+    adaptTimeNs_[ adaptActive_ ? 1 : 0 ] += nowNs - adaptSinceNs_;
+    adaptSinceNs_ = nowNs;
+    adaptActive_ = active;
+    adaptSwitches_++;
+    periodNs = currentPeriodNs();
+    adaptMutex_.unlock();
+
+    //*** skipped IMU samples while idle are not drops ***
+    samplePeriodUs_.store( qMax( (qint64)( 1000000.0 / imuSampleRate() ), periodNs / 1000 ) );
+
+    if ( sensorThread_ && sensorThread_->isRunning() )
+    {
+        sensorThread_->setPeriodNs( periodNs );
+    }
+    else if ( imuTimer_->isActive() )
+    {
+        imuTimer_->start( timerIntervalMSec() );
+    }
+
+    emit updateRateChanged( active, (double)NSecPerSec / periodNs );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief timerIntervalMSec - update interval rounded for the QTimer path
+ * @return - interval in milliseconds, at least 1
+ */
+//******************************************************************************
+int SHSensors::timerIntervalMSec()
+{
+    return (int)qMax( ( currentPeriodNs() + 500000 ) / 1000000, (qint64)1 );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief startPeriodicUpdates - start sensors
+ * @return - TRUE if started OK, else FALSE
+ */
+//******************************************************************************
+bool SHSensors::startPeriodicUpdates()
+{
+    if ( !ready_ || started_ ) return false;
+
+    //*** switch RTIMU's own fusion to match the selected engine ***
+    configureImuFusion();
+
+    //*** seed the IMU from the state cache ***
+    restoreState();
+
+    //*** set started flag ***
+    started_ = true;
+    resetRateStats();
+
+    //*** start the update timer ***
+    imuTimer_->setTimerType( Qt::PreciseTimer );
+    imuTimer_->start( timerIntervalMSec() );
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief startRealtimeUpdates - start updates on a dedicated acquisition thread
+ * @param priority - SCHED_FIFO priority (1-99), or 0 for normal scheduling
+ * @param cpu      - CPU to pin the thread to, or -1 for any
+ * @return - TRUE if started OK, else FALSE
+ */
+//******************************************************************************
+bool SHSensors::startRealtimeUpdates( int priority, int cpu )
+{
+    if ( !ready_ || started_ ) return false;
+
+    //*** switch RTIMU's own fusion to match the selected engine ***
+    configureImuFusion();
+
+    //*** seed the IMU from the state cache ***
+    restoreState();
+
+    //*** set started flag ***
+    started_ = true;
+    resetRateStats();
+
+    //*** create the acquisition thread on first use ***
+    if ( !sensorThread_ )
+    {
+        sensorThread_ = new SensorThread( this, 0 );
+        connect( sensorThread_, SIGNAL(error(QString)), SIGNAL(error(QString)) );
+    }
+
+    //*** configure and start it ***
+    sensorThread_->setPeriodNs( currentPeriodNs() );
+    sensorThread_->setRealtime( priority, cpu );
+    sensorThread_->resetTimingStats();
+    sensorThread_->start();
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief startHighRateUpdates - start the acquisition thread at the IMU's
+ *              recommended poll interval
+ * @param priority - SCHED_FIFO priority (1-99), or 0 for normal scheduling
+ * @param cpu      - CPU to pin the thread to, or -1 for any
+ * @return - TRUE if started OK, else FALSE
+ */
+//******************************************************************************
+bool SHSensors::startHighRateUpdates( int priority, int cpu )
+{
+    if ( !ready_ || started_ ) return false;
+
+    //*** poll as often as the IMU driver asks, never slower than it samples ***
+    qint64 pollNs = (qint64)imu_->IMUGetPollInterval() * 1000000;
+    qint64 sampleNs = (qint64)( NSecPerSec / imuSampleRate() );
+
+    if ( pollNs <= 0 || pollNs > sampleNs )
+    {
+        pollNs = sampleNs;
+    }
+
+    //*** the caller's interval comes back when updates stop ***
+    savedIntervalNSec_ = updateIntervalNSec_;
+    updateIntervalNSec_ = pollNs;
+
+    if ( !startRealtimeUpdates( priority, cpu ) )
+    {
+        updateIntervalNSec_ = savedIntervalNSec_;
+        savedIntervalNSec_ = 0;
+        return false;
+    }
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief imuSampleRate - the IMU's configured sample rate
+ * @return - samples per second
+ */
+//******************************************************************************
+double SHSensors::imuSampleRate()
+{
+    //*** the Sense HAT IMU - rate codes from the settings file ***
+    if ( imu_ && imu_->IMUType() == RTIMU_TYPE_LSM9DS1 )
+    {
+        switch ( settings_->m_LSM9DS1GyroSampleRate )
+        {
+            case LSM9DS1_GYRO_SAMPLERATE_14_9:  return 14.9;
+            case LSM9DS1_GYRO_SAMPLERATE_59_5:  return 59.5;
+            case LSM9DS1_GYRO_SAMPLERATE_119:   return 119.0;
+            case LSM9DS1_GYRO_SAMPLERATE_238:   return 238.0;
+            case LSM9DS1_GYRO_SAMPLERATE_476:   return 476.0;
+            case LSM9DS1_GYRO_SAMPLERATE_952:   return 952.0;
+            default: break;
+        }
+    }
+
+    //*** other IMUs - drivers poll at a fraction of the sample period ***
+    if ( imu_ && imu_->IMUGetPollInterval() > 0 )
+    {
+        return 1000.0 / imu_->IMUGetPollInterval();
+    }
+
+    return 100.0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief sampleRateStats - achieved and dropped sample rates
+ * @return - rate statistics
+ */
+//******************************************************************************
+SampleRateStats SHSensors::sampleRateStats()
+{
+SampleRateStats stats;
+double elapsedSec = ( monotonicNs() - rateStartNs_ ) / (double)NSecPerSec;
+
+    stats.nominalHz = imuSampleRate();
+    stats.samples = samplesRead_.load();
+    stats.dropped = samplesDropped_.load();
+    stats.achievedHz = ( elapsedSec > 0 ) ? stats.samples / elapsedSec : 0.0;
+    stats.droppedHz  = ( elapsedSec > 0 ) ? stats.dropped / elapsedSec : 0.0;
+
+    return stats;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief resetRateStats - restart sample rate accounting
+ */
+//******************************************************************************
+void SHSensors::resetRateStats()
+{
+qint64 periodUs;
+
+    rateStartNs_ = monotonicNs();
+    lastImuTimestamp_ = 0;
+    periodUs = (qint64)( 1000000.0 / imuSampleRate() );
+    if ( adaptive_ ) periodUs = qMax( periodUs, currentPeriodNs() / 1000 );
+    samplePeriodUs_.store( periodUs );
+    samplesRead_.store( 0 );
+    samplesDropped_.store( 0 );
+
+    //*** restart the schedule and bus accounting ***
+    scheduleMutex_.lock();
+    memset( channelNextDueNs_, 0, sizeof(channelNextDueNs_) );
+    scheduleMutex_.unlock();
+    memset( &pending_, 0, sizeof(pending_) );
+    timerDueNs_ = 0;
+
+    //*** the first reading of every channel is reported ***
+    reportMutex_.lock();
+    reportedChannels_ = 0;
+    reportMutex_.unlock();
+
+    QMutexLocker bLock( &busMutex_ );
+    memset( busStats_, 0, sizeof(busStats_) );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief setChannelRate - set the rate of one or more channels
+ * @param channels - 'OR' of ImuSensors channels
+ * @param hz       - rate in Hz, or 0 for every sample / as often as possible
+ */
+//******************************************************************************
+void SHSensors::setChannelRate( quint8 channels, double hz )
+{
+    scheduleChannels( channels, hz );
+
+    //*** the caller has planned the slow sensor rates - interleave them ***
+    if ( channels & ( IMU_PRESSURE | IMU_TEMP | IMU_HUMIDITY ) )
+    {
+        scheduleMutex_.lock();
+        slowRateSet_ = true;
+        scheduleMutex_.unlock();
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief scheduleChannels - set the schedule of one or more channels. Safe
+ *              while updates run
+ * @param channels - 'OR' of ImuSensors channels
+ * @param hz       - rate in Hz, or 0 for every sample
+ */
+//******************************************************************************
+void SHSensors::scheduleChannels( quint8 channels, double hz )
+{
+QMutexLocker sLock( &scheduleMutex_ );
+qint64 intervalNs = ( hz > 0.0 ) ? (qint64)( NSecPerSec / hz ) : 0;
+
+    for ( int i=0; i<ImuChannelCount; i++ )
+    {
+        if ( channels & ( 1 << i ) )
+        {
+            channelIntervalNs_[i] = intervalNs;
+            channelNextDueNs_[i] = 0;
+        }
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief setReportPolicy - choose when readings of one or more channels
+ *              are delivered
+ * @param channels - 'OR' of ImuSensors channels
+ * @param policy   - reporting policy
+ */
+//******************************************************************************
+void SHSensors::setReportPolicy( quint8 channels, const ReportPolicy &policy )
+{
+QMutexLocker rLock( &reportMutex_ );
+
+    for ( int i=0; i<ImuChannelCount; i++ )
+    {
+        if ( !( channels & ( 1 << i ) ) ) continue;
+
+        reportPolicy_[i] = policy;
+        reportPolicy_[i].absDeadband = fabs( policy.absDeadband );
+        reportPolicy_[i].relDeadband = fabs( policy.relDeadband );
+
+        //*** report the next reading under the new policy ***
+        reportedChannels_ &= ~( 1 << i );
+
+        if ( policy.mode == REPORT_ON_CHANGE )
+        {
+            onChangeChannels_ |= ( 1 << i );
+        }
+        else
+        {
+            onChangeChannels_ &= ~( 1 << i );
+        }
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief reportPolicy - reporting policy of a channel
+ * @param channel - ImuSensors channel
+ * @return - policy
+ */
+//******************************************************************************
+ReportPolicy SHSensors::reportPolicy( ImuSensors channel )
+{
+QMutexLocker rLock( &reportMutex_ );
+
+    return reportPolicy_[ channelIndex( channel ) ];
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief filterReports - drop the readings of on-change channels that did
+ *              not move past their deadband, or came too soon
+ * @param sample - sample, valid is updated
+ */
+//******************************************************************************
+void SHSensors::filterReports( SensorSample &sample )
+{
+const float *values;
+ReportPolicy *policy;
+int components;
+int bit;
+qint64 sinceNs;
+float change, magnitude, threshold, diff;
+
+    QMutexLocker rLock( &reportMutex_ );
+
+    for ( int i=0; i<ImuChannelCount; i++ )
+    {
+        bit = 1 << i;
+        if ( !( sample.valid & onChangeChannels_ & bit ) ) continue;
+
+        policy = &reportPolicy_[i];
+        values = channelValues( sample, i );
+        components = ( bit & ( IMU_GYRO | IMU_ACCEL | IMU_COMPASS | IMU_FUSION ) ) ? 3 : 1;
+        sinceNs = sample.timestampNs - lastReportNs_[i];
+
+        if ( reportedChannels_ & bit )
+        {
+            //*** too soon after the last report ***
+            if ( policy->minIntervalNs > 0 && sinceNs < policy->minIntervalNs )
+            {
+                sample.valid &= ~bit;
+                continue;
+            }
+
+            //*** largest component change, and the last reported size ***
+            change = 0.0;
+            magnitude = 0.0;
+            for ( int c=0; c<components; c++ )
+            {
+                diff = fabs( values[c] - lastReported_[i][c] );
+
+                //*** fusion angles wrap at +/-180 ***
+                if ( bit == IMU_FUSION && diff > 180.0f ) diff = 360.0f - diff;
+
+                change = qMax( change, diff );
+                magnitude += lastReported_[i][c] * lastReported_[i][c];
+            }
+
+            threshold = qMax( policy->absDeadband, policy->relDeadband * (float)sqrt( magnitude ) );
+
+            //*** unchanged, and no heartbeat due ***
+            if ( change <= threshold &&
+                 ( policy->maxIntervalNs <= 0 || sinceNs < policy->maxIntervalNs ) )
+            {
+                sample.valid &= ~bit;
+                continue;
+            }
+        }
+
+        //*** reported - the new reference ***
+        for ( int c=0; c<components; c++ )
+        {
+            lastReported_[i][c] = values[c];
+        }
+        lastReportNs_[i] = sample.timestampNs;
+        reportedChannels_ |= bit;
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief busTimeStats - bus time used by the transaction serving a channel
+ * @param channel - ImuSensors channel
+ * @return - statistics since updates were started
+ */
+//******************************************************************************
+BusTimeStats SHSensors::busTimeStats( ImuSensors channel )
+{
+QMutexLocker bLock( &busMutex_ );
+BusTransaction trans = BUS_IMU;
+BusTimeStats stats;
+qint64 elapsedNs = monotonicNs() - rateStartNs_;
+
+    if ( channel & ( IMU_PRESSURE | IMU_TEMP ) ) trans = BUS_PRESSURE;
+    else if ( channel & IMU_HUMIDITY )           trans = BUS_HUMIDITY;
+
+    stats = busStats_[trans];
+    stats.busShare = ( elapsedNs > 0 ) ? (double)stats.totalNs / elapsedNs : 0.0;
+
+    return stats;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief accountBusTime - add one transaction to the bus time statistics
+ * @param trans     - transaction kind
+ * @param elapsedNs - time the transaction took
+ */
+//******************************************************************************
+void SHSensors::accountBusTime( BusTransaction trans, qint64 elapsedNs )
+{
+QMutexLocker bLock( &busMutex_ );
+BusTimeStats &stats = busStats_[trans];
+
+    stats.transactions++;
+    stats.totalNs += elapsedNs;
+    if ( elapsedNs > stats.maxNs ) stats.maxNs = elapsedNs;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief setDemandDriven - only process channels that have consumers
+ * @param enable        - TRUE to enable demand driven acquisition
+ * @param idleTimeoutMs - time without consumers before the IMU goes idle
+ */
+//******************************************************************************
+void SHSensors::setDemandDriven( bool enable, int idleTimeoutMs )
+{
+    idleTimeoutNs_ = (qint64)idleTimeoutMs * 1000000;
+    lastMotionDemandNs_ = monotonicNs();
+    demandDriven_ = enable;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief subscribe - register a consumer of channels
+ * @param channels - 'OR' of ImuSensors channels
+ */
+//******************************************************************************
+void SHSensors::subscribe( quint8 channels )
+{
+    for ( int i=0; i<ImuChannelCount; i++ )
+    {
+        if ( channels & ( 1 << i ) ) subscribers_[i].ref();
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief unsubscribe - remove a consumer registered with subscribe()
+ * @param channels - 'OR' of ImuSensors channels
+ */
+//******************************************************************************
+void SHSensors::unsubscribe( quint8 channels )
+{
+int count;
+
+    for ( int i=0; i<ImuChannelCount; i++ )
+    {
+        if ( ( channels & ( 1 << i ) ) == 0 ) continue;
+
+        //*** an unmatched unsubscribe leaves the count at 0 ***
+        do
+        {
+            count = subscribers_[i].load();
+        }
+        while ( count > 0 && !subscribers_[i].testAndSetOrdered( count, count - 1 ) );
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief demandedChannels - channels that currently have a consumer
+ * @return - 'OR' of ImuSensors channels
+ */
+//******************************************************************************
+quint8 SHSensors::demandedChannels()
+{
+quint8 channels = 0;
+
+    for ( int i=0; i<ImuChannelCount; i++ )
+    {
+        if ( subscribers_[i].load() > 0 || signalReceivers_[i].load() > 0 ) channels |= ( 1 << i );
+    }
+
+    //*** aggregation consumes its channels ***
+    channels |= aggChannels_;
+
+    //*** the spectrum needs every accelerometer sample ***
+    if ( spectrum_ ) channels |= IMU_ACCEL;
+
+    //*** the adaptive rate watches accelerometer and gyro activity ***
+    if ( adaptive_ ) channels |= IMU_ACCEL | IMU_GYRO;
+
+    //*** so do the motion detectors, and still/moving the gyro too ***
+    channels |= motionChannels_;
+
+    //*** aligned channels ***
+    if ( align_ ) channels |= alignChannels_;
+
+    //*** stored channels ***
+    channels |= seriesChannels_;
+
+    //*** batch consumers and the processor take everything ***
+    if ( batchHandler_ || processor_ || batchReceivers_.load() > 0 )
+    {
+        channels |= enabled_ | IMU_FUSION;
+    }
+
+    return channels;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief updateDemand - work out the active channels and idle the IMU when
+ *              no motion channel has been wanted for the idle timeout.
+ *              RTIMU's enable calls only take sensors out of fusion, so an
+ *              idle IMU is simply not read: no bus traffic and no fusion
+ * @param nowNs - current time
+ * @return - FALSE if there is nothing to do
+ */
+//******************************************************************************
+bool SHSensors::updateDemand( qint64 nowNs )
+{
+const quint8 MotionChannels = IMU_GYRO | IMU_ACCEL | IMU_COMPASS | IMU_FUSION;
+
+    //*** everything enabled is active ***
+    if ( !demandDriven_ )
+    {
+        active_ = enabled_ | IMU_FUSION;
+        if ( imuIdle_ ) wakeImu();
+        return true;
+    }
+
+    active_ = demandedChannels() & ( enabled_ | IMU_FUSION );
+
+    //*** motion wanted - make sure the IMU is running ***
+    if ( active_ & MotionChannels )
+    {
+        lastMotionDemandNs_ = nowNs;
+        if ( imuIdle_ ) wakeImu();
+    }
+
+    //*** nobody wanted motion for a while - stop reading the IMU ***
+    else if ( !imuIdle_ && nowNs - lastMotionDemandNs_ > idleTimeoutNs_ )
+    {
+        imu_->setGyroEnable( false );
+        imu_->setAccelEnable( false );
+        imu_->setCompassEnable( false );
+        imuIdle_ = true;
+    }
+
+    return active_ != 0 || !imuIdle_;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief wakeImu - bring an idle IMU back for the enabled sensors
+ */
+//******************************************************************************
+void SHSensors::wakeImu()
+{
+    imu_->setGyroEnable( ( enabled_ & IMU_GYRO ) != 0 );
+    imu_->setAccelEnable( ( enabled_ & IMU_ACCEL ) != 0 );
+    imu_->setCompassEnable( ( enabled_ & IMU_COMPASS ) != 0 );
+
+    //*** the gap while idle is not a dropped sample ***
+    lastImuTimestamp_ = 0;
+    imuIdle_ = false;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief connectNotify - count receivers of the channel signals
+ * @param signal - signal being connected
+ */
+//******************************************************************************
+void SHSensors::connectNotify( const QMetaMethod &signal )
+{
+    if ( signal != QMetaMethod::fromSignal( &SHSensors::sampleBatch ) &&
+         signalChannels( signal ) == 0 ) return;
+
+    countReceivers();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief disconnectNotify - count receivers of the channel signals. The
+ *              signal is invalid when everything is disconnected at once,
+ *              so the receivers are counted again rather than one removed
+ * @param signal - signal being disconnected
+ */
+//******************************************************************************
+void SHSensors::disconnectNotify( const QMetaMethod &signal )
+{
+    if ( signal.isValid() && signal != QMetaMethod::fromSignal( &SHSensors::sampleBatch ) &&
+         signalChannels( signal ) == 0 ) return;
+
+    countReceivers();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief countReceivers - count the receivers of the batch and channel signals
+ */
+//******************************************************************************
+void SHSensors::countReceivers()
+{
+    batchReceivers_.store( receivers( SIGNAL(sampleBatch(SensorBatch)) ) );
+
+    signalReceivers_[ channelIndex( IMU_PRESSURE ) ].store( receivers( SIGNAL(pressure(float,float)) ) );
+    signalReceivers_[ channelIndex( IMU_TEMP ) ].store( receivers( SIGNAL(temperature(float,float)) ) );
+    signalReceivers_[ channelIndex( IMU_HUMIDITY ) ].store( receivers( SIGNAL(humidity(float)) ) );
+    signalReceivers_[ channelIndex( IMU_GYRO ) ].store( receivers( SIGNAL(gyro(float,float,float)) ) );
+    signalReceivers_[ channelIndex( IMU_ACCEL ) ].store( receivers( SIGNAL(accel(float,float,float,float)) ) );
+    signalReceivers_[ channelIndex( IMU_COMPASS ) ].store( receivers( SIGNAL(compass(float,float,float,float)) ) );
+    signalReceivers_[ channelIndex( IMU_FUSION ) ].store( receivers( SIGNAL(fusionPose(float,float,float)) ) );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief signalChannels - channel delivered by a per-channel signal
+ * @param signal - signal
+ * @return - ImuSensors channel, or 0 for other signals
+ */
+//******************************************************************************
+quint8 SHSensors::signalChannels( const QMetaMethod &signal )
+{
+    if ( signal == QMetaMethod::fromSignal( &SHSensors::pressure ) )    return IMU_PRESSURE;
+    if ( signal == QMetaMethod::fromSignal( &SHSensors::temperature ) ) return IMU_TEMP;
+    if ( signal == QMetaMethod::fromSignal( &SHSensors::humidity ) )    return IMU_HUMIDITY;
+    if ( signal == QMetaMethod::fromSignal( &SHSensors::gyro ) )        return IMU_GYRO;
+    if ( signal == QMetaMethod::fromSignal( &SHSensors::accel ) )       return IMU_ACCEL;
+    if ( signal == QMetaMethod::fromSignal( &SHSensors::compass ) )     return IMU_COMPASS;
+    if ( signal == QMetaMethod::fromSignal( &SHSensors::fusionPose ) )  return IMU_FUSION;
+
+    return 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief channelDue - check a channel's schedule, advancing it if due
+ * @param chIdx - channel index
+ * @param nowNs - current time
+ * @return - TRUE if the channel should be delivered now
+ */
+//******************************************************************************
+bool SHSensors::channelDue( int chIdx, qint64 nowNs )
+{
+QMutexLocker sLock( &scheduleMutex_ );
+qint64 intervalNs = channelIntervalNs_[chIdx];
+
+    //*** every sample ***
+    if ( intervalNs == 0 ) return true;
+
+    if ( nowNs < channelNextDueNs_[chIdx] ) return false;
+
+    //*** keep the phase, but don't try to catch up after a long gap ***
+    channelNextDueNs_[chIdx] += intervalNs;
+    if ( channelNextDueNs_[chIdx] <= nowNs )
+    {
+        channelNextDueNs_[chIdx] = nowNs + intervalNs;
+    }
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief channelLateness - how overdue the most overdue enabled channel is.
+ *              Called with scheduleMutex_ held
+ * @param channels - 'OR' of channels served by one transaction
+ * @param nowNs    - current time
+ * @return - lateness in nsecs, negative if none is due
+ */
+//******************************************************************************
+qint64 SHSensors::channelLateness( quint8 channels, qint64 nowNs )
+{
+qint64 lateness = -1;
+
+    for ( int i=0; i<ImuChannelCount; i++ )
+    {
+        if ( ( channels & active_ & ( 1 << i ) ) == 0 ) continue;
+
+        lateness = qMax( lateness, nowNs - channelNextDueNs_[i] );
+    }
+
+    return lateness;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief readSlowSensors - perform the due environmental sensor reads. With
+ *              the default rates every due sensor is read; once a rate has
+ *              been set with setChannelRate(), one transaction per update,
+ *              the most overdue. Readings are held in pending_ until the
+ *              next IMU sample, or go out alone while the IMU idles. Sensors
+ *              nobody wants are not read
+ * @param nowNs - current time
+ */
+//******************************************************************************
+void SHSensors::readSlowSensors( qint64 nowNs )
+{
+qint64 presLate = -1;
+qint64 humLate = -1;
+bool interleave;
+bool logged;
+
+    //*** a sensor nobody wants is not read - the sensor log wants everything ***
+    logged = logWriter_.isOpen();
+
+    scheduleMutex_.lock();
+    if ( pressure_ && ( ( active_ & ( IMU_PRESSURE | IMU_TEMP ) ) || logged ) )
+    {
+        presLate = channelLateness( IMU_PRESSURE | IMU_TEMP, nowNs );
+    }
+    if ( humidity_ && ( ( active_ & IMU_HUMIDITY ) || logged ) )
+    {
+        humLate = channelLateness( IMU_HUMIDITY, nowNs );
+    }
+    interleave = slowRateSet_;
+    scheduleMutex_.unlock();
+
+    //*** nothing due ***
+    if ( presLate < 0 && humLate < 0 ) return;
+
+    //*** every due sensor ***
+    if ( !interleave )
+    {
+        if ( presLate >= 0 ) readPressure( nowNs );
+        if ( humLate >= 0 ) readHumidity( nowNs );
+        return;
+    }
+
+    //*** most overdue transaction wins ***
+    if ( presLate >= humLate )
+    {
+        readPressure( nowNs );
+    }
+    else
+    {
+        readHumidity( nowNs );
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief readPressure - one pressure / temperature transaction
+ * @param nowNs - current time
+ */
+//******************************************************************************
+void SHSensors::readPressure( qint64 nowNs )
+{
+RTIMU_DATA slowData;
+qint64 startNs = 0;
+qint64 readNs = 0;
+SensorSample envSample;
+
+    //*** start from the latest IMU data, as the sensor drivers expect ***
+    slowData = imu_->getIMUData();
+
+    startNs = monotonicNs();
+    bool ok = pressure_->pressureRead( slowData );
+    readNs = monotonicNs() - startNs;
+    accountBusTime( BUS_PRESSURE, readNs );
+
+    instr_.count( COUNT_PRESSURE_READS );
+    instr_.add( HIST_PRESSURE_READ, readNs );
+
+    if ( !ok )
+    {
+        instr_.count( COUNT_PRESSURE_FAILURES );
+        return;
+    }
+
+    //*** raw reading for the sensor log ***
+    logPending_.pressure = slowData.pressure;
+    logPending_.temperature = slowData.temperature;
+    logPending_.valid |= IMU_PRESSURE | IMU_TEMP;
+
+    //*** the aligner sees every reading at the time it was taken ***
+    if ( align_ && ( alignChannels_ & ( IMU_PRESSURE | IMU_TEMP ) ) )
+    {
+        memset( &envSample, 0, sizeof(envSample) );
+        envSample.timestampNs = startNs + readNs;
+        envSample.pressure = slowData.pressure;
+        envSample.altitude = RTMath::convertPressureToHeight( slowData.pressure );
+        envSample.temperature = slowData.temperature;
+        alignSample( envSample, IMU_PRESSURE | IMU_TEMP );
+    }
+
+    if ( seriesChannels_ & ( IMU_PRESSURE | IMU_TEMP ) )
+    {
+        memset( &envSample, 0, sizeof(envSample) );
+        envSample.timestampNs = startNs + readNs;
+        envSample.pressure = slowData.pressure;
+        envSample.temperature = slowData.temperature;
+        storeSample( envSample, seriesChannels_ & ( IMU_PRESSURE | IMU_TEMP ) );
+    }
+
+    if ( ( active_ & IMU_PRESSURE ) && channelDue( channelIndex( IMU_PRESSURE ), nowNs ) )
+    {
+        //*** pressure in hPa ***
+        pending_.pressure = slowData.pressure;
+        pending_.altitude = RTMath::convertPressureToHeight( slowData.pressure );
+        pending_.valid |= IMU_PRESSURE;
+    }
+
+    if ( ( active_ & IMU_TEMP ) && channelDue( channelIndex( IMU_TEMP ), nowNs ) )
+    {
+        //*** temp celsius ***
+        pending_.temperature = slowData.temperature;
+        pending_.valid |= IMU_TEMP;
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief readHumidity - one humidity transaction
+ * @param nowNs - current time
+ */
+//******************************************************************************
+void SHSensors::readHumidity( qint64 nowNs )
+{
+RTIMU_DATA slowData;
+qint64 startNs = 0;
+qint64 readNs = 0;
+SensorSample envSample;
+
+    slowData = imu_->getIMUData();
+
+    startNs = monotonicNs();
+    bool ok = humidity_->humidityRead( slowData );
+    readNs = monotonicNs() - startNs;
+    accountBusTime( BUS_HUMIDITY, readNs );
+
+    instr_.count( COUNT_HUMIDITY_READS );
+    instr_.add( HIST_HUMIDITY_READ, readNs );
+
+    if ( !ok )
+    {
+        instr_.count( COUNT_HUMIDITY_FAILURES );
+        return;
+    }
+
+    //*** raw reading for the sensor log ***
+    logPending_.humidity = slowData.humidity;
+    logPending_.valid |= IMU_HUMIDITY;
+
+    if ( align_ && ( alignChannels_ & IMU_HUMIDITY ) )
+    {
+        memset( &envSample, 0, sizeof(envSample) );
+        envSample.timestampNs = startNs + readNs;
+        envSample.humidity = slowData.humidity;
+        alignSample( envSample, IMU_HUMIDITY );
+    }
+
+    if ( seriesChannels_ & IMU_HUMIDITY )
+    {
+        memset( &envSample, 0, sizeof(envSample) );
+        envSample.timestampNs = startNs + readNs;
+        envSample.humidity = slowData.humidity;
+        storeSample( envSample, IMU_HUMIDITY );
+    }
+
+    if ( ( active_ & IMU_HUMIDITY ) && channelDue( channelIndex( IMU_HUMIDITY ), nowNs ) )
+    {
+        //*** relative humidity ***
+        pending_.humidity = slowData.humidity;
+        pending_.valid |= IMU_HUMIDITY;
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief stopUpdates - stop periodic or realtime updates
+ */
+//******************************************************************************
+void SHSensors::stopUpdates()
+{
+    if ( !started_ ) return;
+
+    //*** stop the timer ***
+    if ( imuTimer_ && imuTimer_->isActive() )
+    {
+        imuTimer_->stop();
+    }
+
+    //*** stop the acquisition thread ***
+    if ( sensorThread_ && sensorThread_->isRunning() )
+    {
+        sensorThread_->requestInterruption();
+        sensorThread_->wait();
+    }
+
+    started_ = false;
+
+    //*** back to the interval set before high rate updates ***
+    if ( savedIntervalNSec_ > 0 )
+    {
+        updateIntervalNSec_ = savedIntervalNSec_;
+        savedIntervalNSec_ = 0;
+    }
+
+    //*** nothing more is coming - deliver what was collected ***
+    acquireMutex_.lock();
+    flushBatch();
+    acquireMutex_.unlock();
+
+    //*** keep what the IMU has learned ***
+    if ( !stateFile_.isEmpty() )
+    {
+        saveState();
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief setBatchSize - number of samples collected before a batch is delivered
+ * @param samples  - 1 to SensorBatchSize
+ * @param maxAgeMs - age limit of a partial batch, 0 for none
+ */
+//******************************************************************************
+void SHSensors::setBatchSize( int samples, int maxAgeMs )
+{
+    batchSize_ = qBound( 1, samples, SensorBatchSize );
+    batchMaxAgeNs_ = qMax( maxAgeMs, 0 ) * 1000000LL;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief setBatchHandler - set a callback that receives each batch directly on
+ *              the acquisition thread
+ * @param handler - handler object, or NULL to remove
+ */
+//******************************************************************************
+void SHSensors::setBatchHandler( SensorBatchHandler *handler )
+{
+    batchHandler_ = handler;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief setProcessor - run a processor on every sample on the acquisition
+ *              thread
+ * @param processor - processor object, or NULL to remove
+ */
+//******************************************************************************
+void SHSensors::setProcessor( SensorProcessor *processor )
+{
+    //*** no update is using the old one once the lock is held ***
+    acquireMutex_.lock();
+    processor_ = processor;
+    acquireMutex_.unlock();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief timingStats - scheduling statistics of the acquisition thread
+ * @return - statistics since start or last reset
+ */
+//******************************************************************************
+AcqTimingStats SHSensors::timingStats()
+{
+    if ( !sensorThread_ )
+    {
+        AcqTimingStats empty;
+        memset( &empty, 0, sizeof(empty) );
+        return empty;
+    }
+
+    return sensorThread_->timingStats();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief resetTimingStats - clear the acquisition thread statistics
+ */
+//******************************************************************************
+void SHSensors::resetTimingStats()
+{
+    if ( sensorThread_ )
+    {
+        sensorThread_->resetTimingStats();
+    }
 }
 
 
@@ -204,75 +1994,2050 @@ bool SHSensors::startPeriodicUpdates()
  * @brief SHSensors::handleUpdate - handle periodic update
  */
 //******************************************************************************
-void SHSensors::handleUpdate()
+void SHSensors::handleUpdate()
+{
+qint64 nowNs = monotonicNs();
+qint64 periodNs = timerIntervalMSec() * 1000000LL;
+
+    //*** lateness against an absolute schedule, as the acquisition thread measures it ***
+    if ( timerDueNs_ == 0 || periodNs != timerPeriodNs_ )
+    {
+        //*** the first update, or a new interval, starts the schedule ***
+        timerDueNs_ = nowNs;
+        timerPeriodNs_ = periodNs;
+    }
+    else
+    {
+        timerDueNs_ += periodNs;
+        instr_.add( HIST_TIMER_LATENESS, nowNs - timerDueNs_ );
+
+        //*** a timer more than a period behind starts again from now ***
+        if ( nowNs - timerDueNs_ >= periodNs ) timerDueNs_ = nowNs;
+    }
+
+    acquire();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::acquire - read and deliver all available sensor data.
+ *              Called from the update timer or the acquisition thread.
+ *              Skipped while a burst capture holds the IMU
+ */
+//******************************************************************************
+void SHSensors::acquire()
+{
+    if ( !acquireMutex_.tryLock() )
+    {
+        instr_.count( COUNT_BURST_SKIPPED );
+        return;
+    }
+
+    drainImu();
+
+    //*** a partial batch is not held past its age limit, even when idle ***
+    if ( batch_.count > 0 && batchMaxAgeNs_ > 0 &&
+         monotonicNs() - batchStartNs_ >= batchMaxAgeNs_ )
+    {
+        flushBatch();
+    }
+
+    //*** the state cache is written from this snapshot, never from a read of the live state ***
+    if ( stateSnapshots_ && monotonicNs() >= nextSnapshotNs_ )
+    {
+        snapshotState( false );
+        nextSnapshotNs_ = monotonicNs() + StateSnapshotNs;
+    }
+
+    acquireMutex_.unlock();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::drainImu - read the sensors due and deliver every IMU
+ *              sample waiting
+ */
+//******************************************************************************
+void SHSensors::drainImu()
+{
+SensorSample sample;
+qint64 startNs = 0;
+qint64 readNs = 0;
+qint64 updateNs = instr_.start();
+qint64 stageNs = 0;
+int drained = 0;
+bool gotSample = false;
+
+    instr_.count( COUNT_UPDATES );
+
+    //*** work out which channels anyone wants ***
+    if ( !updateDemand( monotonicNs() ) ) return;
+
+    //*** environmental sensor transactions due ***
+    readSlowSensors( monotonicNs() );
+
+    //*** nothing wants the IMU - leave the bus alone, the readings go out on their own ***
+    if ( imuIdle_ )
+    {
+        instr_.count( COUNT_IDLE_UPDATES );
+        deliverEnvironment();
+        return;
+    }
+
+    //*** read all data ***
+    while ( true )
+    {
+        startNs = monotonicNs();
+        gotSample = imu_->IMURead();
+        readNs = monotonicNs() - startNs;
+        accountBusTime( BUS_IMU, readNs );
+
+        instr_.count( COUNT_IMU_READS );
+        instr_.add( HIST_IMU_READ, readNs );
+
+        if ( !gotSample )
+        {
+            //*** the read that ends a drain is normal - only an update that found nothing counts ***
+            if ( drained == 0 ) instr_.count( COUNT_IMU_EMPTY_READS );
+
+            //*** the last sample drained is the freshest - check the clock against it ***
+            if ( drained > 0 ) countDrops();
+            break;
+        }
+
+        instr_.count( COUNT_SAMPLES );
+        drained++;
+        stageNs = instr_.start();
+
+        //*** get IMU data ***
+        RTIMU_DATA imuData = imu_->getIMUData();
+
+        //*** library fusion in place of RTIMU's ***
+        if ( fusion_ )
+        {
+            applyFusion( imuData );
+        }
+
+        memset( &sample, 0, sizeof(sample) );
+        sample.timestampNs = monotonicNs();
+
+        //*** count samples, and any the IMU produced that we never saw ***
+        countSample( imuData.timestamp );
+
+        //*** raw stream to the sensor log ***
+        if ( logWriter_.isOpen() )
+        {
+            recordSample( imuData );
+        }
+
+        //*** environmental readings taken since the last sample ***
+        if ( pending_.valid )
+        {
+            sample.pressure    = pending_.pressure;
+            sample.altitude    = pending_.altitude;
+            sample.temperature = pending_.temperature;
+            sample.humidity    = pending_.humidity;
+            sample.valid       = pending_.valid;
+            pending_.valid     = 0;
+        }
+
+        //*** gyroscope, accelerometer, compass and fusion ***
+        imuSample( imuData, active_, sample );
+
+        deliverSample( sample, stageNs );
+    }
+
+    instr_.add( HIST_DRAINED, drained );
+    instr_.stop( HIST_UPDATE, updateNs );
+
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::deliverSample - run a sample through processing, rate
+ *              and report filtering, and hand it to every consumer
+ * @param sample  - sample, its channels filtered in place
+ * @param stageNs - start of the sample's conversion, for instrumentation
+ */
+//******************************************************************************
+void SHSensors::deliverSample( SensorSample &sample, qint64 stageNs )
+{
+const quint8 MotionChannels[] = { IMU_GYRO, IMU_ACCEL, IMU_COMPASS, IMU_FUSION };
+const quint8 MotionMask = IMU_GYRO | IMU_ACCEL | IMU_COMPASS | IMU_FUSION;
+
+    //*** processing graph ***
+    if ( processor_ )
+    {
+        processor_->process( sample );
+    }
+
+    //*** aggregates see every sample ***
+    if ( aggChannels_ & sample.valid )
+    {
+        aggregateSample( sample );
+    }
+
+    //*** vibration spectrum ***
+    if ( spectrum_ && ( sample.valid & IMU_ACCEL ) )
+    {
+        spectrumSample( sample );
+    }
+
+    //*** motion events ***
+    if ( motion_ && ( sample.valid & IMU_ACCEL ) )
+    {
+        motionSample( sample );
+    }
+
+    //*** adaptive update rate ***
+    if ( adaptive_ && ( sample.valid & IMU_ACCEL ) )
+    {
+        adaptSample( sample );
+    }
+
+    //*** channel alignment - environmental readings went in when taken ***
+    if ( align_ && ( alignChannels_ & sample.valid & MotionMask ) )
+    {
+        alignSample( sample, sample.valid & MotionMask );
+    }
+
+    //*** per-channel rates ***
+    for ( int i=0; i<4; i++ )
+    {
+        if ( ( sample.valid & MotionChannels[i] ) &&
+             !channelDue( channelIndex( MotionChannels[i] ), sample.timestampNs ) )
+        {
+            sample.valid &= ~MotionChannels[i];
+        }
+    }
+
+    //*** on-change channels that did not change ***
+    if ( onChangeChannels_ & sample.valid )
+    {
+        filterReports( sample );
+    }
+
+    stageNs = instr_.stop( HIST_CONVERT, stageNs );
+
+    //*** every channel decimated away ***
+    if ( sample.valid == 0 )
+    {
+        instr_.count( COUNT_SAMPLES_SUPPRESSED );
+        return;
+    }
+
+    //*** snapshot for pollers ***
+    publishLatest( sample );
+
+    //*** other processes ***
+    if ( ring_->isOpen() )
+    {
+        publishShared( sample );
+    }
+
+    //*** long term store - environmental readings went in when taken ***
+    if ( seriesChannels_ & sample.valid & MotionMask )
+    {
+        storeSample( sample, seriesChannels_ & sample.valid & MotionMask );
+    }
+
+    //*** compatibility signals ***
+    if ( channelSignals_ )
+    {
+        emitChannels( sample );
+    }
+
+    //*** batched delivery ***
+    appendSample( sample );
+
+    instr_.stop( HIST_EMIT, stageNs );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::deliverEnvironment - deliver environmental readings on
+ *              their own while the IMU is idle, as there is no IMU sample
+ *              to carry them
+ */
+//******************************************************************************
+void SHSensors::deliverEnvironment()
+{
+SensorSample sample;
+SensorLogRecord rec;
+
+    //*** raw readings to the sensor log, in a record of their own ***
+    if ( logWriter_.isOpen() && logPending_.valid )
+    {
+        memset( &rec, 0, sizeof(rec) );
+        rec.timestampUs = RTMath::currentUSecsSinceEpoch();
+        rec.pressure = logPending_.pressure;
+        rec.temperature = logPending_.temperature;
+        rec.humidity = logPending_.humidity;
+        rec.valid = logPending_.valid;
+        logWriter_.append( rec );
+    }
+    logPending_.valid = 0;
+
+    if ( pending_.valid == 0 ) return;
+
+    memset( &sample, 0, sizeof(sample) );
+    sample.timestampNs = monotonicNs();
+    sample.pressure    = pending_.pressure;
+    sample.altitude    = pending_.altitude;
+    sample.temperature = pending_.temperature;
+    sample.humidity    = pending_.humidity;
+    sample.valid       = pending_.valid;
+    pending_.valid     = 0;
+
+    deliverSample( sample, instr_.start() );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::imuSample - copy the motion channels of an RTIMU reading
+ *              into a sample
+ * @param imuData  - RTIMU reading
+ * @param channels - 'OR' of the ImuSensors channels to copy
+ * @param sample   - receives the channels
+ */
+//******************************************************************************
+void SHSensors::imuSample( const RTIMU_DATA &imuData, quint8 channels, SensorSample &sample )
+{
+    //*** gyroscope ***
+    if ( channels & IMU_GYRO )
+    {
+        //*** gyroscope in degrees per second ***
+        sample.gyro[0] = imuData.gyro.x() * RTMATH_RAD_TO_DEGREE;
+        sample.gyro[1] = imuData.gyro.y() * RTMATH_RAD_TO_DEGREE;
+        sample.gyro[2] = imuData.gyro.z() * RTMATH_RAD_TO_DEGREE;
+        sample.valid |= IMU_GYRO;
+    }
+
+    //*** accelerometer ***
+    if ( channels & IMU_ACCEL )
+    {
+        //*** acceleration in g's ***'
+        sample.accel[0] = imuData.accel.x();
+        sample.accel[1] = imuData.accel.y();
+        sample.accel[2] = imuData.accel.z();
+        sample.valid |= IMU_ACCEL;
+    }
+
+    //*** compass ***
+    if ( channels & IMU_COMPASS )
+    {
+        //*** compas (magnetometer) in uT ***
+        sample.compass[0] = imuData.compass.x();
+        sample.compass[1] = imuData.compass.y();
+        sample.compass[2] = imuData.compass.z();
+        sample.valid |= IMU_COMPASS;
+    }
+
+    //*** fusion data - degrees ***
+    if ( channels & IMU_FUSION )
+    {
+        sample.fusionPose[0] = imuData.fusionPose.x() * RTMATH_RAD_TO_DEGREE;
+        sample.fusionPose[1] = imuData.fusionPose.y() * RTMATH_RAD_TO_DEGREE;
+        sample.fusionPose[2] = imuData.fusionPose.z() * RTMATH_RAD_TO_DEGREE;
+        sample.valid |= IMU_FUSION;
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief captureBurst - read count IMU samples back to back into a buffer
+ * @param buffer    - receives the samples
+ * @param count     - samples to capture
+ * @param timeoutMs - longest time the burst may take
+ * @return - capture statistics
+ */
+//******************************************************************************
+BurstStats SHSensors::captureBurst( SensorSample *buffer, int count, int timeoutMs )
+{
+const quint8 MotionChannels = IMU_GYRO | IMU_ACCEL | IMU_COMPASS;
+BurstStats stats;
+RTIMU_DATA imuData;
+SensorSample *sample;
+struct timespec pause;
+qint64 sampleNs = (qint64)( NSecPerSec / imuSampleRate() );
+qint64 savedPeriodUs;
+quint64 droppedBefore;
+qint64 timeoutNs;
+qint64 startNs;
+qint64 readNs;
+qint64 lastNs = 0;
+quint8 channels;
+bool gotSample;
+
+    memset( &stats, 0, sizeof(stats) );
+    stats.requested = count;
+    stats.nominalHz = imuSampleRate();
+
+    if ( !validIMU_ )
+    {
+        emit error( "Sensors: No valid IMU found!!!" );
+        return stats;
+    }
+
+    if ( !buffer || count <= 0 || timeoutMs <= 0 )
+    {
+        emit error( "Sensors: Invalid burst capture" );
+        return stats;
+    }
+
+    if ( !burstMutex_.tryLock() )
+    {
+        emit error( "Sensors: Burst capture already running" );
+        return stats;
+    }
+
+    //*** let an update in progress finish, then hold off the periodic path ***
+    acquireMutex_.lock();
+
+    //*** every enabled motion channel, with the IMU awake ***
+    channels = ( enabled_ & MotionChannels ) | IMU_FUSION;
+    if ( imuIdle_ ) wakeImu();
+
+    //*** count gaps against the IMU rate, not an idle update period ***
+    savedPeriodUs = samplePeriodUs_.load();
+    samplePeriodUs_.store( sampleNs / 1000 );
+    droppedBefore = samplesDropped_.load();
+
+    //*** between samples, poll four times per sample period ***
+    pause.tv_sec = 0;
+    pause.tv_nsec = qMax( sampleNs / 4, (qint64)50000 );
+
+    timeoutNs = monotonicNs() + (qint64)timeoutMs * 1000000;
+
+    while ( stats.captured < count )
+    {
+        startNs = monotonicNs();
+        if ( startNs >= timeoutNs ) break;
+
+        gotSample = imu_->IMURead();
+        readNs = monotonicNs() - startNs;
+        accountBusTime( BUS_IMU, readNs );
+
+        if ( !gotSample )
+        {
+            stats.emptyReads++;
+            clock_nanosleep( CLOCK_MONOTONIC, 0, &pause, 0 );
+            continue;
+        }
+
+        imuData = imu_->getIMUData();
+
+        //*** fusion and the raw log carry on through the burst ***
+        if ( fusion_ )
+        {
+            applyFusion( imuData );
+        }
+
+        countSample( imuData.timestamp );
+        countDrops();
+
+        if ( logWriter_.isOpen() )
+        {
+            recordSample( imuData );
+        }
+
+        //*** timestamp at the end of the read that produced the sample ***
+        sample = &buffer[ stats.captured ];
+        memset( sample, 0, sizeof(SensorSample) );
+        sample->timestampNs = startNs + readNs;
+        imuSample( imuData, channels, *sample );
+
+        if ( stats.captured == 0 )
+        {
+            stats.startNs = sample->timestampNs;
+        }
+        else
+        {
+            stats.maxGapNs = qMax( stats.maxGapNs, sample->timestampNs - lastNs );
+        }
+
+        lastNs = sample->timestampNs;
+        stats.captured++;
+    }
+
+    stats.endNs = lastNs;
+    stats.complete = ( stats.captured == count );
+    stats.dropped = samplesDropped_.load() - droppedBefore;
+
+    if ( stats.captured > 1 && stats.endNs > stats.startNs )
+    {
+        stats.achievedHz = ( stats.captured - 1 ) * (double)NSecPerSec / ( stats.endNs - stats.startNs );
+    }
+
+    //*** periodic delivery resumes at the next update ***
+    samplePeriodUs_.store( savedPeriodUs );
+    acquireMutex_.unlock();
+    burstMutex_.unlock();
+
+    if ( !stats.complete )
+    {
+        emit error( QString("Sensors: Burst capture timed out after %1 of %2 samples")
+                        .arg(stats.captured).arg(count) );
+    }
+
+    return stats;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief startBurst - run a burst capture in the background
+ * @param buffer    - receives the samples
+ * @param count     - samples to capture
+ * @param timeoutMs - longest time the burst may take
+ * @return - TRUE if the burst started, else FALSE
+ */
+//******************************************************************************
+bool SHSensors::startBurst( SensorSample *buffer, int count, int timeoutMs )
+{
+    if ( !validIMU_ )
+    {
+        emit error( "Sensors: No valid IMU found!!!" );
+        return false;
+    }
+
+    if ( !buffer || count <= 0 || timeoutMs <= 0 )
+    {
+        emit error( "Sensors: Invalid burst capture" );
+        return false;
+    }
+
+    //*** create the burst thread on first use ***
+    if ( !burstThread_ )
+    {
+        burstThread_ = new BurstThread( this, 0 );
+    }
+
+    if ( burstThread_->isRunning() )
+    {
+        emit error( "Sensors: Burst capture already running" );
+        return false;
+    }
+
+    burstThread_->setBurst( buffer, count, timeoutMs );
+    burstThread_->start();
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief setAggregation - maintain window statistics and a decimated stream
+ *              of one or more channels
+ * @param channels      - 'OR' of ImuSensors channels
+ * @param decimation    - input samples per aggregate() output
+ * @param windowSamples - window length in samples, or most samples a time
+ *                        window can hold
+ * @param windowNs      - window length in nanoseconds, 0 for a count window
+ * @param cicOrder      - decimation filter order
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSensors::setAggregation( quint8 channels, int decimation, int windowSamples,
+                                qint64 windowNs, int cicOrder )
+{
+ChannelAggregator *built[ImuChannelCount];
+ChannelAggregator *agg;
+quint8 channel;
+bool ok = true;
+
+    memset( built, 0, sizeof(built) );
+
+    //*** build every channel's state off the acquisition path ***
+    for ( int i=0; i<ImuChannelCount && ok; i++ )
+    {
+        channel = 1 << i;
+        if ( !( channels & channel ) ) continue;
+
+        agg = new ChannelAggregator;
+        agg->components = ( channel & ( IMU_GYRO | IMU_ACCEL | IMU_COMPASS | IMU_FUSION ) ) ? 3 : 1;
+        memset( &agg->last, 0, sizeof(agg->last) );
+        agg->last.channel = channel;
+        agg->last.components = agg->components;
+        built[i] = agg;
+
+        for ( int c=0; c<agg->components && ok; c++ )
+        {
+            ok = agg->stats[c].configure( windowSamples, windowNs ) &&
+                 agg->cic[c].configure( decimation, cicOrder, AggregateQuantum );
+        }
+    }
+
+    //*** all or nothing - the current configuration stays on failure ***
+    if ( !ok )
+    {
+        for ( int i=0; i<ImuChannelCount; i++ ) delete built[i];
+        emit error( QString("Sensors: Invalid aggregation window or decimation") );
+        return false;
+    }
+
+    //*** swap them all in at once ***
+    aggMutex_.lock();
+    for ( int i=0; i<ImuChannelCount; i++ )
+    {
+        if ( !built[i] ) continue;
+
+        agg = aggregators_[i];
+        aggregators_[i] = built[i];
+        built[i] = agg;
+        aggChannels_ |= ( 1 << i );
+    }
+    aggMutex_.unlock();
+
+    //*** the replaced ones ***
+    for ( int i=0; i<ImuChannelCount; i++ ) delete built[i];
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief clearAggregation - stop aggregating channels
+ * @param channels - 'OR' of ImuSensors channels
+ */
+//******************************************************************************
+void SHSensors::clearAggregation( quint8 channels )
+{
+ChannelAggregator *old;
+
+    for ( int i=0; i<ImuChannelCount; i++ )
+    {
+        if ( !( channels & ( 1 << i ) ) ) continue;
+
+        aggMutex_.lock();
+        old = aggregators_[i];
+        aggregators_[i] = 0;
+        aggChannels_ &= ~( 1 << i );
+        aggMutex_.unlock();
+
+        delete old;
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief latestAggregate - most recent aggregate of a channel
+ * @param channel - ImuSensors channel
+ * @return - aggregate, windowCount 0 if none yet
+ */
+//******************************************************************************
+SensorAggregate SHSensors::latestAggregate( ImuSensors channel )
+{
+SensorAggregate agg;
+int chIdx = channelIndex( channel );
+QMutexLocker lock( &aggMutex_ );
+
+    memset( &agg, 0, sizeof(agg) );
+    agg.channel = channel;
+
+    if ( aggregators_[chIdx] )
+    {
+        agg = aggregators_[chIdx]->last;
+    }
+
+    return agg;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::aggregateSample - update the window statistics and
+ *              decimators of the aggregated channels in a sample, emitting
+ *              aggregate() for each decimator that produces an output
+ * @param sample - full rate sample
+ */
+//******************************************************************************
+void SHSensors::aggregateSample( const SensorSample &sample )
+{
+SensorAggregate out[ImuChannelCount];
+int outCount = 0;
+const float *values;
+ChannelAggregator *agg;
+bool ready;
+
+    aggMutex_.lock();
+
+    for ( int i=0; i<ImuChannelCount; i++ )
+    {
+        agg = aggregators_[i];
+        if ( !agg || !( sample.valid & ( 1 << i ) ) ) continue;
+
+        values = channelValues( sample, i );
+
+        //*** components decimate in step ***
+        ready = false;
+        for ( int c=0; c<agg->components; c++ )
+        {
+            agg->stats[c].add( sample.timestampNs, values[c] );
+            ready = agg->cic[c].add( values[c] );
+        }
+
+        if ( !ready ) continue;
+
+        //*** new reduced rate output ***
+        agg->last.timestampNs = sample.timestampNs;
+        agg->last.windowCount = agg->stats[0].count();
+        for ( int c=0; c<agg->components; c++ )
+        {
+            agg->last.decimated[c] = agg->cic[c].output();
+            agg->last.mean[c]      = agg->stats[c].mean();
+            agg->last.variance[c]  = agg->stats[c].variance();
+            agg->last.min[c]       = agg->stats[c].min();
+            agg->last.max[c]       = agg->stats[c].max();
+        }
+
+        out[ outCount++ ] = agg->last;
+    }
+
+    aggMutex_.unlock();
+
+    //*** outside the lock - receivers may reconfigure ***
+    for ( int i=0; i<outCount; i++ )
+    {
+        emit aggregate( out[i] );
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief setFusion - select the fusion engine behind fusionPose
+ * @param algorithm - fusion engine
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSensors::setFusion( FusionAlgorithm algorithm )
+{
+SHFusion *fusion = 0;
+SHFusion *old;
+
+    switch ( algorithm )
+    {
+        case FUSION_RTIMU:
+            break;
+
+        case FUSION_MADGWICK:
+        {
+            SHMadgwickFusion *madgwick = new SHMadgwickFusion();
+            madgwick->setBeta( madgwickBeta_ );
+            fusion = madgwick;
+            break;
+        }
+
+        case FUSION_MAHONY:
+        {
+            SHMahonyFusion *mahony = new SHMahonyFusion();
+            mahony->setGains( mahonyKp_, mahonyKi_ );
+            fusion = mahony;
+            break;
+        }
+
+        default:
+            emit error( QString("Sensors: Unknown fusion algorithm") );
+            return false;
+    }
+
+    fusionMutex_.lock();
+    old = fusion_;
+    fusion_ = fusion;
+    fusionAlg_ = algorithm;
+    fusionMutex_.unlock();
+
+    delete old;
+
+    //*** while running, RTIMU's fusion changes at the next start ***
+    if ( !started_ )
+    {
+        configureImuFusion();
+    }
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief setMadgwickBeta - Madgwick filter gain
+ * @param beta - gradient step gain
+ */
+//******************************************************************************
+void SHSensors::setMadgwickBeta( float beta )
+{
+QMutexLocker lock( &fusionMutex_ );
+
+    madgwickBeta_ = beta;
+
+    if ( fusionAlg_ == FUSION_MADGWICK )
+    {
+        static_cast<SHMadgwickFusion *>( fusion_ )->setBeta( beta );
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief setMahonyGains - Mahony filter gains
+ * @param kp - proportional gain
+ * @param ki - integral gain
+ */
+//******************************************************************************
+void SHSensors::setMahonyGains( float kp, float ki )
+{
+QMutexLocker lock( &fusionMutex_ );
+
+    mahonyKp_ = kp;
+    mahonyKi_ = ki;
+
+    if ( fusionAlg_ == FUSION_MAHONY )
+    {
+        static_cast<SHMahonyFusion *>( fusion_ )->setGains( kp, ki );
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::configureImuFusion - RTIMU builds its fusion object when
+ *              it is created, so turning its fusion off (or back on) means
+ *              recreating the IMU. Only called while updates are stopped
+ */
+//******************************************************************************
+void SHSensors::configureImuFusion()
+{
+int wanted = ( fusionAlg_ == FUSION_RTIMU ) ? imuFusionType_ : RTFUSION_TYPE_NULL;
+
+    //*** replayed logs and the simulator carry their own fusion ***
+    if ( !validIMU_ || replaySource_ || simSource_ || settings_->m_fusionType == wanted ) return;
+
+    settings_->m_fusionType = wanted;
+    recreateImu();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::recreateImu - create the IMU again from settings_, which
+ *              RTIMU only reads when it is created. Only called while
+ *              updates are stopped
+ */
+//******************************************************************************
+void SHSensors::recreateImu()
+{
+    delete imu_;
+
+    imu_ = RTIMU::createIMU( settings_ );
+
+    if ( (imu_ == NULL) || (imu_->IMUType() == RTIMU_TYPE_NULL) )
+    {
+        validIMU_ = false;
+        ready_ = false;
+        emit error( "Sensors: No valid IMU found!!!" );
+        return;
+    }
+
+    imu_->IMUInit();
+    imu_->setSlerpPower( 0.02 );
+
+    //*** restore the enabled sensors ***
+    wakeImu();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::applyFusion - run the library fusion on a sample
+ * @param imuData - RTIMU data, fusion outputs replaced
+ */
+//******************************************************************************
+void SHSensors::applyFusion( RTIMU_DATA &imuData )
+{
+    QMutexLocker lock( &fusionMutex_ );
+
+    if ( fusion_ )
+    {
+        fusion_->newIMUData( imuData );
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief setStateCache - keep the fusion state in a cache file
+ * @param fileName        - cache file, empty to disable
+ * @param saveIntervalSec - periodic save interval, 0 for none
+ * @param maxTempDeltaC   - largest temperature change accepted
+ */
+//******************************************************************************
+void SHSensors::setStateCache( QString fileName, int saveIntervalSec, float maxTempDeltaC )
+{
+    stateFile_ = fileName;
+    maxTempDeltaC_ = maxTempDeltaC;
+    stateSnapshots_ = !fileName.isEmpty();
+
+    if ( !stateTimer_ )
+    {
+        stateTimer_ = new QTimer( this );
+        connect( stateTimer_, SIGNAL(timeout()), SLOT(saveState()) );
+    }
+
+    if ( fileName.isEmpty() || saveIntervalSec <= 0 )
+    {
+        stateTimer_->stop();
+        return;
+    }
+
+    stateTimer_->start( saveIntervalSec * 1000 );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief saveState - write the latest state snapshot to the cache. While
+ *              updates run the acquisition path takes the snapshots; when
+ *              stopped, one is taken here
+ * @return - TRUE if written, FALSE if there was nothing to save or an error
+ */
+//******************************************************************************
+bool SHSensors::saveState()
+{
+ImuStateSnapshot snapshot;
+ImuStateCache cache;
+
+    if ( stateFile_.isEmpty() || !validIMU_ || replaySource_ || simSource_ ) return false;
+
+    if ( !started_ )
+    {
+        acquireMutex_.lock();
+        snapshotState( true );
+        acquireMutex_.unlock();
+    }
+
+    //*** nothing learned yet - keep the previous cache ***
+    snapshot = stateLock_.load();
+    if ( !snapshot.valid ) return false;
+
+    memset( &cache, 0, sizeof(cache) );
+    memcpy( cache.magic, StateCacheMagic, sizeof(cache.magic) );
+    cache.version = StateCacheVersion;
+    cache.settingsHash = settingsHash( imu_, settings_ );
+    cache.savedAtSec = time( NULL );
+    cache.temperature = snapshot.temperature;
+    cache.temperatureValid = snapshot.temperatureValid;
+    cache.fusionAlgorithm = snapshot.fusionAlgorithm;
+    cache.fusionValid = snapshot.fusionValid;
+    cache.fusion = snapshot.fusion;
+    cache.gyroBiasValid = snapshot.gyroBiasValid;
+    memcpy( cache.gyroBias, snapshot.gyroBias, sizeof(cache.gyroBias) );
+
+    //*** replace the old cache atomically ***
+    QSaveFile file( stateFile_ );
+    if ( !file.open( QIODevice::WriteOnly ) ||
+         file.write( (const char *)&cache, sizeof(cache) ) != sizeof(cache) ||
+         !file.commit() )
+    {
+        emit error( QString("Sensors: Could not write state cache %1").arg(stateFile_) );
+        return false;
+    }
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::snapshotState - copy the state worth caching into
+ *              stateLock_. Runs on the acquisition path, or with it stopped
+ *              and acquireMutex_ held, so writes are serialized
+ * @param useBus - TRUE to read the temperature from the bus if need be
+ */
+//******************************************************************************
+void SHSensors::snapshotState( bool useBus )
+{
+ImuStateSnapshot snapshot;
+
+    memset( &snapshot, 0, sizeof(snapshot) );
+
+    //*** the state is only worth keeping once the gyro bias is learned ***
+    snapshot.valid = imu_->IMUGyroBiasValid() ? 1 : 0;
+    snapshot.temperatureValid = readTemperature( snapshot.temperature, useBus ) ? 1 : 0;
+
+    //*** RTIMU's bias, as it hands it to its settings once learned ***
+    if ( settings_->m_gyroBiasValid )
+    {
+        snapshot.gyroBiasValid = 1;
+        snapshot.gyroBias[0] = settings_->m_gyroBias.x();
+        snapshot.gyroBias[1] = settings_->m_gyroBias.y();
+        snapshot.gyroBias[2] = settings_->m_gyroBias.z();
+    }
+
+    fusionMutex_.lock();
+    snapshot.fusionAlgorithm = fusionAlg_;
+    if ( fusion_ && fusion_->getState( snapshot.fusion ) )
+    {
+        snapshot.fusionValid = 1;
+    }
+    fusionMutex_.unlock();
+
+    stateLock_.store( snapshot );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::restoreState - seed RTIMU's gyro bias and the library
+ *              fusion from the state cache when it was learned under the
+ *              same settings and temperature. Otherwise RTIMU relearns the
+ *              bias rather than take the one in its settings file, which
+ *              knows nothing of temperature. Called while updates are stopped
+ * @return - TRUE if restored, else FALSE
+ */
+//******************************************************************************
+bool SHSensors::restoreState()
+{
+ImuStateCache cache;
+QFile file( stateFile_ );
+float tempC = 0.0;
+bool tempValid;
+bool seeded = false;
+
+    stateRestored_ = false;
+
+    if ( stateFile_.isEmpty() || !validIMU_ || replaySource_ || simSource_ ) return false;
+
+    //*** no cache yet is normal on the first run ***
+    if ( !file.open( QIODevice::ReadOnly ) ) return false;
+
+    if ( file.read( (char *)&cache, sizeof(cache) ) != sizeof(cache) ||
+         memcmp( cache.magic, StateCacheMagic, sizeof(cache.magic) ) != 0 ||
+         cache.version != StateCacheVersion )
+    {
+        qDebug() << "Ignoring invalid state cache" << stateFile_;
+        forgetGyroBias();
+        return false;
+    }
+
+    if ( cache.settingsHash != settingsHash( imu_, settings_ ) )
+    {
+        qDebug() << "IMU settings changed, not using state cache";
+        forgetGyroBias();
+        return false;
+    }
+
+    //*** the gyro bias and the fusion's bias correction drift with temperature ***
+    tempValid = readTemperature( tempC, true );
+    if ( tempValid != ( cache.temperatureValid != 0 ) ||
+         ( tempValid && fabs( tempC - cache.temperature ) > maxTempDeltaC_ ) )
+    {
+        qDebug() << "Temperature changed, not using state cache";
+        forgetGyroBias();
+        return false;
+    }
+
+    //*** RTIMU takes the bias from its settings when it is created ***
+    if ( cache.gyroBiasValid )
+    {
+        RTVector3 bias( cache.gyroBias[0], cache.gyroBias[1], cache.gyroBias[2] );
+
+        if ( !settings_->m_gyroBiasValid ||
+             settings_->m_gyroBias.x() != bias.x() ||
+             settings_->m_gyroBias.y() != bias.y() ||
+             settings_->m_gyroBias.z() != bias.z() )
+        {
+            settings_->m_gyroBias = bias;
+            settings_->m_gyroBiasValid = true;
+            recreateImu();
+        }
+        seeded = validIMU_;
+    }
+
+    //*** library fusion continues from the saved orientation ***
+    fusionMutex_.lock();
+    if ( cache.fusionValid && cache.fusionAlgorithm == fusionAlg_ && fusion_ )
+    {
+        fusion_->setState( cache.fusion );
+        seeded = true;
+    }
+    fusionMutex_.unlock();
+
+    stateRestored_ = seeded;
+    if ( !stateRestored_ ) return false;
+
+    qDebug() << "IMU state restored from" << stateFile_;
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::forgetGyroBias - make RTIMU learn the gyro bias again
+ *              when the cache cannot vouch for the one in its settings
+ */
+//******************************************************************************
+void SHSensors::forgetGyroBias()
+{
+    if ( !settings_->m_gyroBiasValid ) return;
+
+    settings_->m_gyroBiasValid = false;
+    recreateImu();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::readTemperature - current temperature for the state cache
+ * @param tempC  - receives the temperature
+ * @param useBus - TRUE to read the sensors directly when no reading is
+ *                 available. Only while the acquisition path is stopped
+ * @return - TRUE if a temperature was found
+ */
+//******************************************************************************
+bool SHSensors::readTemperature( float &tempC, bool useBus )
+{
+SensorSample latest = getLatestSample();
+RTIMU_DATA data = imu_->getIMUData();
+
+    if ( latest.valid & IMU_TEMP )
+    {
+        tempC = latest.temperature;
+        return true;
+    }
+
+    if ( !useBus ) return false;
+
+    data.temperatureValid = false;
+
+    if ( pressure_ && pressure_->pressureRead( data ) && data.temperatureValid )
+    {
+        tempC = data.temperature;
+        return true;
+    }
+
+    if ( humidity_ && humidity_->humidityRead( data ) && data.temperatureValid )
+    {
+        tempC = data.temperature;
+        return true;
+    }
+
+    return false;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief startSpectrum - start vibration spectrum mode
+ * @param blockSize - samples per block, power of 2
+ * @param overlap   - samples shared by consecutive blocks
+ * @param axis      - accelerometer axis or magnitude
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSensors::startSpectrum( int blockSize, int overlap, SpectrumAxis axis )
+{
+SHSpectrumAnalyzer *analyzer = new SHSpectrumAnalyzer();
+SHSpectrumAnalyzer *old;
+
+    //*** all buffers are allocated here, off the acquisition path ***
+    //*** the IMU rate is replaced later by the measured one ***
+    if ( !analyzer->configure( blockSize, overlap, imuSampleRate() ) ||
+         !analyzer->setBands( spectrumEdges_, spectrumEdgeCount_ ) )
+    {
+        delete analyzer;
+        emit error( QString("Sensors: Invalid spectrum block size or overlap") );
+        return false;
+    }
+
+    spectrumMutex_.lock();
+    old = spectrum_;
+    spectrum_ = analyzer;
+    spectrumAxis_ = axis;
+    spectrumMutex_.unlock();
+
+    delete old;
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief stopSpectrum - leave vibration spectrum mode
+ */
+//******************************************************************************
+void SHSensors::stopSpectrum()
+{
+SHSpectrumAnalyzer *old;
+
+    spectrumMutex_.lock();
+    old = spectrum_;
+    spectrum_ = 0;
+    spectrumMutex_.unlock();
+
+    delete old;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief startMotionEvents - run motion detectors on the acquisition side
+ * @param config - detectors to run and their thresholds
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSensors::startMotionEvents( const MotionDetectorConfig &config )
+{
+SHMotionDetector *detector;
+SHMotionDetector *old;
+
+    if ( ( config.detectors & DETECT_ALL ) == 0 )
+    {
+        emit error( QString("Sensors: No motion detectors selected") );
+        return false;
+    }
+
+    detector = new SHMotionDetector();
+    detector->configure( config );
+
+    motionMutex_.lock();
+    old = motion_;
+    motion_ = detector;
+    motionChannels_ = IMU_ACCEL | ( ( config.detectors & DETECT_STILL ) ? IMU_GYRO : 0 );
+    motionMutex_.unlock();
+
+    delete old;
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief stopMotionEvents - stop the motion detectors
+ */
+//******************************************************************************
+void SHSensors::stopMotionEvents()
+{
+SHMotionDetector *old;
+
+    motionMutex_.lock();
+    old = motion_;
+    motion_ = 0;
+    motionChannels_ = 0;
+    motionMutex_.unlock();
+
+    delete old;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief startAlignment - resample channels onto a common output clock
+ * @param channels      - 'OR' of ImuSensors channels
+ * @param outputHz      - output clock rate
+ * @param interpolation - linear or zero-order hold
+ * @param maxDelayMs    - longest a frame waits for slow channels
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSensors::startAlignment( quint8 channels, double outputHz,
+                                AlignInterpolation interpolation, int maxDelayMs )
+{
+SHChannelAligner *aligner;
+SHChannelAligner *old;
+
+    if ( channels == 0 || outputHz <= 0.0 || maxDelayMs < 0 )
+    {
+        emit error( QString("Sensors: Invalid alignment settings") );
+        return false;
+    }
+
+    //*** yaw wraps at +/-180 degrees ***
+    aligner = new SHChannelAligner();
+    aligner->configure( channels, (qint64)( NSecPerSec / outputHz ), interpolation,
+                        (qint64)maxDelayMs * 1000000, IMU_FUSION );
+
+    alignMutex_.lock();
+    old = align_;
+    align_ = aligner;
+    alignChannels_ = channels;
+    alignMutex_.unlock();
+
+    delete old;
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief stopAlignment - stop producing aligned frames
+ */
+//******************************************************************************
+void SHSensors::stopAlignment()
+{
+SHChannelAligner *old;
+
+    alignMutex_.lock();
+    old = align_;
+    align_ = 0;
+    alignChannels_ = 0;
+    alignMutex_.unlock();
+
+    delete old;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief alignStats - aligner statistics
+ * @return - statistics, zero if alignment is off
+ */
+//******************************************************************************
+AlignStats SHSensors::alignStats()
+{
+QMutexLocker aLock( &alignMutex_ );
+AlignStats stats;
+
+    if ( align_ ) return align_->stats();
+
+    memset( &stats, 0, sizeof(stats) );
+    return stats;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief setSpectrumBands - set the spectrum band edges
+ * @param edgesHz   - ascending band edges
+ * @param edgeCount - 0 for the default, or 2 to SpectrumMaxBands+1
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSensors::setSpectrumBands( const float *edgesHz, int edgeCount )
+{
+QMutexLocker lock( &spectrumMutex_ );
+
+    if ( edgeCount < 0 || edgeCount == 1 || edgeCount > SpectrumMaxBands + 1 )
+    {
+        emit error( QString("Sensors: Invalid spectrum bands") );
+        return false;
+    }
+
+    //*** applies now, and to the next startSpectrum() ***
+    if ( spectrum_ && !spectrum_->setBands( edgesHz, edgeCount ) )
+    {
+        emit error( QString("Sensors: Invalid spectrum bands") );
+        return false;
+    }
+
+    memcpy( spectrumEdges_, edgesHz, edgeCount * sizeof(float) );
+    spectrumEdgeCount_ = edgeCount;
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::spectrumSample - add an accelerometer sample to the
+ *              spectrum block, emitting spectrum() when a block completes
+ * @param sample - full rate sample
+ */
+//******************************************************************************
+void SHSensors::spectrumSample( const SensorSample &sample )
+{
+SpectrumResult result;
+float value;
+bool ready = false;
+
+    switch ( spectrumAxis_ )
+    {
+        case SPECTRUM_X: value = sample.accel[0]; break;
+        case SPECTRUM_Y: value = sample.accel[1]; break;
+        case SPECTRUM_Z: value = sample.accel[2]; break;
+        default:
+            value = sqrtf( sample.accel[0] * sample.accel[0] +
+                           sample.accel[1] * sample.accel[1] +
+                           sample.accel[2] * sample.accel[2] );
+            break;
+    }
+
+    spectrumMutex_.lock();
+    if ( spectrum_ && spectrum_->add( sample.timestampNs, value ) )
+    {
+        result = spectrum_->result();
+        ready = true;
+    }
+    spectrumMutex_.unlock();
+
+    if ( ready )
+    {
+        emit spectrum( result );
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::motionSample - run the motion detectors on a sample
+ * @param sample - sample with accelerometer data
+ */
+//******************************************************************************
+void SHSensors::motionSample( const SensorSample &sample )
+{
+MotionEvent events[MotionMaxEvents];
+int count = 0;
+
+    motionMutex_.lock();
+    if ( motion_ )
+    {
+        count = motion_->add( sample.timestampNs, sample.accel,
+                              ( sample.valid & IMU_GYRO ) ? sample.gyro : 0, events );
+    }
+    motionMutex_.unlock();
+
+    //*** outside the lock - receivers may reconfigure ***
+    for ( int i=0; i<count; i++ )
+    {
+        emit motionEvent( events[i] );
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::alignSample - feed channels of a sample to the aligner
+ *              and emit the frames they complete
+ * @param sample   - readings, all taken at sample.timestampNs
+ * @param channels - 'OR' of the ImuSensors channels to feed
+ */
+//******************************************************************************
+void SHSensors::alignSample( const SensorSample &sample, quint8 channels )
+{
+AlignedFrame frames[AlignMaxFrames];
+int count = 0;
+int components;
+
+    alignMutex_.lock();
+    if ( align_ )
+    {
+        for ( int i=0; i<ImuChannelCount; i++ )
+        {
+            if ( !( channels & ( 1 << i ) ) ) continue;
+
+            //*** pressure carries its altitude ***
+            if ( ( 1 << i ) == IMU_PRESSURE ) components = 2;
+            else if ( ( 1 << i ) & ( IMU_TEMP | IMU_HUMIDITY ) ) components = 1;
+            else components = 3;
+
+            count = align_->add( i, sample.timestampNs, channelValues( sample, i ),
+                                 components, frames );
+
+            //*** outside the lock - receivers may reconfigure ***
+            if ( count > 0 )
+            {
+                alignMutex_.unlock();
+                for ( int f=0; f<count; f++ )
+                {
+                    emit alignedFrame( frames[f] );
+                }
+                alignMutex_.lock();
+                if ( !align_ ) break;
+            }
+        }
+    }
+    alignMutex_.unlock();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::recordSample - append the IMU data, plus environmental
+ *              readings taken since the last sample, to the sensor log
+ * @param imuData - RTIMU data of the sample
+ */
+//******************************************************************************
+void SHSensors::recordSample( const RTIMU_DATA &imuData )
+{
+SensorLogRecord rec;
+
+    logRecordFromImuData( imuData, rec );
+
+    if ( logPending_.valid & IMU_PRESSURE )
+    {
+        rec.pressure = logPending_.pressure;
+        rec.temperature = logPending_.temperature;
+    }
+
+    if ( logPending_.valid & IMU_HUMIDITY )
+    {
+        rec.humidity = logPending_.humidity;
+    }
+
+    rec.valid |= logPending_.valid;
+    logPending_.valid = 0;
+
+    logWriter_.append( rec );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::storeSample - append channels of a sample to the
+ *              time-series store, one series per component. The store keeps
+ *              wall clock time, so the monotonic timestamp is converted
+ * @param sample   - readings, all taken at sample.timestampNs
+ * @param channels - 'OR' of the ImuSensors channels to store
+ */
+//******************************************************************************
+void SHSensors::storeSample( const SensorSample &sample, quint8 channels )
+{
+struct timespec wall;
+const float *values;
+qint64 timeMs;
+int components;
+
+    clock_gettime( CLOCK_REALTIME, &wall );
+    timeMs = ( (qint64)wall.tv_sec * NSecPerSec + wall.tv_nsec - monotonicNs() + sample.timestampNs ) / 1000000;
+
+    for ( int i=0; i<ImuChannelCount; i++ )
+    {
+        if ( !( channels & ( 1 << i ) ) ) continue;
+
+        components = ( ( 1 << i ) & ( IMU_PRESSURE | IMU_TEMP | IMU_HUMIDITY ) ) ? 1 : 3;
+        values = channelValues( sample, i );
+
+        for ( int c=0; c<components; c++ )
+        {
+            seriesWriter_.append( timeSeriesId( (ImuSensors)( 1 << i ), c ), timeMs, values[c] );
+        }
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::countSample - sample rate accounting. Each sample is due
+ *              one sample period after the one before on the IMU's sample
+ *              clock. Read timestamps are late by up to the poll latency, so
+ *              the clock follows the earliest of them and never a late one
+ * @param imuTimestamp - RTIMU timestamp of the sample (usecs)
+ */
+//******************************************************************************
+void SHSensors::countSample( quint64 imuTimestamp )
+{
+qint64 periodUs = samplePeriodUs_.load();
+
+    samplesRead_.fetchAndAddRelaxed( 1 );
+
+    if ( lastImuTimestamp_ == 0 || periodUs <= 0 )
+    {
+        sampleClockUs_ = imuTimestamp;
+    }
+    else
+    {
+        sampleClockUs_ += periodUs;
+
+        //*** read sooner after its sample than before - the clock was behind ***
+        if ( imuTimestamp < sampleClockUs_ ) sampleClockUs_ = imuTimestamp;
+    }
+
+    lastImuTimestamp_ = imuTimestamp;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::countDrops - count the samples missed before the last one
+ *              counted. A sample read a full period or more after it was due
+ *              on the sample clock is a later one, the due samples having
+ *              been overwritten. Called with the freshest sample of a pass,
+ *              as samples drained from a backlog are all read late
+ */
+//******************************************************************************
+void SHSensors::countDrops()
+{
+qint64 periodUs = samplePeriodUs_.load();
+qint64 lagUs;
+qint64 missing;
+
+    if ( lastImuTimestamp_ == 0 || periodUs <= 0 ) return;
+
+    lagUs = (qint64)( lastImuTimestamp_ - sampleClockUs_ );
+    if ( lagUs < periodUs ) return;
+
+    missing = lagUs / periodUs;
+    samplesDropped_.fetchAndAddRelaxed( missing );
+    sampleClockUs_ += missing * periodUs;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::emitChannels - emit the per-channel signals for a sample
+ * @param sample - sample to emit
+ */
+//******************************************************************************
+void SHSensors::emitChannels( const SensorSample &sample )
 {
 const float fToC = 9.0 / 5.0;
 const float fOffset = 32;
 
-    //*** read all data ***
-    while ( imu_->IMURead() )
+    if ( sample.valid & IMU_PRESSURE )
     {
-        //*** get IMU data ***
-        RTIMU_DATA imuData = imu_->getIMUData();
+        emit pressure( sample.pressure, sample.altitude );
+    }
 
-        //*** pressure / temperature ***
-        if ( ((enabled_ & IMU_PRESSURE) || (enabled_ & IMU_TEMP)) && pressure_ )
-        {
-            pressure_->pressureRead( imuData );
+    if ( sample.valid & IMU_TEMP )
+    {
+        //*** temp celsius, fahrenheit ***
+        emit temperature( sample.temperature, sample.temperature * fToC + fOffset );
+    }
 
-            if ( enabled_ & IMU_PRESSURE )
-            {
-                //*** pressure in hPa ***
-                emit pressure( imuData.pressure, RTMath::convertPressureToHeight(imuData.pressure) );
-            }
+    if ( sample.valid & IMU_HUMIDITY )
+    {
+        emit humidity( sample.humidity );
+    }
 
-            if ( enabled_ & IMU_TEMP )
-            {
-                //*** temp celsius, fahrenheit ***
-                emit temperature( imuData.temperature,
-                                  imuData.temperature * fToC + fOffset );
-            }
-        }
+    if ( sample.valid & IMU_GYRO )
+    {
+        emit gyro( sample.gyro[0], sample.gyro[1], sample.gyro[2] );
+    }
 
-        //*** humidity ***
-        if ( (enabled_ & IMU_HUMIDITY) && humidity_ )
-        {
-            humidity_->humidityRead( imuData );
+    if ( sample.valid & IMU_ACCEL )
+    {
+        emit accel( sample.accel[0], sample.accel[1], sample.accel[2],
+                    sqrt( sample.accel[0] * sample.accel[0] +
+                          sample.accel[1] * sample.accel[1] +
+                          sample.accel[2] * sample.accel[2] ) );
+    }
 
-            //*** relative humidity ***
-            emit humidity( imuData.humidity );
-        }
+    if ( sample.valid & IMU_COMPASS )
+    {
+        emit compass( sample.compass[0], sample.compass[1], sample.compass[2],
+                      sqrt( sample.compass[0] * sample.compass[0] +
+                            sample.compass[1] * sample.compass[1] +
+                            sample.compass[2] * sample.compass[2] ) );
+    }
+
+    if ( sample.valid & IMU_FUSION )
+    {
+        emit fusionPose( sample.fusionPose[0], sample.fusionPose[1], sample.fusionPose[2] );
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::publishLatest - merge the channels of a sample into the
+ *              latest values and publish them through the seqlock
+ * @param sample - new sample
+ */
+//******************************************************************************
+void SHSensors::publishLatest( const SensorSample &sample )
+{
+    latest_.timestampNs = sample.timestampNs;
+    latest_.valid |= sample.valid;
+
+    if ( sample.valid & IMU_PRESSURE )
+    {
+        latest_.pressure = sample.pressure;
+        latest_.altitude = sample.altitude;
+    }
+
+    if ( sample.valid & IMU_TEMP )     latest_.temperature = sample.temperature;
+    if ( sample.valid & IMU_HUMIDITY ) latest_.humidity = sample.humidity;
+    if ( sample.valid & IMU_GYRO )     memcpy( latest_.gyro, sample.gyro, sizeof(latest_.gyro) );
+    if ( sample.valid & IMU_ACCEL )    memcpy( latest_.accel, sample.accel, sizeof(latest_.accel) );
+    if ( sample.valid & IMU_COMPASS )  memcpy( latest_.compass, sample.compass, sizeof(latest_.compass) );
+    if ( sample.valid & IMU_FUSION )   memcpy( latest_.fusionPose, sample.fusionPose, sizeof(latest_.fusionPose) );
+
+    latestLock_.store( latest_ );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::publishShared - write a sample to the shared memory ring,
+ *              now and then checking for readers that fell behind
+ * @param sample - sample to publish
+ */
+//******************************************************************************
+void SHSensors::publishShared( const SensorSample &sample )
+{
+SharedReaderStatus slow[SharedRingMaxReaders];
+int slowCount = 0;
+
+    ring_->write( sample );
+
+    if ( ++ringWrites_ % RingCheckInterval != 0 ) return;
+
+    ring_->checkReaders( 0, 0, slow, &slowCount );
+
+    for ( int i=0; i<slowCount; i++ )
+    {
+        emit slowReader( slow[i].pid, slow[i].lag, slow[i].lost );
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::appendSample - add a sample to the current batch and
+ *              deliver the batch when it reaches the batch size
+ * @param sample - sample to add
+ */
+//******************************************************************************
+void SHSensors::appendSample( const SensorSample &sample )
+{
+    if ( batch_.count == 0 )
+    {
+        batchStartNs_ = monotonicNs();
+        batch_.samples.reserve( batchSize_ );
+    }
+
+    batch_.samples.append( sample );
+    batch_.count++;
+
+    if ( batch_.count >= batchSize_ )
+    {
+        flushBatch();
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSensors::flushBatch - deliver the current batch, full or not. The
+ *              payload holds only the samples collected, so a batch of one
+ *              costs one sample
+ */
+//******************************************************************************
+void SHSensors::flushBatch()
+{
+    if ( batch_.count == 0 ) return;
+
+    //*** direct callback first, then the (queued) signal ***
+    if ( batchHandler_ )
+    {
+        batchHandler_->handleBatch( batch_ );
+    }
+
+    emit sampleBatch( batch_ );
+
+    //*** a queued copy keeps its own data - this starts a fresh one ***
+    batch_.samples.clear();
+    batch_.count = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+//
+// Sensor acquisition thread
+//
+//******************************************************************************
+//******************************************************************************
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SensorThread::SensorThread
+ * @param sensors - sensors to read
+ * @param parent
+ */
+//******************************************************************************
+SensorThread::SensorThread( SHSensors *sensors, QObject *parent )
+    : QThread( parent )
+{
+    sensors_ = sensors;
+    periodNs_.store( 200 * 1000000LL );
+    priority_ = 0;
+    cpu_ = -1;
+    resetTimingStats();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SensorThread::setPeriodNs - set the acquisition period
+ * @param periodNs - period in nanoseconds
+ */
+//******************************************************************************
+void SensorThread::setPeriodNs( qint64 periodNs )
+{
+    periodNs_.store( qMax( periodNs, (qint64)1 ) );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SensorThread::setRealtime - set scheduling parameters. Takes effect
+ *              the next time the thread is started
+ * @param priority - SCHED_FIFO priority, or 0 for normal scheduling
+ * @param cpu      - CPU to pin to, or -1 for any
+ */
+//******************************************************************************
+void SensorThread::setRealtime( int priority, int cpu )
+{
+    priority_ = priority;
+    cpu_ = cpu;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SensorThread::timingStats - scheduling statistics
+ * @return - copy of current statistics
+ */
+//******************************************************************************
+AcqTimingStats SensorThread::timingStats()
+{
+QMutexLocker sLock( &statsMutex_ );
+AcqTimingStats stats = stats_;
+
+    if ( stats.cycles > 1 )
+    {
+        stats.jitterNs = sqrt( latencyM2_ / ( stats.cycles - 1 ) );
+    }
+
+    return stats;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SensorThread::resetTimingStats - clear statistics
+ */
+//******************************************************************************
+void SensorThread::resetTimingStats()
+{
+QMutexLocker sLock( &statsMutex_ );
+
+    memset( &stats_, 0, sizeof(stats_) );
+    latencyM2_ = 0.0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SensorThread::applyScheduling - apply priority and CPU affinity
+ */
+//******************************************************************************
+void SensorThread::applyScheduling()
+{
+    //*** realtime FIFO scheduling ***
+    if ( priority_ > 0 )
+    {
+        struct sched_param param;
+        memset( &param, 0, sizeof(param) );
+        param.sched_priority = qBound( sched_get_priority_min( SCHED_FIFO ),
+                                       priority_,
+                                       sched_get_priority_max( SCHED_FIFO ) );
 
-        //*** gyroscope ***
-        if ( enabled_ & IMU_GYRO )
+        if ( pthread_setschedparam( pthread_self(), SCHED_FIFO, &param ) != 0 )
         {
-            //*** gyroscope in degrees per second ***
-            emit gyro( imuData.gyro.x() * RTMATH_RAD_TO_DEGREE,
-                       imuData.gyro.y() * RTMATH_RAD_TO_DEGREE,
-                       imuData.gyro.z() * RTMATH_RAD_TO_DEGREE );
+            emit error( QString("Sensors: Could not set SCHED_FIFO priority %1").arg(priority_) );
         }
+    }
+
+    //*** pin to a CPU ***
+    if ( cpu_ >= 0 )
+    {
+        cpu_set_t cpuSet;
+        CPU_ZERO( &cpuSet );
+        CPU_SET( cpu_, &cpuSet );
 
-        //*** accelerometer ***
-        if ( enabled_ & IMU_ACCEL )
+        if ( pthread_setaffinity_np( pthread_self(), sizeof(cpuSet), &cpuSet ) != 0 )
         {
-            //*** acceleration in g's ***'
-            emit accel( imuData.accel.x(), imuData.accel.y(),
-                        imuData.accel.z(), imuData.accel.length() );
+            emit error( QString("Sensors: Could not set CPU affinity to %1").arg(cpu_) );
         }
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SensorThread::run - sleep to each absolute deadline, then read
+ */
+//******************************************************************************
+void SensorThread::run()
+{
+struct timespec deadline;       // next absolute wakeup time
+struct timespec now;            // actual wakeup time
+qint64 deadlineNs = 0;
+qint64 nowNs = 0;
+qint64 latencyNs = 0;
+qint64 periodNs = 0;
+
+    applyScheduling();
+
+    //*** first deadline is one period from now ***
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    deadlineNs = (qint64)now.tv_sec * NSecPerSec + now.tv_nsec;
+
+    while ( !isInterruptionRequested() )
+    {
+        //*** advance the deadline by exactly one period - no drift ***
+        periodNs = periodNs_.load();
+        deadlineNs += periodNs;
+        deadline.tv_sec  = deadlineNs / NSecPerSec;
+        deadline.tv_nsec = deadlineNs % NSecPerSec;
+
+        //*** sleep to the deadline, resuming after signals ***
+        while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, 0 ) == EINTR ) {}
+
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        nowNs = (qint64)now.tv_sec * NSecPerSec + now.tv_nsec;
+        latencyNs = nowNs - deadlineNs;
+        sensors_->instr_.add( HIST_TIMER_LATENESS, latencyNs );
+
+        //*** read the sensors ***
+        sensors_->acquire();
 
-        //*** compass ***
-        if ( enabled_ & IMU_COMPASS )
+        //*** update statistics (Welford) ***
         {
-            //*** compas (magnetometer) in uT ***
-            emit compass( imuData.compass.x(), imuData.compass.y(),
-                          imuData.compass.z(), imuData.compass.length() );
+            QMutexLocker sLock( &statsMutex_ );
+
+            stats_.cycles++;
+            if ( stats_.cycles == 1 || latencyNs < stats_.minLatencyNs ) stats_.minLatencyNs = latencyNs;
+            if ( stats_.cycles == 1 || latencyNs > stats_.maxLatencyNs ) stats_.maxLatencyNs = latencyNs;
+
+            double delta = latencyNs - stats_.meanLatencyNs;
+            stats_.meanLatencyNs += delta / stats_.cycles;
+            latencyM2_ += delta * ( latencyNs - stats_.meanLatencyNs );
         }
 
-        //*** always emit fusion data - degrees ***
-        float fusionX = imuData.fusionPose.x() * RTMATH_RAD_TO_DEGREE;
-        float fusionY = imuData.fusionPose.y() * RTMATH_RAD_TO_DEGREE;
-        float fusionZ = imuData.fusionPose.z() * RTMATH_RAD_TO_DEGREE;
-        emit fusionPose( fusionX, fusionY, fusionZ );
+        //*** skip deadlines that already passed rather than bursting ***
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        nowNs = (qint64)now.tv_sec * NSecPerSec + now.tv_nsec;
+        if ( nowNs >= deadlineNs + periodNs )
+        {
+            qint64 missed = ( nowNs - deadlineNs ) / periodNs;
+            deadlineNs += missed * periodNs;
+
+            QMutexLocker sLock( &statsMutex_ );
+            stats_.overruns += missed;
+        }
     }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+//
+// Burst capture thread
+//
+//******************************************************************************
+//******************************************************************************
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief BurstThread::BurstThread
+ * @param sensors - sensors to read
+ * @param parent
+ */
+//******************************************************************************
+BurstThread::BurstThread( SHSensors *sensors, QObject *parent )
+    : QThread( parent )
+{
+    sensors_ = sensors;
+    buffer_ = 0;
+    count_ = 0;
+    timeoutMs_ = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief BurstThread::setBurst - set the capture to run
+ * @param buffer    - receives the samples
+ * @param count     - samples to capture
+ * @param timeoutMs - longest time the burst may take
+ */
+//******************************************************************************
+void BurstThread::setBurst( SensorSample *buffer, int count, int timeoutMs )
+{
+    buffer_ = buffer;
+    count_ = count;
+    timeoutMs_ = timeoutMs;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief BurstThread::run - capture, then report
+ */
+//******************************************************************************
+void BurstThread::run()
+{
+BurstStats stats = sensors_->captureBurst( buffer_, count_, timeoutMs_ );
 
+    emit sensors_->burstComplete( stats );
 }
@@ -14,8 +14,27 @@
 
 #include <QObject>
 #include <QTimer>
+#include <QThread>
+#include <QMutex>
+#include <QMetaMethod>
+#include <QAtomicInt>
+#include <QVector>
 
 #include "RTIMULib.h"
+#include "SHSeqLock.h"
+#include "SHSensorLog.h"
+#include "SHSensorStats.h"
+#include "SHSpectrum.h"
+#include "SHFusion.h"
+#include "SHMotionEvents.h"
+#include "SHAlign.h"
+#include "SHTimeSeries.h"
+#include "SHSimSensors.h"
+#include "SHInstrument.h"
+
+class SHReplaySource;
+class SHSharedRingWriter;
+struct SharedReaderStatus;
 
 //*** used in enableSensors() call ***
 typedef enum
@@ -26,9 +45,299 @@ typedef enum
     IMU_ACCEL    = 0x10,
     IMU_COMPASS  = 0x20,
     IMU_TEMP     = 0x40,
-    IMU_ALL      = 0x7F
+    IMU_ALL      = 0x7F,
+    IMU_FUSION   = 0x80         // fusion pose - always computed, not enabled
 } ImuSensors;
 
+//*** number of ImuSensors channel bits ***
+const int ImuChannelCount = 8;
+
+//*** bus transactions - each serves one or more channels ***
+enum BusTransaction { BUS_IMU, BUS_PRESSURE, BUS_HUMIDITY, BUS_COUNT };
+
+//*** bus time used by one kind of transaction ***
+struct BusTimeStats
+{
+    quint64 transactions;       // number of reads
+    qint64 totalNs;             // time spent in reads
+    qint64 maxNs;               // longest read
+    double busShare;            // fraction of elapsed time spent in reads
+};
+
+//*** one complete reading of all channels ***
+struct SensorSample
+{
+    qint64 timestampNs;         // CLOCK_MONOTONIC time of the read
+    quint32 valid;              // 'OR' of ImuSensors bits for the valid channels
+    float pressure;             // hPa
+    float altitude;             // meters
+    float temperature;          // celsius
+    float humidity;             // % relative humidity
+    float gyro[3];              // degrees per second
+    float accel[3];             // g
+    float compass[3];           // uT
+    float fusionPose[3];        // roll, pitch, yaw in degrees
+};
+
+//*** block of samples delivered together - at most SensorBatchSize ***
+const int SensorBatchSize = 32;
+
+//*** default age at which a partial batch is delivered anyway ***
+const int SensorBatchMaxAgeMs = 100;
+
+struct SensorBatch
+{
+    int count;                  // number of entries in samples
+    QVector<SensorSample> samples;
+};
+
+Q_DECLARE_METATYPE(SensorBatch)
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SensorBatchHandler class - callback interface for batches. Called
+ *              directly on the acquisition thread, so it must not block
+ */
+//******************************************************************************
+class SensorBatchHandler
+{
+public:
+    virtual ~SensorBatchHandler() {}
+    virtual void handleBatch( const SensorBatch &batch ) = 0;
+};
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SensorProcessor class - interface for per-sample processing on
+ *              the acquisition thread. SHPipeline (SHProcessing.h) implements
+ *              it for a chain of stages. Must not block or allocate
+ */
+//******************************************************************************
+class SensorProcessor
+{
+public:
+    virtual ~SensorProcessor() {}
+    virtual void process( const SensorSample &sample ) = 0;
+};
+
+//*** reduced rate statistics of one channel ***
+struct SensorAggregate
+{
+    qint64 timestampNs;         // time of the newest sample in the window
+    quint8 channel;             // ImuSensors channel
+    int components;             // 1 for scalar channels, 3 for vectors
+    int windowCount;            // samples in the window
+    float decimated[3];         // anti-aliased, decimated value
+    float mean[3];              // window statistics, channel units
+    float variance[3];
+    float min[3];
+    float max[3];
+};
+
+Q_DECLARE_METATYPE(SensorAggregate)
+
+Q_DECLARE_METATYPE(SpectrumResult)
+
+Q_DECLARE_METATYPE(AlignedFrame)
+
+Q_DECLARE_METATYPE(MotionEvent)
+
+//*** accelerometer input of the vibration spectrum ***
+enum SpectrumAxis
+{
+    SPECTRUM_X,
+    SPECTRUM_Y,
+    SPECTRUM_Z,
+    SPECTRUM_MAGNITUDE          // vector magnitude - gravity ends up in DC
+};
+
+//*** orientation fusion engines ***
+enum FusionAlgorithm
+{
+    FUSION_RTIMU,               // RTIMU's own fusion, as set in the settings file
+    FUSION_MADGWICK,
+    FUSION_MAHONY
+};
+
+//*** statistics and decimator state of one channel ***
+struct ChannelAggregator
+{
+    int components;
+    SHRollingStats stats[3];
+    SHCicDecimator cic[3];
+    SensorAggregate last;
+};
+
+//*** acquisition thread scheduling statistics (nanoseconds) ***
+struct AcqTimingStats
+{
+    quint64 cycles;             // deadlines serviced
+    quint64 overruns;           // deadlines missed entirely
+    qint64 minLatencyNs;        // smallest wakeup lateness
+    qint64 maxLatencyNs;        // largest wakeup lateness
+    double meanLatencyNs;       // mean wakeup lateness
+    double jitterNs;            // standard deviation of wakeup lateness
+};
+
+//*** sample rate achieved by the acquisition path ***
+struct SampleRateStats
+{
+    double nominalHz;           // IMU's configured sample rate
+    double achievedHz;          // samples read per second
+    double droppedHz;           // samples missed per second
+    quint64 samples;            // samples read
+    quint64 dropped;            // samples missed (gaps in IMU timestamps)
+};
+
+//*** when a channel's readings are delivered ***
+enum ReportMode
+{
+    REPORT_PERIODIC,            // every reading at the channel rate
+    REPORT_ON_CHANGE            // only readings that moved past the deadband
+};
+
+//*** reporting policy of one channel ***
+struct ReportPolicy
+{
+    ReportMode mode;
+    float absDeadband;          // change in channel units that is reported
+    float relDeadband;          // change as a fraction of the last reported value
+    qint64 minIntervalNs;       // least time between reports, 0 for none
+    qint64 maxIntervalNs;       // report unchanged values this often, 0 for never
+};
+
+//*** time spent at each rate of the adaptive update rate ***
+struct AdaptiveRateStats
+{
+    bool enabled;
+    bool active;                // currently at the active rate
+    double idleHz;
+    double activeHz;
+    double idleSec;             // time at the idle rate
+    double activeSec;           // time at the active rate
+    quint64 switches;           // rate changes
+};
+
+//*** result of a burst capture ***
+struct BurstStats
+{
+    bool complete;              // the whole buffer was filled
+    int requested;              // samples asked for
+    int captured;               // samples in the buffer
+    qint64 startNs;             // time of the first sample
+    qint64 endNs;               // time of the last sample
+    double nominalHz;           // IMU's configured sample rate
+    double achievedHz;          // captured samples per second
+    quint64 dropped;            // IMU samples missed during the burst
+    qint64 maxGapNs;            // longest time between two samples
+    quint64 emptyReads;         // polls that found no new sample
+};
+
+Q_DECLARE_METATYPE(BurstStats)
+
+//*** state worth caching, snapshot on the acquisition path ***
+struct ImuStateSnapshot
+{
+    quint8 valid;               // the gyro bias has been learned
+    quint8 temperatureValid;
+    quint8 fusionValid;
+    quint8 gyroBiasValid;
+    float gyroBias[3];          // RTIMU's gyro bias (rad/s), from its settings
+    float temperature;          // celsius
+    qint32 fusionAlgorithm;     // engine the fusion state belongs to
+    FusionState fusion;         // library fusion state
+};
+
+class SHSensors;
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SensorThread class - reads the sensors on absolute deadlines
+ */
+//******************************************************************************
+class SensorThread : public QThread
+{
+    Q_OBJECT
+
+public:
+
+    SensorThread( SHSensors *sensors, QObject *parent );
+
+    //*** set the acquisition period, takes effect at the next deadline ***
+    void setPeriodNs( qint64 periodNs );
+
+    //*** SCHED_FIFO priority (0 = normal scheduling) and CPU (-1 = any) ***
+    void setRealtime( int priority, int cpu );
+
+    //*** scheduling statistics ***
+    AcqTimingStats timingStats();
+    void resetTimingStats();
+
+signals:
+
+    void error( QString errStr );
+
+private:
+
+    //*** override this for the actual thread code ***
+    void run();
+
+    //*** apply priority and affinity to the running thread ***
+    void applyScheduling();
+
+    //*** sensors to read ***
+    SHSensors *sensors_;
+
+    //*** acquisition period ***
+    QAtomicInteger<qint64> periodNs_;
+
+    //*** scheduling parameters ***
+    int priority_;
+    int cpu_;
+
+    //*** statistics and their guard ***
+    AcqTimingStats stats_;
+    double latencyM2_;          // running sum of squared deviations
+    QMutex statsMutex_;
+
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The BurstThread class - runs an asynchronous burst capture
+ */
+//******************************************************************************
+class BurstThread : public QThread
+{
+    Q_OBJECT
+
+public:
+
+    BurstThread( SHSensors *sensors, QObject *parent );
+
+    //*** capture to run the next time the thread is started ***
+    void setBurst( SensorSample *buffer, int count, int timeoutMs );
+
+private:
+
+    //*** override this for the actual thread code ***
+    void run();
+
+    //*** sensors to read ***
+    SHSensors *sensors_;
+
+    //*** the burst ***
+    SensorSample *buffer_;
+    int count_;
+    int timeoutMs_;
+};
+
 //******************************************************************************
 //******************************************************************************
 /**
@@ -96,6 +405,91 @@ public:
     //******************************************************************************
     void setUpdateRate( quint16 updatesPerSec );
 
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setUpdatePeriodNs - set sensor data update period in nanoseconds.
+     *              The timer path rounds to whole milliseconds, the acquisition
+     *              thread uses the exact period
+     * @param periodNs - update period
+     */
+    //******************************************************************************
+    void setUpdatePeriodNs( qint64 periodNs );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setAdaptiveRate - update at a low rate while the device is
+     *              still and a high rate while it moves, in place of the
+     *              setUpdateRate() rate. It goes active as soon as the
+     *              dynamic acceleration or rotation rate passes its
+     *              threshold, and idle after holdMs below half of both.
+     *              Switches take effect at the next update, so the stream has
+     *              no gaps; while idle the IMU samples between updates are
+     *              skipped on purpose and not counted as dropped
+     * @param idleHz         - update rate while still
+     * @param activeHz       - update rate while moving
+     * @param accelThreshold - dynamic acceleration in g
+     * @param gyroThreshold  - rotation rate in degrees/s
+     * @param holdMs         - quiet time before dropping to the idle rate
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool setAdaptiveRate( double idleHz, double activeHz, float accelThreshold = 0.05,
+                          float gyroThreshold = 5.0, int holdMs = 2000 );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief clearAdaptiveRate - return to the fixed update rate
+     */
+    //******************************************************************************
+    void clearAdaptiveRate();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief adaptiveRateStats - time spent at each rate since the adaptive
+     *              rate was set
+     * @return - statistics
+     */
+    //******************************************************************************
+    AdaptiveRateStats adaptiveRateStats();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief captureBurst - read count IMU samples back to back, as fast as
+     *              the IMU produces them, into the caller's buffer. Periodic
+     *              delivery pauses for the burst: updates due meanwhile are
+     *              skipped, and no signals, batches or published samples
+     *              come from the burst. Library fusion and the sensor log
+     *              still see every sample. Blocks until the buffer is full or
+     *              the timeout passes. Not for use from a direct connection
+     *              or batch handler, which already run inside an update
+     * @param buffer    - receives the samples, timestamped at the end of the
+     *                    read that produced them
+     * @param count     - samples to capture
+     * @param timeoutMs - longest time the burst may take
+     * @return - capture statistics. complete is FALSE on timeout or error
+     */
+    //******************************************************************************
+    BurstStats captureBurst( SensorSample *buffer, int count, int timeoutMs = 5000 );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief startBurst - run captureBurst() on a thread of its own and
+     *              emit burstComplete() when done. The buffer must stay valid
+     *              until then
+     * @param buffer    - receives the samples
+     * @param count     - samples to capture
+     * @param timeoutMs - longest time the burst may take
+     * @return - TRUE if the burst started, else FALSE
+     */
+    //******************************************************************************
+    bool startBurst( SensorSample *buffer, int count, int timeoutMs = 5000 );
+
     //******************************************************************************
     //******************************************************************************
     /**
@@ -105,6 +499,569 @@ public:
     //******************************************************************************
     bool startPeriodicUpdates();
 
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief startRealtimeUpdates - start updates on a dedicated acquisition
+     *              thread that wakes on absolute deadlines, independent of the
+     *              thread that owns this object
+     * @param priority - SCHED_FIFO priority (1-99), or 0 for normal scheduling
+     * @param cpu      - CPU to pin the thread to, or -1 for any
+     * @return - TRUE if started OK, else FALSE
+     */
+    //******************************************************************************
+    bool startRealtimeUpdates( int priority = 0, int cpu = -1 );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief stopUpdates - stop periodic or realtime updates
+     */
+    //******************************************************************************
+    void stopUpdates();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief startHighRateUpdates - start the acquisition thread at the IMU's own
+     *              recommended poll interval, draining every sample the IMU has
+     *              produced on each wakeup. The update interval set before is
+     *              restored by stopUpdates()
+     * @param priority - SCHED_FIFO priority (1-99), or 0 for normal scheduling
+     * @param cpu      - CPU to pin the thread to, or -1 for any
+     * @return - TRUE if started OK, else FALSE
+     */
+    //******************************************************************************
+    bool startHighRateUpdates( int priority = 0, int cpu = -1 );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief imuSampleRate - the IMU's configured sample rate
+     * @return - samples per second
+     */
+    //******************************************************************************
+    double imuSampleRate();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief sampleRateStats - achieved and dropped sample rates since the
+     *              updates were started
+     * @return - rate statistics
+     */
+    //******************************************************************************
+    SampleRateStats sampleRateStats();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setChannelRate - set the rate of one or more channels.
+     *              Gyro, accel, compass and fusion come from one IMU read, so
+     *              their rate decimates delivery. Pressure/temperature and
+     *              humidity are separate bus transactions, read between IMU
+     *              reads. At the defaults, the sensors' own output rates
+     *              (pressure/temperature 25 Hz, humidity 12.5 Hz), every due
+     *              sensor is read in each update; once a slow channel rate is
+     *              set here they are scheduled one per update, so they never
+     *              stall motion sampling. IMU channels default to every
+     *              sample. Safe while updates run
+     * @param channels - 'OR' of ImuSensors channels
+     * @param hz       - rate in Hz, or 0 for every sample / as often as possible
+     */
+    //******************************************************************************
+    void setChannelRate( quint8 channels, double hz );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setReportPolicy - choose when readings of one or more channels
+     *              are delivered. Readings are taken at the setChannelRate()
+     *              rate either way. With REPORT_ON_CHANGE a reading is
+     *              dropped on the acquisition side, before any signal, batch
+     *              or getLatestSample() update, unless a component moved from
+     *              the last reported value by more than the larger of the two
+     *              deadbands, with the vector magnitude used for the relative
+     *              one. minIntervalNs holds back changes that come too fast;
+     *              maxIntervalNs repeats an unchanged value as a heartbeat.
+     *              Aggregates, the spectrum and the sensor log still see every
+     *              reading
+     * @param channels - 'OR' of ImuSensors channels
+     * @param policy   - reporting policy
+     */
+    //******************************************************************************
+    void setReportPolicy( quint8 channels, const ReportPolicy &policy );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief reportPolicy - reporting policy of a channel
+     * @param channel - ImuSensors channel
+     * @return - policy
+     */
+    //******************************************************************************
+    ReportPolicy reportPolicy( ImuSensors channel );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief instrumentation - counters and latency histograms of the
+     *              acquisition stages: timer lateness, bus reads, sample
+     *              conversion and delivery. Disabled until
+     *              instrumentation().setEnabled( true ); read back with
+     *              counter(), histogram() or dump()
+     * @return - instrumentation
+     */
+    //******************************************************************************
+    SHInstrumentation &instrumentation() { return instr_; }
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief busTimeStats - bus time used by the transaction serving a channel
+     * @param channel - ImuSensors channel
+     * @return - statistics since updates were started
+     */
+    //******************************************************************************
+    BusTimeStats busTimeStats( ImuSensors channel );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief getLatestSample - latest value of every channel, without connecting
+     *              to any signal. Never blocks the acquisition path
+     * @return - most recent reading of each channel. valid holds the channels
+     *              read at least once, timestampNs the time of the newest read
+     */
+    //******************************************************************************
+    SensorSample getLatestSample() const { return latestLock_.load(); }
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setDemandDriven - only process channels that have consumers.
+     *              Connections to the channel signals are counted
+     *              automatically; a sampleBatch() receiver or batch handler
+     *              consumes every channel; other consumers (such as pollers of
+     *              getLatestSample()) call subscribe(). When no motion channel
+     *              has been wanted for the idle timeout the IMU is no longer
+     *              read, until the next subscription
+     * @param enable        - TRUE to enable demand driven acquisition
+     * @param idleTimeoutMs - time without consumers before the IMU goes idle
+     */
+    //******************************************************************************
+    void setDemandDriven( bool enable, int idleTimeoutMs = 5000 );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief subscribe - register a consumer of channels
+     * @param channels - 'OR' of ImuSensors channels
+     */
+    //******************************************************************************
+    void subscribe( quint8 channels );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief unsubscribe - remove a consumer registered with subscribe()
+     * @param channels - 'OR' of ImuSensors channels
+     */
+    //******************************************************************************
+    void unsubscribe( quint8 channels );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setAggregation - maintain window statistics and a decimated
+     *              stream of one or more channels on the acquisition side,
+     *              delivered through aggregate(). Every sample of the channel
+     *              is used, before setChannelRate() decimation. A configured
+     *              channel counts as demanded. Fusion yaw wraps at +/-180,
+     *              so its window statistics are only meaningful away from it
+     * @param channels      - 'OR' of ImuSensors channels
+     * @param decimation    - input samples per aggregate() output
+     * @param windowSamples - window length in samples or, for a time window,
+     *                        the most samples it can hold
+     * @param windowNs      - window length in nanoseconds, 0 for a count window
+     * @param cicOrder      - decimation filter order, 1 (moving average) to 4
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool setAggregation( quint8 channels, int decimation, int windowSamples,
+                         qint64 windowNs = 0, int cicOrder = 1 );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief clearAggregation - stop aggregating channels
+     * @param channels - 'OR' of ImuSensors channels
+     */
+    //******************************************************************************
+    void clearAggregation( quint8 channels );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief latestAggregate - most recent aggregate of a channel
+     * @param channel - ImuSensors channel
+     * @return - aggregate, windowCount 0 if none yet
+     */
+    //******************************************************************************
+    SensorAggregate latestAggregate( ImuSensors channel );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief startSpectrum - vibration spectrum mode. Every accelerometer
+     *              sample read is buffered; each hop a Hann windowed block is
+     *              transformed on the acquisition thread and spectrum()
+     *              delivers its band energies and peak frequencies, with the
+     *              bins spaced by the rate the block's samples were read at.
+     *              Use with startHighRateUpdates() so no sample is missed
+     * @param blockSize - samples per block, power of 2 (16 to 8192)
+     * @param overlap   - samples shared by consecutive blocks
+     * @param axis      - accelerometer axis or magnitude
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool startSpectrum( int blockSize, int overlap, SpectrumAxis axis = SPECTRUM_MAGNITUDE );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief stopSpectrum - leave vibration spectrum mode
+     */
+    //******************************************************************************
+    void stopSpectrum();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief startMotionEvents - run motion detectors (tap and double tap,
+     *              shake, free fall, tilt, still/moving) on every
+     *              accelerometer and gyro sample on the acquisition side and
+     *              deliver only their events through motionEvent(). The
+     *              detectors count as demand for the accelerometer (and the
+     *              gyro for still/moving), so with setDemandDriven() an
+     *              application can take events alone without any raw stream
+     * @param config - detectors to run and their thresholds
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool startMotionEvents( const MotionDetectorConfig &config = MotionDetectorConfig() );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief stopMotionEvents - stop the motion detectors
+     */
+    //******************************************************************************
+    void stopMotionEvents();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief startAlignment - resample channels onto a common output clock
+     *              and deliver them together through alignedFrame(). Each
+     *              reading is timestamped when it is acquired: environmental
+     *              readings at the end of their own bus transaction, not at
+     *              the IMU sample they are delivered with. Frame values are
+     *              indexed by channel bit position (IMU_GYRO is values[2]);
+     *              pressure has two components, pressure and altitude.
+     *              Linear frames lag the newest reading by up to maxDelayMs,
+     *              which should stay below AlignHistory samples of the
+     *              fastest channel. Aligned channels count as demand
+     * @param channels      - 'OR' of ImuSensors channels
+     * @param outputHz      - output clock rate
+     * @param interpolation - linear or zero-order hold
+     * @param maxDelayMs    - longest a frame waits for slow channels
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool startAlignment( quint8 channels, double outputHz,
+                         AlignInterpolation interpolation = ALIGN_LINEAR, int maxDelayMs = 100 );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief stopAlignment - stop producing aligned frames
+     */
+    //******************************************************************************
+    void stopAlignment();
+
+    //*** aligner statistics since startAlignment() ***
+    AlignStats alignStats();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setSpectrumBands - set the spectrum band edges. By default the
+     *              range up to Nyquist is split into equal bands
+     * @param edgesHz   - ascending band edges, edgeCount-1 bands
+     * @param edgeCount - 0 for the default, or 2 to SpectrumMaxBands+1
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool setSpectrumBands( const float *edgesHz, int edgeCount );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setFusion - select the fusion engine behind fusionPose. Madgwick
+     *              and Mahony run in the library on the raw gyro, accel and
+     *              compass and can be switched at any time. RTIMU's own fusion
+     *              is switched off when updates are not running (the IMU is
+     *              recreated), otherwise at the next start
+     * @param algorithm - fusion engine
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool setFusion( FusionAlgorithm algorithm );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief fusionAlgorithm - the selected fusion engine
+     * @return - fusion engine
+     */
+    //******************************************************************************
+    FusionAlgorithm fusionAlgorithm() { return fusionAlg_; }
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setMadgwickBeta - Madgwick filter gain, applied immediately
+     * @param beta - gradient step gain
+     */
+    //******************************************************************************
+    void setMadgwickBeta( float beta );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setMahonyGains - Mahony filter gains, applied immediately
+     * @param kp - proportional gain
+     * @param ki - integral gain, 0 for no gyro bias learning
+     */
+    //******************************************************************************
+    void setMahonyGains( float kp, float ki );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setStateCache - keep RTIMU's learned gyro bias and the library
+     *              fusion state (orientation and bias correction) in a small
+     *              cache file. It is written when updates stop, on
+     *              destruction and every saveIntervalSec, from a snapshot the
+     *              acquisition path takes each second. Each start seeds the
+     *              IMU and fusion from it when the IMU settings match and
+     *              the temperature (both unknown, or within maxTempDeltaC)
+     *              matches, so orientation is usable at once; otherwise the
+     *              bias is learned again. Temperature comes from the pressure
+     *              or humidity sensor, so enable one of them
+     * @param fileName        - cache file, empty to disable
+     * @param saveIntervalSec - periodic save interval, 0 for none
+     * @param maxTempDeltaC   - largest temperature change accepted
+     */
+    //******************************************************************************
+    void setStateCache( QString fileName, int saveIntervalSec = 60, float maxTempDeltaC = 5.0 );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief stateRestored - indicates the last start was seeded from the cache
+     * @return - TRUE if restored, else FALSE
+     */
+    //******************************************************************************
+    bool stateRestored() { return stateRestored_; }
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief startRecording - record the raw RTIMU stream (timestamps, all
+     *              channels and fusion state) to an append-only sensor log
+     * @param fileName - log file, appended to if it exists
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool startRecording( QString fileName );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief stopRecording - finish the log file
+     */
+    //******************************************************************************
+    void stopRecording();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief startTimeSeries - store channels long term in an on-disk
+     *              time-series store, with minute and hour rollups. Each
+     *              environmental reading is stored when it is taken; motion
+     *              channels at their delivered rate, so set a low channel
+     *              rate for them first. Series numbers come from
+     *              timeSeriesId(). Stored channels count as demand
+     * @param directory - store directory, created if needed
+     * @param channels  - 'OR' of ImuSensors channels
+     * @param options   - segment size and retention
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool startTimeSeries( QString directory, quint8 channels = IMU_PRESSURE | IMU_TEMP | IMU_HUMIDITY,
+                          const TimeSeriesOptions &options = TimeSeriesOptions() );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief stopTimeSeries - write what is buffered and close the store
+     */
+    //******************************************************************************
+    void stopTimeSeries();
+
+    //*** store statistics since startTimeSeries() ***
+    TimeSeriesStats timeSeriesStats();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief timeSeriesId - series number of a channel component in stores
+     *              written by startTimeSeries(), for SHTimeSeriesReader
+     * @param channel   - ImuSensors channel
+     * @param component - 0 for scalar channels, 0 to 2 (x, y, z) for vectors.
+     *                    Pressure is stored without its altitude
+     * @return - series number
+     */
+    //******************************************************************************
+    static int timeSeriesId( ImuSensors channel, int component = 0 );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief startPublishing - also publish every delivered sample into a
+     *              POSIX shared memory ring, so other processes can follow
+     *              the sensors with SHSharedRingReader instead of owning the
+     *              IMU or relaying over IPC. Readers never hold up
+     *              acquisition; readers falling behind are reported through
+     *              slowReader()
+     * @param name     - shared memory name, starting with '/'
+     * @param ringSize - ring size in samples, rounded up to a power of two
+     * @param mode     - permissions of the shared memory object. The owner
+     *                   only by default; readers run as other users need
+     *                   read and write access, e.g. 0660 for a group
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool startPublishing( QString name = "/qsensehat", int ringSize = 1024, int mode = 0600 );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief stopPublishing - close and remove the shared memory ring
+     */
+    //******************************************************************************
+    void stopPublishing();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief sharedReaders - readers registered with the shared memory ring
+     * @param status - receives up to max entries
+     * @param max    - size of status
+     * @return - number of readers
+     */
+    //******************************************************************************
+    int sharedReaders( SharedReaderStatus *status, int max );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief openReplay - replace the IMU, pressure and humidity sensors with a
+     *              replay of a sensor log. Everything downstream (signals,
+     *              batches, snapshots) runs unchanged. Call enableSensors() and
+     *              start updates as with the hardware
+     * @param fileName - log file written by startRecording()
+     * @param realTime - TRUE for original timing, FALSE for as fast as possible
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool openReplay( QString fileName, bool realTime = true );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief openSimulator - replace the IMU, pressure and humidity sensors with
+     *              simulated ones following a motion profile with noise.
+     *              Everything downstream runs unchanged; call enableSensors()
+     *              and start updates as with the hardware. With a speed above
+     *              1 every update drains the samples due on the faster clock
+     * @param options - motion, noise, rates and speed
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool openSimulator( const SimSensorOptions &options = SimSensorOptions() );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief timingStats - scheduling jitter and overrun statistics of the
+     *              acquisition thread
+     * @return - statistics since start or last reset
+     */
+    //******************************************************************************
+    AcqTimingStats timingStats();
+    void resetTimingStats();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setBatchSize - number of samples collected before a batch is
+     *              delivered through sampleBatch() and the batch handler.
+     *              A partial batch is delivered once its first sample is
+     *              maxAgeMs old, and when updates stop
+     * @param samples  - 1 to SensorBatchSize
+     * @param maxAgeMs - age limit of a partial batch, 0 for none
+     */
+    //******************************************************************************
+    void setBatchSize( int samples, int maxAgeMs = SensorBatchMaxAgeMs );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setBatchHandler - set a callback that receives each batch directly
+     *              on the acquisition thread
+     * @param handler - handler object, or NULL to remove
+     */
+    //******************************************************************************
+    void setBatchHandler( SensorBatchHandler *handler );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setProcessor - run a processor on every IMU sample directly on
+     *              the acquisition thread, after conversion and before the
+     *              channel rates, reporting policy and delivery. It sees all
+     *              enabled channels, and what it does to its copy of a sample
+     *              does not change what is delivered. Waits for an update in
+     *              progress to finish, so the old processor can be deleted
+     *              on return. Not for use from inside a processor
+     * @param processor - processor object, or NULL to remove. Not owned
+     */
+    //******************************************************************************
+    void setProcessor( SensorProcessor *processor );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setChannelSignals - enable the per-channel signals (pressure(),
+     *              gyro(), etc.). Kept for compatibility, enabled by default
+     * @param enable - TRUE to emit per-channel signals
+     */
+    //******************************************************************************
+    void setChannelSignals( bool enable ) { channelSignals_ = enable; }
+
 
 signals:
 
@@ -120,6 +1077,36 @@ signals:
     void compass( float x_uT, float y_uT, float z_uT, float mag );
     void fusionPose( float rollDeg, float pitchDeg, float yawDeg );
 
+    //*** batch of complete samples ***
+    void sampleBatch( const SensorBatch &batch );
+
+    //*** reduced rate statistics of a channel ***
+    void aggregate( const SensorAggregate &agg );
+
+    //*** vibration spectrum of a block of accelerometer samples ***
+    void spectrum( const SpectrumResult &result );
+
+    //*** discrete motion event ***
+    void motionEvent( const MotionEvent &event );
+
+    //*** channels resampled onto the common output clock ***
+    void alignedFrame( const AlignedFrame &frame );
+
+    //*** an asynchronous burst capture finished ***
+    void burstComplete( const BurstStats &stats );
+
+    //*** the adaptive update rate switched ***
+    void updateRateChanged( bool active, double hz );
+
+    //*** a shared memory ring reader fell behind or lost samples ***
+    void slowReader( quint32 pid, quint32 lag, quint32 lost );
+
+
+public slots:
+
+    //*** write the state cache now - FALSE if nothing was written ***
+    bool saveState();
+
 
 protected slots:
 
@@ -128,6 +1115,104 @@ protected slots:
 
 protected:
 
+    friend class SensorThread;
+    friend class BurstThread;
+
+    //*** count receivers of the channel signals ***
+    void connectNotify( const QMetaMethod &signal );
+    void disconnectNotify( const QMetaMethod &signal );
+    void countReceivers();
+    quint8 signalChannels( const QMetaMethod &signal );
+
+    //*** demand tracking ***
+    quint8 demandedChannels();
+    bool updateDemand( qint64 nowNs );
+    void wakeImu();
+
+    //*** read and deliver all available sensor data, unless a burst runs ***
+    void acquire();
+    void drainImu();
+
+    //*** hand a sample to every consumer, and environmental readings alone while the IMU idles ***
+    void deliverSample( SensorSample &sample, qint64 stageNs );
+    void deliverEnvironment();
+
+    //*** motion channels of an RTIMU reading ***
+    void imuSample( const RTIMU_DATA &imuData, quint8 channels, SensorSample &sample );
+
+    //*** update interval rounded for the QTimer path ***
+    int timerIntervalMSec();
+
+    //*** update period in effect - fixed or adaptive ***
+    qint64 currentPeriodNs();
+
+    //*** adaptive update rate ***
+    void adaptSample( const SensorSample &sample );
+    void switchRate( bool active, qint64 nowNs );
+
+    //*** sample rate accounting ***
+    void resetRateStats();
+    void countSample( quint64 imuTimestamp );
+    void countDrops();
+
+    //*** channel scheduling ***
+    void scheduleChannels( quint8 channels, double hz );
+    bool channelDue( int chIdx, qint64 nowNs );
+    qint64 channelLateness( quint8 channels, qint64 nowNs );
+    void readSlowSensors( qint64 nowNs );
+    void readPressure( qint64 nowNs );
+    void readHumidity( qint64 nowNs );
+
+    //*** drop readings the reporting policy holds back ***
+    void filterReports( SensorSample &sample );
+
+    //*** bus time accounting ***
+    void accountBusTime( BusTransaction trans, qint64 elapsedNs );
+
+    //*** feed a sample to the channel aggregators ***
+    void aggregateSample( const SensorSample &sample );
+
+    //*** library fusion ***
+    void configureImuFusion();
+    void recreateImu();
+    void applyFusion( RTIMU_DATA &imuData );
+
+    //*** state cache ***
+    bool restoreState();
+    void snapshotState( bool useBus );
+    bool readTemperature( float &tempC, bool useBus );
+    void forgetGyroBias();
+
+    //*** feed a sample to the spectrum analyzer ***
+    void spectrumSample( const SensorSample &sample );
+
+    //*** feed a sample to the motion detectors ***
+    void motionSample( const SensorSample &sample );
+
+    //*** feed channels of a sample to the aligner ***
+    void alignSample( const SensorSample &sample, quint8 channels );
+
+    //*** append a sample to the sensor log ***
+    void recordSample( const RTIMU_DATA &imuData );
+
+    //*** append channels of a sample to the time-series store ***
+    void storeSample( const SensorSample &sample, quint8 channels );
+
+    //*** emit the per-channel signals for a sample ***
+    void emitChannels( const SensorSample &sample );
+
+    //*** add a sample to the current batch, delivering it when full ***
+    void appendSample( const SensorSample &sample );
+
+    //*** deliver the current batch if it holds any samples ***
+    void flushBatch();
+
+    //*** merge a sample into the latest values and publish them ***
+    void publishLatest( const SensorSample &sample );
+
+    //*** write a sample to the shared memory ring ***
+    void publishShared( const SensorSample &sample );
+
     //*** pointer to IMU object ***
     RTIMU *imu_;
 
@@ -141,6 +1226,18 @@ protected:
     //*** enabled sensors ***
     quint8 enabled_;
 
+    //*** channels processed in the current update ***
+    quint8 active_;
+
+    //*** demand driven acquisition ***
+    bool demandDriven_;
+    qint64 idleTimeoutNs_;
+    qint64 lastMotionDemandNs_;
+    bool imuIdle_;
+    QAtomicInt subscribers_[ImuChannelCount];          // subscribe() calls
+    QAtomicInt signalReceivers_[ImuChannelCount];      // channel signal connections
+    QAtomicInt batchReceivers_;
+
     //*** indicates IMU is ready for readings ***
     bool ready_;
 
@@ -153,8 +1250,140 @@ protected:
     //*** update timer ***
     QTimer *imuTimer_;
 
+    //*** realtime acquisition thread ***
+    SensorThread *sensorThread_;
+
+    //*** burst capture - acquireMutex_ is held by every update and by a burst ***
+    BurstThread *burstThread_;
+    QMutex acquireMutex_;
+    QMutex burstMutex_;
+
     //*** update interval ***
-    int updateIntervalMSec_;
+    qint64 updateIntervalNSec_;
+    qint64 savedIntervalNSec_;              // interval before high rate updates, 0 if none
+
+    //*** adaptive update rate ***
+    bool adaptive_;
+    bool adaptActive_;
+    qint64 idlePeriodNs_;
+    qint64 activePeriodNs_;
+    float adaptAccelThreshold_;
+    float adaptGyroThreshold_;
+    qint64 adaptHoldNs_;
+    qint64 adaptLastActivityNs_;
+    qint64 adaptLastSampleNs_;
+    float adaptGravity_;                    // low pass of the acceleration magnitude
+    qint64 adaptSinceNs_;                   // start of the current rate
+    qint64 adaptTimeNs_[2];                 // time at idle, active
+    quint64 adaptSwitches_;
+    QMutex adaptMutex_;
+
+    //*** sample rate accounting ***
+    qint64 rateStartNs_;                    // time updates started
+    quint64 lastImuTimestamp_;              // previous RTIMU timestamp (usecs), 0 to restart
+    quint64 sampleClockUs_;                 // when the previous sample was due (usecs)
+    QAtomicInteger<qint64> samplePeriodUs_; // IMU sample period (usecs), set from any thread
+    QAtomicInteger<quint64> samplesRead_;
+    QAtomicInteger<quint64> samplesDropped_;
+
+    //*** per-channel schedule, indexed by channel bit ***
+    qint64 channelIntervalNs_[ImuChannelCount];     // 0 = every sample
+    qint64 channelNextDueNs_[ImuChannelCount];
+    bool slowRateSet_;                              // setChannelRate() on a slow channel
+    QMutex scheduleMutex_;
+
+    //*** reporting policy, indexed by channel bit ***
+    ReportPolicy reportPolicy_[ImuChannelCount];
+    float lastReported_[ImuChannelCount][3];
+    qint64 lastReportNs_[ImuChannelCount];
+    quint8 onChangeChannels_;               // channels using REPORT_ON_CHANGE
+    quint8 reportedChannels_;               // channels reported since the start
+    QMutex reportMutex_;
+
+    //*** slow sensor readings waiting for the next IMU sample ***
+    SensorSample pending_;
+
+    //*** bus time per transaction ***
+    BusTimeStats busStats_[BUS_COUNT];
+    QMutex busMutex_;
+
+    //*** shared memory ring ***
+    SHSharedRingWriter *ring_;
+    quint32 ringWrites_;
+
+    //*** stage counters and histograms ***
+    SHInstrumentation instr_;
+    qint64 timerDueNs_;                     // when the QTimer update was due, 0 to restart
+    qint64 timerPeriodNs_;                  // QTimer interval of that schedule
+
+    //*** batch being collected ***
+    SensorBatch batch_;
+    int batchSize_;
+    qint64 batchStartNs_;                   // first sample of the batch
+    qint64 batchMaxAgeNs_;                  // 0 for no age limit
+    SensorBatchHandler *batchHandler_;
+
+    //*** per-sample processing graph ***
+    SensorProcessor *processor_;
+
+    //*** per-channel signal compatibility ***
+    bool channelSignals_;
+
+    //*** channel aggregation, indexed by channel bit ***
+    ChannelAggregator *aggregators_[ImuChannelCount];
+    quint8 aggChannels_;
+    QMutex aggMutex_;
+
+    //*** fusion engine - NULL for RTIMU's own ***
+    SHFusion *fusion_;
+    FusionAlgorithm fusionAlg_;
+    int imuFusionType_;                     // RTIMU fusion from the settings file
+    float madgwickBeta_;
+    float mahonyKp_;
+    float mahonyKi_;
+    QMutex fusionMutex_;
+
+    //*** state cache ***
+    QString stateFile_;
+    float maxTempDeltaC_;
+    QTimer *stateTimer_;
+    bool stateRestored_;
+    bool stateSnapshots_;                   // acquisition path snapshots the state
+    qint64 nextSnapshotNs_;
+    SHSeqLock<ImuStateSnapshot> stateLock_;
+
+    //*** vibration spectrum ***
+    SHSpectrumAnalyzer *spectrum_;
+    SpectrumAxis spectrumAxis_;
+    float spectrumEdges_[SpectrumMaxBands+1];
+    int spectrumEdgeCount_;
+    QMutex spectrumMutex_;
+
+    //*** motion event detectors ***
+    SHMotionDetector *motion_;
+    quint8 motionChannels_;             // channels the detectors need, set with motion_
+    QMutex motionMutex_;
+
+    //*** channel alignment ***
+    SHChannelAligner *align_;
+    quint8 alignChannels_;
+    QMutex alignMutex_;
+
+    //*** sensor log recording - environmental readings wait for the next sample ***
+    SHSensorLogWriter logWriter_;
+    SensorLogRecord logPending_;
+
+    //*** time-series store ***
+    SHTimeSeriesWriter seriesWriter_;
+    quint8 seriesChannels_;
+
+    //*** replay or simulation in place of the hardware ***
+    SHReplaySource *replaySource_;
+    SHSimSource *simSource_;
+
+    //*** latest value of every channel ***
+    SensorSample latest_;
+    SHSeqLock<SensorSample> latestLock_;
 
 
 };
@@ -0,0 +1,103 @@
+//******************************************************************************
+//******************************************************************************
+//
+// SHSeqLock
+//
+// Sequence lock holding a single value. One writer at a time publishes, any
+//      number of readers take consistent copies without ever blocking the
+//      writer. Readers retry if a write happened while they were copying
+//
+//******************************************************************************
+//******************************************************************************
+
+#ifndef SHSEQLOCK_H
+#define SHSEQLOCK_H
+
+#include <atomic>
+#include <string.h>
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHSeqLock class - T must be trivially copyable
+ */
+//******************************************************************************
+template <typename T>
+class SHSeqLock
+{
+public:
+
+    SHSeqLock() : seq_( 0 ) { memset( &value_, 0, sizeof(value_) ); }
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief store - publish a new value. Writers must be serialized
+     * @param value - value to publish
+     */
+    //******************************************************************************
+    void store( const T &value )
+    {
+        unsigned seq = seq_.load( std::memory_order_relaxed );
+
+        //*** odd sequence marks a write in progress ***
+        seq_.store( seq + 1, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_release );
+
+        memcpy( &value_, &value, sizeof(T) );
+
+        //*** even again - the value is consistent ***
+        seq_.store( seq + 2, std::memory_order_release );
+    }
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief load - take a consistent copy of the latest value
+     * @return - copy of the value
+     */
+    //******************************************************************************
+    T load() const
+    {
+    T value;
+    unsigned seq1, seq2;
+
+        do
+        {
+            //*** wait out a write in progress ***
+            do
+            {
+                seq1 = seq_.load( std::memory_order_acquire );
+            } while ( seq1 & 1 );
+
+            memcpy( &value, &value_, sizeof(T) );
+
+            std::atomic_thread_fence( std::memory_order_acquire );
+            seq2 = seq_.load( std::memory_order_relaxed );
+
+        } while ( seq1 != seq2 );
+
+        return value;
+    }
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief sequence - number of completed writes times two
+     * @return - current sequence
+     */
+    //******************************************************************************
+    unsigned sequence() const { return seq_.load( std::memory_order_acquire ); }
+
+private:
+
+    //*** write sequence - odd while writing ***
+    std::atomic<unsigned> seq_;
+
+    //*** protected value ***
+    T value_;
+
+};
+
+#endif // SHSEQLOCK_H
@@ -0,0 +1,541 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat shared memory sample ring
+//
+// The process that owns the sensors publishes every delivered SensorSample
+//      into a POSIX shared memory ring. Any number of reader processes follow
+//      it without locks and without ever holding up the writer
+//
+//******************************************************************************
+//******************************************************************************
+#include "SHSharedRing.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+
+//*** a reader lagging by more than this share of the ring is slow ***
+const quint32 SlowLagNum = 3;
+const quint32 SlowLagDen = 4;
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief processExists - check a reader or writer process
+ * @param pid - process id
+ * @return - TRUE unless the process is known to be gone
+ */
+//******************************************************************************
+static bool processExists( quint32 pid )
+{
+    return kill( (pid_t)pid, 0 ) == 0 || errno != ESRCH;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSharedRingWriter::SHSharedRingWriter
+ */
+//******************************************************************************
+SHSharedRingWriter::SHSharedRingWriter()
+{
+    header_ = 0;
+    slots_ = 0;
+    mapSize_ = 0;
+    mask_ = 0;
+    slowMask_ = 0;
+    memset( lastLost_, 0, sizeof(lastLost_) );
+    memset( lastPid_, 0, sizeof(lastPid_) );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSharedRingWriter::~SHSharedRingWriter
+ */
+//******************************************************************************
+SHSharedRingWriter::~SHSharedRingWriter()
+{
+    close();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSharedRingWriter::open - create the shared memory object
+ * @param name     - POSIX shared memory name, starting with '/'
+ * @param ringSize - ring size, rounded up to a power of two
+ * @param mode     - permissions, SharedRingDefaultMode for the owner only
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSharedRingWriter::open( QString name, int ringSize, int mode )
+{
+QByteArray shmName = name.toLocal8Bit();
+quint32 count = 2;
+void *map;
+int fd;
+
+    close();
+
+    if ( ringSize < 2 || ringSize > ( 1 << 20 ) ) return false;
+
+    while ( count < (quint32)ringSize ) count <<= 1;
+
+    //*** a fresh object - readers of an old one see it closed ***
+    shm_unlink( shmName.constData() );
+    fd = shm_open( shmName.constData(), O_RDWR | O_CREAT | O_EXCL, mode );
+    if ( fd < 0 ) return false;
+
+    //*** shm_open applies the umask ***
+    fchmod( fd, mode );
+
+    mapSize_ = sizeof(SharedRingHeader) + count * sizeof(SharedRingSlot);
+    if ( ftruncate( fd, mapSize_ ) != 0 )
+    {
+        ::close( fd );
+        shm_unlink( shmName.constData() );
+        return false;
+    }
+
+    map = mmap( 0, mapSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    ::close( fd );
+
+    if ( map == MAP_FAILED )
+    {
+        shm_unlink( shmName.constData() );
+        return false;
+    }
+
+    //*** new pages are zero - every slot empty, every reader entry free ***
+    QMutexLocker wLock( &mutex_ );
+
+    header_ = (SharedRingHeader *)map;
+    slots_ = (SharedRingSlot *)( header_ + 1 );
+    mask_ = count - 1;
+    name_ = name;
+    slowMask_ = 0;
+    memset( lastLost_, 0, sizeof(lastLost_) );
+    memset( lastPid_, 0, sizeof(lastPid_) );
+
+    header_->version = SharedRingVersion;
+    header_->slotCount = count;
+    header_->slotSize = sizeof(SharedRingSlot);
+    header_->writerPid = getpid();
+    header_->head.store( 0, std::memory_order_relaxed );
+    header_->open.store( 1, std::memory_order_relaxed );
+
+    //*** magic last - readers check it before anything else ***
+    std::atomic_thread_fence( std::memory_order_release );
+    memcpy( header_->magic, SharedRingMagic, sizeof(header_->magic) );
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSharedRingWriter::close - mark the ring closed and remove it.
+ *              Readers keep their mapping until they close
+ */
+//******************************************************************************
+void SHSharedRingWriter::close()
+{
+QMutexLocker wLock( &mutex_ );
+
+    if ( !header_ ) return;
+
+    header_->open.store( 0, std::memory_order_release );
+
+    munmap( header_, mapSize_ );
+    shm_unlink( name_.toLocal8Bit().constData() );
+
+    header_ = 0;
+    slots_ = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSharedRingWriter::write - publish a sample. Never waits for readers
+ * @param sample - sample
+ */
+//******************************************************************************
+void SHSharedRingWriter::write( const SensorSample &sample )
+{
+QMutexLocker wLock( &mutex_ );
+quint32 n;
+SharedRingSlot *slot;
+
+    if ( !header_ ) return;
+
+    n = header_->head.load( std::memory_order_relaxed );
+    slot = &slots_[ n & mask_ ];
+
+    //*** odd - readers of this slot retry or skip ***
+    slot->seq.store( 2 * n + 1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+
+    memcpy( &slot->sample, &sample, sizeof(SensorSample) );
+
+    slot->seq.store( 2 * n + 2, std::memory_order_release );
+    header_->head.store( n + 1, std::memory_order_release );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSharedRingWriter::checkReaders - state of the registered readers
+ * @param status    - receives up to max entries
+ * @param max       - size of status
+ * @param newlySlow - receives the readers that turned slow, may be NULL
+ * @param slowCount - receives the number of entries in newlySlow
+ * @return - number of readers
+ */
+//******************************************************************************
+int SHSharedRingWriter::checkReaders( SharedReaderStatus *status, int max,
+                                      SharedReaderStatus *newlySlow, int *slowCount )
+{
+QMutexLocker wLock( &mutex_ );
+SharedRingReaderEntry *entry;
+SharedReaderStatus st;
+quint32 head;
+int count = 0;
+int newCount = 0;
+
+    if ( slowCount ) *slowCount = 0;
+    if ( !header_ ) return 0;
+
+    head = header_->head.load( std::memory_order_relaxed );
+
+    for ( int i=0; i<SharedRingMaxReaders; i++ )
+    {
+        entry = &header_->readers[i];
+
+        st.pid = entry->pid.load( std::memory_order_acquire );
+        if ( st.pid == 0 )
+        {
+            slowMask_ &= ~( 1 << i );
+            continue;
+        }
+
+        //*** reader died without unregistering ***
+        if ( !processExists( st.pid ) )
+        {
+            entry->pid.compare_exchange_strong( st.pid, 0 );
+            slowMask_ &= ~( 1 << i );
+            continue;
+        }
+
+        st.lag = head - entry->position.load( std::memory_order_acquire );
+        st.lost = entry->lost.load( std::memory_order_relaxed );
+
+        //*** a new reader in the entry ***
+        if ( st.pid != lastPid_[i] )
+        {
+            lastPid_[i] = st.pid;
+            lastLost_[i] = 0;
+            slowMask_ &= ~( 1 << i );
+        }
+
+        st.slow = ( st.lag > ( mask_ + 1 ) / SlowLagDen * SlowLagNum ) || st.lost != lastLost_[i];
+
+        //*** report once per episode ***
+        if ( st.slow && !( slowMask_ & ( 1 << i ) ) && newlySlow )
+        {
+            newlySlow[ newCount++ ] = st;
+        }
+
+        if ( st.slow ) slowMask_ |= ( 1 << i );
+        else slowMask_ &= ~( 1 << i );
+
+        lastLost_[i] = st.lost;
+
+        if ( count < max ) status[ count ] = st;
+        count++;
+    }
+
+    if ( slowCount ) *slowCount = newCount;
+
+    return count;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSharedRingReader::SHSharedRingReader
+ */
+//******************************************************************************
+SHSharedRingReader::SHSharedRingReader()
+{
+    header_ = 0;
+    slots_ = 0;
+    mapSize_ = 0;
+    mask_ = 0;
+    entry_ = 0;
+    position_ = 0;
+    lost_ = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSharedRingReader::~SHSharedRingReader
+ */
+//******************************************************************************
+SHSharedRingReader::~SHSharedRingReader()
+{
+    close();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSharedRingReader::open - map a ring and start at its newest sample
+ * @param name - POSIX shared memory name
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSharedRingReader::open( QString name )
+{
+QByteArray shmName = name.toLocal8Bit();
+SharedRingHeader *header;
+struct stat st;
+bool writable = true;
+bool valid;
+quint32 freePid;
+void *map;
+int fd;
+
+    close();
+
+    fd = shm_open( shmName.constData(), O_RDWR, 0 );
+    if ( fd < 0 )
+    {
+        writable = false;
+        fd = shm_open( shmName.constData(), O_RDONLY, 0 );
+    }
+    if ( fd < 0 ) return false;
+
+    if ( fstat( fd, &st ) != 0 || (size_t)st.st_size < sizeof(SharedRingHeader) )
+    {
+        ::close( fd );
+        return false;
+    }
+
+    map = mmap( 0, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0 );
+    ::close( fd );
+    if ( map == MAP_FAILED ) return false;
+
+    //*** check the format before trusting the size - magic is written last ***
+    header = (SharedRingHeader *)map;
+    valid = memcmp( header->magic, SharedRingMagic, sizeof(header->magic) ) == 0;
+    std::atomic_thread_fence( std::memory_order_acquire );
+
+    if ( !valid ||
+         header->version != SharedRingVersion ||
+         header->slotSize != sizeof(SharedRingSlot) ||
+         header->slotCount < 2 || ( header->slotCount & ( header->slotCount - 1 ) ) ||
+         (size_t)st.st_size < sizeof(SharedRingHeader) + header->slotCount * sizeof(SharedRingSlot) )
+    {
+        munmap( map, st.st_size );
+        return false;
+    }
+
+    header_ = header;
+    slots_ = (SharedRingSlot *)( header_ + 1 );
+    mapSize_ = st.st_size;
+    mask_ = header->slotCount - 1;
+    position_ = header_->head.load( std::memory_order_acquire );
+    lost_ = 0;
+
+    //*** register, so the writer can see how far behind we are ***
+    for ( int i=0; writable && i<SharedRingMaxReaders && !entry_; i++ )
+    {
+        freePid = 0;
+        if ( header_->readers[i].pid.compare_exchange_strong( freePid, getpid() ) )
+        {
+            entry_ = &header_->readers[i];
+            entry_->lost.store( 0, std::memory_order_relaxed );
+            entry_->position.store( position_, std::memory_order_release );
+        }
+    }
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSharedRingReader::close - unregister and unmap
+ */
+//******************************************************************************
+void SHSharedRingReader::close()
+{
+    if ( !header_ ) return;
+
+    if ( entry_ )
+    {
+        entry_->pid.store( 0, std::memory_order_release );
+        entry_ = 0;
+    }
+
+    munmap( header_, mapSize_ );
+    header_ = 0;
+    slots_ = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSharedRingReader::readSlot - copy a slot if it still holds sample n
+ * @param n      - sample number
+ * @param sample - receives the sample
+ * @return - FALSE if the slot is being or has been overwritten
+ */
+//******************************************************************************
+bool SHSharedRingReader::readSlot( quint32 n, SensorSample &sample )
+{
+SharedRingSlot *slot = &slots_[ n & mask_ ];
+quint32 seq1, seq2;
+
+    seq1 = slot->seq.load( std::memory_order_acquire );
+    if ( seq1 != 2 * n + 2 ) return false;
+
+    memcpy( &sample, &slot->sample, sizeof(SensorSample) );
+
+    std::atomic_thread_fence( std::memory_order_acquire );
+    seq2 = slot->seq.load( std::memory_order_relaxed );
+
+    return seq1 == seq2;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSharedRingReader::next - read the next sample in order
+ * @param sample - receives the sample for RING_SAMPLE
+ * @return - result
+ */
+//******************************************************************************
+SharedRingResult SHSharedRingReader::next( SensorSample &sample )
+{
+quint32 head;
+quint32 skip;
+
+    if ( !header_ ) return RING_CLOSED;
+
+    head = header_->head.load( std::memory_order_acquire );
+
+    if ( head == position_ )
+    {
+        return header_->open.load( std::memory_order_relaxed ) ? RING_EMPTY : RING_CLOSED;
+    }
+
+    //*** still in the ring - the usual case ***
+    if ( head - position_ <= mask_ + 1 && readSlot( position_, sample ) )
+    {
+        position_++;
+        if ( entry_ ) entry_->position.store( position_, std::memory_order_relaxed );
+        return RING_SAMPLE;
+    }
+
+    //*** lapped - the writer is at least a ring ahead. Skip to half a ring behind it ***
+    head = header_->head.load( std::memory_order_acquire );
+    skip = head - ( mask_ + 1 ) / 2 - position_;
+    position_ += skip;
+    lost_ += skip;
+
+    if ( entry_ )
+    {
+        entry_->position.store( position_, std::memory_order_relaxed );
+        entry_->lost.store( lost_, std::memory_order_relaxed );
+    }
+
+    return RING_OVERRUN;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSharedRingReader::latest - read the newest sample. next()
+ *              continues after it
+ * @param sample - receives the sample
+ * @return - FALSE if nothing was written yet or the writer has gone
+ */
+//******************************************************************************
+bool SHSharedRingReader::latest( SensorSample &sample )
+{
+quint32 head;
+
+    if ( !header_ || !header_->open.load( std::memory_order_relaxed ) ) return false;
+
+    //*** retry if the writer laps the slot while we copy ***
+    do
+    {
+        head = header_->head.load( std::memory_order_acquire );
+        if ( head == 0 ) return false;
+    } while ( !readSlot( head - 1, sample ) );
+
+    //*** older samples count as read - a reader that only polls is not slow ***
+    if ( (qint32)( head - position_ ) > 0 )
+    {
+        position_ = head;
+        if ( entry_ ) entry_->position.store( position_, std::memory_order_relaxed );
+    }
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSharedRingReader::available - samples waiting to be read
+ * @return - count, at most the ring size
+ */
+//******************************************************************************
+quint32 SHSharedRingReader::available()
+{
+quint32 waiting;
+
+    if ( !header_ ) return 0;
+
+    waiting = header_->head.load( std::memory_order_acquire ) - position_;
+
+    return qMin( waiting, mask_ + 1 );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSharedRingReader::writerAlive - the writer is still publishing
+ * @return - TRUE if the ring is open and its writer exists
+ */
+//******************************************************************************
+bool SHSharedRingReader::writerAlive()
+{
+    if ( !header_ ) return false;
+
+    return header_->open.load( std::memory_order_acquire ) && processExists( header_->writerPid );
+}
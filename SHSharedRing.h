@@ -0,0 +1,240 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat shared memory sample ring
+//
+// The process that owns the sensors publishes every delivered SensorSample
+//      into a POSIX shared memory ring. Any number of reader processes follow
+//      it without locks and without ever holding up the writer: each slot is
+//      a sequence lock, and a reader that falls a whole ring behind notices
+//      the overwritten slots, counts the lost samples and skips ahead.
+//      Readers register in a small table, so the writer can see who is
+//      falling behind and clear entries of readers that died.
+//
+//  Layout: SharedRingHeader, then slotCount SharedRingSlot entries.
+//      Sequence numbers are 32 bit so they stay lock-free on every ARM core
+//      the Sense HAT runs on; they wrap after 2^31 samples, which only
+//      needs readers to compare them modulo 2^32
+//
+//******************************************************************************
+//******************************************************************************
+#ifndef SHSHAREDRING_H
+#define SHSHAREDRING_H
+
+#include <QString>
+#include <QMutex>
+
+#include <atomic>
+
+#include "SHSensors.h"
+
+//*** defaults ***
+const char SharedRingDefaultName[] = "/qsensehat";
+const int SharedRingDefaultSlots = 1024;
+const int SharedRingDefaultMode = 0600;
+
+//*** format ***
+const char SharedRingMagic[4] = { 'S', 'H', 'R', 'B' };
+const quint32 SharedRingVersion = 1;
+const int SharedRingMaxReaders = 16;
+
+//*** one reader's registration - pid 0 is a free entry ***
+struct SharedRingReaderEntry
+{
+    std::atomic<quint32> pid;
+    std::atomic<quint32> position;      // next sample number the reader wants
+    std::atomic<quint32> lost;          // samples overwritten before it read them
+    quint32 pad;
+};
+
+//*** start of the shared memory object ***
+struct SharedRingHeader
+{
+    char magic[4];                      // SharedRingMagic
+    quint32 version;                    // SharedRingVersion
+    quint32 slotCount;                  // power of two
+    quint32 slotSize;                   // sizeof(SharedRingSlot)
+    quint32 writerPid;
+    std::atomic<quint32> open;          // cleared when the writer closes
+    quint32 reserved[2];
+
+    //*** samples written, modulo 2^32 - on its own cache line ***
+    std::atomic<quint32> head;
+    quint32 pad[15];
+
+    SharedRingReaderEntry readers[SharedRingMaxReaders];
+};
+
+//*** one sample - seq is 2n+1 while sample n is written, 2n+2 once complete ***
+struct SharedRingSlot
+{
+    std::atomic<quint32> seq;
+    quint32 pad;
+    SensorSample sample;
+};
+
+//*** reader state as seen by the writer ***
+struct SharedReaderStatus
+{
+    quint32 pid;
+    quint32 lag;                        // samples written but not yet read
+    quint32 lost;                       // samples the reader missed
+    bool slow;                          // more than 3/4 of the ring behind, or lost samples
+};
+
+//*** result of SHSharedRingReader::next() ***
+enum SharedRingResult
+{
+    RING_SAMPLE,                        // a sample was read
+    RING_EMPTY,                         // no new sample yet
+    RING_OVERRUN,                       // samples were lost, reading continues after them
+    RING_CLOSED                         // the writer has gone
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHSharedRingWriter class - creates the ring and publishes
+ *              samples. One writer per ring
+ */
+//******************************************************************************
+class SHSharedRingWriter
+{
+public:
+
+    SHSharedRingWriter();
+    ~SHSharedRingWriter();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief open - create the shared memory object, replacing any left by
+     *              an earlier writer
+     * @param name     - POSIX shared memory name, starting with '/'
+     * @param ringSize - ring size, rounded up to a power of two
+     * @param mode     - permissions. Readers need write access to register,
+     *                   so widen the default to let other users follow the ring
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool open( QString name, int ringSize, int mode = SharedRingDefaultMode );
+
+    //*** mark the ring closed for readers and remove it ***
+    void close();
+
+    bool isOpen() { return header_ != 0; }
+
+    //*** publish a sample ***
+    void write( const SensorSample &sample );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief checkReaders - state of the registered readers. Entries of
+     *              readers that no longer exist are freed
+     * @param status   - receives up to max entries
+     * @param max      - size of status
+     * @param newlySlow - receives the readers that turned slow since the
+     *                   last check, may be NULL
+     * @param slowCount - receives the number of entries in newlySlow
+     * @return - number of readers
+     */
+    //******************************************************************************
+    int checkReaders( SharedReaderStatus *status, int max,
+                      SharedReaderStatus *newlySlow = 0, int *slowCount = 0 );
+
+private:
+
+    QMutex mutex_;
+    QString name_;
+
+    SharedRingHeader *header_;
+    SharedRingSlot *slots_;
+    size_t mapSize_;
+    quint32 mask_;
+
+    //*** readers already reported slow, by entry ***
+    quint32 slowMask_;
+    quint32 lastLost_[SharedRingMaxReaders];
+    quint32 lastPid_[SharedRingMaxReaders];
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHSharedRingReader class - follows a ring from any process.
+ *              Never blocks and never writes anything but its own entry.
+ *              One reader object per thread
+ */
+//******************************************************************************
+class SHSharedRingReader
+{
+public:
+
+    SHSharedRingReader();
+    ~SHSharedRingReader();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief open - map a ring and start at its newest sample. Without write
+     *              access the reader works but is not visible to the writer
+     * @param name - POSIX shared memory name
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool open( QString name = SharedRingDefaultName );
+
+    //*** unregister and unmap ***
+    void close();
+
+    bool isOpen() { return header_ != 0; }
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief next - read the next sample in order
+     * @param sample - receives the sample for RING_SAMPLE
+     * @return - result
+     */
+    //******************************************************************************
+    SharedRingResult next( SensorSample &sample );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief latest - read the newest sample, for readers that only poll.
+     *              Older samples count as read, next() continues after it
+     * @param sample - receives the sample
+     * @return - FALSE if nothing was written yet or the writer has gone
+     */
+    //******************************************************************************
+    bool latest( SensorSample &sample );
+
+    //*** samples waiting to be read ***
+    quint32 available();
+
+    //*** samples lost to overruns since open ***
+    quint32 lost() { return lost_; }
+
+    //*** the writer is still publishing ***
+    bool writerAlive();
+
+private:
+
+    //*** copy a slot if it still holds sample n ***
+    bool readSlot( quint32 n, SensorSample &sample );
+
+    SharedRingHeader *header_;
+    SharedRingSlot *slots_;
+    size_t mapSize_;
+    quint32 mask_;
+
+    SharedRingReaderEntry *entry_;      // NULL if not registered
+    quint32 position_;
+    quint32 lost_;
+};
+
+#endif // SHSHAREDRING_H
@@ -0,0 +1,468 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat simulated sensors
+//
+// RTIMU, RTPressure and RTHumidity implementations that synthesize readings
+//      from a motion profile and a noise model, so SHSensors runs unchanged
+//      on a machine without the hardware
+//
+//******************************************************************************
+//******************************************************************************
+#include "SHSimSensors.h"
+
+#include <time.h>
+#include <math.h>
+
+//*** most samples returned in a row before yielding ***
+const int MaxSimBurst = 256;
+
+//*** earth field of the simulated location ***
+const double SimFieldUt = 48.0;
+const double SimFieldInclination = 65.0 * M_PI / 180.0;
+
+//*** time step for angular rates from the motion profile ***
+const double RateStepSec = 0.001;
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief simNowNs - current CLOCK_MONOTONIC time
+ * @return - time in nanoseconds
+ */
+//******************************************************************************
+static qint64 simNowNs()
+{
+struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief wrapAngle - angle into -pi to pi
+ * @param angle - radians
+ * @return - wrapped angle
+ */
+//******************************************************************************
+static double wrapAngle( double angle )
+{
+    return atan2( sin( angle ), cos( angle ) );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SimSensorOptions::SimSensorOptions - a still board at 100 Hz, in
+ *              real time, with noise typical of the Sense Hat sensors
+ */
+//******************************************************************************
+SimSensorOptions::SimSensorOptions()
+{
+    sampleRateHz = 100.0;
+    speed = 1.0;
+    profile = SIM_STILL;
+    amplitude = 0.3;
+    frequencyHz = 0.25;
+    accelNoise = 0.003;
+    gyroNoise = 0.002;
+    compassNoise = 0.3;
+    pressureNoise = 0.02;
+    temperatureNoise = 0.05;
+    humidityNoise = 0.2;
+    gyroBias = 0.0;
+    pressure = 1013.25;
+    temperature = 25.0;
+    humidity = 40.0;
+    seed = 1;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimSource::SHSimSource
+ * @param options - simulation settings
+ */
+//******************************************************************************
+SHSimSource::SHSimSource( const SimSensorOptions &options )
+{
+    options_ = options;
+    options_.sampleRateHz = qBound( 1.0, options_.sampleRateHz, 10000.0 );
+    options_.speed = qMax( 0.0, options_.speed );
+
+    intervalUs_ = qMax( (qint64)( 1000000.0 / options_.sampleRateHz ), (qint64)1 );
+    sampleCount_ = 0;
+    epochUs_ = RTMath::currentUSecsSinceEpoch();
+    startNs_ = 0;
+    burstCount_ = 0;
+
+    //*** xorshift state must not be zero ***
+    rng_ = options_.seed ? options_.seed : 0x9E3779B97F4A7C15ULL;
+    spare_ = 0.0;
+    haveSpare_ = false;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimSource::realIntervalUs - real time between samples
+ * @return - interval in usecs, 0 when running as fast as read
+ */
+//******************************************************************************
+qint64 SHSimSource::realIntervalUs()
+{
+    if ( options_.speed <= 0.0 ) return 0;
+
+    return (qint64)( intervalUs_ / options_.speed );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimSource::nextDue - generate the next sample if it is due
+ * @param data - receives the sample
+ * @return - TRUE if a sample was generated
+ */
+//******************************************************************************
+bool SHSimSource::nextDue( RTIMU_DATA &data )
+{
+double tSec;
+double pose[3];
+double before[3];
+double after[3];
+double linear[3];
+double unused[3];
+double rate[3];
+double gravity[3];
+double v[3];
+double w[3];
+double cr, sr, cp, sp, cy, sy;
+RTVector3 euler;
+
+    //*** simulated clock starts at the first read ***
+    if ( startNs_ == 0 )
+    {
+        startNs_ = simNowNs();
+    }
+
+    //*** not due yet ***
+    if ( options_.speed > 0.0 )
+    {
+        double simUs = ( simNowNs() - startNs_ ) / 1000.0 * options_.speed;
+        if ( (double)sampleCount_ * intervalUs_ > simUs )
+        {
+            burstCount_ = 0;
+            return false;
+        }
+    }
+
+    //*** let the caller finish its update ***
+    if ( ++burstCount_ > MaxSimBurst )
+    {
+        burstCount_ = 0;
+        return false;
+    }
+
+    tSec = (double)sampleCount_ * intervalUs_ / 1000000.0;
+
+    //*** orientation, and its rate of change from either side ***
+    motion( tSec, pose, linear );
+    motion( tSec - RateStepSec / 2, before, unused );
+    motion( tSec + RateStepSec / 2, after, unused );
+
+    for ( int i=0; i<3; i++ )
+    {
+        rate[i] = wrapAngle( after[i] - before[i] ) / RateStepSec;
+    }
+
+    cr = cos( pose[0] );  sr = sin( pose[0] );
+    cp = cos( pose[1] );  sp = sin( pose[1] );
+    cy = cos( pose[2] );  sy = sin( pose[2] );
+
+    //*** body rates from the roll, pitch and yaw rates ***
+    data.gyroValid = true;
+    data.gyro = RTVector3( rate[0] - sp * rate[2] + options_.gyroBias + gaussian( options_.gyroNoise ),
+                           cr * rate[1] + sr * cp * rate[2] + options_.gyroBias + gaussian( options_.gyroNoise ),
+                           -sr * rate[1] + cr * cp * rate[2] + options_.gyroBias + gaussian( options_.gyroNoise ) );
+
+    //*** gravity seen by the tilted board, plus the motion ***
+    gravity[0] = -sp;
+    gravity[1] = sr * cp;
+    gravity[2] = cr * cp;
+
+    data.accelValid = true;
+    data.accel = RTVector3( gravity[0] + linear[0] + gaussian( options_.accelNoise ),
+                            gravity[1] + linear[1] + gaussian( options_.accelNoise ),
+                            gravity[2] + linear[2] + gaussian( options_.accelNoise ) );
+
+    //*** earth field (north and down) rotated into the board: yaw, pitch, roll ***
+    v[0] = cy * SimFieldUt * cos( SimFieldInclination );
+    v[1] = -sy * SimFieldUt * cos( SimFieldInclination );
+    v[2] = -SimFieldUt * sin( SimFieldInclination );
+
+    w[0] = cp * v[0] - sp * v[2];
+    w[1] = v[1];
+    w[2] = sp * v[0] + cp * v[2];
+
+    data.compassValid = true;
+    data.compass = RTVector3( w[0] + gaussian( options_.compassNoise ),
+                              cr * w[1] + sr * w[2] + gaussian( options_.compassNoise ),
+                              -sr * w[1] + cr * w[2] + gaussian( options_.compassNoise ) );
+
+    //*** fusion is the truth ***
+    euler = RTVector3( pose[0], pose[1], pose[2] );
+    data.fusionPoseValid = true;
+    data.fusionPose = euler;
+    data.fusionQPoseValid = true;
+    data.fusionQPose.fromEuler( euler );
+
+    //*** environmental readings come from the pressure and humidity objects ***
+    data.pressureValid = false;
+    data.temperatureValid = false;
+    data.humidityValid = false;
+
+    data.timestamp = epochUs_ + sampleCount_ * intervalUs_;
+    sampleCount_++;
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimSource::environment - pressure, temperature and humidity
+ * @param data - receives the readings
+ */
+//******************************************************************************
+void SHSimSource::environment( RTIMU_DATA &data )
+{
+    data.pressureValid = true;
+    data.pressure = options_.pressure + gaussian( options_.pressureNoise );
+    data.temperatureValid = true;
+    data.temperature = options_.temperature + gaussian( options_.temperatureNoise );
+    data.humidityValid = true;
+    data.humidity = qBound( 0.0, options_.humidity + gaussian( options_.humidityNoise ), 100.0 );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimSource::motion - the motion profile
+ * @param tSec   - simulated time
+ * @param pose   - receives roll, pitch and yaw (radians)
+ * @param linear - receives acceleration other than gravity (g, board axes)
+ */
+//******************************************************************************
+void SHSimSource::motion( double tSec, double pose[3], double linear[3] )
+{
+double a = options_.amplitude;
+double wt = 2.0 * M_PI * options_.frequencyHz * tSec;
+
+    for ( int i=0; i<3; i++ )
+    {
+        pose[i] = 0.0;
+        linear[i] = 0.0;
+    }
+
+    switch ( options_.profile )
+    {
+        case SIM_TILT:
+            pose[0] = a * sin( wt );
+            pose[1] = a * sin( 0.7 * wt );
+            break;
+
+        case SIM_SPIN:
+            pose[2] = wrapAngle( wt );
+            break;
+
+        case SIM_SHAKE:
+            linear[0] = a * sin( wt );
+            break;
+
+        case SIM_WANDER:
+            pose[0] = a * ( 0.6 * sin( wt ) + 0.4 * sin( 2.3 * wt + 1.0 ) );
+            pose[1] = a * ( 0.6 * sin( 0.8 * wt + 2.0 ) + 0.4 * sin( 1.9 * wt ) );
+            pose[2] = wrapAngle( a * ( 4.0 * sin( 0.3 * wt ) + 2.0 * sin( 0.7 * wt + 0.5 ) ) );
+            break;
+
+        case SIM_STILL:
+        default:
+            break;
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimSource::gaussian - normally distributed noise (xorshift64*
+ *              and Box-Muller)
+ * @param sigma - standard deviation
+ * @return - noise value
+ */
+//******************************************************************************
+double SHSimSource::gaussian( double sigma )
+{
+double u1, u2, r;
+
+    if ( sigma <= 0.0 ) return 0.0;
+
+    if ( haveSpare_ )
+    {
+        haveSpare_ = false;
+        return spare_ * sigma;
+    }
+
+    rng_ ^= rng_ >> 12;  rng_ ^= rng_ << 25;  rng_ ^= rng_ >> 27;
+    u1 = ( ( rng_ * 0x2545F4914F6CDD1DULL ) >> 11 ) * ( 1.0 / 9007199254740992.0 );
+    rng_ ^= rng_ >> 12;  rng_ ^= rng_ << 25;  rng_ ^= rng_ >> 27;
+    u2 = ( ( rng_ * 0x2545F4914F6CDD1DULL ) >> 11 ) * ( 1.0 / 9007199254740992.0 );
+
+    //*** u1 in (0, 1] for the log ***
+    r = sqrt( -2.0 * log( 1.0 - u1 ) );
+    spare_ = r * sin( 2.0 * M_PI * u2 );
+    haveSpare_ = true;
+
+    return r * cos( 2.0 * M_PI * u2 ) * sigma;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+//
+// Simulated IMU
+//
+//******************************************************************************
+//******************************************************************************
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimIMU::SHSimIMU
+ * @param settings - RTIMU settings
+ * @param source   - shared simulation
+ */
+//******************************************************************************
+SHSimIMU::SHSimIMU( RTIMUSettings *settings, SHSimSource *source )
+    : RTIMU( settings )
+{
+    source_ = source;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimIMU::IMUGetPollInterval - poll at the real sample interval
+ * @return - interval in msecs
+ */
+//******************************************************************************
+int SHSimIMU::IMUGetPollInterval()
+{
+    return qMax( (int)( source_->realIntervalUs() / 1000 ), 1 );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimIMU::IMURead - generate the next due sample, fusion included
+ * @return - TRUE if a sample was generated
+ */
+//******************************************************************************
+bool SHSimIMU::IMURead()
+{
+    return source_->nextDue( m_imuData );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+//
+// Simulated pressure and humidity
+//
+//******************************************************************************
+//******************************************************************************
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimPressure::SHSimPressure
+ * @param settings - RTIMU settings
+ * @param source   - shared simulation
+ */
+//******************************************************************************
+SHSimPressure::SHSimPressure( RTIMUSettings *settings, SHSimSource *source )
+    : RTPressure( settings )
+{
+    source_ = source;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimPressure::pressureRead - simulated pressure and temperature
+ * @param data - receives pressure and temperature
+ * @return - TRUE
+ */
+//******************************************************************************
+bool SHSimPressure::pressureRead( RTIMU_DATA &data )
+{
+RTIMU_DATA env;
+
+    source_->environment( env );
+
+    data.pressureValid = true;
+    data.pressure = env.pressure;
+    data.temperatureValid = true;
+    data.temperature = env.temperature;
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimHumidity::SHSimHumidity
+ * @param settings - RTIMU settings
+ * @param source   - shared simulation
+ */
+//******************************************************************************
+SHSimHumidity::SHSimHumidity( RTIMUSettings *settings, SHSimSource *source )
+    : RTHumidity( settings )
+{
+    source_ = source;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimHumidity::humidityRead - simulated humidity
+ * @param data - receives humidity
+ * @return - TRUE
+ */
+//******************************************************************************
+bool SHSimHumidity::humidityRead( RTIMU_DATA &data )
+{
+RTIMU_DATA env;
+
+    source_->environment( env );
+
+    data.humidityValid = true;
+    data.humidity = env.humidity;
+
+    return true;
+}
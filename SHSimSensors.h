@@ -0,0 +1,190 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat simulated sensors
+//
+// RTIMU, RTPressure and RTHumidity implementations that synthesize readings
+//      instead of reading the I2C bus. The board follows a motion profile and
+//      every reading is the exact value for that motion plus gaussian noise;
+//      the fusion pose is the exact orientation, so fusion and motion
+//      processing can be checked against the truth
+//
+//  Samples are generated on a simulated clock that runs at a set multiple
+//      of real time, or as fast as the reader takes them, so hours of data
+//      can be pushed through SHSensors in minutes. The noise generator is
+//      seeded, so a run can be repeated exactly
+//
+//******************************************************************************
+//******************************************************************************
+#ifndef SHSIMSENSORS_H
+#define SHSIMSENSORS_H
+
+#include "RTIMULib.h"
+
+#include <QtGlobal>
+
+//*** motion of the simulated board ***
+enum SimMotionProfile
+{
+    SIM_STILL,                  // flat and level
+    SIM_TILT,                   // rocking in roll and pitch, amplitude in radians
+    SIM_SPIN,                   // turning about the vertical at frequency revolutions per second
+    SIM_SHAKE,                  // level, shaken along x, amplitude in g
+    SIM_WANDER                  // slow irregular turning on all axes, amplitude in radians
+};
+
+//*** simulation settings - the constructor sets defaults ***
+struct SimSensorOptions
+{
+    SimSensorOptions();
+
+    double sampleRateHz;        // IMU samples per simulated second
+    double speed;               // simulated seconds per real second, 0 for as fast as read
+
+    SimMotionProfile profile;
+    double amplitude;           // see SimMotionProfile
+    double frequencyHz;         // rate of the motion
+
+    //*** noise standard deviations ***
+    double accelNoise;          // g
+    double gyroNoise;           // radians per second
+    double compassNoise;        // uT
+    double pressureNoise;       // hPa
+    double temperatureNoise;    // celsius
+    double humidityNoise;       // % relative humidity
+
+    //*** constant gyro offset, radians per second, on every axis ***
+    double gyroBias;
+
+    //*** environment ***
+    double pressure;            // hPa
+    double temperature;         // celsius
+    double humidity;            // % relative humidity
+
+    quint64 seed;               // noise generator seed
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHSimSource class - simulated clock, motion and noise shared by
+ *              the simulated IMU, pressure and humidity objects
+ */
+//******************************************************************************
+class SHSimSource
+{
+public:
+
+    SHSimSource( const SimSensorOptions &options );
+
+    //*** the next sample if it is due on the simulated clock - FALSE if not yet ***
+    bool nextDue( RTIMU_DATA &data );
+
+    //*** environmental readings at the current simulated time ***
+    void environment( RTIMU_DATA &data );
+
+    //*** sample interval (usecs of simulated time) ***
+    qint64 intervalUs() { return intervalUs_; }
+
+    //*** real time between samples (usecs), 0 when running as fast as read ***
+    qint64 realIntervalUs();
+
+    const SimSensorOptions &options() { return options_; }
+
+private:
+
+    //*** orientation (roll, pitch, yaw) and linear acceleration at a time ***
+    void motion( double tSec, double pose[3], double linear[3] );
+
+    //*** gaussian noise ***
+    double gaussian( double sigma );
+
+    SimSensorOptions options_;
+    qint64 intervalUs_;
+
+    //*** simulated clock - samples generated, against the start ***
+    quint64 sampleCount_;
+    quint64 epochUs_;               // RTIMU timestamp of the first sample
+    qint64 startNs_;                // real start, 0 until the first read
+
+    //*** samples returned since the last FALSE - bounds bursts ***
+    int burstCount_;
+
+    //*** noise generator state ***
+    quint64 rng_;
+    double spare_;
+    bool haveSpare_;
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHSimIMU class
+ */
+//******************************************************************************
+class SHSimIMU : public RTIMU
+{
+public:
+
+    SHSimIMU( RTIMUSettings *settings, SHSimSource *source );
+
+    virtual const char *IMUName() { return "Simulated IMU"; }
+    virtual int IMUType() { return RTIMU_TYPE_AUTODISCOVER; }
+    virtual bool IMUInit() { return true; }
+    virtual int IMUGetPollInterval();
+    virtual bool IMURead();
+
+private:
+
+    SHSimSource *source_;
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHSimPressure class - simulated pressure and temperature
+ */
+//******************************************************************************
+class SHSimPressure : public RTPressure
+{
+public:
+
+    SHSimPressure( RTIMUSettings *settings, SHSimSource *source );
+
+    virtual const char *pressureName() { return "Simulated pressure"; }
+    virtual int pressureType() { return RTPRESSURE_TYPE_AUTODISCOVER; }
+    virtual bool pressureInit() { return true; }
+    virtual bool pressureRead( RTIMU_DATA &data );
+
+private:
+
+    SHSimSource *source_;
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHSimHumidity class - simulated humidity
+ */
+//******************************************************************************
+class SHSimHumidity : public RTHumidity
+{
+public:
+
+    SHSimHumidity( RTIMUSettings *settings, SHSimSource *source );
+
+    virtual const char *humidityName() { return "Simulated humidity"; }
+    virtual int humidityType() { return RTHUMIDITY_TYPE_AUTODISCOVER; }
+    virtual bool humidityInit() { return true; }
+    virtual bool humidityRead( RTIMU_DATA &data );
+
+private:
+
+    SHSimSource *source_;
+};
+
+#endif // SHSIMSENSORS_H
@@ -0,0 +1,472 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat headless simulator
+//
+// Memory framebuffer, scripted joystick and simulated sensors in place of the
+//      Sense Hat hardware
+//
+//******************************************************************************
+//******************************************************************************
+#include "SHSimulator.h"
+
+#include <QDebug>
+#include <QStringList>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/input.h>
+
+//*** longest sleep of a script before checking for interruption ***
+const qint64 MaxScriptSleepNs = 100000000;
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief writeKey - write a key press and release into the joystick socket
+ * @param fd  - simulator end of the socket
+ * @param key - key
+ * @return - TRUE if written, FALSE if the socket is full (EAGAIN) or the
+ *              joystick has closed its end (EPIPE)
+ */
+//******************************************************************************
+static bool writeKey( int fd, Joystick_Event key )
+{
+struct input_event ev[4];
+struct timeval now;
+int code = KEY_ENTER;
+
+    switch ( key )
+    {
+        case JS_UP:     code = KEY_UP;     break;
+        case JS_DOWN:   code = KEY_DOWN;   break;
+        case JS_LEFT:   code = KEY_LEFT;   break;
+        case JS_RIGHT:  code = KEY_RIGHT;  break;
+        case JS_ENTER:
+        default:        code = KEY_ENTER;  break;
+    }
+
+    memset( ev, 0, sizeof(ev) );
+    gettimeofday( &now, 0 );
+
+    //*** press, sync, release, sync - as the joystick driver reports them ***
+    for ( int i=0; i<4; i++ )
+    {
+        ev[i].time = now;
+        ev[i].type = ( i % 2 == 0 ) ? EV_KEY : EV_SYN;
+        ev[i].code = ( i % 2 == 0 ) ? code : SYN_REPORT;
+        ev[i].value = ( i == 0 ) ? 1 : 0;
+    }
+
+    //*** one packet, sent whole or not at all. No SIGPIPE if the joystick has gone ***
+    return send( fd, ev, sizeof(ev), MSG_NOSIGNAL | MSG_DONTWAIT ) == (ssize_t)sizeof(ev);
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimulator::SHSimulator
+ * @param parent
+ */
+//******************************************************************************
+SHSimulator::SHSimulator( QObject *parent ) :
+    QObject( parent )
+{
+    fbFd_ = -1;
+    fbPtr_ = 0;
+    jsFd_ = -1;
+    scriptThread_ = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimulator::~SHSimulator
+ */
+//******************************************************************************
+SHSimulator::~SHSimulator()
+{
+    stopJoystickScript();
+
+    //*** the joystick sees the end of its input ***
+    if ( jsFd_ >= 0 )
+    {
+        ::close( jsFd_ );
+    }
+
+    if ( fbPtr_ )
+    {
+        munmap( (void *)fbPtr_, DisplayMemSizeBytes );
+    }
+
+    if ( fbFd_ >= 0 )
+    {
+        ::close( fbFd_ );
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimulator::attach - simulated devices in place of the hardware
+ * @param display  - gets a memory framebuffer, or 0
+ * @param joystick - gets the simulator's event socket, or 0
+ * @param sensors  - gets simulated sensors, or 0
+ * @param options  - sensor simulation and speed
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSimulator::attach( SHLedMatrix *display, SHJoystick *joystick, SHSensors *sensors,
+                          const SimSensorOptions &options )
+{
+int jsFds[2];
+void *map;
+
+    options_ = options;
+
+    //*** display - a memory file with the framebuffer layout ***
+    if ( display )
+    {
+        if ( fbFd_ < 0 )
+        {
+            fbFd_ = memfd_create( "qsensehat-sim-fb", MFD_CLOEXEC );
+            if ( fbFd_ < 0 || ftruncate( fbFd_, DisplayMemSizeBytes ) < 0 )
+            {
+                emit error( QString("Simulator: Could not create the framebuffer") );
+                return false;
+            }
+
+            map = mmap( 0, DisplayMemSizeBytes, PROT_READ, MAP_SHARED, fbFd_, 0 );
+            if ( map == MAP_FAILED )
+            {
+                emit error( QString("Simulator: Could not map the framebuffer") );
+                return false;
+            }
+            fbPtr_ = (volatile quint16 *)map;
+        }
+
+        if ( !display->setFramebufferDevice( dup( fbFd_ ) ) )
+        {
+            return false;
+        }
+    }
+
+    //*** joystick - reads what pressKey() and scripts write ***
+    if ( joystick )
+    {
+        //*** a packet per key - unlike a pipe, written without the risk of SIGPIPE ***
+        if ( socketpair( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, jsFds ) < 0 )
+        {
+            emit error( QString("Simulator: Could not create the joystick socket") );
+            return false;
+        }
+
+        stopJoystickScript();
+        if ( jsFd_ >= 0 )
+        {
+            ::close( jsFd_ );
+        }
+        jsFd_ = jsFds[1];
+
+        joystick->setInputDevice( jsFds[0] );
+    }
+
+    //*** sensors ***
+    if ( sensors && !sensors->openSimulator( options ) )
+    {
+        return false;
+    }
+
+    qDebug() << "Sense Hat simulator attached";
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimulator::pressKey - press and release a key now
+ * @param key - key
+ * @return - TRUE if the events were written, FALSE if the socket is full or
+ *              the joystick has gone
+ */
+//******************************************************************************
+bool SHSimulator::pressKey( Joystick_Event key )
+{
+    if ( jsFd_ < 0 ) return false;
+
+    return writeKey( jsFd_, key );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimulator::runJoystickScript - press keys on a schedule
+ * @param script - key names and waits
+ * @param repeat - times to run the script, 0 for until stopped
+ * @return - TRUE if the script is valid and started
+ */
+//******************************************************************************
+bool SHSimulator::runJoystickScript( QString script, int repeat )
+{
+QVector<SimJoystickStep> steps;
+qint64 durationUs = 0;
+
+    if ( jsFd_ < 0 )
+    {
+        emit error( QString("Simulator: No joystick attached") );
+        return false;
+    }
+
+    if ( !parseScript( script, steps, durationUs ) || steps.isEmpty() )
+    {
+        emit error( QString("Simulator: Invalid joystick script %1").arg(script) );
+        return false;
+    }
+
+    stopJoystickScript();
+
+    scriptThread_ = new SimJoystickThread( jsFd_, steps, durationUs, options_.speed,
+                                           qMax( repeat, 0 ), this );
+    connect( scriptThread_, SIGNAL(finished()), SIGNAL(scriptFinished()) );
+    scriptThread_->start();
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimulator::stopJoystickScript - stop any running script
+ */
+//******************************************************************************
+void SHSimulator::stopJoystickScript()
+{
+    if ( !scriptThread_ )
+    {
+        return;
+    }
+
+    scriptThread_->requestInterruption();
+    scriptThread_->wait();
+    delete scriptThread_;
+    scriptThread_ = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimulator::parseScript - parse a joystick script
+ * @param script     - key names and waits
+ * @param steps      - receives the key presses
+ * @param durationUs - receives the script length, trailing wait included
+ * @return - TRUE if every word was understood
+ */
+//******************************************************************************
+bool SHSimulator::parseScript( QString script, QVector<SimJoystickStep> &steps, qint64 &durationUs )
+{
+QStringList words = script.toLower().replace( ',', ' ' ).simplified().split( ' ', QString::SkipEmptyParts );
+SimJoystickStep step;
+qint64 atUs = 0;
+bool ok;
+
+    steps.clear();
+
+    for ( int i=0; i<words.size(); i++ )
+    {
+        QString word = words[i];
+
+        //*** waits ***
+        if ( word.endsWith( "ms" ) )
+        {
+            atUs += (qint64)( word.left( word.size() - 2 ).toDouble( &ok ) * 1000 );
+            if ( !ok ) return false;
+            continue;
+        }
+
+        if ( word.endsWith( "s" ) && word.size() > 1 && ( word[0].isDigit() || word[0] == '.' ) )
+        {
+            atUs += (qint64)( word.left( word.size() - 1 ).toDouble( &ok ) * 1000000 );
+            if ( !ok ) return false;
+            continue;
+        }
+
+        //*** keys ***
+        if ( word == "up" )          step.key = JS_UP;
+        else if ( word == "down" )   step.key = JS_DOWN;
+        else if ( word == "left" )   step.key = JS_LEFT;
+        else if ( word == "right" )  step.key = JS_RIGHT;
+        else if ( word == "enter" )  step.key = JS_ENTER;
+        else return false;
+
+        step.atUs = atUs;
+        steps.append( step );
+    }
+
+    durationUs = atUs;
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSimulator::parseOptions - read simulation settings
+ * @param spec    - "1", or key=value pairs separated by commas
+ * @param options - settings to update
+ * @return - TRUE if every key was understood
+ */
+//******************************************************************************
+bool SHSimulator::parseOptions( QString spec, SimSensorOptions &options )
+{
+QStringList pairs = spec.trimmed().toLower().split( ',', QString::SkipEmptyParts );
+bool allOk = true;
+bool ok;
+double value;
+
+    for ( int i=0; i<pairs.size(); i++ )
+    {
+        QString key = pairs[i].section( '=', 0, 0 ).trimmed();
+        QString text = pairs[i].section( '=', 1 ).trimmed();
+
+        //*** a plain switch selects the defaults ***
+        if ( text.isEmpty() && ( key == "1" || key == "on" || key == "yes" || key == "true" ) )
+        {
+            continue;
+        }
+
+        if ( key == "profile" )
+        {
+            if ( text == "still" )        options.profile = SIM_STILL;
+            else if ( text == "tilt" )    options.profile = SIM_TILT;
+            else if ( text == "spin" )    options.profile = SIM_SPIN;
+            else if ( text == "shake" )   options.profile = SIM_SHAKE;
+            else if ( text == "wander" )  options.profile = SIM_WANDER;
+            else allOk = false;
+            continue;
+        }
+
+        value = text.toDouble( &ok );
+        if ( !ok )
+        {
+            allOk = false;
+            continue;
+        }
+
+        if ( key == "rate" )            options.sampleRateHz = value;
+        else if ( key == "speed" )      options.speed = value;
+        else if ( key == "amplitude" )  options.amplitude = value;
+        else if ( key == "frequency" )  options.frequencyHz = value;
+        else if ( key == "gyrobias" )   options.gyroBias = value;
+        else if ( key == "seed" )       options.seed = (quint64)value;
+        else if ( key == "noise" )
+        {
+            options.accelNoise *= value;
+            options.gyroNoise *= value;
+            options.compassNoise *= value;
+            options.pressureNoise *= value;
+            options.temperatureNoise *= value;
+            options.humidityNoise *= value;
+        }
+        else allOk = false;
+    }
+
+    return allOk;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+//
+// Joystick script thread
+//
+//******************************************************************************
+//******************************************************************************
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SimJoystickThread::SimJoystickThread
+ * @param sockFd     - simulator end of the joystick socket (not closed)
+ * @param steps      - key presses
+ * @param durationUs - length of one run
+ * @param speed      - simulated seconds per real second, 0 for no waits
+ * @param repeat     - runs, 0 for until interrupted
+ * @param parent
+ */
+//******************************************************************************
+SimJoystickThread::SimJoystickThread( int sockFd, const QVector<SimJoystickStep> &steps,
+                                      qint64 durationUs, double speed, int repeat, QObject *parent )
+    : QThread( parent )
+{
+    sockFd_ = sockFd;
+    steps_ = steps;
+    durationUs_ = durationUs;
+    speed_ = speed;
+    repeat_ = repeat;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SimJoystickThread::run
+ */
+//******************************************************************************
+void SimJoystickThread::run()
+{
+struct timespec start;
+struct timespec now;
+qint64 runStartUs = 0;
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    for ( int run=0; ( repeat_ == 0 || run < repeat_ ) && !isInterruptionRequested(); run++ )
+    {
+        for ( int i=0; i<steps_.size() && !isInterruptionRequested(); i++ )
+        {
+            //*** wait for the step's time on the simulated clock ***
+            if ( speed_ > 0.0 )
+            {
+                qint64 dueNSec = (qint64)( ( runStartUs + steps_[i].atUs ) * 1000 / speed_ );
+
+                while ( !isInterruptionRequested() )
+                {
+                    clock_gettime( CLOCK_MONOTONIC, &now );
+                    qint64 elapsedNSec = ( now.tv_sec - start.tv_sec ) * 1000000000LL +
+                                         ( now.tv_nsec - start.tv_nsec );
+                    qint64 waitNSec = dueNSec - elapsedNSec;
+                    if ( waitNSec <= 0 ) break;
+
+                    waitNSec = qMin( waitNSec, MaxScriptSleepNs );
+                    struct timespec ts = { (time_t)(waitNSec / 1000000000), (long)(waitNSec % 1000000000) };
+                    nanosleep( &ts, 0 );
+                }
+            }
+
+            //*** a full socket means the joystick is behind - wait for it. EPIPE: detached ***
+            while ( !isInterruptionRequested() && !writeKey( sockFd_, steps_[i].key ) )
+            {
+                if ( errno != EAGAIN && errno != EINTR ) return;
+                msleep( 1 );
+            }
+        }
+
+        runStartUs += durationUs_;
+    }
+}
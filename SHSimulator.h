@@ -0,0 +1,185 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat headless simulator
+//
+// Runs the library without the board: the display draws into a memory file
+//      in place of the framebuffer, the joystick reads events written by the
+//      simulator into a socket pair in place of the input device, and the sensors
+//      are synthesized (see SHSimSensors.h). The components themselves run
+//      unchanged, threads, locks and signals included, so load and soak
+//      tests exercise the same code as the hardware
+//
+//  Selected with QSenseHat::startSimulator(), or for a program that uses
+//      QSenseHat::getInstance() without changes, by setting
+//      QSENSEHAT_SIMULATOR before the first call:
+//
+//      QSENSEHAT_SIMULATOR=1
+//      QSENSEHAT_SIMULATOR=rate=400,speed=50,profile=wander,noise=2,seed=7
+//
+//      keys: rate (Hz), speed (x real time, 0 for as fast as read),
+//      profile (still, tilt, spin, shake, wander), amplitude, frequency (Hz),
+//      noise (scale on every noise level), gyrobias (rad/s), seed
+//
+//  Joystick scripts are key names (up, down, left, right, enter) and waits
+//      (250ms, 2s) separated by spaces or commas, e.g. "up 100ms up 1s enter".
+//      Waits are in simulated time and shrink with the speed
+//
+//******************************************************************************
+//******************************************************************************
+#ifndef SHSIMULATOR_H
+#define SHSIMULATOR_H
+
+#include <QObject>
+#include <QThread>
+#include <QVector>
+
+#include "SHLedMatrix.h"
+#include "SHJoystick.h"
+#include "SHSensors.h"
+
+//*** environment variable that selects the simulator ***
+const char SimulatorEnvVar[] = "QSENSEHAT_SIMULATOR";
+
+//*** one joystick script step - press a key at a time from the script start ***
+struct SimJoystickStep
+{
+    qint64 atUs;                // simulated time
+    Joystick_Event key;
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SimJoystickThread class - presses the keys of a script into the
+ *              simulator's joystick socket at their times
+ */
+//******************************************************************************
+class SimJoystickThread : public QThread
+{
+public:
+
+    SimJoystickThread( int sockFd, const QVector<SimJoystickStep> &steps, qint64 durationUs,
+                       double speed, int repeat, QObject *parent );
+
+private:
+
+    //*** override this for the actual thread code ***
+    void run();
+
+    //*** simulator end of the joystick socket, owned by SHSimulator ***
+    int sockFd_;
+
+    QVector<SimJoystickStep> steps_;
+    qint64 durationUs_;             // one run of the script, trailing wait included
+    double speed_;
+    int repeat_;
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHSimulator class
+ */
+//******************************************************************************
+class SHSimulator : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    explicit SHSimulator( QObject *parent = 0 );
+    virtual ~SHSimulator();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief attach - put simulated devices in place of the hardware of the
+     *              given components. Any of them may be 0 to keep its hardware
+     * @param display  - gets a memory framebuffer
+     * @param joystick - gets the simulator's event socket
+     * @param sensors  - gets simulated sensors
+     * @param options  - sensor simulation, and the speed for joystick scripts
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool attach( SHLedMatrix *display, SHJoystick *joystick, SHSensors *sensors,
+                 const SimSensorOptions &options = SimSensorOptions() );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief framebuffer - the simulated display, for checking what was drawn
+     * @return - DisplayXSize x DisplayYSize RGB565 pixels, row by row, or 0
+     *              if no display is attached
+     */
+    //******************************************************************************
+    const volatile quint16 *framebuffer() { return fbPtr_; }
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief pressKey - press and release a key now. Safe from any thread
+     * @param key - key
+     * @return - TRUE if the events were written, FALSE if the socket is full
+     *              or the joystick has gone
+     */
+    //******************************************************************************
+    bool pressKey( Joystick_Event key );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief runJoystickScript - press keys on a schedule, replacing any script
+     *              still running. scriptFinished() is emitted when it ends
+     * @param script - key names and waits, see the file header
+     * @param repeat - times to run the script, 0 for until stopped
+     * @return - TRUE if the script is valid and started
+     */
+    //******************************************************************************
+    bool runJoystickScript( QString script, int repeat = 1 );
+
+    void stopJoystickScript();
+
+    bool joystickScriptRunning() { return scriptThread_ && scriptThread_->isRunning(); }
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief parseOptions - read simulation settings from the form used in
+     *              SimulatorEnvVar. Keys not given keep their value
+     * @param spec    - "1", or key=value pairs separated by commas
+     * @param options - settings to update
+     * @return - TRUE if every key was understood
+     */
+    //******************************************************************************
+    static bool parseOptions( QString spec, SimSensorOptions &options );
+
+    //*** parse a joystick script into steps and its duration - FALSE on an unknown word ***
+    static bool parseScript( QString script, QVector<SimJoystickStep> &steps, qint64 &durationUs );
+
+signals:
+
+    void error( QString errStr );
+
+    //*** a joystick script has ended ***
+    void scriptFinished();
+
+private:
+
+    //*** memory framebuffer ***
+    int fbFd_;
+    volatile quint16 *fbPtr_;
+
+    //*** simulator end of the joystick socket ***
+    int jsFd_;
+
+    SimJoystickThread *scriptThread_;
+    SimSensorOptions options_;
+
+    Q_DISABLE_COPY( SHSimulator )
+};
+
+#endif // SHSIMULATOR_H
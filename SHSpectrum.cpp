@@ -0,0 +1,595 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat vibration spectrum
+//
+// Radix-2 real FFT and a block spectrum analyzer for accelerometer samples.
+//      All buffers and tables are allocated when a size is configured, so
+//      analysis never allocates
+//
+//******************************************************************************
+//******************************************************************************
+#include "SHSpectrum.h"
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SH_FFT_NEON
+#endif
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief spectrumNowNs - current CLOCK_MONOTONIC time
+ * @return - time in nanoseconds
+ */
+//******************************************************************************
+static qint64 spectrumNowNs()
+{
+struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHFft::SHFft
+ */
+//******************************************************************************
+SHFft::SHFft()
+{
+    size_ = 0;
+    half_ = 0;
+    swaps_ = 0;
+    swapCount_ = 0;
+    twRe_ = 0;
+    twIm_ = 0;
+    splitRe_ = 0;
+    splitIm_ = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHFft::~SHFft
+ */
+//******************************************************************************
+SHFft::~SHFft()
+{
+    release();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHFft::release - free the tables
+ */
+//******************************************************************************
+void SHFft::release()
+{
+    delete [] swaps_;
+    delete [] twRe_;
+    delete [] twIm_;
+    delete [] splitRe_;
+    delete [] splitIm_;
+
+    swaps_ = 0;
+    twRe_ = twIm_ = 0;
+    splitRe_ = splitIm_ = 0;
+    size_ = half_ = swapCount_ = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHFft::configure - build the tables for a transform size
+ * @param size - number of real samples, power of 2, at least 4
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHFft::configure( int size )
+{
+int bits = 0;
+int rev;
+
+    if ( size < 4 || ( size & ( size - 1 ) ) ) return false;
+
+    release();
+
+    size_ = size;
+    half_ = size / 2;
+
+    while ( ( 1 << bits ) < half_ ) bits++;
+
+    //*** bit reversal as a list of swaps ***
+    swaps_ = new int[ half_ ];
+    for ( int i=0; i<half_; i++ )
+    {
+        rev = 0;
+        for ( int b=0; b<bits; b++ )
+        {
+            if ( i & ( 1 << b ) ) rev |= 1 << ( bits - 1 - b );
+        }
+
+        if ( rev > i )
+        {
+            swaps_[ swapCount_++ ] = i;
+            swaps_[ swapCount_++ ] = rev;
+        }
+    }
+
+    //*** twiddles of every stage, laid out contiguously ***
+    twRe_ = new float[ half_ ];
+    twIm_ = new float[ half_ ];
+    for ( int h=1; h<half_; h<<=1 )
+    {
+        for ( int j=0; j<h; j++ )
+        {
+            twRe_[ h - 1 + j ] = cos( -M_PI * j / h );
+            twIm_[ h - 1 + j ] = sin( -M_PI * j / h );
+        }
+    }
+
+    //*** real split twiddles ***
+    splitRe_ = new float[ half_ / 2 + 1 ];
+    splitIm_ = new float[ half_ / 2 + 1 ];
+    for ( int k=0; k<=half_/2; k++ )
+    {
+        splitRe_[k] = cos( -2.0 * M_PI * k / size_ );
+        splitIm_[k] = sin( -2.0 * M_PI * k / size_ );
+    }
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHFft::complexForward - iterative decimation in time complex FFT of
+ *              half_ interleaved values
+ * @param data - interleaved real, imaginary
+ */
+//******************************************************************************
+void SHFft::complexForward( float *data )
+{
+float tr, ti;
+float *a, *b;
+const float *wr, *wi;
+int j;
+
+    //*** bit reversed order ***
+    for ( int s=0; s<swapCount_; s+=2 )
+    {
+        float *p = data + 2 * swaps_[s];
+        float *q = data + 2 * swaps_[s+1];
+
+        tr = p[0]; p[0] = q[0]; q[0] = tr;
+        ti = p[1]; p[1] = q[1]; q[1] = ti;
+    }
+
+    //*** butterflies ***
+    for ( int h=1; h<half_; h<<=1 )
+    {
+        wr = twRe_ + h - 1;
+        wi = twIm_ + h - 1;
+
+        for ( int i=0; i<half_; i+=2*h )
+        {
+            a = data + 2 * i;
+            b = data + 2 * ( i + h );
+            j = 0;
+
+#ifdef SH_FFT_NEON
+            //*** four butterflies at a time, deinterleaved on load ***
+            for ( ; j+4<=h; j+=4 )
+            {
+                float32x4x2_t va = vld2q_f32( a + 2 * j );
+                float32x4x2_t vb = vld2q_f32( b + 2 * j );
+                float32x4_t vwr = vld1q_f32( wr + j );
+                float32x4_t vwi = vld1q_f32( wi + j );
+
+                float32x4_t vtr = vmlsq_f32( vmulq_f32( vb.val[0], vwr ), vb.val[1], vwi );
+                float32x4_t vti = vmlaq_f32( vmulq_f32( vb.val[0], vwi ), vb.val[1], vwr );
+
+                vb.val[0] = vsubq_f32( va.val[0], vtr );
+                vb.val[1] = vsubq_f32( va.val[1], vti );
+                va.val[0] = vaddq_f32( va.val[0], vtr );
+                va.val[1] = vaddq_f32( va.val[1], vti );
+
+                vst2q_f32( a + 2 * j, va );
+                vst2q_f32( b + 2 * j, vb );
+            }
+#endif
+
+            for ( ; j<h; j++ )
+            {
+                tr = b[2*j] * wr[j] - b[2*j+1] * wi[j];
+                ti = b[2*j] * wi[j] + b[2*j+1] * wr[j];
+
+                b[2*j]   = a[2*j] - tr;
+                b[2*j+1] = a[2*j+1] - ti;
+                a[2*j]   += tr;
+                a[2*j+1] += ti;
+            }
+        }
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHFft::forward - forward transform of real data in place
+ * @param data - size_ real samples, replaced by the packed spectrum
+ */
+//******************************************************************************
+void SHFft::forward( float *data )
+{
+float zr, zi, cr, ci;
+float er, ei, or_, oi, tr, ti;
+int m = half_;
+
+    //*** even samples as real, odd as imaginary ***
+    complexForward( data );
+
+    //*** DC and Nyquist are purely real ***
+    zr = data[0];
+    zi = data[1];
+    data[0] = zr + zi;
+    data[1] = zr - zi;
+
+    //*** split the half size transform into the real spectrum ***
+    for ( int k=1; k<=m/2; k++ )
+    {
+        zr = data[2*k];
+        zi = data[2*k+1];
+        cr = data[2*(m-k)];
+        ci = -data[2*(m-k)+1];
+
+        //*** even and odd sample transforms ***
+        er = 0.5f * ( zr + cr );
+        ei = 0.5f * ( zi + ci );
+        or_ = 0.5f * ( zi - ci );
+        oi = -0.5f * ( zr - cr );
+
+        tr = splitRe_[k] * or_ - splitIm_[k] * oi;
+        ti = splitRe_[k] * oi + splitIm_[k] * or_;
+
+        data[2*k]       = er + tr;
+        data[2*k+1]     = ei + ti;
+        data[2*(m-k)]   = er - tr;
+        data[2*(m-k)+1] = -( ei - ti );
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+//
+// Spectrum analyzer
+//
+//******************************************************************************
+//******************************************************************************
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSpectrumAnalyzer::SHSpectrumAnalyzer
+ */
+//******************************************************************************
+SHSpectrumAnalyzer::SHSpectrumAnalyzer()
+{
+    blockSize_ = 0;
+    hop_ = 0;
+    sampleRateHz_ = 0.0;
+    ring_ = 0;
+    times_ = 0;
+    work_ = 0;
+    window_ = 0;
+    power_ = 0;
+    powerScale_ = 0.0;
+    writePos_ = 0;
+    filled_ = 0;
+    sinceBlock_ = 0;
+    edgeCount_ = 0;
+    memset( &result_, 0, sizeof(result_) );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSpectrumAnalyzer::~SHSpectrumAnalyzer
+ */
+//******************************************************************************
+SHSpectrumAnalyzer::~SHSpectrumAnalyzer()
+{
+    release();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSpectrumAnalyzer::release - free the buffers
+ */
+//******************************************************************************
+void SHSpectrumAnalyzer::release()
+{
+    delete [] ring_;
+    delete [] times_;
+    delete [] work_;
+    delete [] window_;
+    delete [] power_;
+
+    ring_ = work_ = window_ = power_ = 0;
+    times_ = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSpectrumAnalyzer::configure - set the block and allocate buffers
+ * @param blockSize    - samples per block, power of 2
+ * @param overlap      - samples shared by consecutive blocks
+ * @param sampleRateHz - nominal input sample rate, until the first block
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSpectrumAnalyzer::configure( int blockSize, int overlap, double sampleRateHz )
+{
+double sumSq = 0.0;
+
+    if ( blockSize < SpectrumMinBlock || blockSize > SpectrumMaxBlock ) return false;
+    if ( overlap < 0 || overlap >= blockSize || sampleRateHz <= 0.0 ) return false;
+    if ( !fft_.configure( blockSize ) ) return false;
+
+    release();
+
+    blockSize_ = blockSize;
+    hop_ = blockSize - overlap;
+    sampleRateHz_ = sampleRateHz;
+
+    ring_ = new float[ blockSize_ ];
+    times_ = new qint64[ blockSize_ ];
+    work_ = new float[ blockSize_ ];
+    window_ = new float[ blockSize_ ];
+    power_ = new float[ blockSize_ / 2 + 1 ];
+
+    //*** Hann window ***
+    for ( int i=0; i<blockSize_; i++ )
+    {
+        window_[i] = 0.5 - 0.5 * cos( 2.0 * M_PI * i / blockSize_ );
+        sumSq += window_[i] * window_[i];
+    }
+
+    //*** bins sum to the mean square of the block ***
+    powerScale_ = 1.0 / ( blockSize_ * sumSq );
+
+    writePos_ = 0;
+    filled_ = 0;
+    sinceBlock_ = 0;
+
+    memset( &result_, 0, sizeof(result_) );
+    result_.blockSize = blockSize_;
+    result_.sampleRateHz = sampleRateHz_;
+    result_.binHz = sampleRateHz_ / blockSize_;
+
+    return setBands( edges_, edgeCount_ );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSpectrumAnalyzer::setBands - set the band edges
+ * @param edgesHz   - ascending band edges
+ * @param edgeCount - 0, or 2 to SpectrumMaxBands+1
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHSpectrumAnalyzer::setBands( const float *edgesHz, int edgeCount )
+{
+float nyquist = sampleRateHz_ / 2.0;
+
+    if ( edgeCount == 1 || edgeCount > SpectrumMaxBands + 1 ) return false;
+
+    for ( int i=1; i<edgeCount; i++ )
+    {
+        if ( edgesHz[i] <= edgesHz[i-1] ) return false;
+    }
+
+    //*** keep the edges - they may be set before the sample rate is known ***
+    if ( edgesHz != edges_ )
+    {
+        memmove( edges_, edgesHz, edgeCount * sizeof(float) );
+    }
+    edgeCount_ = edgeCount;
+
+    //*** equal bands up to Nyquist by default ***
+    if ( edgeCount_ == 0 )
+    {
+        result_.bandCount = SpectrumDefaultBands;
+        for ( int i=0; i<SpectrumDefaultBands; i++ )
+        {
+            result_.bandLowHz[i] = nyquist * i / SpectrumDefaultBands;
+            result_.bandHighHz[i] = nyquist * ( i + 1 ) / SpectrumDefaultBands;
+        }
+        return true;
+    }
+
+    result_.bandCount = edgeCount_ - 1;
+    for ( int i=0; i<result_.bandCount; i++ )
+    {
+        result_.bandLowHz[i] = edges_[i];
+        result_.bandHighHz[i] = edges_[i+1];
+    }
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSpectrumAnalyzer::add - add a sample
+ * @param timestampNs - time of the sample
+ * @param value       - sample value
+ * @return - TRUE when a new result is ready
+ */
+//******************************************************************************
+bool SHSpectrumAnalyzer::add( qint64 timestampNs, float value )
+{
+    if ( blockSize_ == 0 ) return false;
+
+    ring_[ writePos_ ] = value;
+    times_[ writePos_ ] = timestampNs;
+    if ( ++writePos_ == blockSize_ ) writePos_ = 0;
+
+    //*** first block needs a full buffer, later ones one hop ***
+    if ( filled_ < blockSize_ )
+    {
+        if ( ++filled_ < blockSize_ ) return false;
+    }
+    else if ( ++sinceBlock_ < hop_ )
+    {
+        return false;
+    }
+
+    sinceBlock_ = 0;
+    analyze( timestampNs );
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSpectrumAnalyzer::analyze - window, transform and reduce the block
+ * @param timestampNs - time of the newest sample
+ */
+//******************************************************************************
+void SHSpectrumAnalyzer::analyze( qint64 timestampNs )
+{
+qint64 startNs = spectrumNowNs();
+qint64 spanNs = timestampNs - times_[ writePos_ ];
+int half = blockSize_ / 2;
+double mean = 0.0;
+float binHz;
+int src, lo, hi;
+double energy;
+
+    //*** bins are spaced by the rate the samples actually came in at ***
+    if ( spanNs > 0 )
+    {
+        sampleRateHz_ = ( blockSize_ - 1 ) * 1000000000.0 / spanNs;
+        result_.sampleRateHz = sampleRateHz_;
+        result_.binHz = sampleRateHz_ / blockSize_;
+        if ( edgeCount_ == 0 ) setBands( edges_, edgeCount_ );
+    }
+    binHz = result_.binHz;
+
+    //*** oldest sample first, mean removed ***
+    for ( int i=0; i<blockSize_; i++ )
+    {
+        mean += ring_[i];
+    }
+    mean /= blockSize_;
+
+    src = writePos_;
+    for ( int i=0; i<blockSize_; i++ )
+    {
+        work_[i] = ( ring_[src] - mean ) * window_[i];
+        if ( ++src == blockSize_ ) src = 0;
+    }
+
+    fft_.forward( work_ );
+
+    //*** one-sided power - interior bins count twice ***
+    power_[0] = work_[0] * work_[0] * powerScale_;
+    power_[half] = work_[1] * work_[1] * powerScale_;
+    for ( int k=1; k<half; k++ )
+    {
+        power_[k] = 2.0 * ( work_[2*k] * work_[2*k] + work_[2*k+1] * work_[2*k+1] ) * powerScale_;
+    }
+
+    //*** band energies ***
+    for ( int b=0; b<result_.bandCount; b++ )
+    {
+        lo = (int)ceil( result_.bandLowHz[b] / binHz );
+        hi = (int)ceil( result_.bandHighHz[b] / binHz );
+        if ( hi > half + 1 ) hi = half + 1;
+
+        energy = 0.0;
+        for ( int k=lo; k<hi; k++ )
+        {
+            energy += power_[k];
+        }
+        result_.bandEnergy[b] = energy;
+    }
+
+    //*** local maxima, refined by parabolic interpolation ***
+    result_.peakCount = 0;
+    for ( int k=1; k<half; k++ )
+    {
+        float l = power_[k-1];
+        float c = power_[k];
+        float r = power_[k+1];
+
+        if ( c <= l || c < r || c <= 0.0f ) continue;
+
+        float denom = l - 2.0f * c + r;
+        float delta = ( denom != 0.0f ) ? 0.5f * ( l - r ) / denom : 0.0f;
+
+        addPeak( ( k + delta ) * binHz, sqrtf( l + c + r ) );
+    }
+
+    result_.timestampNs = timestampNs;
+    result_.analysisNs = spectrumNowNs() - startNs;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHSpectrumAnalyzer::addPeak - insert a peak, keeping the strongest
+ * @param hz  - peak frequency
+ * @param rms - RMS amplitude of the peak (Hann main lobe)
+ */
+//******************************************************************************
+void SHSpectrumAnalyzer::addPeak( float hz, float rms )
+{
+int pos = result_.peakCount;
+
+    //*** find the slot, strongest first ***
+    while ( pos > 0 && result_.peakRms[pos-1] < rms )
+    {
+        pos--;
+    }
+
+    if ( pos >= SpectrumMaxPeaks ) return;
+
+    if ( result_.peakCount < SpectrumMaxPeaks ) result_.peakCount++;
+
+    for ( int i=result_.peakCount-1; i>pos; i-- )
+    {
+        result_.peakHz[i] = result_.peakHz[i-1];
+        result_.peakRms[i] = result_.peakRms[i-1];
+    }
+
+    result_.peakHz[pos] = hz;
+    result_.peakRms[pos] = rms;
+}
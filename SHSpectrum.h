@@ -0,0 +1,195 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat vibration spectrum
+//
+// Radix-2 real FFT and a block spectrum analyzer for accelerometer samples.
+//      All buffers and tables are allocated when a size is configured, so
+//      analysis never allocates
+//
+//******************************************************************************
+//******************************************************************************
+#ifndef SHSPECTRUM_H
+#define SHSPECTRUM_H
+
+#include <QtGlobal>
+
+//*** block size limits (power of 2) ***
+const int SpectrumMinBlock = 16;
+const int SpectrumMaxBlock = 8192;
+
+//*** most bands and peaks reported per block ***
+const int SpectrumMaxBands = 16;
+const int SpectrumMaxPeaks = 4;
+
+//*** default number of equal width bands ***
+const int SpectrumDefaultBands = 8;
+
+//*** spectrum of one block ***
+struct SpectrumResult
+{
+    qint64 timestampNs;         // time of the newest sample in the block
+    int blockSize;              // samples per block
+    float sampleRateHz;         // input sample rate, measured over the block
+    float binHz;                // frequency resolution
+    int bandCount;              // entries in bandEnergy
+    float bandLowHz[SpectrumMaxBands];
+    float bandHighHz[SpectrumMaxBands];
+    float bandEnergy[SpectrumMaxBands];     // mean square, input units^2
+    int peakCount;              // entries in peakHz
+    float peakHz[SpectrumMaxPeaks];         // strongest first
+    float peakRms[SpectrumMaxPeaks];        // RMS amplitude, input units
+    qint64 analysisNs;          // time taken to window, transform and reduce
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHFft class - in-place radix-2 FFT of real data. Computed as a
+ *              half size complex FFT with per-stage contiguous twiddle
+ *              tables, so butterflies vectorize (NEON where available)
+ */
+//******************************************************************************
+class SHFft
+{
+public:
+
+    SHFft();
+    ~SHFft();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief configure - build the tables for a transform size
+     * @param size - number of real samples, power of 2, at least 4
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool configure( int size );
+
+    int size() { return size_; }
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief forward - forward transform in place. On return data[0] is the DC
+     *              bin, data[1] the Nyquist bin and data[2k], data[2k+1] the
+     *              real and imaginary parts of bin k, for k = 1 .. size/2-1
+     * @param data - size real samples
+     */
+    //******************************************************************************
+    void forward( float *data );
+
+private:
+
+    void release();
+
+    //*** half size complex FFT on interleaved data ***
+    void complexForward( float *data );
+
+    int size_;
+    int half_;
+
+    //*** bit reversal swaps (pairs of complex indexes) ***
+    int *swaps_;
+    int swapCount_;
+
+    //*** complex FFT twiddles - stage with half length h starts at h-1 ***
+    float *twRe_;
+    float *twIm_;
+
+    //*** real split twiddles, e^-2pi*i*k/size ***
+    float *splitRe_;
+    float *splitIm_;
+
+    Q_DISABLE_COPY( SHFft )
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHSpectrumAnalyzer class - buffers samples and transforms a
+ *              Hann windowed block every hop, reducing it to band energies
+ *              and peak frequencies
+ */
+//******************************************************************************
+class SHSpectrumAnalyzer
+{
+public:
+
+    SHSpectrumAnalyzer();
+    ~SHSpectrumAnalyzer();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief configure - set the block and allocate all buffers
+     * @param blockSize    - samples per block, power of 2
+     * @param overlap      - samples shared by consecutive blocks
+     * @param sampleRateHz - nominal input sample rate. Each block measures
+     *              the rate its samples came in at from their timestamps
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool configure( int blockSize, int overlap, double sampleRateHz );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief setBands - set the band edges. With no edges the range up to
+     *              Nyquist is split into SpectrumDefaultBands equal bands
+     * @param edgesHz   - ascending band edges, edgeCount-1 bands
+     * @param edgeCount - 0, or 2 to SpectrumMaxBands+1
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool setBands( const float *edgesHz, int edgeCount );
+
+    //*** add a sample - TRUE when a new result is ready ***
+    bool add( qint64 timestampNs, float value );
+
+    //*** most recent result ***
+    const SpectrumResult &result() { return result_; }
+
+private:
+
+    void release();
+
+    //*** transform the buffered block ***
+    void analyze( qint64 timestampNs );
+
+    //*** keep the strongest peaks ***
+    void addPeak( float hz, float rms );
+
+    SHFft fft_;
+
+    //*** block ***
+    int blockSize_;
+    int hop_;
+    double sampleRateHz_;
+
+    //*** sample ring and fill state ***
+    float *ring_;
+    qint64 *times_;             // sample timestamps, parallel to ring_
+    int writePos_;
+    int filled_;
+    int sinceBlock_;
+
+    //*** preallocated work areas ***
+    float *work_;
+    float *window_;
+    float *power_;
+    double powerScale_;         // one-sided mean square normalization
+
+    //*** band edges ***
+    float edges_[SpectrumMaxBands+1];
+    int edgeCount_;
+
+    SpectrumResult result_;
+
+    Q_DISABLE_COPY( SHSpectrumAnalyzer )
+};
+
+#endif // SHSPECTRUM_H
@@ -0,0 +1,1591 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat time-series store
+//
+// Append-only segments of Gorilla encoded 4 KiB blocks, a block index per
+//      segment and minute and hour rollups, queried through mmap
+//
+//******************************************************************************
+//******************************************************************************
+#include "SHTimeSeries.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QStringList>
+#include <QDateTime>
+#include <QElapsedTimer>
+
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//*** encoded bits available in a block ***
+const quint32 PayloadBits = ( TimeSeriesBlockBytes - sizeof(TimeSeriesBlockHeader) ) * 8;
+
+//*** largest encoded point - '1111' and a 32 bit delta-of-delta, '11', window and value ***
+const quint32 MaxPointBits = 4 + 32 + 2 + 5 + 5 + 32;
+
+//*** file names ***
+const char SegmentPattern[] = "segment-*.shts";
+const char DataSuffix[] = ".shts";
+const char IndexSuffix[] = ".shti";
+const char MinuteRollupFile[] = "rollup-1m.shtr";
+const char HourRollupFile[] = "rollup-1h.shtr";
+
+//*** rollup intervals ***
+const qint64 MinuteMs = 60 * 1000LL;
+const qint64 HourMs = 60 * MinuteMs;
+
+//*** write queue - the writer thread takes it this often, or when half full ***
+const int QueuePoints = 16384;
+const int QueueWaitMs = 200;
+
+//*** a trimmed rollup file keeps this share of its limit ***
+const qint64 TrimKeepNum = 3;
+const qint64 TrimKeepDen = 4;
+
+//*** records copied at a time when trimming ***
+const int TrimChunkRecords = 256;
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief putBits - append bits to a block payload, most significant first.
+ *              The payload must start zeroed
+ * @param buf    - payload
+ * @param bitPos - write position in bits, advanced
+ * @param value  - bits to write, in the low end
+ * @param bits   - number of bits, up to 64
+ */
+//******************************************************************************
+static void putBits( quint8 *buf, quint32 &bitPos, quint64 value, int bits )
+{
+    for ( int i=bits-1; i>=0; i-- )
+    {
+        if ( ( value >> i ) & 1 )
+        {
+            buf[ bitPos >> 3 ] |= 0x80 >> ( bitPos & 7 );
+        }
+        bitPos++;
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief getBits - read bits from a block payload
+ * @param buf    - payload
+ * @param bitPos - read position in bits, advanced
+ * @param endPos - end of the payload in bits
+ * @param bits   - number of bits, up to 64
+ * @param value  - receives the bits
+ * @return - FALSE if the payload ends first
+ */
+//******************************************************************************
+static bool getBits( const quint8 *buf, quint32 &bitPos, quint32 endPos, int bits, quint64 &value )
+{
+    if ( bitPos + bits > endPos ) return false;
+
+    value = 0;
+    for ( int i=0; i<bits; i++ )
+    {
+        value = ( value << 1 ) | ( ( buf[ bitPos >> 3 ] >> ( 7 - ( bitPos & 7 ) ) ) & 1 );
+        bitPos++;
+    }
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief validHeader - a block header is one of ours
+ * @param hdr - header
+ * @return - TRUE if valid
+ */
+//******************************************************************************
+static bool validHeader( const TimeSeriesBlockHeader *hdr )
+{
+    return memcmp( hdr->magic, TimeSeriesMagic, sizeof(hdr->magic) ) == 0 &&
+           hdr->version == TimeSeriesVersion &&
+           hdr->series < TimeSeriesMax &&
+           hdr->count > 0 &&
+           hdr->usedBits <= PayloadBits;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief TimeSeriesOptions::TimeSeriesOptions - 64 MiB segments, 2 GiB of
+ *              raw data. Three environmental series at 1 Hz fill that in
+ *              about 10 years, and their minute rollups about 512 MiB.
+ *              Partial blocks are written every minute
+ */
+//******************************************************************************
+TimeSeriesOptions::TimeSeriesOptions()
+{
+    segmentBytes = 64 * 1024 * 1024LL;
+    maxRawBytes = 2048 * 1024 * 1024LL;
+    maxRollupBytes = 512 * 1024 * 1024LL;
+    flushIntervalMs = 60 * 1000;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+//
+// Writer thread
+//
+//******************************************************************************
+//******************************************************************************
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief TimeSeriesWriterThread::TimeSeriesWriterThread
+ * @param writer - store writer
+ */
+//******************************************************************************
+TimeSeriesWriterThread::TimeSeriesWriterThread( SHTimeSeriesWriter *writer )
+{
+    writer_ = writer;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief TimeSeriesWriterThread::run - write until the store is closed
+ */
+//******************************************************************************
+void TimeSeriesWriterThread::run()
+{
+    writer_->writeLoop();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+//
+// Store writer
+//
+//******************************************************************************
+//******************************************************************************
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::SHTimeSeriesWriter
+ */
+//******************************************************************************
+SHTimeSeriesWriter::SHTimeSeriesWriter()
+{
+    memset( blocks_, 0, sizeof(blocks_) );
+    memset( &stats_, 0, sizeof(stats_) );
+    blockPoints_ = 0;
+    blockBytes_ = 0;
+    minutes_.intervalMs = MinuteMs;
+    minutes_.startMs = -1;
+    minutes_.openPos = 0;
+    hours_.intervalMs = HourMs;
+    hours_.startMs = -1;
+    hours_.openPos = 0;
+    nextSlot_ = 0;
+
+    queue_.resize( QueuePoints );
+    queueCount_ = 0;
+    queueOpen_ = false;
+    stopWriter_ = false;
+    dropped_ = 0;
+
+    thread_ = new TimeSeriesWriterThread( this );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::~SHTimeSeriesWriter
+ */
+//******************************************************************************
+SHTimeSeriesWriter::~SHTimeSeriesWriter()
+{
+    close();
+    delete thread_;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::open - open a store for append
+ * @param directory - store directory
+ * @param options   - segment size and retention
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHTimeSeriesWriter::open( QString directory, const TimeSeriesOptions &options )
+{
+QStringList segments;
+QString baseName;
+
+    close();
+
+    QMutexLocker wLock( &mutex_ );
+
+    if ( !QDir().mkpath( directory ) ) return false;
+
+    directory_ = directory;
+    options_ = options;
+    memset( &stats_, 0, sizeof(stats_) );
+    blockPoints_ = 0;
+    blockBytes_ = 0;
+
+    //*** continue the newest segment unless it is full ***
+    segments = QDir( directory_ ).entryList( QStringList( SegmentPattern ), QDir::Files, QDir::Name );
+
+    if ( !segments.isEmpty() &&
+         QFileInfo( directory_ + "/" + segments.last() ).size() < options_.segmentBytes )
+    {
+        baseName = segments.last();
+        baseName.chop( strlen( DataSuffix ) );
+    }
+    else
+    {
+        baseName = QString( "segment-%1" ).arg( QDateTime::currentMSecsSinceEpoch(), 16, 10, QChar('0') );
+    }
+
+    if ( !openSegment( baseName ) ||
+         !openRollup( minutes_, directory_ + "/" + MinuteRollupFile, MinuteMs ) ||
+         !openRollup( hours_, directory_ + "/" + HourRollupFile, HourMs ) )
+    {
+        data_.close();
+        index_.close();
+        minutes_.file.close();
+        hours_.file.close();
+        return false;
+    }
+
+    enforceRetention();
+
+    //*** start taking points ***
+    queueMutex_.lock();
+    queueCount_ = 0;
+    dropped_ = 0;
+    stopWriter_ = false;
+    queueOpen_ = true;
+    queueMutex_.unlock();
+
+    thread_->start();
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::close - store the queued points, write the
+ *              partial blocks and rollup intervals and close
+ */
+//******************************************************************************
+void SHTimeSeriesWriter::close()
+{
+    //*** the writer thread stores what is queued, then ends ***
+    queueMutex_.lock();
+    queueOpen_ = false;
+    stopWriter_ = true;
+    queueWait_.wakeAll();
+    queueMutex_.unlock();
+
+    thread_->wait();
+
+    QMutexLocker wLock( &mutex_ );
+
+    if ( !data_.isOpen() ) return;
+
+    for ( int i=0; i<TimeSeriesMax; i++ )
+    {
+        if ( blocks_[i] )
+        {
+            flushBlock( blocks_[i], true );
+            delete blocks_[i];
+            blocks_[i] = 0;
+        }
+    }
+
+    //*** reopening takes the open intervals back ***
+    flushRollup( minutes_, true );
+    flushRollup( hours_, true );
+    minutes_.file.close();
+    hours_.file.close();
+
+    data_.close();
+    index_.close();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::append - queue a point for the writer thread
+ * @param series - series number
+ * @param timeMs - milliseconds since the epoch
+ * @param value  - value
+ * @return - TRUE if the point was queued
+ */
+//******************************************************************************
+bool SHTimeSeriesWriter::append( int series, qint64 timeMs, float value )
+{
+QMutexLocker qLock( &queueMutex_ );
+QueuedPoint *point;
+
+    if ( !queueOpen_ || series < 0 || series >= TimeSeriesMax ) return false;
+
+    if ( queueCount_ >= QueuePoints )
+    {
+        dropped_++;
+        return false;
+    }
+
+    point = &queue_[ queueCount_++ ];
+    point->series = series;
+    point->timeMs = timeMs;
+    point->value = value;
+
+    //*** wake the writer early rather than drop ***
+    if ( queueCount_ == QueuePoints / 2 ) queueWait_.wakeOne();
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::writeLoop - writer thread. Takes the whole queue
+ *              at a time, stores it, and writes the partial blocks when due
+ */
+//******************************************************************************
+void SHTimeSeriesWriter::writeLoop()
+{
+QVector<QueuedPoint> points( QueuePoints );
+QElapsedTimer sinceFlush;
+bool stop = false;
+int count;
+
+    sinceFlush.start();
+
+    while ( !stop )
+    {
+        //*** swap buffers with append() ***
+        queueMutex_.lock();
+        if ( !stopWriter_ && queueCount_ < QueuePoints / 2 )
+        {
+            queueWait_.wait( &queueMutex_, QueueWaitMs );
+        }
+        stop = stopWriter_;
+        queue_.swap( points );
+        count = queueCount_;
+        queueCount_ = 0;
+        queueMutex_.unlock();
+
+        mutex_.lock();
+
+        for ( int i=0; i<count && data_.isOpen(); i++ )
+        {
+            writePoint( points[i].series, points[i].timeMs, points[i].value );
+        }
+
+        if ( options_.flushIntervalMs > 0 && sinceFlush.elapsed() >= options_.flushIntervalMs )
+        {
+            flushPartial();
+            sinceFlush.restart();
+        }
+
+        mutex_.unlock();
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::writePoint - encode a point into its block and
+ *              rollups. Called with mutex_ held
+ * @param series - series number
+ * @param timeMs - milliseconds since the epoch
+ * @param value  - value
+ */
+//******************************************************************************
+void SHTimeSeriesWriter::writePoint( int series, qint64 timeMs, float value )
+{
+SeriesBlock *block;
+
+    //*** first point of the series ***
+    if ( !blocks_[series] )
+    {
+        blocks_[series] = new SeriesBlock;
+        memset( blocks_[series]->data, 0, sizeof(blocks_[series]->data) );
+        blocks_[series]->header = (TimeSeriesBlockHeader *)blocks_[series]->data;
+        blocks_[series]->slot = -1;
+        blocks_[series]->writtenCount = 0;
+    }
+
+    block = blocks_[series];
+
+    if ( block->header->count > 0 && timeMs < block->prevTimeMs )
+    {
+        stats_.rejected++;
+        return;
+    }
+
+    //*** block full, or a gap too long to encode - start another ***
+    if ( block->header->count == 0 )
+    {
+        startBlock( block, series, timeMs, value );
+    }
+    else if ( !encodePoint( block, timeMs, value ) )
+    {
+        flushBlock( block, true );
+        startBlock( block, series, timeMs, value );
+    }
+
+    addRollup( minutes_, series, timeMs, value );
+    addRollup( hours_, series, timeMs, value );
+
+    stats_.points++;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::stats - writer statistics
+ * @return - statistics since open
+ */
+//******************************************************************************
+TimeSeriesStats SHTimeSeriesWriter::stats()
+{
+QMutexLocker wLock( &mutex_ );
+TimeSeriesStats stats = stats_;
+
+    stats.bytesPerPoint = blockPoints_ ? (double)blockBytes_ / blockPoints_ : 0.0;
+
+    queueMutex_.lock();
+    stats.dropped = dropped_;
+    queueMutex_.unlock();
+
+    return stats;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::startBlock - start a block with its first
+ *              point, stored whole
+ * @param block  - block to start
+ * @param series - series number
+ * @param timeMs - time of the point
+ * @param value  - value of the point
+ */
+//******************************************************************************
+void SHTimeSeriesWriter::startBlock( SeriesBlock *block, int series, qint64 timeMs, float value )
+{
+TimeSeriesBlockHeader *hdr = block->header;
+quint8 *payload = block->data + sizeof(TimeSeriesBlockHeader);
+
+    memset( block->data, 0, sizeof(block->data) );
+    memcpy( hdr->magic, TimeSeriesMagic, sizeof(hdr->magic) );
+    hdr->version = TimeSeriesVersion;
+    hdr->series = series;
+    hdr->count = 1;
+    hdr->firstTimeMs = timeMs;
+    hdr->lastTimeMs = timeMs;
+    hdr->min = value;
+    hdr->max = value;
+    hdr->sum = value;
+
+    //*** first value as raw bits ***
+    memcpy( &block->prevBits, &value, sizeof(value) );
+    putBits( payload, hdr->usedBits, block->prevBits, 32 );
+
+    block->prevTimeMs = timeMs;
+    block->prevDeltaMs = 0;
+    block->prevLeading = -1;
+    block->prevTrailing = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::encodePoint - add a point to a started block.
+ *              Timestamps are delta-of-deltas in 1, 9, 12, 16 or 36 bits;
+ *              values are XORs with the previous value, 1 bit if unchanged,
+ *              else the meaningful bits in the previous window or a new one
+ * @param block  - block
+ * @param timeMs - time of the point, not before the previous one
+ * @param value  - value of the point
+ * @return - FALSE if the point does not fit in the block
+ */
+//******************************************************************************
+bool SHTimeSeriesWriter::encodePoint( SeriesBlock *block, qint64 timeMs, float value )
+{
+TimeSeriesBlockHeader *hdr = block->header;
+quint8 *payload = block->data + sizeof(TimeSeriesBlockHeader);
+qint64 deltaMs = timeMs - block->prevTimeMs;
+qint64 dod = deltaMs - block->prevDeltaMs;
+quint32 bits;
+quint32 xorBits;
+int leading;
+int trailing;
+int meaningful;
+
+    if ( hdr->usedBits + MaxPointBits > PayloadBits ) return false;
+    if ( dod < -2147483647LL || dod > 2147483647LL ) return false;
+
+    //*** timestamp ***
+    if ( dod == 0 )
+    {
+        putBits( payload, hdr->usedBits, 0, 1 );
+    }
+    else if ( dod >= -63 && dod <= 64 )
+    {
+        putBits( payload, hdr->usedBits, 0x2, 2 );
+        putBits( payload, hdr->usedBits, dod + 63, 7 );
+    }
+    else if ( dod >= -255 && dod <= 256 )
+    {
+        putBits( payload, hdr->usedBits, 0x6, 3 );
+        putBits( payload, hdr->usedBits, dod + 255, 9 );
+    }
+    else if ( dod >= -2047 && dod <= 2048 )
+    {
+        putBits( payload, hdr->usedBits, 0xE, 4 );
+        putBits( payload, hdr->usedBits, dod + 2047, 12 );
+    }
+    else
+    {
+        putBits( payload, hdr->usedBits, 0xF, 4 );
+        putBits( payload, hdr->usedBits, (quint32)(qint32)dod, 32 );
+    }
+
+    //*** value ***
+    memcpy( &bits, &value, sizeof(value) );
+    xorBits = bits ^ block->prevBits;
+
+    if ( xorBits == 0 )
+    {
+        putBits( payload, hdr->usedBits, 0, 1 );
+    }
+    else
+    {
+        leading = __builtin_clz( xorBits );
+        trailing = __builtin_ctz( xorBits );
+
+        //*** fits the previous window ***
+        if ( block->prevLeading >= 0 && leading >= block->prevLeading && trailing >= block->prevTrailing )
+        {
+            meaningful = 32 - block->prevLeading - block->prevTrailing;
+            putBits( payload, hdr->usedBits, 0x2, 2 );
+            putBits( payload, hdr->usedBits, xorBits >> block->prevTrailing, meaningful );
+        }
+
+        //*** new window ***
+        else
+        {
+            meaningful = 32 - leading - trailing;
+            putBits( payload, hdr->usedBits, 0x3, 2 );
+            putBits( payload, hdr->usedBits, leading, 5 );
+            putBits( payload, hdr->usedBits, meaningful - 1, 5 );
+            putBits( payload, hdr->usedBits, xorBits >> trailing, meaningful );
+            block->prevLeading = leading;
+            block->prevTrailing = trailing;
+        }
+    }
+
+    hdr->count++;
+    hdr->lastTimeMs = timeMs;
+    hdr->min = qMin( hdr->min, value );
+    hdr->max = qMax( hdr->max, value );
+    hdr->sum += value;
+
+    block->prevTimeMs = timeMs;
+    block->prevDeltaMs = deltaMs;
+    block->prevBits = bits;
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::flushBlock - write a block to its place in the
+ *              data file and its header to the index. A block written before
+ *              it is full is written again over the same place, so readers
+ *              see its points early and the file never holds them twice.
+ *              Called with mutex_ held
+ * @param block - block to write
+ * @param seal  - the block is done - empty it, its next points go to a new one
+ */
+//******************************************************************************
+void SHTimeSeriesWriter::flushBlock( SeriesBlock *block, bool seal )
+{
+    if ( block->header->count == 0 ) return;
+
+    //*** first write - take the next block, rolling over a full segment first ***
+    if ( block->slot < 0 )
+    {
+        if ( nextSlot_ * TimeSeriesBlockBytes >= options_.segmentBytes )
+        {
+            newSegment( block->header->firstTimeMs );
+        }
+
+        block->slot = nextSlot_++;
+    }
+
+    //*** data before index, so the index never names a missing block ***
+    if ( block->header->count != block->writtenCount )
+    {
+        data_.seek( block->slot * TimeSeriesBlockBytes );
+        data_.write( (const char *)block->data, TimeSeriesBlockBytes );
+        data_.flush();
+        index_.seek( block->slot * sizeof(TimeSeriesBlockHeader) );
+        index_.write( (const char *)block->header, sizeof(TimeSeriesBlockHeader) );
+        index_.flush();
+
+        block->writtenCount = block->header->count;
+    }
+
+    if ( !seal ) return;
+
+    stats_.blocks++;
+    blockPoints_ += block->header->count;
+    blockBytes_ += TimeSeriesBlockBytes;
+
+    memset( block->data, 0, sizeof(block->data) );
+    block->slot = -1;
+    block->writtenCount = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::flushPartial - write the blocks and rollup
+ *              intervals still being filled in place and sync them to the
+ *              card. Called with mutex_ held
+ */
+//******************************************************************************
+void SHTimeSeriesWriter::flushPartial()
+{
+    if ( !data_.isOpen() ) return;
+
+    for ( int i=0; i<TimeSeriesMax; i++ )
+    {
+        if ( blocks_[i] ) flushBlock( blocks_[i], false );
+    }
+
+    flushRollup( minutes_, false );
+    flushRollup( hours_, false );
+
+    //*** to the card, not just the page cache ***
+    fdatasync( data_.handle() );
+    fdatasync( index_.handle() );
+    if ( minutes_.file.isOpen() ) fdatasync( minutes_.file.handle() );
+    if ( hours_.file.isOpen() ) fdatasync( hours_.file.handle() );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::openSegment - open a segment for append
+ * @param baseName - file name without suffix
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHTimeSeriesWriter::openSegment( QString baseName )
+{
+qint64 validBytes;
+qint64 wholeBlocks;
+
+    data_.close();
+    index_.close();
+
+    data_.setFileName( directory_ + "/" + baseName + DataSuffix );
+    index_.setFileName( directory_ + "/" + baseName + IndexSuffix );
+
+    if ( !data_.open( QIODevice::ReadWrite ) || !index_.open( QIODevice::ReadWrite ) )
+    {
+        data_.close();
+        index_.close();
+        return false;
+    }
+
+    //*** a block cut short by a crash keeps what reached the card, padded to a whole block ***
+    validBytes = data_.size();
+    wholeBlocks = ( validBytes + TimeSeriesBlockBytes - 1 ) / TimeSeriesBlockBytes;
+    data_.resize( wholeBlocks * TimeSeriesBlockBytes );
+
+    repairIndex( validBytes );
+
+    nextSlot_ = wholeBlocks;
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::newSegment - close the segment and start another
+ * @param timeMs - time of the first point in the new segment
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHTimeSeriesWriter::newSegment( qint64 timeMs )
+{
+QString baseName = QString( "segment-%1" ).arg( timeMs, 16, 10, QChar('0') );
+
+    //*** blocks already written into this segment are finished there ***
+    for ( int i=0; i<TimeSeriesMax; i++ )
+    {
+        if ( blocks_[i] && blocks_[i]->slot >= 0 ) flushBlock( blocks_[i], true );
+    }
+
+    //*** never reuse a name, even if the clock went back ***
+    while ( QFile::exists( directory_ + "/" + baseName + DataSuffix ) )
+    {
+        timeMs++;
+        baseName = QString( "segment-%1" ).arg( timeMs, 16, 10, QChar('0') );
+    }
+
+    if ( !openSegment( baseName ) ) return false;
+
+    enforceRetention();
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::repairIndex - make the index match the data
+ *              blocks, copying the headers of blocks it is missing
+ * @param validBytes - data that reached the file before it was padded
+ */
+//******************************************************************************
+void SHTimeSeriesWriter::repairIndex( qint64 validBytes )
+{
+TimeSeriesBlockHeader hdr;
+qint64 dataBlocks = data_.size() / TimeSeriesBlockBytes;
+qint64 indexBlocks = index_.size() / sizeof(TimeSeriesBlockHeader);
+
+    if ( indexBlocks > dataBlocks ) indexBlocks = dataBlocks;
+    index_.resize( indexBlocks * sizeof(TimeSeriesBlockHeader) );
+
+    for ( qint64 b=indexBlocks; b<dataBlocks; b++ )
+    {
+        data_.seek( b * TimeSeriesBlockBytes );
+        if ( data_.read( (char *)&hdr, sizeof(hdr) ) != sizeof(hdr) )
+        {
+            memset( &hdr, 0, sizeof(hdr) );
+        }
+
+        //*** the end of the points of a block cut short is gone - leave it out of the index ***
+        if ( b * TimeSeriesBlockBytes + (qint64)sizeof(hdr) + ( hdr.usedBits + 7 ) / 8 > validBytes )
+        {
+            memset( &hdr, 0, sizeof(hdr) );
+        }
+
+        index_.seek( b * sizeof(TimeSeriesBlockHeader) );
+        index_.write( (const char *)&hdr, sizeof(hdr) );
+    }
+
+    index_.flush();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::enforceRetention - delete the oldest segments
+ *              while the raw data is over its limit
+ */
+//******************************************************************************
+void SHTimeSeriesWriter::enforceRetention()
+{
+QDir dir( directory_ );
+QStringList segments;
+QString baseName;
+qint64 total = 0;
+
+    if ( options_.maxRawBytes <= 0 ) return;
+
+    segments = dir.entryList( QStringList( SegmentPattern ), QDir::Files, QDir::Name );
+
+    for ( int i=0; i<segments.size(); i++ )
+    {
+        total += QFileInfo( dir.filePath( segments[i] ) ).size();
+    }
+
+    //*** oldest first, never the one being written ***
+    for ( int i=0; i<segments.size() && total > options_.maxRawBytes; i++ )
+    {
+        if ( dir.filePath( segments[i] ) == data_.fileName() ) break;
+
+        total -= QFileInfo( dir.filePath( segments[i] ) ).size();
+
+        baseName = segments[i];
+        baseName.chop( strlen( DataSuffix ) );
+        dir.remove( segments[i] );
+        dir.remove( baseName + IndexSuffix );
+
+        stats_.segmentsDeleted++;
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::openRollup - open a rollup file for append and
+ *              take back its last interval, which may still be open
+ * @param rollup     - rollup state
+ * @param fileName   - rollup file
+ * @param intervalMs - interval length
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHTimeSeriesWriter::openRollup( RollupState &rollup, QString fileName, qint64 intervalMs )
+{
+TimeSeriesRollupHeader hdr;
+TimeSeriesRollup rec;
+qint64 records;
+qint64 keep;
+TimeSeriesRollup *acc;
+
+    rollup.file.close();
+    rollup.file.setFileName( fileName );
+    rollup.intervalMs = intervalMs;
+    rollup.startMs = -1;
+    memset( rollup.acc, 0, sizeof(rollup.acc) );
+
+    if ( !rollup.file.open( QIODevice::ReadWrite ) ) return false;
+
+    //*** new file ***
+    if ( rollup.file.size() < (qint64)sizeof(hdr) )
+    {
+        memset( &hdr, 0, sizeof(hdr) );
+        memcpy( hdr.magic, TimeSeriesRollupMagic, sizeof(hdr.magic) );
+        hdr.version = TimeSeriesVersion;
+        hdr.intervalMs = intervalMs;
+
+        rollup.file.resize( 0 );
+        rollup.file.write( (const char *)&hdr, sizeof(hdr) );
+        rollup.file.flush();
+        rollup.openPos = sizeof(hdr);
+        return true;
+    }
+
+    if ( rollup.file.read( (char *)&hdr, sizeof(hdr) ) != sizeof(hdr) ||
+         memcmp( hdr.magic, TimeSeriesRollupMagic, sizeof(hdr.magic) ) != 0 ||
+         hdr.version != TimeSeriesVersion || hdr.intervalMs != intervalMs )
+    {
+        rollup.file.close();
+        return false;
+    }
+
+    //*** the records of the newest interval go back into the accumulators ***
+    records = ( rollup.file.size() - sizeof(hdr) ) / sizeof(rec);
+    keep = records;
+
+    while ( keep > 0 )
+    {
+        rollup.file.seek( sizeof(hdr) + ( keep - 1 ) * sizeof(rec) );
+        if ( rollup.file.read( (char *)&rec, sizeof(rec) ) != sizeof(rec) ) break;
+
+        if ( rollup.startMs >= 0 && rec.startMs != rollup.startMs ) break;
+        if ( rec.series >= TimeSeriesMax ) break;
+
+        rollup.startMs = rec.startMs;
+        acc = &rollup.acc[ rec.series ];
+
+        if ( acc->count == 0 )
+        {
+            *acc = rec;
+        }
+        else
+        {
+            acc->count += rec.count;
+            acc->min = qMin( acc->min, rec.min );
+            acc->max = qMax( acc->max, rec.max );
+            acc->sum += rec.sum;
+        }
+
+        keep--;
+    }
+
+    rollup.openPos = sizeof(hdr) + keep * sizeof(rec);
+    rollup.file.resize( rollup.openPos );
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::addRollup - add a point to its interval. A new
+ *              interval closes the open one for every series, so the file
+ *              stays in time order. Points that arrive after their interval
+ *              closed join the open one
+ * @param rollup - rollup state
+ * @param series - series number
+ * @param timeMs - time of the point
+ * @param value  - value of the point
+ */
+//******************************************************************************
+void SHTimeSeriesWriter::addRollup( RollupState &rollup, int series, qint64 timeMs, float value )
+{
+qint64 startMs = timeMs - ( ( timeMs % rollup.intervalMs ) + rollup.intervalMs ) % rollup.intervalMs;
+TimeSeriesRollup *acc = &rollup.acc[series];
+
+    if ( rollup.startMs < 0 || startMs > rollup.startMs )
+    {
+        flushRollup( rollup, true );
+        rollup.startMs = startMs;
+    }
+
+    if ( acc->count == 0 )
+    {
+        acc->series = series;
+        acc->min = value;
+        acc->max = value;
+        acc->sum = 0.0;
+    }
+
+    acc->count++;
+    acc->min = qMin( acc->min, value );
+    acc->max = qMax( acc->max, value );
+    acc->sum += value;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::flushRollup - write the open interval of every
+ *              series at the end of the file. The records of an interval
+ *              only grow in number, so writing it again covers the last write
+ * @param rollup - rollup state
+ * @param seal   - the interval is closed - start empty after it
+ */
+//******************************************************************************
+void SHTimeSeriesWriter::flushRollup( RollupState &rollup, bool seal )
+{
+    if ( rollup.startMs < 0 || !rollup.file.isOpen() ) return;
+
+    rollup.file.seek( rollup.openPos );
+
+    for ( int i=0; i<TimeSeriesMax; i++ )
+    {
+        if ( rollup.acc[i].count == 0 ) continue;
+
+        rollup.acc[i].startMs = rollup.startMs;
+        rollup.acc[i].series = i;
+        rollup.file.write( (const char *)&rollup.acc[i], sizeof(TimeSeriesRollup) );
+    }
+
+    rollup.file.flush();
+
+    if ( !seal ) return;
+
+    rollup.openPos = rollup.file.pos();
+    memset( rollup.acc, 0, sizeof(rollup.acc) );
+
+    trimRollup( rollup );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesWriter::trimRollup - once a rollup file passes its
+ *              limit, drop its oldest intervals down to 3/4 of the limit.
+ *              The rest is copied to a new file that replaces it, so a
+ *              power cut leaves one or the other. Called between intervals
+ * @param rollup - rollup state
+ */
+//******************************************************************************
+void SHTimeSeriesWriter::trimRollup( RollupState &rollup )
+{
+TimeSeriesRollupHeader hdr;
+TimeSeriesRollup chunk[TrimChunkRecords];
+TimeSeriesRollup rec;
+QString fileName = rollup.file.fileName();
+QFile trimmed( fileName + ".tmp" );
+qint64 records;
+qint64 drop;
+qint64 startMs;
+qint64 bytes;
+
+    if ( options_.maxRollupBytes <= 0 || rollup.file.size() <= options_.maxRollupBytes ) return;
+
+    records = ( rollup.file.size() - sizeof(hdr) ) / sizeof(rec);
+    drop = records - ( options_.maxRollupBytes / TrimKeepDen * TrimKeepNum - (qint64)sizeof(hdr) ) / (qint64)sizeof(rec);
+    if ( drop <= 0 ) return;
+    drop = qMin( drop, records );
+
+    //*** cut between intervals ***
+    rollup.file.seek( sizeof(hdr) + ( drop - 1 ) * sizeof(rec) );
+    if ( rollup.file.read( (char *)&rec, sizeof(rec) ) != sizeof(rec) ) return;
+    startMs = rec.startMs;
+
+    while ( drop < records &&
+            rollup.file.read( (char *)&rec, sizeof(rec) ) == sizeof(rec) &&
+            rec.startMs == startMs )
+    {
+        drop++;
+    }
+
+    //*** header and the records kept ***
+    if ( !trimmed.open( QIODevice::WriteOnly | QIODevice::Truncate ) ) return;
+
+    rollup.file.seek( 0 );
+    rollup.file.read( (char *)&hdr, sizeof(hdr) );
+    trimmed.write( (const char *)&hdr, sizeof(hdr) );
+
+    rollup.file.seek( sizeof(hdr) + drop * sizeof(rec) );
+    while ( ( bytes = rollup.file.read( (char *)chunk, sizeof(chunk) ) ) > 0 )
+    {
+        trimmed.write( (const char *)chunk, bytes );
+    }
+
+    trimmed.flush();
+    fdatasync( trimmed.handle() );
+    trimmed.close();
+
+    if ( ::rename( qPrintable( trimmed.fileName() ), qPrintable( fileName ) ) != 0 )
+    {
+        trimmed.remove();
+        return;
+    }
+
+    //*** carry on in the new file ***
+    rollup.file.close();
+    if ( !rollup.file.open( QIODevice::ReadWrite ) ) return;
+    rollup.openPos = rollup.file.size();
+
+    stats_.rollupsTrimmed += drop;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+//
+// Store reader
+//
+//******************************************************************************
+//******************************************************************************
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesReader::SHTimeSeriesReader
+ */
+//******************************************************************************
+SHTimeSeriesReader::SHTimeSeriesReader()
+{
+    memset( &minutes_, 0, sizeof(minutes_) );
+    memset( &hours_, 0, sizeof(hours_) );
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesReader::~SHTimeSeriesReader
+ */
+//******************************************************************************
+SHTimeSeriesReader::~SHTimeSeriesReader()
+{
+    close();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesReader::open - map a store
+ * @param directory - store directory
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHTimeSeriesReader::open( QString directory )
+{
+    close();
+
+    if ( !QDir( directory ).exists() ) return false;
+
+    directory_ = directory;
+
+    return refresh();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesReader::close - unmap everything
+ */
+//******************************************************************************
+void SHTimeSeriesReader::close()
+{
+    for ( int i=0; i<segments_.size(); i++ )
+    {
+        if ( segments_[i].data )
+        {
+            munmap( (void *)segments_[i].data, segments_[i].dataSize );
+        }
+
+        if ( segments_[i].index )
+        {
+            munmap( (void *)segments_[i].index, segments_[i].blockCount * sizeof(TimeSeriesBlockHeader) );
+        }
+    }
+    segments_.clear();
+
+    if ( minutes_.map ) munmap( (void *)minutes_.map, minutes_.mapSize );
+    if ( hours_.map ) munmap( (void *)hours_.map, hours_.mapSize );
+    memset( &minutes_, 0, sizeof(minutes_) );
+    memset( &hours_, 0, sizeof(hours_) );
+
+    directory_.clear();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesReader::refresh - remap the store
+ * @return - TRUE if successful, else FALSE
+ */
+//******************************************************************************
+bool SHTimeSeriesReader::refresh()
+{
+QString directory = directory_;
+QStringList names;
+QString baseName;
+Segment segment;
+
+    if ( directory.isEmpty() ) return false;
+
+    close();
+    directory_ = directory;
+
+    names = QDir( directory_ ).entryList( QStringList( SegmentPattern ), QDir::Files, QDir::Name );
+
+    for ( int i=0; i<names.size(); i++ )
+    {
+        baseName = names[i];
+        baseName.chop( strlen( DataSuffix ) );
+
+        if ( mapSegment( baseName, segment ) )
+        {
+            segments_.append( segment );
+        }
+    }
+
+    mapRollup( directory_ + "/" + MinuteRollupFile, minutes_ );
+    mapRollup( directory_ + "/" + HourRollupFile, hours_ );
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesReader::mapSegment - map a segment and its index. A
+ *              missing index is replaced by the block headers in the data
+ * @param baseName - file name without suffix
+ * @param segment  - receives the mapping
+ * @return - TRUE if the segment holds any blocks
+ */
+//******************************************************************************
+bool SHTimeSeriesReader::mapSegment( QString baseName, Segment &segment )
+{
+QString path = directory_ + "/" + baseName;
+const TimeSeriesBlockHeader *hdr;
+struct stat st;
+int fd;
+void *map;
+int dataBlocks;
+int indexBlocks = 0;
+
+    memset( &segment, 0, sizeof(segment) );
+
+    //*** data ***
+    if ( ( fd = ::open( qPrintable( path + DataSuffix ), O_RDONLY | O_CLOEXEC ) ) < 0 ) return false;
+
+    if ( fstat( fd, &st ) < 0 || st.st_size < TimeSeriesBlockBytes )
+    {
+        ::close( fd );
+        return false;
+    }
+
+    dataBlocks = st.st_size / TimeSeriesBlockBytes;
+    map = mmap( 0, (qint64)dataBlocks * TimeSeriesBlockBytes, PROT_READ, MAP_SHARED, fd, 0 );
+    ::close( fd );
+
+    if ( map == MAP_FAILED ) return false;
+
+    segment.data = (const quint8 *)map;
+    segment.dataSize = (qint64)dataBlocks * TimeSeriesBlockBytes;
+    segment.blockCount = dataBlocks;
+
+    //*** queries jump between blocks ***
+    madvise( map, segment.dataSize, MADV_RANDOM );
+
+    //*** index ***
+    if ( ( fd = ::open( qPrintable( path + IndexSuffix ), O_RDONLY | O_CLOEXEC ) ) >= 0 )
+    {
+        if ( fstat( fd, &st ) == 0 )
+        {
+            indexBlocks = qMin( (qint64)dataBlocks, (qint64)( st.st_size / sizeof(TimeSeriesBlockHeader) ) );
+        }
+
+        //*** only a complete index is used ***
+        if ( indexBlocks == dataBlocks )
+        {
+            map = mmap( 0, indexBlocks * sizeof(TimeSeriesBlockHeader), PROT_READ, MAP_SHARED, fd, 0 );
+            if ( map != MAP_FAILED ) segment.index = (const TimeSeriesBlockHeader *)map;
+        }
+
+        ::close( fd );
+    }
+
+    //*** time span ***
+    segment.firstMs = 0;
+    segment.lastMs = -1;
+
+    for ( int b=0; b<segment.blockCount; b++ )
+    {
+        hdr = segment.index ? &segment.index[b]
+                            : (const TimeSeriesBlockHeader *)( segment.data + (qint64)b * TimeSeriesBlockBytes );
+
+        if ( !validHeader( hdr ) ) continue;
+
+        if ( segment.lastMs < 0 || hdr->firstTimeMs < segment.firstMs ) segment.firstMs = hdr->firstTimeMs;
+        if ( hdr->lastTimeMs > segment.lastMs ) segment.lastMs = hdr->lastTimeMs;
+    }
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesReader::mapRollup - map a rollup file
+ * @param fileName - rollup file
+ * @param rollup   - receives the mapping, empty if the file is missing
+ */
+//******************************************************************************
+void SHTimeSeriesReader::mapRollup( QString fileName, RollupMap &rollup )
+{
+const TimeSeriesRollupHeader *hdr;
+struct stat st;
+int fd;
+void *map;
+
+    memset( &rollup, 0, sizeof(rollup) );
+
+    if ( ( fd = ::open( qPrintable( fileName ), O_RDONLY | O_CLOEXEC ) ) < 0 ) return;
+
+    if ( fstat( fd, &st ) < 0 || st.st_size <= (qint64)sizeof(TimeSeriesRollupHeader) )
+    {
+        ::close( fd );
+        return;
+    }
+
+    map = mmap( 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    ::close( fd );
+
+    if ( map == MAP_FAILED ) return;
+
+    hdr = (const TimeSeriesRollupHeader *)map;
+    if ( memcmp( hdr->magic, TimeSeriesRollupMagic, sizeof(hdr->magic) ) != 0 ||
+         hdr->version != TimeSeriesVersion )
+    {
+        munmap( map, st.st_size );
+        return;
+    }
+
+    rollup.map = (const quint8 *)map;
+    rollup.mapSize = st.st_size;
+    rollup.records = (const TimeSeriesRollup *)( rollup.map + sizeof(TimeSeriesRollupHeader) );
+    rollup.count = ( st.st_size - sizeof(TimeSeriesRollupHeader) ) / sizeof(TimeSeriesRollup);
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesReader::firstTimeMs - time of the oldest raw point
+ * @return - milliseconds since the epoch, 0 if empty
+ */
+//******************************************************************************
+qint64 SHTimeSeriesReader::firstTimeMs()
+{
+qint64 first = 0;
+
+    for ( int i=0; i<segments_.size(); i++ )
+    {
+        if ( segments_[i].lastMs < 0 ) continue;
+        if ( first == 0 || segments_[i].firstMs < first ) first = segments_[i].firstMs;
+    }
+
+    return first;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesReader::lastTimeMs - time of the newest raw point
+ * @return - milliseconds since the epoch, 0 if empty
+ */
+//******************************************************************************
+qint64 SHTimeSeriesReader::lastTimeMs()
+{
+qint64 last = 0;
+
+    for ( int i=0; i<segments_.size(); i++ )
+    {
+        if ( segments_[i].lastMs > last ) last = segments_[i].lastMs;
+    }
+
+    return last;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesReader::query - raw points of a series in a time range.
+ *              Segments and blocks outside the range are skipped on the
+ *              index alone
+ * @param series - series number
+ * @param fromMs - start of the range
+ * @param toMs   - end of the range, inclusive
+ * @param points - receives the points
+ * @param max    - size of points
+ * @return - number of points
+ */
+//******************************************************************************
+int SHTimeSeriesReader::query( int series, qint64 fromMs, qint64 toMs, TimeSeriesPoint *points, int max )
+{
+const TimeSeriesBlockHeader *hdr;
+int count = 0;
+
+    for ( int i=0; i<segments_.size() && count < max; i++ )
+    {
+        const Segment &seg = segments_[i];
+
+        if ( seg.lastMs < fromMs || seg.firstMs > toMs ) continue;
+
+        for ( int b=0; b<seg.blockCount && count < max; b++ )
+        {
+            hdr = seg.index ? &seg.index[b]
+                            : (const TimeSeriesBlockHeader *)( seg.data + (qint64)b * TimeSeriesBlockBytes );
+
+            if ( !validHeader( hdr ) || hdr->series != series ) continue;
+            if ( hdr->lastTimeMs < fromMs || hdr->firstTimeMs > toMs ) continue;
+
+            count += decodeBlock( seg.data + (qint64)b * TimeSeriesBlockBytes, fromMs, toMs,
+                                  points + count, max - count );
+        }
+    }
+
+    return count;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesReader::decodeBlock - the points of a block in a range
+ * @param block  - mapped block
+ * @param fromMs - start of the range
+ * @param toMs   - end of the range, inclusive
+ * @param points - receives the points
+ * @param max    - size of points
+ * @return - number of points
+ */
+//******************************************************************************
+int SHTimeSeriesReader::decodeBlock( const quint8 *block, qint64 fromMs, qint64 toMs,
+                                     TimeSeriesPoint *points, int max )
+{
+const TimeSeriesBlockHeader *hdr = (const TimeSeriesBlockHeader *)block;
+const quint8 *payload = block + sizeof(TimeSeriesBlockHeader);
+quint32 pos = 0;
+quint64 v = 0;
+qint64 timeMs;
+qint64 deltaMs = 0;
+qint64 dod;
+quint32 bits;
+int leading = 0;
+int trailing = 0;
+int meaningful;
+int count = 0;
+
+    if ( !validHeader( hdr ) ) return 0;
+
+    //*** first point ***
+    if ( !getBits( payload, pos, hdr->usedBits, 32, v ) ) return 0;
+    bits = (quint32)v;
+    timeMs = hdr->firstTimeMs;
+
+    for ( quint32 i=0; i<hdr->count && count < max; i++ )
+    {
+        if ( i > 0 )
+        {
+            //*** delta-of-delta ***
+            if ( !getBits( payload, pos, hdr->usedBits, 1, v ) ) break;
+            if ( v == 0 )
+            {
+                dod = 0;
+            }
+            else
+            {
+                if ( !getBits( payload, pos, hdr->usedBits, 1, v ) ) break;
+                if ( v == 0 )
+                {
+                    if ( !getBits( payload, pos, hdr->usedBits, 7, v ) ) break;
+                    dod = (qint64)v - 63;
+                }
+                else
+                {
+                    if ( !getBits( payload, pos, hdr->usedBits, 1, v ) ) break;
+                    if ( v == 0 )
+                    {
+                        if ( !getBits( payload, pos, hdr->usedBits, 9, v ) ) break;
+                        dod = (qint64)v - 255;
+                    }
+                    else
+                    {
+                        if ( !getBits( payload, pos, hdr->usedBits, 1, v ) ) break;
+                        if ( v == 0 )
+                        {
+                            if ( !getBits( payload, pos, hdr->usedBits, 12, v ) ) break;
+                            dod = (qint64)v - 2047;
+                        }
+                        else
+                        {
+                            if ( !getBits( payload, pos, hdr->usedBits, 32, v ) ) break;
+                            dod = (qint32)(quint32)v;
+                        }
+                    }
+                }
+            }
+
+            deltaMs += dod;
+            timeMs += deltaMs;
+
+            //*** XOR value ***
+            if ( !getBits( payload, pos, hdr->usedBits, 1, v ) ) break;
+            if ( v != 0 )
+            {
+                if ( !getBits( payload, pos, hdr->usedBits, 1, v ) ) break;
+                if ( v != 0 )
+                {
+                    if ( !getBits( payload, pos, hdr->usedBits, 5, v ) ) break;
+                    leading = (int)v;
+                    if ( !getBits( payload, pos, hdr->usedBits, 5, v ) ) break;
+                    trailing = 32 - leading - ( (int)v + 1 );
+                    if ( trailing < 0 ) break;
+                }
+
+                meaningful = 32 - leading - trailing;
+                if ( !getBits( payload, pos, hdr->usedBits, meaningful, v ) ) break;
+                bits ^= (quint32)v << trailing;
+            }
+        }
+
+        //*** past the range - the rest of the block is later still ***
+        if ( timeMs > toMs ) break;
+
+        if ( timeMs >= fromMs )
+        {
+            points[count].timeMs = timeMs;
+            memcpy( &points[count].value, &bits, sizeof(bits) );
+            count++;
+        }
+    }
+
+    return count;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief SHTimeSeriesReader::queryRollup - minute or hour statistics in a
+ *              time range
+ * @param resolution - SERIES_MINUTE or SERIES_HOUR
+ * @param series     - series number
+ * @param fromMs     - start of the range
+ * @param toMs       - end of the range, inclusive
+ * @param rollups    - receives the intervals starting in the range
+ * @param max        - size of rollups
+ * @return - number of intervals
+ */
+//******************************************************************************
+int SHTimeSeriesReader::queryRollup( TimeSeriesResolution resolution, int series,
+                                     qint64 fromMs, qint64 toMs,
+                                     TimeSeriesRollup *rollups, int max )
+{
+const RollupMap &map = ( resolution == SERIES_HOUR ) ? hours_ : minutes_;
+int lo = 0;
+int hi = map.count;
+int mid;
+int count = 0;
+
+    if ( resolution == SERIES_RAW || !map.records ) return 0;
+
+    //*** records are in time order - binary search the first in range ***
+    while ( lo < hi )
+    {
+        mid = ( lo + hi ) / 2;
+
+        if ( map.records[mid].startMs < fromMs )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for ( int i=lo; i<map.count && count < max; i++ )
+    {
+        if ( map.records[i].startMs > toMs ) break;
+        if ( map.records[i].series != series ) continue;
+
+        rollups[count++] = map.records[i];
+    }
+
+    return count;
+}
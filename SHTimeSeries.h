@@ -0,0 +1,396 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Sense Hat time-series store
+//
+// Long term on-disk storage of sensor readings, built for months or years on
+//      an SD card. A store is a directory holding:
+//
+//      segment-<first ms>.shts  append-only data, a sequence of 4 KiB blocks.
+//                               Each block holds the points of one series:
+//                               timestamps as delta-of-deltas and values as
+//                               XORs with the previous value (the Gorilla
+//                               encoding, on 32 bit floats). Slowly changing
+//                               environmental data takes one to three bytes
+//                               a point
+//      segment-<first ms>.shti  one TimeSeriesBlockHeader per data block, so a
+//                               query finds its blocks without touching the
+//                               data. Rebuilt from the block headers if it is
+//                               lost or short
+//      rollup-1m.shtr           count, min, max and sum of every series for
+//      rollup-1h.shtr           each minute and hour, kept when old segments
+//                               are deleted and trimmed at their own limit
+//
+//  append() only queues a point; a writer thread encodes it and does all the
+//      file I/O, so the acquisition thread never waits for the card. Blocks
+//      are written whole, so the card sees 4 KiB writes. A block still being
+//      filled, and the open rollup intervals, are also written in place at a
+//      set interval and synced, so a power cut loses at most that much.
+//      Segments roll over at a set size and the oldest are deleted once raw
+//      data passes its limit. Times are wall clock milliseconds since the epoch
+//
+//******************************************************************************
+//******************************************************************************
+#ifndef SHTIMESERIES_H
+#define SHTIMESERIES_H
+
+#include <QString>
+#include <QVector>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <QFile>
+
+//*** block layout ***
+const int TimeSeriesBlockBytes = 4096;
+const char TimeSeriesMagic[4] = { 'S', 'H', 'T', 'S' };
+const char TimeSeriesRollupMagic[4] = { 'S', 'H', 'T', 'R' };
+const quint16 TimeSeriesVersion = 1;
+
+//*** number of series - SHSensors::timeSeriesId() uses 3 per channel ***
+const int TimeSeriesMax = 32;
+
+//*** rollup resolutions ***
+enum TimeSeriesResolution
+{
+    SERIES_RAW,                 // every stored point
+    SERIES_MINUTE,
+    SERIES_HOUR
+};
+
+//*** one point ***
+struct TimeSeriesPoint
+{
+    qint64 timeMs;              // milliseconds since the epoch
+    float value;
+};
+
+//*** header at the start of every data block, and its copy in the index ***
+struct TimeSeriesBlockHeader
+{
+    char magic[4];              // TimeSeriesMagic
+    quint16 version;            // TimeSeriesVersion
+    quint16 series;
+    quint32 count;              // points in the block
+    quint32 usedBits;           // encoded bits after the header
+    qint64 firstTimeMs;         // time of the first point
+    qint64 lastTimeMs;          // time of the last point
+    float min;                  // value range of the block
+    float max;
+    double sum;
+};
+
+//*** statistics of one series over a minute or an hour ***
+struct TimeSeriesRollup
+{
+    qint64 startMs;             // start of the interval
+    quint16 series;
+    quint16 reserved;
+    quint32 count;              // points in the interval
+    float min;
+    float max;
+    double sum;                 // mean is sum / count
+};
+
+//*** header of a rollup file ***
+struct TimeSeriesRollupHeader
+{
+    char magic[4];              // TimeSeriesRollupMagic
+    quint16 version;            // TimeSeriesVersion
+    quint16 reserved;
+    qint64 intervalMs;
+};
+
+//*** store settings - the constructor sets defaults ***
+struct TimeSeriesOptions
+{
+    TimeSeriesOptions();
+
+    qint64 segmentBytes;        // start a new segment after this size
+    qint64 maxRawBytes;         // delete the oldest segments beyond this, 0 to keep all
+    qint64 maxRollupBytes;      // trim the oldest intervals of a rollup file beyond this, 0 to keep all
+    int flushIntervalMs;        // write blocks still being filled this often, 0 for only when full
+};
+
+//*** writer statistics ***
+struct TimeSeriesStats
+{
+    quint64 points;             // points appended
+    quint64 rejected;           // points older than the last of their series
+    quint64 dropped;            // points lost to a full write queue
+    quint64 blocks;             // data blocks written
+    quint64 segmentsDeleted;    // segments removed by the size limit
+    quint64 rollupsTrimmed;     // rollup records removed by the size limit
+    double bytesPerPoint;       // disk bytes per point of the written blocks
+};
+
+
+class SHTimeSeriesWriter;
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The TimeSeriesWriterThread class - encodes queued points and writes
+ *              the store, from open to close
+ */
+//******************************************************************************
+class TimeSeriesWriterThread : public QThread
+{
+public:
+
+    TimeSeriesWriterThread( SHTimeSeriesWriter *writer );
+
+private:
+
+    //*** override this for the actual thread code ***
+    void run();
+
+    SHTimeSeriesWriter *writer_;
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHTimeSeriesWriter class - appends points to a store. append()
+ *              only queues, so it can be called from the acquisition thread
+ */
+//******************************************************************************
+class SHTimeSeriesWriter
+{
+public:
+
+    SHTimeSeriesWriter();
+    ~SHTimeSeriesWriter();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief open - open a store for append, creating the directory if needed.
+     *              Continues the newest segment and the open rollup intervals
+     * @param directory - store directory
+     * @param options   - segment size and retention
+     * @return - TRUE if successful, else FALSE
+     */
+    //******************************************************************************
+    bool open( QString directory, const TimeSeriesOptions &options = TimeSeriesOptions() );
+
+    //*** store the queued points, write the partial blocks and rollups and close ***
+    void close();
+
+    bool isOpen() { return data_.isOpen(); }
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief append - queue a point for the writer thread. Never waits for
+     *              I/O. Points of a series must come in time order; the
+     *              writer rejects older ones
+     * @param series - 0 to TimeSeriesMax - 1
+     * @param timeMs - milliseconds since the epoch
+     * @param value  - value
+     * @return - TRUE if the point was queued, FALSE if closed or the queue is full
+     */
+    //******************************************************************************
+    bool append( int series, qint64 timeMs, float value );
+
+    TimeSeriesStats stats();
+
+private:
+
+    friend class TimeSeriesWriterThread;
+
+    //*** a point waiting for the writer thread ***
+    struct QueuedPoint
+    {
+        qint64 timeMs;
+        float value;
+        int series;
+    };
+
+    //*** block being filled for one series ***
+    struct SeriesBlock
+    {
+        quint8 data[TimeSeriesBlockBytes];
+        TimeSeriesBlockHeader *header;
+        qint64 slot;                    // block number in the segment once written, else -1
+        quint32 writtenCount;           // points in the last write of the block
+        qint64 prevTimeMs;
+        qint64 prevDeltaMs;
+        quint32 prevBits;
+        int prevLeading;                // -1 until a value window is set
+        int prevTrailing;
+    };
+
+    //*** rollup interval being accumulated ***
+    struct RollupState
+    {
+        QFile file;
+        qint64 intervalMs;
+        qint64 startMs;                 // interval being accumulated, -1 for none
+        qint64 openPos;                 // file offset of its records
+        TimeSeriesRollup acc[TimeSeriesMax];
+    };
+
+    //*** writer thread ***
+    void writeLoop();
+    void writePoint( int series, qint64 timeMs, float value );
+
+    //*** encoding ***
+    void startBlock( SeriesBlock *block, int series, qint64 timeMs, float value );
+    bool encodePoint( SeriesBlock *block, qint64 timeMs, float value );
+
+    //*** write a block to the data and index files, sealing it if it is done ***
+    void flushBlock( SeriesBlock *block, bool seal );
+
+    //*** write and sync everything still being filled ***
+    void flushPartial();
+
+    //*** segments ***
+    bool openSegment( QString baseName );
+    bool newSegment( qint64 timeMs );
+    void repairIndex( qint64 validBytes );
+    void enforceRetention();
+
+    //*** rollups ***
+    bool openRollup( RollupState &rollup, QString fileName, qint64 intervalMs );
+    void addRollup( RollupState &rollup, int series, qint64 timeMs, float value );
+    void flushRollup( RollupState &rollup, bool seal );
+    void trimRollup( RollupState &rollup );
+
+    QString directory_;
+    TimeSeriesOptions options_;
+
+    //*** current segment ***
+    QFile data_;
+    QFile index_;
+    qint64 nextSlot_;                   // next free block
+
+    //*** blocks being filled, allocated on a series' first point ***
+    SeriesBlock *blocks_[TimeSeriesMax];
+
+    RollupState minutes_;
+    RollupState hours_;
+
+    TimeSeriesStats stats_;
+    quint64 blockPoints_;               // points in written blocks
+    quint64 blockBytes_;                // their disk bytes
+
+    //*** guards everything but the queue ***
+    QMutex mutex_;
+
+    //*** points for the writer thread - append() only fills queue_ ***
+    QVector<QueuedPoint> queue_;
+    int queueCount_;
+    bool queueOpen_;
+    bool stopWriter_;
+    quint64 dropped_;
+    QMutex queueMutex_;
+    QWaitCondition queueWait_;
+
+    TimeSeriesWriterThread *thread_;
+
+    Q_DISABLE_COPY( SHTimeSeriesWriter )
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The SHTimeSeriesReader class - time range queries over the memory
+ *              mapped segments and rollups of a store. Can be used while a
+ *              writer appends; refresh() picks up what it has written
+ */
+//******************************************************************************
+class SHTimeSeriesReader
+{
+public:
+
+    SHTimeSeriesReader();
+    ~SHTimeSeriesReader();
+
+    //*** map a store ***
+    bool open( QString directory );
+    void close();
+
+    bool isOpen() { return !directory_.isEmpty(); }
+
+    //*** remap to see data written since open ***
+    bool refresh();
+
+    //*** time span of the raw data ***
+    qint64 firstTimeMs();
+    qint64 lastTimeMs();
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief query - raw points of a series in a time range, oldest first.
+     *              For more than max points, query again from the time after
+     *              the last one returned
+     * @param series - series number
+     * @param fromMs - start of the range
+     * @param toMs   - end of the range, inclusive
+     * @param points - receives the points
+     * @param max    - size of points
+     * @return - number of points
+     */
+    //******************************************************************************
+    int query( int series, qint64 fromMs, qint64 toMs, TimeSeriesPoint *points, int max );
+
+    //******************************************************************************
+    //******************************************************************************
+    /**
+     * @brief queryRollup - minute or hour statistics of a series in a time
+     *              range, oldest first
+     * @param resolution - SERIES_MINUTE or SERIES_HOUR
+     * @param series     - series number
+     * @param fromMs     - start of the range
+     * @param toMs       - end of the range, inclusive
+     * @param rollups    - receives the intervals starting in the range
+     * @param max        - size of rollups
+     * @return - number of intervals
+     */
+    //******************************************************************************
+    int queryRollup( TimeSeriesResolution resolution, int series, qint64 fromMs, qint64 toMs,
+                     TimeSeriesRollup *rollups, int max );
+
+private:
+
+    //*** one mapped segment ***
+    struct Segment
+    {
+        const quint8 *data;
+        qint64 dataSize;
+        const TimeSeriesBlockHeader *index;
+        int blockCount;
+        qint64 firstMs;
+        qint64 lastMs;
+    };
+
+    //*** one mapped rollup file ***
+    struct RollupMap
+    {
+        const quint8 *map;
+        qint64 mapSize;
+        const TimeSeriesRollup *records;
+        int count;
+    };
+
+    bool mapSegment( QString baseName, Segment &segment );
+    void mapRollup( QString fileName, RollupMap &rollup );
+
+    //*** decode the points of a block in a range ***
+    int decodeBlock( const quint8 *block, qint64 fromMs, qint64 toMs,
+                     TimeSeriesPoint *points, int max );
+
+    QString directory_;
+    QVector<Segment> segments_;
+    RollupMap minutes_;
+    RollupMap hours_;
+
+    Q_DISABLE_COPY( SHTimeSeriesReader )
+};
+
+#endif // SHTIMESERIES_H
@@ -0,0 +1,12 @@
+#-------------------------------------------------
+#
+# Shared by the benchmarks - link against the library built at the top of
+#   the tree by QSenseHatAll.pro, or else the installed one
+#
+#-------------------------------------------------
+
+INCLUDEPATH += $$PWD/..
+
+LIBS += -L$$OUT_PWD/../.. -lQSenseHat -lRTIMULib -lrt
+
+QMAKE_RPATHDIR += $$OUT_PWD/../..
@@ -0,0 +1,13 @@
+#-------------------------------------------------
+#
+# QSenseHat benchmarks - linked against the library, run on the target.
+#   Built together with the library by QSenseHatAll.pro
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += fft \
+           fusion \
+           latency \
+           leds
@@ -0,0 +1,18 @@
+#-------------------------------------------------
+#
+# FFT time per block of the vibration spectrum
+#
+#-------------------------------------------------
+
+TARGET = shbench_fft
+
+TEMPLATE = app
+
+QT -= gui
+
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+include( ../benchmarks.pri )
+
+SOURCES += main.cpp
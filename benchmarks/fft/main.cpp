@@ -0,0 +1,159 @@
+//******************************************************************************
+//******************************************************************************
+//
+// FFT benchmark
+//
+// Times the real FFT alone and the complete spectrum analysis (window,
+//      transform, bands and peaks) for every supported block size, so the
+//      block size and overlap of the vibration spectrum can be chosen for the
+//      target CPU and IMU sample rate
+//
+//  usage: shbench_fft [sampleRateHz]
+//
+//******************************************************************************
+//******************************************************************************
+#include "SHSpectrum.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+//*** time spent on each measurement ***
+const qint64 MeasureNs = 500 * 1000000LL;
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief nowNs - current CLOCK_MONOTONIC time
+ * @return - time in nanoseconds
+ */
+//******************************************************************************
+static qint64 nowNs()
+{
+struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief benchFft - time the transform alone
+ * @param size - block size
+ * @return - nanoseconds per transform
+ */
+//******************************************************************************
+static double benchFft( int size )
+{
+SHFft fft;
+float *input = new float[ size ];
+float *data = new float[ size ];
+qint64 startNs, elapsedNs;
+long runs = 0;
+
+    fft.configure( size );
+
+    for ( int i=0; i<size; i++ )
+    {
+        input[i] = (float)rand() / RAND_MAX - 0.5f;
+    }
+
+    //*** restore the input each run - the copy is timed too, and is tiny ***
+    startNs = nowNs();
+    do
+    {
+        for ( int i=0; i<size; i++ ) data[i] = input[i];
+        fft.forward( data );
+        runs++;
+        elapsedNs = nowNs() - startNs;
+    } while ( elapsedNs < MeasureNs );
+
+    delete [] input;
+    delete [] data;
+
+    return (double)elapsedNs / runs;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief benchBlock - time complete blocks, as run on the acquisition thread
+ * @param size         - block size
+ * @param sampleRateHz - input sample rate
+ * @param maxNs        - receives the slowest block
+ * @return - mean nanoseconds per block
+ */
+//******************************************************************************
+static double benchBlock( int size, double sampleRateHz, qint64 *maxNs )
+{
+SHSpectrumAnalyzer analyzer;
+qint64 startNs = nowNs();
+qint64 totalNs = 0;
+long blocks = 0;
+long n = 0;
+float value;
+
+    //*** hop of one sample - after the first block every sample completes one ***
+    analyzer.configure( size, size - 1, sampleRateHz );
+    *maxNs = 0;
+
+    while ( nowNs() - startNs < MeasureNs )
+    {
+        //*** 1 g plus a tone and some noise ***
+        value = 1.0f + 0.2f * sin( 2.0 * M_PI * 37.0 * n / sampleRateHz ) +
+                0.01f * ( (float)rand() / RAND_MAX - 0.5f );
+        n++;
+
+        //*** timestamps at the sample rate - the analyzer measures it from them ***
+        if ( analyzer.add( (qint64)( n * 1e9 / sampleRateHz ), value ) )
+        {
+            totalNs += analyzer.result().analysisNs;
+            if ( analyzer.result().analysisNs > *maxNs ) *maxNs = analyzer.result().analysisNs;
+            blocks++;
+        }
+    }
+
+    return blocks ? (double)totalNs / blocks : 0.0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief main
+ */
+//******************************************************************************
+int main( int argc, char *argv[] )
+{
+double sampleRateHz = ( argc > 1 ) ? atof( argv[1] ) : 952.0;
+double fftNs, blockNs, periodNs;
+qint64 maxNs;
+
+    if ( sampleRateHz <= 0.0 )
+    {
+        fprintf( stderr, "usage: %s [sampleRateHz]\n", argv[0] );
+        return 1;
+    }
+
+    printf( "# sample rate %.1f Hz\n", sampleRateHz );
+    printf( "# size  fft_ns  block_ns  block_max_ns  block_period_ns  cpu_at_no_overlap\n" );
+
+    for ( int size=SpectrumMinBlock; size<=SpectrumMaxBlock; size*=2 )
+    {
+        fftNs = benchFft( size );
+        blockNs = benchBlock( size, sampleRateHz, &maxNs );
+
+        //*** share of one CPU when blocks do not overlap ***
+        periodNs = size * 1e9 / sampleRateHz;
+
+        printf( "%6d  %8.0f  %8.0f  %10lld  %12.0f  %8.5f\n",
+                size, fftNs, blockNs, (long long)maxNs, periodNs, blockNs / periodNs );
+    }
+
+    return 0;
+}
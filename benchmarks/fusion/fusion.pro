@@ -0,0 +1,16 @@
+#-------------------------------------------------
+#
+# Fusion accuracy against CPU cost on a recorded log or a simulated run
+#
+#-------------------------------------------------
+
+TARGET = shbench_fusion
+
+TEMPLATE = app
+
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+include( ../benchmarks.pri )
+
+SOURCES += main.cpp
@@ -0,0 +1,368 @@
+//******************************************************************************
+//******************************************************************************
+//
+// Fusion benchmark
+//
+// Runs RTIMULib's fusion engines and the library's Madgwick and Mahony
+//      filters over raw gyro, accelerometer and compass samples and reports
+//      CPU time per update and how far each orientation is from a reference
+//
+//  With -s the samples come from the simulator (see SHSimulator.h for the
+//      options) and the reference is the simulated board's true
+//      orientation, so the figures are errors. A recorded sensor log has
+//      no truth: the reference is the fusion recorded in the log, and the
+//      figures are deviations from that engine, not errors
+//
+//  usage: shbench_fusion <sensor log> [settings name]
+//         shbench_fusion -s <simulator options> [-d seconds] [settings name]
+//
+//******************************************************************************
+//******************************************************************************
+#include "SHSensorLog.h"
+#include "SHFusion.h"
+#include "SHSimSensors.h"
+#include "SHSimulator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <string.h>
+#include <unistd.h>
+
+//*** records decoded, copied and run at a time ***
+const int ChunkRecords = 4096;
+
+//*** settling time excluded from the error ***
+const double WarmupSec = 5.0;
+
+//*** default simulated run ***
+const double DefaultSimSec = 60.0;
+
+//*** samples under test - a recorded log, or a simulated run ***
+struct Input
+{
+    SHSensorLogReader *reader;      // 0 for the simulator
+    SimSensorOptions simOptions;
+    SHSimSource *sim;               // restarted for every engine
+    quint64 simSamples;             // samples per simulated run
+    quint64 simDone;
+};
+
+//*** one engine under test - exactly one of sh, rt is set ***
+struct Engine
+{
+    const char *label;
+    SHFusion *sh;
+    RTFusion *rt;
+};
+
+//*** results of one run ***
+struct RunStats
+{
+    quint64 updates;
+    double cpuNs;
+    quint64 compared;
+    double errSum;
+    double errSqSum;
+    double errMax;
+};
+
+//*** chunk buffers - samples with the reference pose, and the copy fused ***
+static RTIMU_DATA reference[ChunkRecords];
+static RTIMU_DATA work[ChunkRecords];
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief cpuNs - CPU time of this thread
+ * @return - time in nanoseconds
+ */
+//******************************************************************************
+static qint64 cpuNs()
+{
+struct timespec ts;
+
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief angleDeg - angle between two orientations
+ * @param a - first quaternion
+ * @param b - second quaternion
+ * @return - angle in degrees
+ */
+//******************************************************************************
+static double angleDeg( const RTQuaternion &a, const RTQuaternion &b )
+{
+double dot = fabs( a.scalar() * b.scalar() + a.x() * b.x() + a.y() * b.y() + a.z() * b.z() );
+
+    if ( dot > 1.0 ) dot = 1.0;
+
+    return 2.0 * acos( dot ) * 180.0 / M_PI;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief rewindInput - back to the first sample. A simulated run starts again
+ *              from the same seed, so every engine sees the same samples
+ * @param input - samples under test
+ */
+//******************************************************************************
+static void rewindInput( Input &input )
+{
+    if ( input.reader )
+    {
+        input.reader->rewind();
+        return;
+    }
+
+    delete input.sim;
+    input.sim = new SHSimSource( input.simOptions );
+    input.simDone = 0;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief readChunk - the next samples, with the reference orientation in the
+ *              fusion pose
+ * @param input  - samples under test
+ * @param buffer - receives up to ChunkRecords samples
+ * @return - number of samples, 0 at the end
+ */
+//******************************************************************************
+static int readChunk( Input &input, RTIMU_DATA *buffer )
+{
+SensorLogRecord rec;
+int count = 0;
+
+    if ( input.reader )
+    {
+        while ( count < ChunkRecords && input.reader->next( rec ) )
+        {
+            imuDataFromLogRecord( rec, buffer[count++] );
+        }
+        return count;
+    }
+
+    //*** as fast as read - FALSE only ends a burst ***
+    while ( count < ChunkRecords && input.simDone < input.simSamples )
+    {
+        if ( input.sim->nextDue( buffer[count] ) )
+        {
+            count++;
+            input.simDone++;
+        }
+    }
+
+    return count;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief runEngine - run one engine over all the samples
+ * @param input    - samples under test
+ * @param engine   - engine under test
+ * @param settings - RTIMULib settings for the RTIMULib engines
+ * @param stats    - receives the results
+ */
+//******************************************************************************
+static void runEngine( Input &input, Engine &engine,
+                       RTIMUSettings *settings, RunStats &stats )
+{
+quint64 firstUs = 0;
+qint64 startNs;
+int count;
+double err;
+
+    memset( &stats, 0, sizeof(stats) );
+    rewindInput( input );
+
+    if ( engine.sh ) engine.sh->reset();
+    if ( engine.rt ) engine.rt->reset();
+
+    while ( true )
+    {
+        //*** decode or generate a chunk - not timed ***
+        count = readChunk( input, reference );
+        if ( count == 0 ) break;
+
+        if ( firstUs == 0 ) firstUs = reference[0].timestamp;
+
+        for ( int i=0; i<count; i++ )
+        {
+            work[i] = reference[i];
+            work[i].fusionPoseValid = false;
+            work[i].fusionQPoseValid = false;
+        }
+
+        //*** fusion only ***
+        startNs = cpuNs();
+        if ( engine.sh )
+        {
+            for ( int i=0; i<count; i++ ) engine.sh->newIMUData( work[i] );
+        }
+        else
+        {
+            for ( int i=0; i<count; i++ ) engine.rt->newIMUData( work[i], settings );
+        }
+        stats.cpuNs += cpuNs() - startNs;
+        stats.updates += count;
+
+        //*** distance from the reference, after the warmup ***
+        for ( int i=0; i<count; i++ )
+        {
+            if ( !reference[i].fusionQPoseValid || !work[i].fusionQPoseValid ) continue;
+            if ( ( reference[i].timestamp - firstUs ) / 1e6 < WarmupSec ) continue;
+
+            err = angleDeg( reference[i].fusionQPose, work[i].fusionQPose );
+            stats.compared++;
+            stats.errSum += err;
+            stats.errSqSum += err * err;
+            if ( err > stats.errMax ) stats.errMax = err;
+        }
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief main
+ */
+//******************************************************************************
+int main( int argc, char *argv[] )
+{
+SHSensorLogReader reader;
+RTIMUSettings *settings;
+Input input;
+RunStats stats;
+const char *simSpec = 0;
+const char *source;
+double simSec = DefaultSimSec;
+double spanSec, rateHz;
+double nsPerUpdate, compared;
+quint64 samples;
+int opt;
+bool usage = false;
+RTFusionRTQF rtqf;
+RTFusionKalman4 kalman;
+SHMadgwickFusion madgwickLow, madgwick, madgwickHigh;
+SHMahonyFusion mahony, mahonyBias;
+
+    while ( ( opt = getopt( argc, argv, "s:d:" ) ) != -1 )
+    {
+        switch ( opt )
+        {
+            case 's': simSpec = optarg; break;
+            case 'd': simSec = atof( optarg ); break;
+            default:  usage = true; break;
+        }
+    }
+
+    if ( usage || ( !simSpec && optind >= argc ) || simSec <= WarmupSec )
+    {
+        fprintf( stderr, "usage: %s <sensor log> [settings name]\n"
+                         "       %s -s <simulator options> [-d seconds] [settings name]\n",
+                 argv[0], argv[0] );
+        return 1;
+    }
+
+    input.reader = 0;
+    input.sim = 0;
+    input.simSamples = 0;
+    input.simDone = 0;
+
+    if ( simSpec )
+    {
+        //*** simulated board - the reference is the truth ***
+        if ( !SHSimulator::parseOptions( simSpec, input.simOptions ) )
+        {
+            fprintf( stderr, "%s: invalid simulator options %s\n", argv[0], simSpec );
+            return 1;
+        }
+
+        input.simOptions.speed = 0.0;
+        rateHz = input.simOptions.sampleRateHz;
+        spanSec = simSec;
+        samples = (quint64)( simSec * rateHz );
+        input.simSamples = samples;
+        source = simSpec;
+    }
+    else
+    {
+        //*** recorded log - the reference is the recorded fusion ***
+        if ( !reader.open( argv[optind] ) || reader.recordCount() < 2 )
+        {
+            fprintf( stderr, "%s: cannot read sensor log %s\n", argv[0], argv[optind] );
+            return 1;
+        }
+
+        input.reader = &reader;
+        spanSec = ( reader.lastTimestampUs() - reader.firstTimestampUs() ) / 1e6;
+        rateHz = ( spanSec > 0.0 ) ? ( reader.recordCount() - 1 ) / spanSec : 0.0;
+        samples = reader.recordCount();
+        source = argv[optind++];
+    }
+
+    settings = new RTIMUSettings( ( optind < argc ) ? argv[optind] : "RTIMULib" );
+
+    //*** engines under test ***
+    rtqf.setSlerpPower( 0.02 );
+    madgwickLow.setBeta( 0.033f );
+    madgwickHigh.setBeta( 0.3f );
+    mahonyBias.setGains( 1.0f, 0.05f );
+
+    Engine engines[] =
+    {
+        { "rtimu-rtqf",            0,             &rtqf },
+        { "rtimu-kalman4",         0,             &kalman },
+        { "madgwick-beta0.033",    &madgwickLow,  0 },
+        { "madgwick-beta0.1",      &madgwick,     0 },
+        { "madgwick-beta0.3",      &madgwickHigh, 0 },
+        { "mahony-kp0.5-ki0",      &mahony,       0 },
+        { "mahony-kp1-ki0.05",     &mahonyBias,   0 }
+    };
+
+    printf( "# %s %s: %llu samples, %.1f s, %.1f Hz\n", input.reader ? "log" : "simulator",
+            source, (unsigned long long)samples, spanSec, rateHz );
+
+    if ( input.reader )
+    {
+        printf( "# deviation from the recorded fusion (not ground truth), first %.0f s excluded\n", WarmupSec );
+        printf( "# engine  ns_per_update  cpu_share  mean_dev_deg  rms_dev_deg  max_dev_deg\n" );
+    }
+    else
+    {
+        printf( "# error against the true orientation, first %.0f s excluded\n", WarmupSec );
+        printf( "# engine  ns_per_update  cpu_share  mean_err_deg  rms_err_deg  max_err_deg\n" );
+    }
+
+    for ( unsigned e=0; e<sizeof(engines)/sizeof(engines[0]); e++ )
+    {
+        runEngine( input, engines[e], settings, stats );
+
+        nsPerUpdate = stats.cpuNs / stats.updates;
+        compared = stats.compared ? stats.compared : 1;
+
+        printf( "%-20s  %10.0f  %9.5f  %10.3f  %10.3f  %10.3f\n",
+                engines[e].label, nsPerUpdate, nsPerUpdate * rateHz / 1e9,
+                stats.errSum / compared, sqrt( stats.errSqSum / compared ), stats.errMax );
+    }
+
+    delete settings;
+    delete input.sim;
+
+    return 0;
+}
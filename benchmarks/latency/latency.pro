@@ -0,0 +1,16 @@
+#-------------------------------------------------
+#
+# End-to-end latency from joystick and IMU input to the LED framebuffer
+#
+#-------------------------------------------------
+
+TARGET = shbench_latency
+
+TEMPLATE = app
+
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+include( ../benchmarks.pri )
+
+SOURCES += main.cpp
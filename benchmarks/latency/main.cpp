@@ -0,0 +1,550 @@
+//******************************************************************************
+//******************************************************************************
+//
+// End-to-end latency benchmark
+//
+// Time from a joystick press or an IMU change to the matching LED update,
+//      with stand-ins for the hardware: input events are written into a pipe
+//      in place of the joystick device, IMU samples are replayed from a
+//      synthesized sensor log and the display is a memory file mapped in
+//      place of the framebuffer. An observer thread spins on a second mapping
+//      of that memory, so "visible" is when a scan of the framebuffer would
+//      first show the change. The observer keeps one CPU busy.
+//
+//  Each stimulus toggles one pixel and is timestamped at every stage:
+//      joystick   written  -> handled -> drawn -> visible
+//      sensors    acquired -> handled -> drawn -> visible
+//
+//  Paths and thread configurations, each with the GUI event loop idle and
+//      loaded by a busy handler:
+//      joystick       input thread, event queued to the GUI thread
+//      sensor-timer   acquisition on a GUI thread QTimer, signal to a handler
+//      sensor-thread  acquisition thread, signal queued to the GUI thread
+//      sensor-direct  acquisition thread, SHDisplayBinder in the pipeline
+//
+//  usage: shbench_latency [-n stimuli] [-p period ms] [-r sample Hz] [-l load ms]
+//
+//******************************************************************************
+//******************************************************************************
+#include "SHJoystick.h"
+#include "SHLedMatrix.h"
+#include "SHSensors.h"
+#include "SHSensorLog.h"
+#include "SHProcessing.h"
+#include "SHDisplayBinding.h"
+
+#include <QGuiApplication>
+#include <QEventLoop>
+#include <QTimer>
+#include <QThread>
+#include <QAtomicInt>
+#include <QDir>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <linux/input.h>
+
+#include <vector>
+#include <algorithm>
+
+//*** stimuli per run at most ***
+const int MaxStimuli = 10000;
+
+//*** stages of a path ***
+const int PathStages = 4;
+
+//*** pixels toggled by each path ***
+const int JsPixelX = 0;
+const int JsPixelY = 0;
+const int SensorColumn = 7;                  // bar binding column, bottom pixel watched
+
+//*** busy handler interval on the loaded GUI thread ***
+const int LoadIntervalMs = 10;
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief nowNs - current CLOCK_MONOTONIC time, the sample clock
+ * @return - time in nanoseconds
+ */
+//******************************************************************************
+static qint64 nowNs()
+{
+struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The StageLog class - the times a stage changed state. Written by
+ *              one thread during a run, read after it
+ */
+//******************************************************************************
+class StageLog
+{
+public:
+
+    StageLog() { reset(); }
+
+    void reset() { count_ = 0; state_ = -1; }
+
+    //*** record a state, keeping only changes ***
+    void add( int state, qint64 timeNs )
+    {
+        if ( state == state_ || count_ >= MaxStimuli * 2 ) return;
+
+        state_ = state;
+        states_[count_] = state;
+        times_[count_] = timeNs;
+        count_++;
+    }
+
+    //*** first change to a state in [fromNs, toNs), or -1 ***
+    qint64 find( int state, qint64 fromNs, qint64 toNs ) const
+    {
+        for ( int i=0; i<count_; i++ )
+        {
+            if ( times_[i] >= toNs ) break;
+            if ( times_[i] >= fromNs && states_[i] == state ) return times_[i];
+        }
+
+        return -1;
+    }
+
+    int count() const { return count_; }
+    int state( int i ) const { return states_[i]; }
+    qint64 time( int i ) const { return times_[i]; }
+
+private:
+
+    int count_;
+    int state_;
+    int states_[MaxStimuli * 2];
+    qint64 times_[MaxStimuli * 2];
+};
+
+//*** the four stages of the run in progress ***
+static StageLog stages[PathStages];
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The Observer class - spins on the framebuffer until stopped and logs
+ *              when the watched pixel goes on or off
+ */
+//******************************************************************************
+class Observer : public QThread
+{
+public:
+
+    Observer( const volatile quint16 *pixel ) : pixel_( pixel ) { stop_.store( 0 ); }
+
+    void stop() { stop_.store( 1 ); wait(); }
+
+private:
+
+    void run()
+    {
+        int lit = ( *pixel_ != 0 );
+
+        stages[3].add( lit, nowNs() );
+
+        while ( !stop_.load() )
+        {
+            if ( ( *pixel_ != 0 ) != lit )
+            {
+                lit = !lit;
+                stages[3].add( lit, nowNs() );
+            }
+        }
+    }
+
+    const volatile quint16 *pixel_;
+    QAtomicInt stop_;
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The PressWriter class - writes alternating up and down presses into
+ *              the joystick pipe, one per period
+ */
+//******************************************************************************
+class PressWriter : public QThread
+{
+public:
+
+    PressWriter( int fd, int count, int periodMs ) : fd_( fd ), count_( count ), periodMs_( periodMs ) {}
+
+private:
+
+    void run()
+    {
+        struct input_event ev[2];
+        struct timespec wake;
+        qint64 startNs = nowNs() + periodMs_ * 1000000LL;
+        qint64 dueNs;
+
+        for ( int k=0; k<count_; k++ )
+        {
+            dueNs = startNs + (qint64)k * periodMs_ * 1000000LL;
+            wake.tv_sec = dueNs / 1000000000LL;
+            wake.tv_nsec = dueNs % 1000000000LL;
+            clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, 0 );
+
+            //*** a key press and its sync ***
+            memset( ev, 0, sizeof(ev) );
+            gettimeofday( &ev[0].time, 0 );
+            ev[0].type = EV_KEY;
+            ev[0].code = ( k % 2 == 0 ) ? KEY_UP : KEY_DOWN;
+            ev[0].value = 1;
+            ev[1].time = ev[0].time;
+            ev[1].type = EV_SYN;
+
+            stages[0].add( k % 2 == 0, nowNs() );
+            if ( write( fd_, ev, sizeof(ev) ) != sizeof(ev) ) break;
+        }
+    }
+
+    int fd_;
+    int count_;
+    int periodMs_;
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief writeSensorLog - synthesize a log whose accelerometer x steps
+ *              between 0 and 1 g every period, starting at 0
+ * @param fileName - log file, replaced
+ * @param count    - steps to 1 g and back counted singly
+ * @param periodMs - time between steps
+ * @param rateHz   - sample rate
+ * @return - TRUE if written
+ */
+//******************************************************************************
+static bool writeSensorLog( QString fileName, int count, int periodMs, int rateHz )
+{
+SHSensorLogWriter writer;
+SensorLogRecord rec;
+qint64 samples = (qint64)( count + 2 ) * periodMs * rateHz / 1000;
+
+    QFile::remove( fileName );
+    if ( !writer.open( fileName ) ) return false;
+
+    for ( qint64 i=0; i<samples; i++ )
+    {
+        memset( &rec, 0, sizeof(rec) );
+        rec.timestampUs = 1000000 + i * 1000000 / rateHz;
+        rec.valid = IMU_GYRO | IMU_ACCEL | IMU_COMPASS;
+        rec.accel[0] = ( ( i * 1000 / rateHz ) / periodMs ) % 2;
+        rec.accel[2] = 1.0f;
+        writer.append( rec );
+    }
+
+    writer.close();
+
+    return true;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief percentile - a value of a sorted list
+ * @param sorted   - ascending values
+ * @param fraction - 0 to 1
+ * @return - value
+ */
+//******************************************************************************
+static double percentile( const std::vector<double> &sorted, double fraction )
+{
+    if ( sorted.empty() ) return 0.0;
+
+    return sorted[ std::min( sorted.size() - 1, (size_t)( fraction * sorted.size() ) ) ];
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief report - match every stimulus through the stages and print the
+ *              latency of each step and of the whole path
+ * @param path     - path and thread configuration
+ * @param loaded   - GUI thread loaded
+ * @param names    - stage names
+ * @param periodMs - time between stimuli, the matching window
+ */
+//******************************************************************************
+static void report( const char *path, bool loaded, const char *const *names, int periodMs )
+{
+std::vector<double> steps[PathStages];
+qint64 times[PathStages];
+qint64 windowNs = periodMs * 1000000LL;
+char label[64];
+int lost = 0;
+bool found;
+
+    //*** every change of the first stage is a stimulus ***
+    for ( int k=0; k<stages[0].count(); k++ )
+    {
+        times[0] = stages[0].time( k );
+        found = true;
+
+        for ( int s=1; s<PathStages && found; s++ )
+        {
+            times[s] = stages[s].find( stages[0].state( k ), times[s-1], times[0] + windowNs );
+            found = ( times[s] >= 0 );
+        }
+
+        if ( !found )
+        {
+            lost++;
+            continue;
+        }
+
+        for ( int s=1; s<PathStages; s++ )
+        {
+            steps[s-1].push_back( ( times[s] - times[s-1] ) / 1000.0 );
+        }
+        steps[PathStages-1].push_back( ( times[PathStages-1] - times[0] ) / 1000.0 );
+    }
+
+    for ( int s=0; s<PathStages; s++ )
+    {
+        std::sort( steps[s].begin(), steps[s].end() );
+
+        double sum = 0.0;
+        for ( size_t i=0; i<steps[s].size(); i++ ) sum += steps[s][i];
+
+        if ( s < PathStages - 1 )
+            snprintf( label, sizeof(label), "%s-%s", names[s], names[s+1] );
+        else
+            snprintf( label, sizeof(label), "total" );
+
+        printf( "%-14s %-6s %-18s %6d %5d %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+                path, loaded ? "loaded" : "idle", label, (int)steps[s].size(), lost,
+                steps[s].empty() ? 0.0 : sum / steps[s].size(),
+                percentile( steps[s], 0.5 ), percentile( steps[s], 0.9 ),
+                percentile( steps[s], 0.99 ),
+                steps[s].empty() ? 0.0 : steps[s].back() );
+    }
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief runFor - run the GUI event loop, busy for loadMs of every
+ *              LoadIntervalMs if loadMs is set
+ * @param durationMs - run time
+ * @param loadMs     - busy time per interval, 0 for idle
+ */
+//******************************************************************************
+static void runFor( int durationMs, int loadMs )
+{
+QEventLoop loop;
+QTimer load;
+
+    if ( loadMs > 0 )
+    {
+        QObject::connect( &load, &QTimer::timeout, [loadMs]() {
+            qint64 endNs = nowNs() + loadMs * 1000000LL;
+            while ( nowNs() < endNs ) {}
+        } );
+        load.start( LoadIntervalMs );
+    }
+
+    QTimer::singleShot( durationMs, &loop, SLOT(quit()) );
+    loop.exec();
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief main
+ */
+//******************************************************************************
+int main( int argc, char *argv[] )
+{
+int stimuli = 200;
+int periodMs = 50;
+int rateHz = 100;
+int loadMs = 4;
+int opt;
+int fbFd;
+int pipeFds[2];
+const volatile quint16 *watch;
+QString logFile;
+const char *const jsNames[PathStages] = { "written", "handled", "drawn", "visible" };
+const char *const sensorNames[PathStages] = { "acquired", "handled", "drawn", "visible" };
+const char *const sensorModes[3] = { "sensor-timer", "sensor-thread", "sensor-direct" };
+
+    while ( ( opt = getopt( argc, argv, "n:p:r:l:" ) ) != -1 )
+    {
+        switch ( opt )
+        {
+            case 'n': stimuli = qBound( 2, atoi( optarg ), MaxStimuli ); break;
+            case 'p': periodMs = qMax( 5, atoi( optarg ) ); break;
+            case 'r': rateHz = qBound( 10, atoi( optarg ), 2000 ); break;
+            case 'l': loadMs = qBound( 0, atoi( optarg ), LoadIntervalMs - 1 ); break;
+            default:
+                fprintf( stderr, "usage: %s [-n stimuli] [-p period ms] [-r sample Hz] [-l load ms]\n", argv[0] );
+                return 1;
+        }
+    }
+
+    //*** fonts for the display class without a screen ***
+    qputenv( "QT_QPA_PLATFORM", "offscreen" );
+    QGuiApplication app( argc, argv );
+
+    //*** the display is a memory file, watched through a second mapping ***
+    fbFd = memfd_create( "shbench-fb", MFD_CLOEXEC );
+    if ( fbFd < 0 || ftruncate( fbFd, DisplayMemSizeBytes ) < 0 )
+    {
+        fprintf( stderr, "%s: cannot create the memory framebuffer\n", argv[0] );
+        return 1;
+    }
+
+    watch = (const volatile quint16 *)mmap( 0, DisplayMemSizeBytes, PROT_READ, MAP_SHARED, fbFd, 0 );
+
+    SHLedMatrix display;
+    if ( watch == MAP_FAILED || !display.setFramebufferDevice( dup( fbFd ) ) )
+    {
+        fprintf( stderr, "%s: cannot map the memory framebuffer\n", argv[0] );
+        return 1;
+    }
+
+    printf( "# %d stimuli %d ms apart, sensors at %d Hz, loaded GUI thread busy %d of every %d ms\n",
+            stimuli, periodMs, rateHz, loadMs, LoadIntervalMs );
+    printf( "# path          loop   step               count  lost   mean_us    p50_us    p90_us    p99_us    max_us\n" );
+
+    //******************************************************************************
+    //*** joystick: pipe -> input thread -> GUI thread handler -> framebuffer ***
+    //******************************************************************************
+    SHJoystick joystick;
+    QObject handler;
+
+    QObject::connect( &joystick, &SHJoystick::joystickEvent, &handler, [&display]( Joystick_Event ev ) {
+        int lit = ( ev == JS_UP );
+        stages[1].add( lit, nowNs() );
+        display.setPixel( JsPixelX, JsPixelY, lit ? Color16b::white() : Color16b::black() );
+        stages[2].add( lit, nowNs() );
+    } );
+
+    for ( int loaded=0; loaded<2; loaded++ )
+    {
+        for ( int s=0; s<PathStages; s++ ) stages[s].reset();
+        display.clear();
+
+        if ( pipe( pipeFds ) < 0 || !joystick.setInputDevice( pipeFds[0] ) ) return 1;
+
+        Observer observer( &watch[ JsPixelY * DisplayXSize + JsPixelX ] );
+        PressWriter writer( pipeFds[1], stimuli, periodMs );
+        observer.start();
+        writer.start();
+
+        runFor( ( stimuli + 2 ) * periodMs, loaded ? loadMs : 0 );
+
+        writer.wait();
+        observer.stop();
+        ::close( pipeFds[1] );
+
+        report( "joystick", loaded, jsNames, periodMs );
+    }
+
+    //******************************************************************************
+    //*** sensors: replayed log -> acquisition -> handler or binder -> framebuffer ***
+    //******************************************************************************
+    logFile = QDir::tempPath() + "/shbench_latency.shlog";
+    if ( !writeSensorLog( logFile, stimuli, periodMs, rateHz ) )
+    {
+        fprintf( stderr, "%s: cannot write %s\n", argv[0], qPrintable( logFile ) );
+        return 1;
+    }
+
+    for ( int mode=0; mode<3; mode++ )
+    {
+        for ( int loaded=0; loaded<2; loaded++ )
+        {
+            for ( int s=0; s<PathStages; s++ ) stages[s].reset();
+            display.clear();
+
+            SHSensors sensors;
+            QObject receiver;
+            SHDisplayBinder binder( &display, 1000.0 );
+            DisplayBinding bar( BIND_BAR, IMU_ACCEL, 0.0f, 1.0f, SensorColumn, 0, 1, DisplayYSize );
+
+            //*** acquisition time of each step, seen from the pipeline ***
+            auto acquired = functionStage( []( SensorSample &s ) {
+                stages[0].add( s.accel[0] > 0.5f, s.timestampNs );
+                stages[1].add( s.accel[0] > 0.5f, nowNs() );
+                return true; }, "acquired" );
+            auto drawn = functionStage( []( SensorSample &s ) {
+                stages[2].add( s.accel[0] > 0.5f, nowNs() );
+                return true; }, "drawn" );
+
+            auto *probe = newPipeline( acquired );
+            auto *direct = newPipeline( acquired, SHDisplayStage( &binder ), drawn );
+
+            if ( !sensors.openReplay( logFile, true ) || !sensors.enableSensors( IMU_ACCEL ) ) return 1;
+            sensors.setUpdateRate( rateHz );
+
+            if ( mode == 2 )
+            {
+                bar.component = 0;
+                binder.addBinding( bar );
+                sensors.setProcessor( direct );
+            }
+            else
+            {
+                //*** the probe's handled stamp is replaced by the handler's ***
+                sensors.setProcessor( probe );
+                QObject::connect( &sensors, &SHSensors::accel, &receiver, [&display]( float x, float, float, float ) {
+                    int lit = ( x > 0.5f );
+                    stages[1].add( lit, nowNs() );
+                    display.setPixel( SensorColumn, DisplayYSize - 1, lit ? Color16b::white() : Color16b::black() );
+                    stages[2].add( lit, nowNs() );
+                } );
+            }
+
+            Observer observer( &watch[ ( DisplayYSize - 1 ) * DisplayXSize + SensorColumn ] );
+            observer.start();
+
+            if ( mode == 0 )
+                sensors.startPeriodicUpdates();
+            else
+                sensors.startRealtimeUpdates();
+
+            runFor( ( stimuli + 2 ) * periodMs, loaded ? loadMs : 0 );
+
+            sensors.stopUpdates();
+            sensors.setProcessor( 0 );
+            observer.stop();
+
+            delete probe;
+            delete direct;
+
+            report( sensorModes[mode], loaded, sensorNames, periodMs );
+        }
+    }
+
+    QFile::remove( logFile );
+
+    return 0;
+}
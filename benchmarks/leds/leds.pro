@@ -0,0 +1,16 @@
+#-------------------------------------------------
+#
+# LED matrix drawing cost and scaling under concurrent callers
+#
+#-------------------------------------------------
+
+TARGET = shbench_leds
+
+TEMPLATE = app
+
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+include( ../benchmarks.pri )
+
+SOURCES += main.cpp
@@ -0,0 +1,293 @@
+//******************************************************************************
+//******************************************************************************
+//
+// LED matrix benchmark
+//
+// Times the drawing operations of SHLedMatrix on a memory file mapped in place
+//      of the framebuffer, first from one thread and then from 2, 4, ... up
+//      to the thread limit all drawing on the same display, so a regression
+//      in an operation or in its locking shows up as a change in cost or in
+//      the scaling curve
+//
+//  One line per operation and thread count, whitespace separated under the
+//      '#' header so runs on different commits can be compared with diff or
+//      a script:
+//      op           operation
+//      threads      threads calling it at once
+//      ops          operations completed in the measurement
+//      ns_per_op    wall time per operation of one thread
+//      ops_per_sec  operations per second of all threads
+//      p50_ns       median and worst per-operation time of batches of
+//      p99_ns       BatchOps operations, where waits for the display lock
+//      max_ns       of other threads show up
+//      scaling      ops_per_sec over that of one thread times threads
+//
+//  rotateBuffer works on each thread's own buffer and takes no lock; it is
+//      the baseline for how the others should scale without contention
+//
+//  usage: shbench_leds [-t max threads] [-m ms per measurement]
+//
+//******************************************************************************
+//******************************************************************************
+#include "SHLedMatrix.h"
+
+#include <QGuiApplication>
+#include <QThread>
+#include <QAtomicInt>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <vector>
+#include <algorithm>
+
+//*** operations timed between clock reads ***
+const int BatchOps = 64;
+
+//*** operations ***
+enum LedOp { OP_SETPIXEL, OP_FILL, OP_SETBLOCK, OP_SETIMAGE, OP_KALEIDOSCOPE, OP_ROTATE, OP_COUNT };
+const char *const OpNames[OP_COUNT] = { "setPixel", "fill", "setBlock", "setImage", "kaleidoscope", "rotateBuffer" };
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief nowNs - current CLOCK_MONOTONIC time
+ * @return - time in nanoseconds
+ */
+//******************************************************************************
+static qint64 nowNs()
+{
+struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief The Worker class - runs one operation in batches between the start
+ *              and stop flags and keeps the time of every batch
+ */
+//******************************************************************************
+class Worker : public QThread
+{
+public:
+
+    Worker( SHLedMatrix *display, LedOp op, int seed, const QAtomicInt *go, const QAtomicInt *stop )
+        : display_( display ), op_( op ), seed_( seed ), go_( go ), stop_( stop ),
+          image_( DisplayXSize, DisplayYSize, QImage::Format_RGB16 )
+    {
+        for ( int i=0; i<DisplayXSize * DisplayYSize; i++ )
+        {
+            src_[i] = (quint16)( i * 1021 + seed );
+            if ( i < 16 ) block_[i] = src_[i];
+        }
+
+        image_.fill( Qt::blue );
+        batchNs_.reserve( 1 << 18 );
+    }
+
+    quint64 ops() const { return (quint64)batchNs_.size() * BatchOps; }
+    const std::vector<qint64> &batches() const { return batchNs_; }
+
+private:
+
+    void run()
+    {
+        qint64 startNs;
+        int i = 0;
+
+        while ( !go_->load() ) {}
+
+        while ( !stop_->load() )
+        {
+            startNs = nowNs();
+            for ( int b=0; b<BatchOps; b++, i++ ) runOp( i );
+            batchNs_.push_back( nowNs() - startNs );
+        }
+    }
+
+    //*** one operation, varying the pixels so every call writes ***
+    void runOp( int i )
+    {
+        quint16 color = (quint16)( i * 37 + seed_ );
+
+        switch ( op_ )
+        {
+            case OP_SETPIXEL:
+                display_->setPixel( i % DisplayXSize, ( i / DisplayXSize ) % DisplayYSize, color );
+                break;
+
+            case OP_FILL:
+                display_->fill( color );
+                break;
+
+            case OP_SETBLOCK:
+                block_[i % 16] = color;
+                display_->setBlock( block_, 4, 4, ( i % 2 ) * 4, ( ( i / 2 ) % 2 ) * 4 );
+                break;
+
+            case OP_SETIMAGE:
+                display_->setImage( &image_ );
+                break;
+
+            case OP_KALEIDOSCOPE:
+                block_[i % 16] = color;
+                display_->kaleidoscope( block_ );
+                break;
+
+            case OP_ROTATE:
+                display_->rotateBuffer( src_, dest_, DisplayXSize, (BufRotate)( i % 3 ) );
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    SHLedMatrix *display_;
+    LedOp op_;
+    int seed_;
+    const QAtomicInt *go_;
+    const QAtomicInt *stop_;
+
+    //*** the thread's own source data ***
+    quint16 src_[DisplayXSize * DisplayYSize];
+    quint16 dest_[DisplayXSize * DisplayYSize];
+    quint16 block_[16];
+    QImage image_;
+
+    std::vector<qint64> batchNs_;
+};
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief measure - run an operation on a number of threads at once and print
+ *              its line
+ * @param display   - display to draw on
+ * @param op        - operation
+ * @param threads   - threads
+ * @param measureMs - measurement time
+ * @param baseRate  - ops per second of one thread, 0 when measuring it
+ * @return - ops per second of all threads
+ */
+//******************************************************************************
+static double measure( SHLedMatrix *display, LedOp op, int threads, int measureMs, double baseRate )
+{
+std::vector<Worker *> workers;
+std::vector<qint64> batches;
+QAtomicInt go( 0 );
+QAtomicInt stop( 0 );
+qint64 startNs;
+qint64 elapsedNs;
+quint64 ops = 0;
+double rate;
+
+    for ( int t=0; t<threads; t++ )
+    {
+        workers.push_back( new Worker( display, op, t * 7919, &go, &stop ) );
+        workers.back()->start();
+    }
+
+    //*** all threads start and stop together ***
+    startNs = nowNs();
+    go.store( 1 );
+    usleep( measureMs * 1000 );
+    stop.store( 1 );
+    elapsedNs = nowNs() - startNs;
+
+    for ( int t=0; t<threads; t++ )
+    {
+        workers[t]->wait();
+        ops += workers[t]->ops();
+        batches.insert( batches.end(), workers[t]->batches().begin(), workers[t]->batches().end() );
+        delete workers[t];
+    }
+
+    std::sort( batches.begin(), batches.end() );
+    rate = ops * 1e9 / elapsedNs;
+
+    printf( "%-14s %3d %12llu %10.1f %14.0f %9.1f %9.1f %10.1f %8.3f\n",
+            OpNames[op], threads, (unsigned long long)ops,
+            ops ? (double)elapsedNs * threads / ops : 0.0, rate,
+            batches.empty() ? 0.0 : (double)batches[ batches.size() / 2 ] / BatchOps,
+            batches.empty() ? 0.0 : (double)batches[ batches.size() * 99 / 100 ] / BatchOps,
+            batches.empty() ? 0.0 : (double)batches.back() / BatchOps,
+            baseRate > 0.0 ? rate / ( baseRate * threads ) : 1.0 );
+    fflush( stdout );
+
+    return rate;
+}
+
+
+//******************************************************************************
+//******************************************************************************
+/**
+ * @brief main
+ */
+//******************************************************************************
+int main( int argc, char *argv[] )
+{
+int maxThreads = qMax( 4, QThread::idealThreadCount() );
+int measureMs = 300;
+int opt;
+int fbFd;
+double baseRate;
+
+    while ( ( opt = getopt( argc, argv, "t:m:" ) ) != -1 )
+    {
+        switch ( opt )
+        {
+            case 't': maxThreads = qBound( 1, atoi( optarg ), 64 ); break;
+            case 'm': measureMs = qMax( 10, atoi( optarg ) ); break;
+            default:
+                fprintf( stderr, "usage: %s [-t max threads] [-m ms per measurement]\n", argv[0] );
+                return 1;
+        }
+    }
+
+    //*** fonts for the display class without a screen ***
+    qputenv( "QT_QPA_PLATFORM", "offscreen" );
+    QGuiApplication app( argc, argv );
+
+    //*** the display is a memory file with the framebuffer layout ***
+    fbFd = memfd_create( "shbench-fb", MFD_CLOEXEC );
+    if ( fbFd < 0 || ftruncate( fbFd, DisplayMemSizeBytes ) < 0 )
+    {
+        fprintf( stderr, "%s: cannot create the memory framebuffer\n", argv[0] );
+        return 1;
+    }
+
+    SHLedMatrix display;
+    if ( !display.setFramebufferDevice( fbFd ) )
+    {
+        fprintf( stderr, "%s: cannot map the memory framebuffer\n", argv[0] );
+        return 1;
+    }
+
+    printf( "# %d ms per measurement, batches of %d ops, %d cpus\n",
+            measureMs, BatchOps, QThread::idealThreadCount() );
+    printf( "# op         threads      ops  ns_per_op    ops_per_sec    p50_ns    p99_ns     max_ns  scaling\n" );
+
+    for ( int op=0; op<OP_COUNT; op++ )
+    {
+        baseRate = 0.0;
+
+        for ( int threads=1; threads<=maxThreads; threads*=2 )
+        {
+            double rate = measure( &display, (LedOp)op, threads, measureMs, baseRate );
+            if ( threads == 1 ) baseRate = rate;
+        }
+    }
+
+    return 0;
+}